@@ -0,0 +1,275 @@
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+#include "Aot.h"
+
+//Function-local so modules registering from other translation units never see it unconstructed
+static std::vector<const Chip8AotModule*> &registry(){
+    static std::vector<const Chip8AotModule*> modules;
+    return modules;
+}
+
+void Chip8Aot::registerModule(const Chip8AotModule &module){
+    registry().push_back(&module);
+}
+
+const std::vector<const Chip8AotModule*> &Chip8Aot::getModules(){
+    return registry();
+}
+
+const Chip8AotModule *Chip8Aot::findModule(uint64_t romHash, Chip8Quirks quirks){
+    for(const Chip8AotModule *module : registry()){
+        if(module->romHash == romHash && module->quirks == quirks)
+            return module;
+    }
+    return nullptr;
+}
+
+Chip8Aot::Chip8Aot(Chip8 &chip, const Chip8AotModule &module) : chip(chip), module(module){
+    memset(blocks, 0, sizeof(blocks));
+    memset(entries, 0, sizeof(entries));
+    memset(usable, 0, sizeof(usable));
+    memset(covered, 0, sizeof(covered));
+    longestBlock = 0;
+    for(size_t i = 0; i < module.blockCount; i++){
+        const Chip8AotBlock &block = module.blocks[i];
+        int bytes = block.length * 2;
+        //Blocks only ever cover bytes of the ROM, anything else is a broken module
+        if(block.address < 0x200 || block.address + bytes > 0x200 + (int)module.romSize || block.length == 0 ||
+            block.length > 0xFF)
+            continue;
+        for(int k = 0; k < block.length; k++){
+            int address = block.address + k * 2;
+            const Chip8AotBlock *other = blocks[address];
+            if(!other || other->length - entries[address] < block.length - k){
+                blocks[address] = &block;
+                entries[address] = k;
+            }
+        }
+        memset(covered + block.address, 1, bytes);
+        longestBlock = std::max(longestBlock, bytes);
+    }
+    compiledInstructions = 0;
+    interpretedInstructions = 0;
+    differential = false;
+    shadow = nullptr;
+    diverged = false;
+    divergedPC = 0;
+
+    seenWrites = chip.writeCount;
+    validate(0, 0xFFF);
+}
+
+Chip8Aot::~Chip8Aot(){
+    delete shadow;
+}
+
+void Chip8Aot::setDifferential(bool enabled){
+    differential = enabled;
+    diverged = false;
+    if(!enabled)
+        return;
+    //A machine of its own restored from the real one. It only checks the real instance, so it
+    //has no profiler, beeper or breakpoints of its own
+    if(!shadow)
+        shadow = new Chip8();
+    if(shadow->getPlatform() != chip.getPlatform())
+        shadow->setPlatform(chip.getPlatform());
+    shadow->setQuirks(chip.quirks);
+    shadow->restore(chip);
+}
+
+bool Chip8Aot::compatible() const{
+    return !chip.ext && !chip.profiler && !chip.breakpointCount && !chip.watchCount && chip.getQuirks() == module.quirks;
+}
+
+//Rechecks the blocks overlapping [first, last] against the ROM they were compiled from
+void Chip8Aot::validate(int first, int last){
+    first = std::max(first, 0);
+    last = std::min(last, 0xFFF);
+    for(int start = std::max(first - longestBlock + 1, 0); start <= last; start++){
+        const Chip8AotBlock *block = blocks[start];
+        if(!block || entries[start] != 0 || start + block->length * 2 <= first)
+            continue;
+        usable[start] = memcmp(chip.memory + start, module.rom + (start - 0x200), block->length * 2) == 0;
+    }
+}
+
+//Follows memory written since the last check. Writes run through Chip8::invalidateDecoded(),
+//which only keeps the last range, so more than one since the last look means checking everything
+void Chip8Aot::checkWrites(){
+    if(chip.writeCount == seenWrites)
+        return;
+    bool single = chip.writeCount - seenWrites == 1;
+    seenWrites = chip.writeCount;
+
+    int first = chip.lastWriteAddress - 1;
+    int last = chip.lastWriteAddress + chip.lastWriteLength - 1;
+    if(!single || last - first >= 0x1000){
+        validate(0, 0xFFF);
+        return;
+    }
+    //Most writes are to data, which no block covers
+    bool hit = false;
+    for(int i = first; i <= last && !hit; i++)
+        hit = covered[i & 0xFFF];
+    if(hit)
+        validate(first, last);
+}
+
+//Runs one block, as much of it as the batch has room for, or one opcode through the
+//interpreter where there's no usable block. Returns the opcodes run, skipped ones included
+uint64_t Chip8Aot::step(uint16_t &pc, uint64_t executed, uint64_t cycles, uint16_t &loopTarget, uint64_t &loopStart,
+    uint16_t &loopI, uint8_t *loopV){
+    uint16_t address = pc & 0xFFF;
+    const Chip8AotBlock *block = blocks[address];
+    uint64_t remaining = cycles - executed;
+    if(!block || !usable[block->address]){
+        //PC goes back through the machine masked, as it does at the end of every interpreter run
+        bool wasIdle = chip.idle;
+        chip.PC = address;
+        uint64_t count = chip.run(1);
+        chip.idle |= wasIdle;
+        pc = chip.PC;
+        interpretedInstructions += count;
+        loopTarget = NO_LOOP;
+        checkWrites();
+        return count;
+    }
+
+    uint16_t entryPC = pc;
+    uint32_t entry = entries[address];
+    uint32_t length = block->length - entry;
+    uint32_t result = block->run(chip, pc, entry, (uint32_t)std::min<uint64_t>(remaining, length));
+    uint64_t count = result & ~WAITING;
+    if(result & WAITING){
+        //FX0A with no key down spins out the rest of the batch, as in the interpreter
+        chip.idleInstructions += remaining - count - 1;
+        chip.idle = chip.delayTimer == 0 && chip.soundTimer == 0;
+        count = remaining;
+    }
+    else if(chip.fault == Chip8Fault::None && count == length){
+        //The interpreter's idle loop detection, a block at a time: a closing backward jump
+        //landing on the same target with the same V and I and no side effect in between
+        if(block->sideEffects)
+            loopTarget = NO_LOOP;
+        uint16_t jumpAt = entryPC + (length - 1) * 2;
+        if(block->loopTarget != NO_LOOP && block->loopTarget <= jumpAt){
+            uint64_t done = executed + count;
+            if(loopTarget == block->loopTarget && loopI == chip.I && memcmp(loopV, chip.V, 16) == 0){
+                uint64_t period = done - loopStart;
+                uint64_t skip = (cycles - done) / period * period;
+                count += skip;
+                done += skip;
+                chip.idleInstructions += skip;
+                chip.idle = chip.delayTimer == 0 && chip.soundTimer == 0;
+            }
+            loopTarget = block->loopTarget;
+            loopStart = done;
+            loopI = chip.I;
+            memcpy(loopV, chip.V, 16);
+        }
+    }
+    chip.instructionClock += count;
+    compiledInstructions += count;
+
+    //FX33 and FX55 end their block, so a block never runs over bytes it has just rewritten
+    checkWrites();
+    return count;
+}
+
+uint64_t Chip8Aot::run(uint64_t cycles){
+    if(!compatible())
+        return chip.run(cycles);
+    return runCompiled(cycles);
+}
+
+uint64_t Chip8Aot::runCompiled(uint64_t cycles){
+    checkWrites();
+    chip.stop = Chip8Stop::None;
+    if(chip.fault != Chip8Fault::None || cycles == 0)
+        return 0;
+    chip.idle = false;
+
+    //PC stays unmasked for the length of the batch, as in the interpreter
+    uint16_t pc = chip.PC;
+    uint64_t executed = 0;
+    uint16_t loopTarget = NO_LOOP;
+    uint64_t loopStart = 0;
+    uint16_t loopI = 0;
+    uint8_t loopV[16];
+    while(executed < cycles && chip.fault == Chip8Fault::None && !diverged){
+        if(!differential){
+            executed += step(pc, executed, cycles, loopTarget, loopStart, loopI, loopV);
+            continue;
+        }
+
+        //Each side has its own generator, so the shadow only needs the keys
+        uint16_t startPC = pc & 0xFFF;
+        memcpy(shadow->key, chip.key, sizeof(chip.key));
+        uint64_t count = step(pc, executed, cycles, loopTarget, loopStart, loopI, loopV);
+        chip.PC = pc & 0xFFF;
+        shadow->run(count);
+        //A faulting opcode doesn't count as executed, but the shadow still has to hit it
+        if(chip.fault != Chip8Fault::None)
+            shadow->run(1);
+        executed += count;
+
+        if(!compareShadow()){
+            diverged = true;
+            divergedPC = startPC;
+        }
+    }
+    chip.PC = pc & 0xFFF;
+    return executed;
+}
+
+//Same frame structure as Chip8::runFrame
+uint64_t Chip8Aot::runFrame(int instructionsPerFrame){
+    if(!compatible())
+        return chip.runFrame(instructionsPerFrame);
+    uint64_t executed = runCompiled(instructionsPerFrame);
+    if(chip.fault == Chip8Fault::None && !diverged){
+        chip.tickTimers();
+        if(differential)
+            shadow->tickTimers();
+    }
+    return executed;
+}
+
+bool Chip8Aot::compareShadow(){
+    const Chip8 &a = chip;
+    const Chip8 &b = *shadow;
+    return memcmp(a.memory, b.memory, sizeof(a.memory)) == 0 &&
+        memcmp(a.V, b.V, sizeof(a.V)) == 0 &&
+        a.I == b.I && a.PC == b.PC && a.SP == b.SP &&
+        memcmp(a.stack, b.stack, sizeof(a.stack)) == 0 &&
+        a.delayTimer == b.delayTimer && a.soundTimer == b.soundTimer &&
+        memcmp(a.display, b.display, sizeof(a.display)) == 0 &&
+        a.rngState == b.rngState && a.fault == b.fault && a.opcode == b.opcode;
+}
+
+void Chip8Aot::clearScreen(Chip8 &c){
+    memset(c.display, 0, sizeof(c.display));
+    c.markDirty(0, 0, 64, 32);
+}
+
+//FX0A: the highest key down goes into Vx. False with none down, leaving Vx alone
+bool Chip8Aot::waitKey(Chip8 &c, int x){
+    bool pressed = false;
+    for(int i = 0; i < 16; i++){
+        if(c.key[i] != 0){
+            pressed = true;
+            c.V[x] = i;
+        }
+    }
+    return pressed;
+}
+
+//FX18, index opcodes into the block, so the beeper edge lands on the same instruction as in the interpreter
+void Chip8Aot::setSound(Chip8 &c, int x, uint32_t index){
+    bool wasOn = c.soundTimer > 0;
+    c.soundTimer = c.V[x];
+    c.soundChanged(wasOn, c.instructionClock + index);
+}
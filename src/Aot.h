@@ -0,0 +1,134 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "Chip8.h"
+
+//Specialized once per compiled ROM, with a type of the module's own, to hold its
+//blocks. A friend of Chip8, so generated code works on the machine's own fields
+template<typename Module> struct Chip8AotCode;
+
+//One basic block of a compiled ROM, entered with pc at its opcode number entry, so a
+//batch that ended part way through carries on in compiled code. Runs at most budget
+//opcodes (at least one), returns how many it ran and leaves pc where the interpreter
+//would have. A fault returns the opcodes before the faulting one, with pc on it; FX0A
+//with no key down returns the opcodes before it with Chip8Aot::WAITING set
+typedef uint32_t (*Chip8AotBlockFn)(Chip8 &c, uint16_t &pc, uint32_t entry, uint32_t budget);
+
+struct Chip8AotBlock{
+    uint16_t address;
+    uint16_t length; //Opcodes, the terminator included
+    uint16_t loopTarget; //Where a closing 1NNN jumps, or Chip8Aot::NO_LOOP
+    bool sideEffects; //Runs an opcode the interpreter's idle loop detection treats as one
+    Chip8AotBlockFn run;
+};
+
+//Everything a generated translation unit defines about its ROM
+struct Chip8AotModule{
+    const char *name;
+    uint64_t romHash; //Movie::hashROM()
+    Chip8Quirks quirks; //Never Default
+    const uint8_t *rom; //The ROM as compiled, loaded at 0x200
+    size_t romSize;
+    const Chip8AotBlock *blocks;
+    size_t blockCount;
+};
+
+/*
+Ahead-of-time compiled ROMs:
+chip8-aot recovers the control-flow graph of a ROM by recursive descent from
+0x200 and writes out a C++ translation unit with one function per basic
+block. Built into a program (CMake's CHIP8_AOT_ROMS does this), the module
+registers itself and Chip8Aot runs the ROM through it.
+
+Blocks are looked up by address on every entry, so returns, BNNN and any
+other jump whose target is only known at run time are just dispatched
+through the table. Every opcode of a block is an entry point too, for
+batches that end part way through one. Every block was compiled from the ROM's bytes, and a
+write over them (self-modifying code, a state load, another ROM) puts it
+out of use until the bytes are the same again. An address without a
+usable block runs through Chip8::executeCycle(), until control reaches one
+that has. Idle loops are skipped as the interpreter skips them, so a run
+ends in exactly the interpreter's state, which differential mode checks
+against a shadow interpreter after every block.
+
+Classic platform only, and the quirk profile the module was compiled for.
+Anything else, a profiler, breakpoints or watchpoints all run through the
+interpreter.
+*/
+class Chip8Aot{
+    public:
+        static const uint16_t NO_LOOP = 0xFFFF;
+        static const uint32_t WAITING = 0x80000000;
+
+    private:
+        Chip8 &chip;
+        const Chip8AotModule &module;
+        const Chip8AotBlock *blocks[0x1000]; //By address: the block running furthest from each opcode
+        uint8_t entries[0x1000]; //Which opcode of that block the address is
+        bool usable[0x1000]; //By start address, block bytes still match the ROM
+        uint8_t covered[0x1000]; //Memory bytes inside any block
+        uint32_t seenWrites;
+        int longestBlock; //Bytes
+
+        uint64_t compiledInstructions;
+        uint64_t interpretedInstructions;
+
+        bool differential;
+        Chip8 *shadow;
+        bool diverged;
+        uint16_t divergedPC;
+
+        bool compatible() const;
+        uint64_t runCompiled(uint64_t cycles);
+        void checkWrites();
+        void validate(int first, int last);
+        uint64_t step(uint16_t &pc, uint64_t executed, uint64_t cycles, uint16_t &loopTarget, uint64_t &loopStart,
+            uint16_t &loopI, uint8_t *loopV);
+        bool compareShadow();
+
+    public:
+        Chip8Aot(Chip8 &chip, const Chip8AotModule &module);
+        ~Chip8Aot();
+
+        //Modules built into the program, registered before main() runs
+        static void registerModule(const Chip8AotModule &module);
+        static const std::vector<const Chip8AotModule*> &getModules();
+        //The module compiled from a ROM with this hash for these quirks, or nullptr
+        static const Chip8AotModule *findModule(uint64_t romHash, Chip8Quirks quirks);
+
+        //Runs up to cycles opcodes and returns how many ran, like Chip8::run
+        uint64_t run(uint64_t cycles);
+        uint64_t runFrame(int instructionsPerFrame);
+
+        //Differential mode checks every block against the interpreter
+        void setDifferential(bool enabled);
+        bool hasDiverged() const { return diverged; }
+        uint16_t getDivergedPC() const { return divergedPC; }
+
+        //Opcodes run by compiled blocks, and through the interpreter
+        uint64_t getCompiledInstructions() const { return compiledInstructions; }
+        uint64_t getInterpretedInstructions() const { return interpretedInstructions; }
+
+        //Called from generated code, for the opcodes too long to be worth writing out in each block
+        static uint32_t fault(Chip8 &c, uint16_t &pc, uint32_t index, uint16_t opcode, Chip8Fault reason){
+            c.opcode = opcode;
+            c.fault = reason;
+            pc += index * 2;
+            return index;
+        }
+        static void clearScreen(Chip8 &c);
+        static bool waitKey(Chip8 &c, int x);
+        static void setSound(Chip8 &c, int x, uint32_t index);
+};
+
+//Generated modules register themselves with one of these at static initialization
+struct Chip8AotRegistration{
+    Chip8AotRegistration(const Chip8AotModule &module){ Chip8Aot::registerModule(module); }
+};
+
+
+#endif
@@ -0,0 +1,461 @@
+#include <string.h>
+
+#include "BatchEngine.h"
+
+BatchEngine::BatchEngine(int lanes, int instructionsPerFrame, uint64_t *observations){
+    this->lanes = lanes > 0 ? lanes : 1;
+    this->instructionsPerFrame = instructionsPerFrame > 0 ? instructionsPerFrame : 1;
+    paddedLanes = (this->lanes + WARP - 1) / WARP * WARP;
+
+    size_t n = paddedLanes;
+    V = new uint8_t[16 * n]();
+    I = new uint16_t[n]();
+    PC = new uint16_t[n]();
+    SP = new uint8_t[n]();
+    stack = new uint16_t[16 * n]();
+    delayTimer = new uint8_t[n]();
+    soundTimer = new uint8_t[n]();
+    keys = new uint16_t[n]();
+    rngState = new uint64_t[n]();
+    alive = new uint8_t[n]();
+    faultOpcode = new uint16_t[n]();
+    faults = new Chip8Fault[n]();
+    remaining = new uint32_t[n]();
+    pages = new uint8_t*[PAGES * n]();
+
+    ownsDisplay = observations == nullptr;
+    display = ownsDisplay ? new uint64_t[this->lanes * 32] : observations;
+    memset(display, 0, sizeof(uint64_t) * 32 * this->lanes);
+
+    memset(image, 0, sizeof(image));
+    memset(privateCount, 0, sizeof(privateCount));
+    loaded = false;
+    seed = 0;
+    groupedInstructions = 0;
+    laneInstructions = 0;
+}
+
+BatchEngine::~BatchEngine(){
+    delete[] V;
+    delete[] I;
+    delete[] PC;
+    delete[] SP;
+    delete[] stack;
+    delete[] delayTimer;
+    delete[] soundTimer;
+    delete[] keys;
+    delete[] rngState;
+    delete[] alive;
+    delete[] faultOpcode;
+    delete[] faults;
+    delete[] remaining;
+    delete[] pages;
+    if(ownsDisplay)
+        delete[] display;
+    for(uint8_t *block : pageBlocks)
+        delete[] block;
+}
+
+bool BatchEngine::loadROM(const uint8_t *data, size_t size, uint64_t seed){
+    //The image comes from a regular Chip8, so the font and the load rules live in one place
+    Chip8 *chip = new Chip8();
+    bool ok = chip->LoadROM(data, size);
+    uint8_t *state = new uint8_t[Chip8::STATE_SIZE];
+    chip->saveState(state);
+    memcpy(image, state + 8, sizeof(image));
+    delete[] state;
+    delete chip;
+    if(!ok)
+        return false;
+
+    for(int a = 0; a < 0x1000; a++)
+        decoded[a] = Chip8::decode(image[a] << 8 | image[(a + 1) & 0xFFF]);
+
+    this->seed = seed;
+    loaded = true;
+    for(int lane = 0; lane < paddedLanes; lane++){
+        releasePages(lane);
+        for(int p = 0; p < PAGES; p++)
+            pages[lane * PAGES + p] = image + p * PAGE_SIZE;
+        resetLane(lane);
+    }
+    return true;
+}
+
+void BatchEngine::reset(int lane){
+    if(!loaded || lane < 0 || lane >= lanes)
+        return;
+    releasePages(lane);
+    resetLane(lane);
+}
+
+void BatchEngine::resetLane(int lane){
+    for(int r = 0; r < 16; r++){
+        V[r * paddedLanes + lane] = 0;
+        stack[r * paddedLanes + lane] = 0;
+    }
+    I[lane] = 0;
+    PC[lane] = 0x200;
+    SP[lane] = 0;
+    delayTimer[lane] = 0;
+    soundTimer[lane] = 0;
+    keys[lane] = 0;
+    rngState[lane] = Chip8::randomState(seed + lane);
+    faultOpcode[lane] = 0;
+    faults[lane] = Chip8Fault::None;
+    remaining[lane] = 0;
+    alive[lane] = lane < lanes;
+    if(lane < lanes)
+        memset(display + lane * 32, 0, sizeof(uint64_t) * 32);
+}
+
+//Hands a lane's private pages back to the pool and points it at the shared image again
+void BatchEngine::releasePages(int lane){
+    for(int p = 0; p < PAGES; p++){
+        uint8_t *&page = pages[lane * PAGES + p];
+        if(page && page != image + p * PAGE_SIZE){
+            freePages.push_back(page);
+            privateCount[p]--;
+        }
+        page = image + p * PAGE_SIZE;
+    }
+}
+
+void BatchEngine::write(int lane, uint16_t address, uint8_t value){
+    address &= 0xFFF;
+    int p = address >> 8;
+    uint8_t *&page = pages[lane * PAGES + p];
+    if(page == image + p * PAGE_SIZE){
+        if(freePages.empty()){
+            const int perBlock = 64;
+            uint8_t *block = new uint8_t[perBlock * PAGE_SIZE];
+            pageBlocks.push_back(block);
+            for(int i = 0; i < perBlock; i++)
+                freePages.push_back(block + i * PAGE_SIZE);
+        }
+        uint8_t *copy = freePages.back();
+        freePages.pop_back();
+        memcpy(copy, page, PAGE_SIZE);
+        page = copy;
+        privateCount[p]++;
+    }
+    page[address & 0xFF] = value;
+}
+
+//An opcode can straddle two pages, and both have to be untouched by every lane
+bool BatchEngine::codeIsShared(uint16_t address) const{
+    return privateCount[(address & 0xFFF) >> 8] == 0 && privateCount[((address + 1) & 0xFFF) >> 8] == 0;
+}
+
+Chip8Instr BatchEngine::fetch(int lane) const{
+    uint16_t pc = PC[lane] & 0xFFF;
+    const uint8_t *first = pages[lane * PAGES + (pc >> 8)];
+    const uint8_t *second = pages[lane * PAGES + (((pc + 1) & 0xFFF) >> 8)];
+    if(first == image + (pc & 0xF00) && second == image + (((pc + 1) & 0xFFF) & 0xF00))
+        return decoded[pc];
+    return Chip8::decode(read(lane, pc) << 8 | read(lane, pc + 1));
+}
+
+static inline uint64_t spriteRow(uint8_t bits, int x){
+    uint64_t row = (uint64_t)bits << 56;
+    return x ? (row >> x) | (row << (64 - x)) : row;
+}
+
+//One opcode on one lane, with the same behaviour as the interpreter
+void BatchEngine::execute(int lane, const Chip8Instr &in){
+    const int n = paddedLanes;
+    uint8_t &vx = V[in.x * n + lane];
+    uint8_t &vy = V[in.y * n + lane];
+    uint8_t &vf = V[0xF * n + lane];
+    uint16_t &pc = PC[lane];
+
+    switch(in.op){
+        case OP_CLS:
+            memset(display + lane * 32, 0, sizeof(uint64_t) * 32);
+            pc += 2;
+            break;
+        case OP_RET:
+            if(SP[lane] == 0){
+                halt(lane, in, Chip8Fault::StackUnderflow);
+                return;
+            }
+            SP[lane]--;
+            pc = stack[SP[lane] * n + lane];
+            break;
+        case OP_JUMP: pc = in.nnn; break;
+        case OP_CALL:
+            if(SP[lane] >= 16){
+                halt(lane, in, Chip8Fault::StackOverflow);
+                return;
+            }
+            stack[SP[lane] * n + lane] = (pc + 2) & 0xFFF;
+            SP[lane]++;
+            pc = in.nnn;
+            break;
+        case OP_SKIP_EQ_IMM: pc += vx == in.nn ? 4 : 2; break;
+        case OP_SKIP_NE_IMM: pc += vx != in.nn ? 4 : 2; break;
+        case OP_SKIP_EQ_REG: pc += vx == vy ? 4 : 2; break;
+        case OP_LOAD_IMM: vx = in.nn; pc += 2; break;
+        case OP_ADD_IMM: vx += in.nn; pc += 2; break;
+        case OP_MOVE: vx = vy; pc += 2; break;
+        case OP_OR: vx |= vy; pc += 2; break;
+        case OP_AND: vx &= vy; pc += 2; break;
+        case OP_XOR: vx ^= vy; pc += 2; break;
+        case OP_ADD: {
+            int sum = vx + vy;
+            vf = sum > 0xFF;
+            vx = sum & 0xFF;
+            pc += 2;
+        } break;
+        case OP_SUB: vf = vx > vy; vx -= vy; pc += 2; break;
+        case OP_SHR: vf = vx & 1; vx >>= 1; pc += 2; break;
+        case OP_SUBN: vf = vy > vx; vx = vy - vx; pc += 2; break;
+        case OP_SHL: vf = vx >> 7; vx <<= 1; pc += 2; break;
+        case OP_SKIP_NE_REG: pc += vx != vy ? 4 : 2; break;
+        case OP_LOAD_I: I[lane] = in.nnn; pc += 2; break;
+        case OP_JUMP_V0: pc = in.nnn + V[lane]; break;
+        case OP_RAND: vx = Chip8::randomByte(rngState[lane]) & in.nn; pc += 2; break;
+        case OP_DRAW: {
+            if(I[lane] + in.n > 0x1000){
+                halt(lane, in, Chip8Fault::MemoryOutOfBounds);
+                return;
+            }
+            int x = vx & 63;
+            int y = vy & 31;
+            uint64_t *rows = display + lane * 32;
+            uint64_t collision = 0;
+            for(int row = 0; row < in.n; row++){
+                uint64_t sprite = spriteRow(read(lane, I[lane] + row), x);
+                uint64_t &line = rows[(y + row) & 31];
+                collision |= line & sprite;
+                line ^= sprite;
+            }
+            vf = collision != 0;
+            pc += 2;
+        } break;
+        case OP_SKIP_KEY:
+            if(vx > 0xF){
+                halt(lane, in, Chip8Fault::BadKey);
+                return;
+            }
+            pc += (keys[lane] >> vx) & 1 ? 4 : 2;
+            break;
+        case OP_SKIP_NOT_KEY:
+            if(vx > 0xF){
+                halt(lane, in, Chip8Fault::BadKey);
+                return;
+            }
+            pc += (keys[lane] >> vx) & 1 ? 2 : 4;
+            break;
+        case OP_GET_DELAY: vx = delayTimer[lane]; pc += 2; break;
+        case OP_WAIT_KEY:
+            //Highest key down, like the interpreter's scan. PC stays put until there is one
+            if(keys[lane]){
+                vx = 31 - __builtin_clz(keys[lane]);
+                pc += 2;
+            }
+            break;
+        case OP_SET_DELAY: delayTimer[lane] = vx; pc += 2; break;
+        case OP_SET_SOUND: soundTimer[lane] = vx; pc += 2; break;
+        case OP_ADD_I: I[lane] += vx; pc += 2; break;
+        case OP_FONT: I[lane] = vx * 5; pc += 2; break;
+        case OP_BCD: {
+            if(I[lane] + 3 > 0x1000){
+                halt(lane, in, Chip8Fault::MemoryOutOfBounds);
+                return;
+            }
+            uint8_t value = vx;
+            write(lane, I[lane], value / 100);
+            write(lane, I[lane] + 1, (value / 10) % 10);
+            write(lane, I[lane] + 2, value % 10);
+            pc += 2;
+        } break;
+        case OP_STORE:
+            if(I[lane] + in.x + 1 > 0x1000){
+                halt(lane, in, Chip8Fault::MemoryOutOfBounds);
+                return;
+            }
+            for(int r = 0; r <= in.x; r++)
+                write(lane, I[lane] + r, V[r * n + lane]);
+            pc += 2;
+            break;
+        case OP_LOAD:
+            if(I[lane] + in.x + 1 > 0x1000){
+                halt(lane, in, Chip8Fault::MemoryOutOfBounds);
+                return;
+            }
+            for(int r = 0; r <= in.x; r++)
+                V[r * n + lane] = read(lane, I[lane] + r);
+            pc += 2;
+            break;
+        default:
+            halt(lane, in, Chip8Fault::UnknownOpcode);
+            return;
+    }
+    remaining[lane]--;
+}
+
+//Stops a lane on an opcode it can't run, like Chip8 does. The lane stays halted until it's reset
+void BatchEngine::halt(int lane, const Chip8Instr &in, Chip8Fault fault){
+    faultOpcode[lane] = in.opcode;
+    faults[lane] = fault;
+    alive[lane] = 0;
+}
+
+/*
+One opcode on every lane of a warp whose mask is set. Register and
+branch opcodes are written as plain loops over the lane arrays with the
+mask folded in arithmetically, so they vectorize. Anything touching memory,
+the screen or the generator goes through execute() one lane at a time.
+*/
+void BatchEngine::executeGroup(int base, const uint8_t *mask, const Chip8Instr &in){
+    const int n = paddedLanes;
+    uint8_t *vx = V + in.x * n + base;
+    uint8_t *vy = V + in.y * n + base;
+    uint8_t *vf = V + 0xF * n + base;
+    uint16_t *pc = PC + base;
+    uint32_t *left = remaining + base;
+    uint8_t nn = in.nn;
+
+    //Masked lanes advance by step, the others stay where they are
+    #define LANES(body) for(int j = 0; j < WARP; j++){ body; }
+    #define ADVANCE(step) LANES(pc[j] += mask[j] * (step); left[j] -= mask[j])
+
+    switch(in.op){
+        case OP_JUMP: LANES(pc[j] = mask[j] ? in.nnn : pc[j]; left[j] -= mask[j]) break;
+        case OP_SKIP_EQ_IMM: ADVANCE(vx[j] == nn ? 4 : 2) break;
+        case OP_SKIP_NE_IMM: ADVANCE(vx[j] != nn ? 4 : 2) break;
+        case OP_SKIP_EQ_REG: ADVANCE(vx[j] == vy[j] ? 4 : 2) break;
+        case OP_SKIP_NE_REG: ADVANCE(vx[j] != vy[j] ? 4 : 2) break;
+        case OP_LOAD_IMM: LANES(vx[j] = mask[j] ? nn : vx[j]) ADVANCE(2) break;
+        case OP_ADD_IMM: LANES(vx[j] += mask[j] ? nn : 0) ADVANCE(2) break;
+        case OP_MOVE: LANES(vx[j] = mask[j] ? vy[j] : vx[j]) ADVANCE(2) break;
+        case OP_OR: LANES(vx[j] |= mask[j] ? vy[j] : 0) ADVANCE(2) break;
+        case OP_AND: LANES(vx[j] &= mask[j] ? vy[j] : 0xFF) ADVANCE(2) break;
+        case OP_XOR: LANES(vx[j] ^= mask[j] ? vy[j] : 0) ADVANCE(2) break;
+        //Flag opcodes keep the interpreter's order per lane: VF first, then Vx from the possibly updated registers
+        case OP_ADD: {
+            uint8_t sum[WARP];
+            LANES(sum[j] = vx[j] + vy[j])
+            LANES(vf[j] = mask[j] ? (uint8_t)(vx[j] + vy[j] > 0xFF) : vf[j])
+            LANES(vx[j] = mask[j] ? sum[j] : vx[j])
+            ADVANCE(2)
+        } break;
+        case OP_SUB:
+            LANES(vf[j] = mask[j] ? (uint8_t)(vx[j] > vy[j]) : vf[j])
+            LANES(vx[j] = mask[j] ? (uint8_t)(vx[j] - vy[j]) : vx[j])
+            ADVANCE(2)
+            break;
+        case OP_SHR:
+            LANES(vf[j] = mask[j] ? (uint8_t)(vx[j] & 1) : vf[j])
+            LANES(vx[j] = mask[j] ? (uint8_t)(vx[j] >> 1) : vx[j])
+            ADVANCE(2)
+            break;
+        case OP_SUBN:
+            LANES(vf[j] = mask[j] ? (uint8_t)(vy[j] > vx[j]) : vf[j])
+            LANES(vx[j] = mask[j] ? (uint8_t)(vy[j] - vx[j]) : vx[j])
+            ADVANCE(2)
+            break;
+        case OP_SHL:
+            LANES(vf[j] = mask[j] ? (uint8_t)(vx[j] >> 7) : vf[j])
+            LANES(vx[j] = mask[j] ? (uint8_t)(vx[j] << 1) : vx[j])
+            ADVANCE(2)
+            break;
+        case OP_LOAD_I: LANES(I[base + j] = mask[j] ? in.nnn : I[base + j]) ADVANCE(2) break;
+        case OP_ADD_I: LANES(I[base + j] += mask[j] ? vx[j] : 0) ADVANCE(2) break;
+        case OP_FONT: LANES(I[base + j] = mask[j] ? vx[j] * 5 : I[base + j]) ADVANCE(2) break;
+        case OP_GET_DELAY: LANES(vx[j] = mask[j] ? delayTimer[base + j] : vx[j]) ADVANCE(2) break;
+        case OP_SET_DELAY: LANES(delayTimer[base + j] = mask[j] ? vx[j] : delayTimer[base + j]) ADVANCE(2) break;
+        case OP_SET_SOUND: LANES(soundTimer[base + j] = mask[j] ? vx[j] : soundTimer[base + j]) ADVANCE(2) break;
+        default:
+            for(int j = 0; j < WARP; j++){
+                if(mask[j])
+                    execute(base + j, in);
+            }
+            break;
+    }
+
+    #undef ADVANCE
+    #undef LANES
+}
+
+void BatchEngine::runLane(int lane){
+    while(remaining[lane] && alive[lane]){
+        execute(lane, fetch(lane));
+        laneInstructions++;
+    }
+}
+
+void BatchEngine::runWarp(int base){
+    uint8_t mask[WARP];
+    while(true){
+        //Lowest PC among the lanes with work left, so lanes ahead wait for the rest
+        uint16_t target = 0xFFFF;
+        for(int j = 0; j < WARP; j++){
+            uint16_t pc = alive[base + j] && remaining[base + j] ? PC[base + j] & 0xFFF : 0xFFFF;
+            target = pc < target ? pc : target;
+        }
+        if(target == 0xFFFF)
+            return;
+
+        int count = 0;
+        for(int j = 0; j < WARP; j++){
+            mask[j] = alive[base + j] && remaining[base + j] && (PC[base + j] & 0xFFF) == target;
+            count += mask[j];
+        }
+
+        if(count < MIN_GROUP){
+            for(int j = 0; j < WARP; j++)
+                runLane(base + j);
+            return;
+        }
+
+        if(codeIsShared(target)){
+            executeGroup(base, mask, decoded[target]);
+            groupedInstructions += count;
+            continue;
+        }
+
+        //Some lane wrote to this page, often only data next to the code. Lanes that
+        //all still hold the same opcode here can run together anyway
+        int first = 0;
+        while(!mask[first])
+            first++;
+        uint16_t opcode = read(base + first, target) << 8 | read(base + first, target + 1);
+        bool same = true;
+        for(int j = first + 1; j < WARP && same; j++)
+            same = !mask[j] || (read(base + j, target) << 8 | read(base + j, target + 1)) == opcode;
+
+        if(same){
+            executeGroup(base, mask, opcode == decoded[target].opcode ? decoded[target] : Chip8::decode(opcode));
+            groupedInstructions += count;
+        }
+        else{
+            for(int j = 0; j < WARP; j++){
+                if(mask[j])
+                    execute(base + j, fetch(base + j));
+            }
+            laneInstructions += count;
+        }
+    }
+}
+
+void BatchEngine::step(const uint16_t *actions, int frames){
+    if(!loaded)
+        return;
+    if(actions)
+        memcpy(keys, actions, sizeof(uint16_t) * lanes);
+
+    for(int f = 0; f < frames; f++){
+        for(int lane = 0; lane < paddedLanes; lane++)
+            remaining[lane] = alive[lane] ? instructionsPerFrame : 0;
+        for(int base = 0; base < paddedLanes; base += WARP)
+            runWarp(base);
+
+        //One 60 Hz tick for every lane still running
+        for(int lane = 0; lane < paddedLanes; lane++){
+            delayTimer[lane] -= alive[lane] && delayTimer[lane] > 0;
+            soundTimer[lane] -= alive[lane] && soundTimer[lane] > 0;
+        }
+    }
+}
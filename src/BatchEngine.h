@@ -0,0 +1,121 @@
+#ifndef BATCH_ENGINE_H
+#define BATCH_ENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "Chip8.h"
+
+/*
+Lockstep engine for many instances of one ROM:
+Registers, timers, keys and stacks of every lane are stored as arrays
+indexed by lane (structure of arrays), so one operation over a group of
+lanes is a straight loop the compiler turns into SIMD (32 byte lanes per
+instruction with CHIP8_AVX2).
+
+Lanes are processed in warps of WARP lanes. Each step picks the lowest PC
+among the warp's lanes that still have budget left this frame and runs that
+opcode on every lane sitting at it, so lanes that branched apart wait for
+each other to converge again. Once fewer than MIN_GROUP lanes share a PC
+the rest of the warp's frame is run lane by lane instead.
+
+Memory is copy on write: every lane starts on the shared image of font and
+ROM, and a lane gets a private copy of a 256-byte page on its first write
+to it. Code on shared pages is decoded once for all lanes.
+
+Screens live in a caller-owned buffer of lanes x 32 rows (the same packed
+rows as Chip8::getDisplay()) and are drawn into directly, so observations
+never need copying.
+
+Lanes run the classic machine with the modern quirk profile, whatever the
+template instance was set to.
+*/
+class BatchEngine{
+    private:
+        static const int WARP = 32;
+        static const int MIN_GROUP = 4;
+        static const int PAGE_SIZE = 0x100;
+        static const int PAGES = 0x1000 / PAGE_SIZE;
+
+        int lanes;
+        int paddedLanes; //Rounded up to whole warps. The padding lanes never run
+        int instructionsPerFrame;
+
+        uint8_t image[0x1000]; //Font and ROM, shared by every lane until it writes
+        Chip8Instr decoded[0x1000]; //Decoded image, valid for lanes still on the shared page
+        uint32_t privateCount[PAGES]; //Lanes holding a private copy of each page
+        bool loaded;
+        uint64_t seed;
+
+        //Per-lane state, each array indexed by lane. V and stack are [register][lane]
+        uint8_t *V;
+        uint16_t *I;
+        uint16_t *PC;
+        uint8_t *SP;
+        uint16_t *stack;
+        uint8_t *delayTimer;
+        uint8_t *soundTimer;
+        uint16_t *keys; //Bit n set while key n is down
+        uint64_t *rngState;
+        uint8_t *alive; //0 once a lane faults, and for padding lanes
+        uint16_t *faultOpcode;
+        Chip8Fault *faults;
+        uint32_t *remaining; //Instructions left in the current frame
+        uint8_t **pages; //[lane][page], the shared image or the lane's own copy
+
+        uint64_t *display;
+        bool ownsDisplay;
+
+        std::vector<uint8_t*> pageBlocks;
+        std::vector<uint8_t*> freePages;
+
+        uint64_t groupedInstructions;
+        uint64_t laneInstructions;
+
+        uint8_t read(int lane, uint16_t address) const{
+            address &= 0xFFF;
+            return pages[lane * PAGES + (address >> 8)][address & 0xFF];
+        }
+        void write(int lane, uint16_t address, uint8_t value);
+        Chip8Instr fetch(int lane) const;
+        bool codeIsShared(uint16_t address) const;
+
+        void resetLane(int lane);
+        void releasePages(int lane);
+        void execute(int lane, const Chip8Instr &in);
+        void halt(int lane, const Chip8Instr &in, Chip8Fault fault);
+        void executeGroup(int base, const uint8_t *mask, const Chip8Instr &in);
+        void runLane(int lane);
+        void runWarp(int base);
+
+    public:
+        //observations, if given, must hold lanes * 32 rows and outlive the engine
+        BatchEngine(int lanes, int instructionsPerFrame = 9, uint64_t *observations = nullptr);
+        ~BatchEngine();
+
+        //Loads one ROM into every lane. Lane n gets generator seed seed + n
+        bool loadROM(const uint8_t *data, size_t size, uint64_t seed = 0);
+        //Puts a single lane back at the start of the ROM, e.g. at the end of an episode
+        void reset(int lane);
+
+        //Sets each lane's keys from actions (one 16-bit key mask per lane, or nullptr
+        //to keep them), then runs frames frames of every live lane
+        void step(const uint16_t *actions, int frames);
+
+        int getLanes() const { return lanes; }
+        const uint64_t *getObservations() const { return display; }
+        const uint64_t *getDisplay(int lane) const { return display + lane * 32; }
+        bool isFaulted(int lane) const { return !alive[lane]; }
+        uint16_t getFaultOpcode(int lane) const { return faultOpcode[lane]; }
+        Chip8Fault getFault(int lane) const { return faults[lane]; } //The same faults as Chip8 raises
+        uint8_t getRegister(int lane, int index) const { return V[(index & 0xF) * paddedLanes + lane]; }
+        uint8_t readMemory(int lane, uint16_t address) const { return read(lane, address); }
+
+        //Instructions run in lockstep groups and one lane at a time, since construction
+        uint64_t getGroupedInstructions() const { return groupedInstructions; }
+        uint64_t getLaneInstructions() const { return laneInstructions; }
+};
+
+
+#endif
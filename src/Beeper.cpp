@@ -0,0 +1,138 @@
+#include <math.h>
+#include <fstream>
+
+#include "Beeper.h"
+
+Beeper::Beeper(int sampleRate, int instructionsPerSecond, int latencySamples, double frequency, float volume){
+    this->sampleRate = sampleRate > 0 ? sampleRate : 48000;
+    samplesPerInstruction = (double)this->sampleRate / (instructionsPerSecond > 0 ? instructionsPerSecond : 540);
+    latency = latencySamples > 0 ? latencySamples : 0;
+    phase = 0.0;
+    phaseStep = frequency / this->sampleRate;
+    gain = 0.0f;
+    gainStep = 1000.0f / this->sampleRate; //A millisecond from silence to full volume
+    this->volume = volume;
+    on = false;
+    playhead = 0.0;
+    synced = false;
+    hasPending = false;
+    droppedEdges = 0;
+}
+
+//A full queue means the audio side has stopped pulling. Losing edges then is
+//better than blocking emulation
+void Beeper::edge(uint64_t time, bool on){
+    BeeperEdge e = { time, on };
+    if(!edges.push(e))
+        droppedEdges.fetch_add(1, std::memory_order_relaxed);
+}
+
+//Peeks at the oldest edge not applied yet, giving its sample time
+bool Beeper::nextEdge(double &at){
+    if(!hasPending)
+        hasPending = edges.pop(pending);
+    if(hasPending)
+        at = pending.time * samplesPerInstruction;
+    return hasPending;
+}
+
+//Correction for the step of a square wave, spread over the samples either side of it.
+//t is the oscillator phase and dt the phase step per sample
+static double polyBlep(double t, double dt){
+    if(t < dt){
+        t /= dt;
+        return t + t - t * t - 1.0;
+    }
+    if(t > 1.0 - dt){
+        t = (t - 1.0) / dt;
+        return t * t + t + t + 1.0;
+    }
+    return 0.0;
+}
+
+//Renders count samples from the playhead on, switching the beeper at every edge that falls inside them
+void Beeper::synthesize(int16_t *out, int count){
+    for(int i = 0; i < count; i++){
+        double at;
+        while(nextEdge(at) && at <= playhead + i){
+            on = pending.on;
+            hasPending = false;
+        }
+
+        //The gain ramps instead of jumping, so switching never clicks
+        if(on && gain < 1.0f)
+            gain = fminf(1.0f, gain + gainStep);
+        else if(!on && gain > 0.0f)
+            gain = fmaxf(0.0f, gain - gainStep);
+
+        float sample = 0.0f;
+        if(gain > 0.0f){
+            double value = phase < 0.5 ? 1.0 : -1.0;
+            value += polyBlep(phase, phaseStep);
+            value -= polyBlep(fmod(phase + 0.5, 1.0), phaseStep);
+            sample = (float)value * gain * volume;
+        }
+        out[i] = (int16_t)lrintf(sample * 32767.0f);
+
+        //The oscillator keeps running while silent, so a new beep starts mid-cycle like a real beeper
+        phase += phaseStep;
+        if(phase >= 1.0)
+            phase -= 1.0;
+    }
+    playhead += count;
+}
+
+void Beeper::render(int16_t *out, int count){
+    //Playback aims to stay latency samples behind the edges. An edge that's
+    //already late means emulation stalled (or slept on an idle ROM), one that's
+    //far ahead means playback fell behind. Either way, line up with it again
+    double at;
+    if(nextEdge(at) && (!synced || at < playhead || at > playhead + count + 4.0 * latency)){
+        playhead = at - latency;
+        synced = true;
+    }
+    synthesize(out, count);
+}
+
+void Beeper::renderUntil(uint64_t time, std::vector<int16_t> &out){
+    double end = time * samplesPerInstruction;
+    if(end <= playhead)
+        return;
+    int count = (int)(end - playhead);
+    size_t start = out.size();
+    out.resize(start + count);
+    synthesize(out.data() + start, count);
+}
+
+static void put16(std::ofstream &file, uint16_t value){
+    char bytes[2] = { (char)(value & 0xFF), (char)(value >> 8) };
+    file.write(bytes, 2);
+}
+
+static void put32(std::ofstream &file, uint32_t value){
+    put16(file, value & 0xFFFF);
+    put16(file, value >> 16);
+}
+
+bool Beeper::writeWAV(const char *filePath, const std::vector<int16_t> &samples, int sampleRate){
+    std::ofstream file(filePath, std::ios::binary);
+    if(!file.is_open())
+        return false;
+
+    uint32_t dataSize = (uint32_t)(samples.size() * 2);
+    file.write("RIFF", 4);
+    put32(file, 36 + dataSize);
+    file.write("WAVEfmt ", 8);
+    put32(file, 16); //PCM format chunk
+    put16(file, 1);
+    put16(file, 1); //Mono
+    put32(file, sampleRate);
+    put32(file, sampleRate * 2); //Bytes per second
+    put16(file, 2); //Bytes per sample frame
+    put16(file, 16);
+    file.write("data", 4);
+    put32(file, dataSize);
+    for(int16_t s : samples)
+        put16(file, (uint16_t)s);
+    return file.good();
+}
@@ -0,0 +1,75 @@
+#ifndef BEEPER_H
+#define BEEPER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+#include "SpscQueue.h"
+
+//The beeper switching on or off. Time is the Chip8 instruction clock at the switch
+struct BeeperEdge{
+    uint64_t time;
+    bool on;
+};
+
+/*
+Beeper synthesizer:
+Attached to a Chip8 with setBeeper(), it gets an edge every time the sound
+timer starts or stops, stamped with the instruction clock. Edges go through
+a lock-free queue, so the emulation thread never waits on the audio thread.
+The audio side turns instruction time into sample time and plays a square
+wave while the beeper is on. The wave is band-limited with PolyBLEP and
+faded in and out over a millisecond, so it neither aliases nor clicks.
+
+render() is for real-time audio callbacks: playback runs a fixed latency
+behind the newest edges and resyncs when emulation stalls or jumps ahead.
+renderUntil() is for offline use, it renders exactly up to an instruction
+time with no latency at all.
+*/
+class Beeper{
+    private:
+        SpscQueue<BeeperEdge, 1024> edges;
+        std::atomic<uint32_t> droppedEdges;
+
+        //Everything below belongs to the consumer side
+        int sampleRate;
+        double samplesPerInstruction;
+        int latency; //Samples real-time playback stays behind the edges
+        double phase;
+        double phaseStep;
+        float gain;
+        float gainStep;
+        float volume;
+        bool on;
+
+        double playhead; //Sample time of the next sample rendered
+        bool synced;
+        BeeperEdge pending;
+        bool hasPending;
+
+        bool nextEdge(double &at);
+        void synthesize(int16_t *out, int count);
+
+    public:
+        Beeper(int sampleRate = 48000, int instructionsPerSecond = 540, int latencySamples = 1024,
+            double frequency = 440.0, float volume = 0.25f);
+
+        //Producer side, called by the core
+        void edge(uint64_t time, bool on);
+
+        //Consumer side
+        void render(int16_t *out, int count);
+        void renderUntil(uint64_t time, std::vector<int16_t> &out);
+
+        int getSampleRate() const { return sampleRate; }
+        int getLatency() const { return latency; }
+        uint32_t getDroppedEdges() const { return droppedEdges.load(std::memory_order_relaxed); }
+
+        //Writes 16-bit mono PCM as a WAV file
+        static bool writeWAV(const char *filePath, const std::vector<int16_t> &samples, int sampleRate);
+};
+
+
+#endif
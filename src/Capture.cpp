@@ -0,0 +1,471 @@
+#include <string.h>
+#include <chrono>
+
+#include "Capture.h"
+
+static const uint32_t FRAME_RATE = 60;
+
+FrameCapture::FrameCapture(CaptureFormat format, const char *path, int scale, int poolSize)
+    : format(format), path(path), dropped(0), stopping(false){
+    this->scale = scale > 0 ? scale : 1;
+    if(poolSize < 1)
+        poolSize = 1;
+    if(poolSize > MAX_POOL)
+        poolSize = MAX_POOL;
+    slots.resize(poolSize);
+    for(int i = 0; i < poolSize; i++)
+        freeSlots.push(i);
+    width = 0;
+    height = 0;
+    memset(colors, 0, sizeof(colors));
+    blocking = false;
+    memset(&last, 0, sizeof(last));
+    hasLast = false;
+    frames = 0;
+    duplicates = 0;
+    file = nullptr;
+    failed = false;
+    written = 0;
+    lastFrame = 0;
+    hasFrame = false;
+}
+
+FrameCapture::~FrameCapture(){
+    finish();
+}
+
+bool FrameCapture::formatFromPath(const char *path, CaptureFormat &format){
+    const char *dot = strrchr(path, '.');
+    if(!dot)
+        return false;
+    if(strcmp(dot, ".y4m") == 0)
+        format = CaptureFormat::Y4M;
+    else if(strcmp(dot, ".png") == 0)
+        format = CaptureFormat::PNG;
+    else if(strcmp(dot, ".gif") == 0)
+        format = CaptureFormat::GIF;
+    else
+        return false;
+    return true;
+}
+
+void FrameCapture::writeAll(const void *data, size_t size){
+    if(file && fwrite(data, 1, size, file) != size)
+        failed = true;
+}
+
+bool FrameCapture::start(Chip8Platform platform, const uint32_t *colors){
+    memcpy(this->colors, colors, sizeof(this->colors));
+    int base = platform == Chip8Platform::Chip8 ? 64 : 128;
+    width = base * scale;
+    height = base / 2 * scale;
+    size_t pixels = (size_t)width * height;
+    indices.resize(pixels);
+
+    if(format != CaptureFormat::PNG){
+        file = fopen(path.c_str(), "wb");
+        if(!file)
+            return false;
+    }
+
+    char header[96];
+    switch(format){
+        case CaptureFormat::Y4M:{
+            //BT.601 studio range, worked out once per palette colour
+            yuvColors.resize(48);
+            for(int i = 0; i < 16; i++){
+                double r = (colors[i] >> 16) & 0xFF, g = (colors[i] >> 8) & 0xFF, b = colors[i] & 0xFF;
+                yuvColors[i * 3] = (uint8_t)(16.5 + (65.738 * r + 129.057 * g + 25.064 * b) / 256);
+                yuvColors[i * 3 + 1] = (uint8_t)(128.5 + (-37.945 * r - 74.494 * g + 112.439 * b) / 256);
+                yuvColors[i * 3 + 2] = (uint8_t)(128.5 + (112.439 * r - 94.154 * g - 18.285 * b) / 256);
+            }
+            encoded.reserve(6 + pixels * 3);
+            int length = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%u:1 Ip A1:1 C444\n",
+                width, height, FRAME_RATE);
+            writeAll(header, length);
+            break;
+        }
+        case CaptureFormat::PNG:
+            //Scanlines with their filter bytes, stored in 64 KB deflate blocks, plus the chunks around them
+            encoded.reserve(pixels + height + (pixels + height) / 0xFFFF * 5 + 256);
+            break;
+        case CaptureFormat::GIF:{
+            //12-bit codes at worst, in 255-byte sub-blocks
+            encoded.reserve(pixels * 2 + 1024);
+            lzwTable.resize(4096 * 16);
+            uint8_t screen[13 + 48];
+            memcpy(screen, "GIF89a", 6);
+            screen[6] = width & 0xFF;
+            screen[7] = width >> 8;
+            screen[8] = height & 0xFF;
+            screen[9] = height >> 8;
+            screen[10] = 0xF3; //Global colour table of 16 entries
+            screen[11] = 0;
+            screen[12] = 0;
+            for(int i = 0; i < 16; i++){
+                screen[13 + i * 3] = (colors[i] >> 16) & 0xFF;
+                screen[14 + i * 3] = (colors[i] >> 8) & 0xFF;
+                screen[15 + i * 3] = colors[i] & 0xFF;
+            }
+            writeAll(screen, sizeof(screen));
+            static const uint8_t loop[19] = { 0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0',
+                0x03, 0x01, 0x00, 0x00, 0x00 };
+            writeAll(loop, sizeof(loop));
+            break;
+        }
+    }
+
+    writer = std::thread(&FrameCapture::writerLoop, this);
+    return true;
+}
+
+void FrameCapture::submit(const Chip8 &chip){
+    uint32_t frame = frames++;
+    int planeCount = chip.getPlatform() == Chip8Platform::Chip8 ? 1 : chip.getPlanes();
+    if(hasLast && sameScreen(chip, planeCount)){
+        duplicates++;
+        return;
+    }
+
+    int index;
+    while(!freeSlots.pop(index)){
+        if(!blocking){
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    last.width = (uint16_t)chip.getWidth();
+    last.height = (uint16_t)chip.getHeight();
+    last.planeCount = (uint8_t)planeCount;
+    if(chip.getPlatform() == Chip8Platform::Chip8){
+        const uint64_t *rows = chip.getDisplay();
+        for(int y = 0; y < 32; y++)
+            last.planes[0][y][0] = rows[y];
+    }
+    else{
+        for(int p = 0; p < planeCount; p++)
+            memcpy(last.planes[p], chip.getPlane(p), sizeof(last.planes[p]));
+    }
+    last.frame = frame;
+    hasLast = true;
+
+    Slot &slot = slots[index];
+    memcpy(&slot, &last, sizeof(slot));
+    fullSlots.push(index);
+    wake.notify_one();
+}
+
+bool FrameCapture::sameScreen(const Chip8 &chip, int planeCount) const{
+    if(chip.getWidth() != last.width || planeCount != last.planeCount)
+        return false;
+    if(chip.getPlatform() == Chip8Platform::Chip8){
+        const uint64_t *rows = chip.getDisplay();
+        for(int y = 0; y < 32; y++){
+            if(rows[y] != last.planes[0][y][0])
+                return false;
+        }
+        return true;
+    }
+    for(int p = 0; p < planeCount; p++){
+        if(memcmp(chip.getPlane(p), last.planes[p], sizeof(last.planes[p])) != 0)
+            return false;
+    }
+    return true;
+}
+
+void FrameCapture::writerLoop(){
+    for(;;){
+        //Read before draining, so nothing submitted before finish() is left behind
+        bool last = stopping.load(std::memory_order_acquire);
+        int index;
+        while(fullSlots.pop(index)){
+            writeFrame(slots[index]);
+            freeSlots.push(index);
+        }
+        if(last)
+            return;
+
+        //A notify can slip past between the check and the wait, so the wait is short
+        std::unique_lock<std::mutex> lock(wakeLock);
+        wake.wait_for(lock, std::chrono::milliseconds(2), [this]{
+            return !fullSlots.empty() || stopping.load(std::memory_order_acquire);
+        });
+    }
+}
+
+//Colour indices at output size. Lo-res frames on a hi-res platform are pixel doubled
+void FrameCapture::expand(const Slot &slot){
+    int factor = width / scale / slot.width * scale;
+    uint8_t row[128];
+    for(int y = 0; y < slot.height; y++){
+        for(int x = 0; x < slot.width; x++){
+            int color = 0;
+            for(int p = 0; p < slot.planeCount; p++)
+                color |= ((slot.planes[p][y][x >> 6] >> (63 - (x & 63))) & 1) << p;
+            row[x] = (uint8_t)color;
+        }
+        uint8_t *out = &indices[(size_t)y * factor * width];
+        for(int x = 0; x < width; x++)
+            out[x] = row[x / factor];
+        for(int r = 1; r < factor; r++)
+            memcpy(out + (size_t)r * width, out, width);
+    }
+}
+
+void FrameCapture::writeFrame(const Slot &slot){
+    expand(slot);
+    written++;
+    switch(format){
+        case CaptureFormat::Y4M:
+            writeY4M(slot.frame);
+            break;
+        case CaptureFormat::PNG:
+            writePNG(slot.frame);
+            break;
+        case CaptureFormat::GIF:
+            if(hasFrame)
+                flushGIF(slot.frame);
+            encodeGIF();
+            break;
+    }
+    lastFrame = slot.frame;
+    hasFrame = true;
+}
+
+void FrameCapture::writeY4M(uint32_t frame){
+    //Frames skipped since the last one written were the same as it
+    if(hasFrame){
+        for(uint32_t f = lastFrame + 1; f < frame; f++)
+            writeAll(encoded.data(), encoded.size());
+    }
+
+    size_t pixels = indices.size();
+    encoded.resize(6 + pixels * 3);
+    memcpy(encoded.data(), "FRAME\n", 6);
+    uint8_t *planes = encoded.data() + 6;
+    for(size_t i = 0; i < pixels; i++){
+        const uint8_t *yuv = &yuvColors[indices[i] * 3];
+        planes[i] = yuv[0];
+        planes[pixels + i] = yuv[1];
+        planes[pixels * 2 + i] = yuv[2];
+    }
+
+    //Frames dropped before the first one written show it
+    uint32_t copies = hasFrame ? 1 : frame + 1;
+    for(uint32_t i = 0; i < copies; i++)
+        writeAll(encoded.data(), encoded.size());
+}
+
+//Table driven CRC-32, as PNG chunks use
+struct CrcTable{
+    uint32_t entries[256];
+
+    CrcTable(){
+        for(uint32_t n = 0; n < 256; n++){
+            uint32_t c = n;
+            for(int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            entries[n] = c;
+        }
+    }
+};
+
+static uint32_t crc32(const uint8_t *data, size_t size){
+    static const CrcTable table;
+    uint32_t crc = 0xFFFFFFFF;
+    for(size_t i = 0; i < size; i++)
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFF;
+}
+
+static void put32BE(std::vector<uint8_t> &out, uint32_t value){
+    out.push_back(value >> 24);
+    out.push_back((value >> 16) & 0xFF);
+    out.push_back((value >> 8) & 0xFF);
+    out.push_back(value & 0xFF);
+}
+
+//Closes the chunk whose length field starts at start, filling in its length and CRC
+static void endChunk(std::vector<uint8_t> &out, size_t start){
+    uint32_t length = (uint32_t)(out.size() - start - 8);
+    out[start] = length >> 24;
+    out[start + 1] = (length >> 16) & 0xFF;
+    out[start + 2] = (length >> 8) & 0xFF;
+    out[start + 3] = length & 0xFF;
+    put32BE(out, crc32(&out[start + 4], length + 4));
+}
+
+static size_t beginChunk(std::vector<uint8_t> &out, const char *type){
+    size_t start = out.size();
+    put32BE(out, 0);
+    out.insert(out.end(), type, type + 4);
+    return start;
+}
+
+//An 8-bit indexed PNG. The image data is deflate's stored mode: a screen
+//capture is small enough that compressing isn't worth a dependency
+void FrameCapture::writePNG(uint32_t frame){
+    encoded.clear();
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    encoded.insert(encoded.end(), signature, signature + 8);
+
+    size_t chunk = beginChunk(encoded, "IHDR");
+    put32BE(encoded, width);
+    put32BE(encoded, height);
+    static const uint8_t format[5] = { 8, 3, 0, 0, 0 }; //8-bit palette indices, no interlacing
+    encoded.insert(encoded.end(), format, format + 5);
+    endChunk(encoded, chunk);
+
+    chunk = beginChunk(encoded, "PLTE");
+    for(int i = 0; i < 16; i++){
+        encoded.push_back((colors[i] >> 16) & 0xFF);
+        encoded.push_back((colors[i] >> 8) & 0xFF);
+        encoded.push_back(colors[i] & 0xFF);
+    }
+    endChunk(encoded, chunk);
+
+    //Each scanline is a filter byte (0, none) and the row's indices
+    chunk = beginChunk(encoded, "IDAT");
+    encoded.push_back(0x78);
+    encoded.push_back(0x01);
+    size_t rawSize = (size_t)height * (width + 1);
+    uint32_t a = 1, b = 0;
+    for(size_t done = 0; done < rawSize;){
+        size_t block = rawSize - done < 0xFFFF ? rawSize - done : 0xFFFF;
+        encoded.push_back(done + block == rawSize ? 1 : 0);
+        encoded.push_back(block & 0xFF);
+        encoded.push_back(block >> 8);
+        encoded.push_back(~block & 0xFF);
+        encoded.push_back((~block >> 8) & 0xFF);
+        for(size_t i = done; i < done + block; i++){
+            size_t column = i % (width + 1);
+            uint8_t value = column ? indices[i / (width + 1) * width + column - 1] : 0;
+            encoded.push_back(value);
+            a = (a + value) % 65521;
+            b = (b + a) % 65521;
+        }
+        done += block;
+    }
+    put32BE(encoded, b << 16 | a);
+    endChunk(encoded, chunk);
+
+    chunk = beginChunk(encoded, "IEND");
+    endChunk(encoded, chunk);
+
+    //path.png becomes path_000123.png
+    std::string::size_type dot = path.rfind(".png");
+    char name[4096];
+    snprintf(name, sizeof(name), "%s_%06u.png", path.substr(0, dot).c_str(), frame);
+    FILE *out = fopen(name, "wb");
+    if(!out || fwrite(encoded.data(), 1, encoded.size(), out) != encoded.size())
+        failed = true;
+    if(out)
+        fclose(out);
+}
+
+//LZW over the 16-colour indices into an image descriptor and data sub-blocks,
+//held back until the next frame says how long this one lasts
+void FrameCapture::encodeGIF(){
+    encoded.clear();
+    const uint8_t descriptor[10] = { 0x2C, 0, 0, 0, 0, (uint8_t)(width & 0xFF), (uint8_t)(width >> 8),
+        (uint8_t)(height & 0xFF), (uint8_t)(height >> 8), 0 };
+    encoded.insert(encoded.end(), descriptor, descriptor + 10);
+    const int minCodeSize = 4;
+    const int clearCode = 1 << minCodeSize;
+    const int endCode = clearCode + 1;
+    encoded.push_back(minCodeSize);
+
+    size_t blockStart = encoded.size();
+    encoded.push_back(0);
+    uint32_t bits = 0;
+    int bitCount = 0;
+    int codeSize = minCodeSize + 1;
+    auto putByte = [&](uint8_t byte){
+        if(encoded.size() - blockStart == 256){
+            encoded[blockStart] = 255;
+            blockStart = encoded.size();
+            encoded.push_back(0);
+        }
+        encoded.push_back(byte);
+    };
+    auto putCode = [&](int code){
+        bits |= (uint32_t)code << bitCount;
+        bitCount += codeSize;
+        while(bitCount >= 8){
+            putByte(bits & 0xFF);
+            bits >>= 8;
+            bitCount -= 8;
+        }
+    };
+
+    //Children of each code by next index. 0 means none, no code past the first 18 is ever 0
+    std::fill(lzwTable.begin(), lzwTable.end(), 0);
+    int maxCode = endCode;
+    putCode(clearCode);
+    int current = indices[0];
+    for(size_t i = 1; i < indices.size(); i++){
+        int next = indices[i];
+        uint16_t &child = lzwTable[current * 16 + next];
+        if(child){
+            current = child;
+            continue;
+        }
+        putCode(current);
+        child = (uint16_t)++maxCode;
+        if(maxCode >= (1 << codeSize))
+            codeSize++;
+        if(maxCode == 4095){
+            putCode(clearCode);
+            std::fill(lzwTable.begin(), lzwTable.end(), 0);
+            codeSize = minCodeSize + 1;
+            maxCode = endCode;
+        }
+        current = next;
+    }
+    putCode(current);
+    putCode(endCode);
+    if(bitCount)
+        putByte(bits & 0xFF);
+    encoded[blockStart] = (uint8_t)(encoded.size() - blockStart - 1);
+    if(encoded[blockStart])
+        encoded.push_back(0);
+}
+
+//Writes the held back frame, shown until endFrame. Delays are in hundredths of a
+//second, rounded so they add up to the right total
+void FrameCapture::flushGIF(uint32_t endFrame){
+    uint32_t start = (lastFrame * 100 + FRAME_RATE / 2) / FRAME_RATE;
+    uint32_t end = ((uint64_t)endFrame * 100 + FRAME_RATE / 2) / FRAME_RATE;
+    uint32_t delay = end > start ? end - start : 1;
+    if(delay > 0xFFFF)
+        delay = 0xFFFF;
+    const uint8_t control[8] = { 0x21, 0xF9, 0x04, 0x04, (uint8_t)(delay & 0xFF), (uint8_t)(delay >> 8), 0, 0 };
+    writeAll(control, sizeof(control));
+    writeAll(encoded.data(), encoded.size());
+}
+
+bool FrameCapture::finish(){
+    if(!writer.joinable())
+        return !failed;
+    stopping.store(true, std::memory_order_release);
+    wake.notify_one();
+    writer.join();
+
+    if(hasFrame && format == CaptureFormat::Y4M){
+        for(uint32_t f = lastFrame + 1; f < frames; f++)
+            writeAll(encoded.data(), encoded.size());
+    }
+    if(format == CaptureFormat::GIF){
+        if(hasFrame)
+            flushGIF(frames);
+        writeAll(";", 1);
+    }
+    if(file){
+        if(fclose(file) != 0)
+            failed = true;
+        file = nullptr;
+    }
+    return !failed;
+}
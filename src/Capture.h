@@ -0,0 +1,116 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Chip8.h"
+#include "SpscQueue.h"
+
+enum class CaptureFormat : uint8_t{
+    Y4M, //Uncompressed 4:4:4 video, 60 frames per second
+    PNG, //One indexed PNG per distinct frame, named by frame number
+    GIF //Animated GIF, each distinct frame shown for as long as it lasted
+};
+
+/*
+Headless frame capture:
+submit() takes the screen at the end of every emulated frame and hands it
+to a writer thread, which converts and writes it in the background. Frames
+travel in a fixed pool of preallocated buffers passed back and forth through
+two lock-free queues, so submitting never allocates or takes a lock.
+
+A frame identical to the last one sent isn't sent again, and when the
+writer is behind and no buffer is free the frame is dropped and counted,
+never waited for. The writer knows the frame number of everything it gets,
+so skipped frames still take their time in the output: Y4M repeats the
+previous frame, a GIF frame's delay covers them and PNG numbering has a gap.
+*/
+class FrameCapture{
+    private:
+        static const int MAX_POOL = 64;
+
+        struct Slot{
+            uint64_t planes[Chip8Extended::PLANES][64][2]; //Classic screens use the left words of plane 0
+            uint32_t frame;
+            uint16_t width;
+            uint16_t height;
+            uint8_t planeCount;
+        };
+
+        CaptureFormat format;
+        std::string path;
+        int scale;
+        int width; //Output size: the platform's largest screen times scale
+        int height;
+        uint32_t colors[16];
+        bool blocking;
+
+        //Producer side
+        std::vector<Slot> slots;
+        SpscQueue<int, MAX_POOL> freeSlots; //Writer to producer
+        SpscQueue<int, MAX_POOL> fullSlots; //Producer to writer
+        Slot last; //Screen of the last frame sent, compared in full since the screen hash can collide
+        bool hasLast;
+        uint32_t frames;
+        uint64_t duplicates;
+        std::atomic<uint64_t> dropped;
+
+        //Writer side. Every buffer is sized in start(), so writing doesn't allocate either
+        std::thread writer;
+        std::mutex wakeLock;
+        std::condition_variable wake;
+        std::atomic<bool> stopping;
+        FILE *file;
+        bool failed;
+        uint64_t written;
+        uint32_t lastFrame; //Frame number of the last frame written, or pending for a GIF
+        bool hasFrame;
+        std::vector<uint8_t> indices; //Colour index per output pixel
+        std::vector<uint8_t> encoded; //Format specific encoding of the last frame
+        std::vector<uint16_t> lzwTable; //GIF dictionary, 16 children per code
+        std::vector<uint8_t> yuvColors; //Y4M: Y, U and V of each palette colour
+
+        bool sameScreen(const Chip8 &chip, int planeCount) const;
+        void writerLoop();
+        void writeFrame(const Slot &slot);
+        void expand(const Slot &slot);
+        void writeY4M(uint32_t frame);
+        void writePNG(uint32_t frame);
+        void encodeGIF();
+        void flushGIF(uint32_t endFrame);
+        void writeAll(const void *data, size_t size);
+
+    public:
+        //poolSize buffers of about 4 KB each, at most 64. Output pixels are scale x scale
+        FrameCapture(CaptureFormat format, const char *path, int scale = 1, int poolSize = 16);
+        ~FrameCapture();
+
+        //Opens the output and starts the writer. colors are ARGB8888 for each of the 16 plane combinations
+        bool start(Chip8Platform platform, const uint32_t *colors);
+        //Call at the end of every completed frame, from the emulation thread
+        void submit(const Chip8 &chip);
+        //Waits for the writer to catch up, pads the output to the last frame and closes it
+        bool finish();
+
+        //Offline hosts can wait for a free buffer instead of dropping, since nothing there is real time
+        void setBlocking(bool enabled){ blocking = enabled; }
+
+        uint32_t getFrames() const { return frames; }
+        uint64_t getWritten() const { return written; } //Distinct frames encoded
+        uint64_t getDuplicates() const { return duplicates; }
+        uint64_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+        //The format from the extension of path: .y4m, .png or .gif
+        static bool formatFromPath(const char *path, CaptureFormat &format);
+};
+
+
+#endif
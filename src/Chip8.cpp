@@ -1,9 +1,16 @@
 #include <stdint.h>
 #include <iostream>
 #include <fstream>
-#include <random>
+#include <vector>
+#include <string.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "Beeper.h"
 #include "Chip8.h"
+#include "Profiler.h"
 /*TODO: 
 Fleshout opcode descriptions
 Clean up comments
@@ -40,12 +47,29 @@ Memory Allocation:
 
 //Constructor
 Chip8::Chip8(){
+    rngSeed = 0;
+    profiler = nullptr;
+    beeper = nullptr;
+    instructionClock = 0;
+    soundTimer = 0;
+    platform = Chip8Platform::Chip8;
+    quirks = Chip8Quirks::Default;
+    ext = nullptr;
+    memset(breakpoints, 0, sizeof(breakpoints));
+    memset(watchpoints, 0, sizeof(watchpoints));
+    breakpointCount = 0;
+    watchCount = 0;
+    stop = Chip8Stop::None;
+    stopAddress = 0;
+    breakAddress = 0;
     init();
     drawFlag = false;
 }
 
 //Destructor
-Chip8::~Chip8(){}
+Chip8::~Chip8(){
+    delete ext;
+}
 
 
 
@@ -54,68 +78,126 @@ void Chip8::init(){
     PC = 0x200; //Starting at 0x200
 
     //Clear registers and stack
-    for(int i = 0; i<16; i++){
-        V[i] = 0;
-        stack[i] = 0;
-    }
+    memset(V, 0, sizeof(V));
+    memset(stack, 0, sizeof(stack));
+    memset(key, 0, sizeof(key));
     opcode = 0;
     SP = 0;
+    delayTimer = 0;
+    bool wasOn = soundTimer > 0;
+    soundTimer = 0;
+    soundChanged(wasOn, instructionClock);
+    fault = Chip8Fault::None;
+    idle = false;
+    idleInstructions = 0;
+
+    //Clear screen
+    memset(display, 0, sizeof(display));
+    clearDirty();
+    markDirty(0, 0, 64, 32);
+
+    //Clear memory and load the fontset. Some emulators start it at 0x50, but 0 is acceptable
+    memset(memory, 0, sizeof(memory));
+    memcpy(memory, fontset, sizeof(fontset));
+
+    //Nothing has been decoded yet
+    writeCount = 0;
+    invalidateDecoded(0, 0x1000);
+
+    if(ext)
+        initExtended();
+
+    //Start the generator over so a reload replays the same numbers
+    seedRandom();
+}
 
-    //Clear screen pixel array
-    for(int i = 0; i< 64*32; i++){
-        pixels[i%64][i%32] = 0;
+void Chip8::setPlatform(Chip8Platform platform){
+    this->platform = platform;
+    if(platform == Chip8Platform::Chip8){
+        delete ext;
+        ext = nullptr;
     }
+    else if(!ext){
+        ext = new Chip8Extended();
+    }
+    init();
+}
 
-    //Clear memory
-    for(int i = 0; i<0xFFF; i++){
-        memory[i] = 0;
+const char *Chip8::platformName(Chip8Platform platform){
+    switch(platform){
+        case Chip8Platform::SuperChip: return "schip";
+        case Chip8Platform::XOChip: return "xochip";
+        default: return "chip8";
     }
+}
 
-    //Load fontset into memory
-    for(int i = 0; i<80; i++){
-        //Some emulators start at 50, but 0 is acceptable
-        memory[i] = fontset[i];
+bool Chip8::parsePlatform(const char *name, Chip8Platform &platform){
+    for(Chip8Platform p : { Chip8Platform::Chip8, Chip8Platform::SuperChip, Chip8Platform::XOChip }){
+        if(strcmp(name, platformName(p)) == 0){
+            platform = p;
+            return true;
+        }
     }
+    return false;
+}
 
-    //Seed random value generator using time at init
-    srand(time(nullptr));
+const char *Chip8::quirksName(Chip8Quirks quirks){
+    switch(quirks){
+        case Chip8Quirks::Modern: return "modern";
+        case Chip8Quirks::VIP: return "vip";
+        case Chip8Quirks::SuperChip: return "schip";
+        case Chip8Quirks::XOChip: return "xochip";
+        default: return "default";
+    }
+}
 
+bool Chip8::parseQuirks(const char *name, Chip8Quirks &quirks){
+    for(Chip8Quirks q : { Chip8Quirks::Default, Chip8Quirks::Modern, Chip8Quirks::VIP, Chip8Quirks::SuperChip, Chip8Quirks::XOChip }){
+        if(strcmp(name, quirksName(q)) == 0){
+            quirks = q;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Chip8::setSeed(uint64_t seed){
+    rngSeed = seed;
+    seedRandom();
+}
+
+void Chip8::seedRandom(){
+    rngState = randomState(rngSeed);
+}
+
+//Standard PCG32 seeding with the default stream
+uint64_t Chip8::randomState(uint64_t seed){
+    uint64_t state = 0;
+    randomByte(state);
+    state += seed;
+    randomByte(state);
+    return state;
 }
 
 bool Chip8::LoadROM(const char *filePath){
     bool status;
-    init();
 
     //Open file and start at end of file
     std::cout << "Loading ROM: " << filePath << std::endl;
     std::ifstream file(filePath, std::ios::binary | std::ios::ate);
 
     if(file.is_open()){
-        //Find file size by checking current position relative to start
-        std::streampos size = file.tellg();
-        //Allocate space to a buffer that's the size of the file
-        char* buffer = new char[size];
-
-        //Set file pointer to beginning with offset of 0 bits, dump file contents into buffer
+        //Find file size by checking current position relative to start, and read it all in one go
+        std::vector<uint8_t> buffer((size_t)file.tellg());
         file.seekg(0, std::ios::beg);
-        file.read(buffer, size);
+        file.read((char*)buffer.data(), buffer.size());
         file.close();
 
-        //Check that Chip8 RAM is large enough for ROM
-        if(0xFFF-0x200 > size){
-            //Load file into memory
-            for(int i = 0; i<size; i++){
-                memory[i+0x200] = buffer[i];
-            }
+        status = LoadROM(buffer.data(), buffer.size());
+        if(status)
             std::cout<<"File read successfully" << std::endl;
-            status = true;
-        }
-        else{
+        else
             std::cout << "File is too large" << std::endl;
-            status = false;
-        }
-
-        delete[] buffer;
     }
     else{
         status = false;
@@ -123,331 +205,1088 @@ bool Chip8::LoadROM(const char *filePath){
     return status;
 }
 
-void Chip8::executeCycle(){
-    opcode = memory[PC] << 8 | memory[PC+1]; //Fetching both parts of opcode and combining them with | (or) operation
-    
-    switch (opcode & 0xF000){
+bool Chip8::LoadROM(const uint8_t *data, size_t size){
+    init();
+    return placeROM(data, size);
+}
 
-        case 0x0000: { //Opcode starts with 0
-            switch (opcode & 0x000F){
-                case 0x0000: { //Opcode 00E0, display clear
-                    for(int i = 0; i< 64*32; i++){
-                        pixels[i%64][i%32] = 0;
-                    }
-                    PC += 2; //Move to next instruction
-                } break;
-                case 0x000E: { //Opcode 00EE, return
-                    SP--;
-                    PC = stack[SP];
-                } break;
-                default: {
-                    printf("\nUnknown op code: %.4X\n", opcode);
-                } exit(3);
+bool Chip8::placeROM(const uint8_t *data, size_t size){
+    if(ext){
+        size_t space = (platform == Chip8Platform::XOChip ? 0x10000 : 0x1000) - 0x200;
+        if(size > space)
+            return false;
+        memcpy(ext->memory + 0x200, data, size);
+        invalidateExtended(0x200, (int)size);
+        return true;
+    }
+
+    //Check that Chip8 RAM is large enough for ROM. It can fill memory right up to 0xFFF
+    if(size <= sizeof(memory) - 0x200){
+        //Load ROM into memory
+        memcpy(memory + 0x200, data, size);
+        invalidateDecoded(0x200, (int)size);
+        return true;
+    }
+    return false;
+}
+
+bool Chip8::restore(const Chip8 &pristine){
+    if(pristine.platform != platform)
+        return false;
+
+    bool wasOn = soundTimer > 0;
+    const uint8_t *first = (const uint8_t*)pristine.memory;
+    memcpy(memory, first, (const uint8_t*)(pristine.decoded + 0x1000) - first);
+    if(ext){
+        //Only the part of the extended address space the platform can reach
+        size_t span = platform == Chip8Platform::XOChip ? 0x10000 : 0x1000;
+        memcpy(ext->memory, pristine.ext->memory, span);
+        memcpy(ext->decoded, pristine.ext->decoded, span * sizeof(Chip8Instr));
+        memcpy(ext->planes, pristine.ext->planes, sizeof(Chip8Extended) - offsetof(Chip8Extended, planes));
+    }
+    memcpy(key, pristine.key, sizeof(key));
+    drawFlag = pristine.drawFlag;
+    soundChanged(wasOn, instructionClock);
+    idle = false;
+    idleInstructions = 0;
+    stop = Chip8Stop::None;
+
+    //This instance's breakpoints go back into the cache as their addresses are decoded again
+    for(int word = 0; word < 0x1000 / 64; word++){
+        for(uint64_t bits = breakpoints[word] | pristine.breakpoints[word]; bits; bits &= bits - 1)
+            decoded[word * 64 + __builtin_ctzll(bits)].op = OP_DECODE;
+    }
+
+    //Everything may have changed, as far as a backend caching translated code knows
+    writeCount++;
+    lastWriteAddress = 0;
+    lastWriteLength = 0x1000;
+    return true;
+}
+
+//FNV-1a only mixes a byte into the whole hash, so rows go in a byte at a time, column 0 first
+static uint64_t hashRow(uint64_t hash, uint64_t row){
+    for(int shift = 56; shift >= 0; shift -= 8){
+        hash ^= (row >> shift) & 0xFF;
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+uint64_t Chip8::framebufferHash() const{
+    //64-bit FNV-1a over the screen
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    if(ext){
+        hash ^= ext->hires;
+        hash *= 0x100000001B3ULL;
+        for(int p = 0; p < Chip8Extended::PLANES; p++){
+            for(int y = 0; y < 64; y++){
+                hash = hashRow(hash, ext->planes[p][y][0]);
+                hash = hashRow(hash, ext->planes[p][y][1]);
             }
-        } break;
-
-        case 0x1000: { //Opcode 1NNN, goto NNN
-            int address = opcode & 0x0FFF; //Get last three digits of opcode to find jump destination
-            PC = address;
-        } break;
-
-        case 0x2000: { //Opcode 2NNN, *(0xNNN)() (call subroutine at NNN)
-            stack[SP] = PC + 2;//Moving to next instruction to store it
-            SP++;
-            PC = opcode & 0x0FFF;
-        } break;
-            
-        case 0x3000: { //Opcode 3XNN, if (Vx == NN)
-            int X = (opcode & 0x0F00) >> 8;
-            if(V[X] == (opcode & 0x00FF))
-                PC += 4;
-            else
-                PC += 2;
-        } break;
+        }
+        return hash;
+    }
+    for(int y = 0; y < 32; y++)
+        hash = hashRow(hash, display[y]);
+    return hash;
+}
 
-        case 0x4000: { //Opcode 4XNN, if (Vx != NN)
-            int X = (opcode & 0x0F00) >> 8;
-            if(V[X] != (opcode & 0x00FF))
-                PC += 4;
-            else
-                PC += 2;
-        } break;
-
-        case 0x5000: { //Opcode 5XY0, if (Vx == Vy)
-            int X = (opcode & 0x0F00) >> 8;
-            int Y = (opcode & 0x00F0) >> 4;
-            if(V[X] == V[Y])
-                PC += 4;
-            else
-                PC += 2;
-        } break;
-
-        case 0x6000: { //Opcode 6XNN, Vx = NN
-            int X = (opcode & 0x0F00) >> 8;
-            V[X] = (opcode & 0x00FF);
-            PC += 2;
-        } break;
-
-        case 0x7000: { //Opcode 7XNN, Vx += NN
-            int X = (opcode & 0x0F00) >> 8;
-            V[X] += (opcode & 0x00FF);
-            PC += 2;
-        } break;
-
-        case 0x8000: { //Opcode starts with 8
-            switch (opcode & 0x000F){
-                case 0x0000: { //Opcode 8XY0, Vx = Vy
-                    int X = (opcode & 0x0F00) >> 8;
-                    int Y = (opcode & 0x00F0) >> 4;
-                    V[X] = V[Y];
-                    PC += 2;
-                } break;
-                case 0x0001: { //Opcode 8XY1, Vx |= Vy
-                    int X = (opcode & 0x0F00) >> 8;
-                    int Y = (opcode & 0x00F0) >> 4;
-                    V[X] |= V[Y];
-                    PC += 2;
-                } break;
-                case 0x0002: { //Opcode 8XY2, Vx &= Vy
-                    int X = (opcode & 0x0F00) >> 8;
-                    int Y = (opcode & 0x00F0) >> 4;
-                    V[X] &= V[Y];
-                    PC += 2;
-                } break;
-                case 0x0003: { //Opcode 8XY3, Vx ^= Vy
-                    int X = (opcode & 0x0F00) >> 8;
-                    int Y = (opcode & 0x00F0) >> 4;
-                    V[X] ^= V[Y];
-                    PC += 2;
-                } break;
-                case 0x0004: { //Opcode 8XY4, Vx += Vy
-                    int X = (opcode & 0x0F00) >> 8;
-                    int Y = (opcode & 0x00F0) >> 4;
-                    int sum = V[X] + V[Y];
-                    V[0xF] = (sum > 0xFF) ? 1 : 0;
-                    V[X] = sum & 0xFF;
-                    PC += 2;
-                } break;
-                case 0x0005: { //Opcode 8XY5, Vx -= Vy
-                    int X = (opcode & 0x0F00) >> 8;
-                    int Y = (opcode & 0x00F0) >> 4;
-                    V[0xF] = (V[X] > V[Y])? 1 : 0;
-                    V[X] -= V[Y];
-                    PC += 2;
-                } break;
-                case 0x0006: { //Opcode 8XY6, Vx >>= 1
-                    int X = (opcode & 0x0F00) >> 8;
-                    V[0xF] = V[X] & 0x1;
-                    V[X] = V[X] >> 1;
-                    PC += 2;
-                } break;
-                case 0x0007: { //Opcode 8XY7, Vx = Vy - Vx
-                    int X = (opcode & 0x0F00) >> 8;
-                    int Y = (opcode & 0x00F0) >> 4;
-                    V[0xF] = (V[Y] > V[X])? 1 : 0;
-                    V[X] = V[Y] - V[X];
-                    PC += 2;
-                } break;
-                case 0x000E: { //Opcode 8XYE, Vx <<= 1
-                    int X = (opcode & 0x0F00) >> 8;
-                    V[0xF] = V[X] >> 7;
-                    V[X] = V[X] << 1;
-                    PC += 2;
-                } break;
-                default: {
-                    printf("\nUnknown op code: %.4X\n", opcode);
-                } exit(3);
+/*
+Save state layout, all multi-byte values little-endian:
+0x0000 "C8ST", version (16 bit), platform, quirk profile
+0x0008 memory (4096 bytes)
+0x1008 V0-VF, I, PC, opcode, stack (16 x 16 bit), SP
+0x1040 delay timer, sound timer, fault, 1 reserved byte
+0x1044 keys (16 bytes)
+0x1054 screen rows (32 x 64 bit)
+0x1154 generator state (64 bit), 0x115C bytes in total
+The platform and quirk profile bytes were reserved once and are 0 in classic
+states from then, which is still what they mean. SUPER-CHIP and XO-CHIP
+states put the first 4 KB of their memory in the memory field and then add:
+0x115C planes (4 x 64 rows x 2 x 64 bit)
+0x215C user flags (16 bytes), audio pattern (16 bytes), pitch, plane mask, hi-res, 1 reserved byte
+0x2180 memory from 0x1000 up, XO-CHIP only (0xF000 bytes)
+Fields stay at fixed offsets so consecutive states can be diffed byte by byte.
+*/
+static const uint8_t stateMagic[4] = { 'C', '8', 'S', 'T' };
+
+static inline uint8_t *put16(uint8_t *p, uint16_t v){
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static inline uint16_t get16(const uint8_t *p){
+    return p[0] | p[1] << 8;
+}
+
+static inline uint8_t *put64(uint8_t *p, uint64_t v){
+    for(int b = 0; b < 8; b++)
+        p[b] = v >> (b * 8);
+    return p + 8;
+}
+
+static inline uint64_t get64(const uint8_t *p){
+    return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+        (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+size_t Chip8::stateSize(Chip8Platform platform){
+    switch(platform){
+        case Chip8Platform::SuperChip: return 0x2180;
+        case Chip8Platform::XOChip: return MAX_STATE_SIZE;
+        default: return STATE_SIZE;
+    }
+}
+
+void Chip8::saveState(uint8_t *out) const{
+    uint8_t *p = out;
+    memcpy(p, stateMagic, 4);
+    p = put16(p + 4, STATE_VERSION);
+    *p++ = (uint8_t)platform;
+    *p++ = (uint8_t)quirks;
+
+    memcpy(p, ext ? ext->memory : memory, 0x1000);
+    p += 0x1000;
+    memcpy(p, V, 16);
+    p += 16;
+    p = put16(p, I);
+    p = put16(p, PC);
+    p = put16(p, opcode);
+    for(int i = 0; i < 16; i++)
+        p = put16(p, stack[i]);
+    p = put16(p, SP);
+
+    *p++ = delayTimer;
+    *p++ = soundTimer;
+    *p++ = (uint8_t)fault;
+    *p++ = 0;
+    memcpy(p, key, 16);
+    p += 16;
+
+    for(int y = 0; y < 32; y++)
+        p = put64(p, display[y]);
+    p = put64(p, rngState);
+
+    if(ext){
+        for(int plane = 0; plane < Chip8Extended::PLANES; plane++){
+            for(int y = 0; y < 64; y++){
+                p = put64(p, ext->planes[plane][y][0]);
+                p = put64(p, ext->planes[plane][y][1]);
             }
-        } break;
+        }
+        memcpy(p, ext->flags, 16);
+        memcpy(p + 16, ext->pattern, 16);
+        p += 32;
+        *p++ = ext->pitch;
+        *p++ = ext->planeMask;
+        *p++ = ext->hires;
+        *p++ = 0;
+        if(platform == Chip8Platform::XOChip)
+            memcpy(p, ext->memory + 0x1000, 0xF000);
+    }
+}
 
-        case 0x9000: { //Opcode 9XY0, if(Vx != Vy)
-            int X = (opcode & 0x0F00) >> 8;
-            int Y = (opcode & 0x00F0) >> 4;
-            if(V[X] != V[Y])
-                PC += 4;
-            else
-                PC += 2;
-        } break;
-
-        case 0xA000: { //Opcode ANNN, I = NNN
-            int address = opcode & 0x0FFF;
-            I = address;
-            PC += 2;
-        } break;
-
-        case 0xB000: { //Opcode BNNN, PC = V0 + NNN
-            int address = opcode & 0x0FFF;
-            PC = address + V[0];
-        } break;
-
-        case 0xC000: { //Opcode CXNN, Vx = rand() & NN
-            int X = (opcode & 0x0F00) >> 8;
-            V[X] = (rand() % (0xFF + 1)) & (opcode & 0x0FF);
-            PC += 2;
-        } break;
-
-        case 0xD000: { //Opcode DXYN, draw(Vx, Vy, N)
-            int X = (opcode & 0x0F00) >> 8;
-            int Y = (opcode & 0x00F0) >> 4;
-            int height = (opcode & 0x000F);
-            int pixVal;
-            V[0xF] = 0;
+//A state only loads into an instance of its own platform, and brings its quirk profile along
+bool Chip8::isValidState(const uint8_t *data, size_t size) const{
+    if(size != getStateSize() || memcmp(data, stateMagic, 4) != 0 || get16(data + 4) != STATE_VERSION ||
+        data[6] != (uint8_t)platform || data[7] > (uint8_t)Chip8Quirks::XOChip)
+        return false;
+    const uint8_t *regs = data + 0x1008;
+    uint16_t newPC = get16(regs + 18);
+    uint16_t newSP = get16(regs + 54);
+    uint8_t newFault = regs[56 + 2];
+    uint16_t lastAddress = platform == Chip8Platform::XOChip ? 0xFFFF : 0xFFF;
+    if(newPC > lastAddress || newSP > 16 || newFault > (uint8_t)Chip8Fault::BadKey)
+        return false;
+    const uint8_t *extra = data + STATE_SIZE;
+    if(ext && extra[0x1000 + 34] > 1)
+        return false;
+    return true;
+}
 
-            //Iterate (height) number of times
-            for(int yPos = 0; yPos < height; yPos++){
-                //Pull the value of the current row from memory
-                pixVal = memory[I + yPos];
-                //Iterate the fixed 8 times
-                for(int xPos = 0; xPos < 8; xPos++){
-                    //Check, for each bit of pixVal, if its respective pixel should be flipped
-                    if((pixVal & (0x80 >> xPos)) != 0){
-                        //If the pixel is currently on, set V[F] to 1 to indicate a collision
-                        if(pixels[(V[X]+xPos)%64][(V[Y]+yPos)%32] == 1)
-                            V[0xF] = 1;
-                        //XOR the pixel's value to toggle it on or off
-                        pixels[(V[X]+xPos)%64][(V[Y]+yPos)%32] ^= 1;
-                    }
-                }
+bool Chip8::loadState(const uint8_t *data, size_t size){
+    //Check everything before touching the machine, so a bad state leaves it as it was
+    if(!isValidState(data, size))
+        return false;
+    const uint8_t *regs = data + 0x1008;
+    uint16_t newPC = get16(regs + 18);
+    uint16_t newSP = get16(regs + 54);
+    uint8_t newFault = regs[56 + 2];
+    const uint8_t *extra = data + STATE_SIZE;
+    quirks = (Chip8Quirks)data[7];
+
+    const uint8_t *mem = data + 8;
+    if(ext){
+        //Any change at all drops every decoded opcode, it's only a state load
+        bool high = platform == Chip8Platform::XOChip;
+        if(memcmp(ext->memory, mem, 0x1000) != 0 || (high && memcmp(ext->memory + 0x1000, extra + 0x1024, 0xF000) != 0)){
+            memcpy(ext->memory, mem, 0x1000);
+            if(high)
+                memcpy(ext->memory + 0x1000, extra + 0x1024, 0xF000);
+            for(int i = 0; i < 0x10000; i++)
+                ext->decoded[i].op = OP_DECODE;
+        }
+        for(int plane = 0; plane < Chip8Extended::PLANES; plane++){
+            for(int y = 0; y < 64; y++){
+                ext->planes[plane][y][0] = get64(extra + (plane * 64 + y) * 16);
+                ext->planes[plane][y][1] = get64(extra + (plane * 64 + y) * 16 + 8);
             }
+        }
+        memcpy(ext->flags, extra + 0x1000, 16);
+        memcpy(ext->pattern, extra + 0x1010, 16);
+        ext->pitch = extra[0x1020];
+        ext->planeMask = extra[0x1021];
+        ext->hires = extra[0x1022] != 0;
+    }
+    else{
+        //Only the span of memory that actually differs loses its decoded opcodes
+        int first = 0;
+        int last = 0xFFF;
+        while(first < 0x1000 && get64(memory + first) == get64(mem + first))
+            first += 8;
+        while(first < 0x1000 && memory[first] == mem[first])
+            first++;
+        while(last >= first + 7 && get64(memory + last - 7) == get64(mem + last - 7))
+            last -= 8;
+        while(last >= first && memory[last] == mem[last])
+            last--;
+        if(first <= last){
+            memcpy(memory + first, mem + first, last - first + 1);
+            invalidateDecoded(first, last - first + 1);
+        }
+    }
+
+    memcpy(V, regs, 16);
+    I = get16(regs + 16);
+    PC = newPC;
+    opcode = get16(regs + 20);
+    for(int i = 0; i < 16; i++)
+        stack[i] = get16(regs + 22 + i*2);
+    SP = newSP;
+
+    const uint8_t *p = regs + 56;
+    delayTimer = p[0];
+    bool wasOn = soundTimer > 0;
+    soundTimer = p[1];
+    soundChanged(wasOn, instructionClock);
+    fault = (Chip8Fault)newFault;
+    memcpy(key, p + 4, 16);
+    p += 20;
+
+    for(int y = 0; y < 32; y++)
+        display[y] = get64(p + y*8);
+    rngState = get64(p + 256);
+    markDirty(0, 0, 64, 32);
+    drawFlag = true;
+    idle = false;
+    return true;
+}
+
+bool Chip8::saveState(const char *filePath) const{
+    std::vector<uint8_t> buffer(getStateSize());
+    saveState(buffer.data());
+
+    std::ofstream file(filePath, std::ios::binary);
+    if(!file.is_open())
+        return false;
+    file.write((const char*)buffer.data(), buffer.size());
+    return file.good();
+}
+
+bool Chip8::loadState(const char *filePath){
+    std::vector<uint8_t> buffer(getStateSize());
+
+    std::ifstream file(filePath, std::ios::binary);
+    if(!file.is_open())
+        return false;
+    file.read((char*)buffer.data(), buffer.size());
+    //Anything shorter or longer than a state is rejected
+    if(file.gcount() != (std::streamsize)buffer.size() || file.peek() != EOF)
+        return false;
+    return loadState(buffer.data(), buffer.size());
+}
+
+uint8_t Chip8::getPixel(int x, int y) const{
+    if(!ext)
+        return (display[y & 31] >> (63 - (x & 63))) & 1;
+
+    x &= getWidth() - 1;
+    y &= getHeight() - 1;
+    uint8_t color = 0;
+    for(int p = 0; p < getPlanes(); p++)
+        color |= ((ext->planes[p][y][x >> 6] >> (63 - (x & 63))) & 1) << p;
+    return color;
+}
+
+//One byte per pixel, row-major, holding the colour index (1 for lit and 0 for unlit on one plane)
+void Chip8::copyPixels(uint8_t *out) const{
+    if(ext){
+        int width = getWidth();
+        for(int y = 0; y < getHeight(); y++)
+            for(int x = 0; x < width; x++)
+                out[y*width + x] = getPixel(x, y);
+        return;
+    }
+    for(int y = 0; y < 32; y++){
+        uint64_t row = display[y];
+        for(int x = 0; x < 64; x++)
+            out[y*64 + x] = (row >> (63 - x)) & 1;
+    }
+}
+
+//One ARGB8888 value per pixel, row-major
+void Chip8::copyARGB(uint32_t *out, uint32_t on, uint32_t off) const{
+    if(ext){
+        uint32_t palette[16];
+        for(int i = 0; i < 16; i++)
+            palette[i] = i ? on : off;
+        copyARGB(out, palette);
+        return;
+    }
+    for(int y = 0; y < 32; y++){
+        uint64_t row = display[y];
+        for(int x = 0; x < 64; x++)
+            out[y*64 + x] = ((row >> (63 - x)) & 1) ? on : off;
+    }
+}
+
+void Chip8::copyARGB(uint32_t *out, const uint32_t *palette) const{
+    if(!ext){
+        copyARGB(out, palette[1], palette[0]);
+        return;
+    }
+    int width = getWidth();
+    for(int y = 0; y < getHeight(); y++)
+        for(int x = 0; x < width; x++)
+            out[y*width + x] = palette[getPixel(x, y)];
+}
+
+//Grows the dirty region by a w x h rectangle at (x, y). Rows wrap at the bottom;
+//a rectangle wrapping past the right edge dirties the full width
+void Chip8::markDirty(int x, int y, int w, int h){
+    if(h <= 0)
+        return;
+    uint32_t rows = h >= 32 ? 0xFFFFFFFF : (1u << h) - 1;
+    dirtyRows |= y ? (rows << y) | (rows >> (32 - y)) : rows;
+
+    int left = x;
+    int right = x + w - 1;
+    if(right > 63){
+        left = 0;
+        right = 63;
+    }
+    if(left < dirtyLeft)
+        dirtyLeft = left;
+    if(right > dirtyRight)
+        dirtyRight = right;
+}
+
+void Chip8::clearDirty(){
+    dirtyRows = 0;
+    dirtyLeft = 64;
+    dirtyRight = -1;
+}
+
+//Sprite row byte placed at column x of a packed row, wrapping around the right edge
+static inline uint64_t spriteRow(uint8_t bits, int x){
+    uint64_t row = (uint64_t)bits << 56;
+    return x ? (row >> x) | (row << (64 - x)) : row;
+}
+
+//Sprite row byte placed at column x, with whatever passes the right edge cut off
+static inline uint64_t clippedRow(uint8_t bits, int x){
+    return ((uint64_t)bits << 56) >> x;
+}
+
+//XORs an N-row sprite into the display and returns whether any lit pixel was cleared.
+//Clip cuts the sprite off at the right and bottom edges rather than wrapping it round
+template<bool Clip>
+bool Chip8::drawSprite(int x, int y, int height){
+    x &= 63;
+    y &= 31;
+    if(Clip && y + height > 32)
+        height = 32 - y;
+    markDirty(x, y, 8, height);
+    uint64_t collision = 0;
+    int row = 0;
+
+#if defined(__AVX2__)
+    //Four rows per step while the sprite doesn't wrap past the bottom edge
+    if(y + height <= 32){
+        __m128i shift = _mm_cvtsi32_si128(x);
+        __m128i unshift = _mm_cvtsi32_si128(64 - x);
+        __m256i hits = _mm256_setzero_si256();
+        for(; row + 4 <= height; row += 4){
+            __m256i sprite = _mm256_set_epi64x(
+                (uint64_t)memory[I + row + 3] << 56, (uint64_t)memory[I + row + 2] << 56,
+                (uint64_t)memory[I + row + 1] << 56, (uint64_t)memory[I + row] << 56);
+            if(Clip)
+                sprite = _mm256_srl_epi64(sprite, shift);
+            else
+                sprite = _mm256_or_si256(_mm256_srl_epi64(sprite, shift), _mm256_sll_epi64(sprite, unshift));
+            __m256i *lines = (__m256i*)&display[y + row];
+            __m256i current = _mm256_loadu_si256(lines);
+            hits = _mm256_or_si256(hits, _mm256_and_si256(current, sprite));
+            _mm256_storeu_si256(lines, _mm256_xor_si256(current, sprite));
+        }
+        collision = !_mm256_testz_si256(hits, hits);
+    }
+#endif
 
-            drawFlag = true;
-            PC += 2;
-        } break;
-
-        case 0xE000: { //Opcode starts with E
-            switch(opcode & 0x000F){
-                case 0x000E: { //EX9E, if(key() == Vx)
-                    int X = (opcode & 0x0F00) >> 8;
-                    if (key[V[X]] != 0)
-                        PC += 4;
-                    else
-                        PC += 2;
-                } break;
-                case 0x0001: { //EXA1, if(key() != Vx)
-                    int X = (opcode & 0x0F00) >> 8;
-                    if (key[V[X]] == 0)
-                        PC += 4;
-                    else
-                        PC += 2;
-                } break;
-                default: {
-                    printf("\nUnknown op code: %.4X\n", opcode);
-                } exit(3);
+    for(; row < height; row++){
+        uint64_t sprite = Clip ? clippedRow(memory[I + row], x) : spriteRow(memory[I + row], x);
+        uint64_t &line = display[(y + row) & 31];
+        collision |= line & sprite;
+        line ^= sprite;
+    }
+
+    return collision != 0;
+}
+
+//Compiled ROM modules and the JIT call these from their own translation units
+template bool Chip8::drawSprite<false>(int x, int y, int height);
+template bool Chip8::drawSprite<true>(int x, int y, int height);
+
+/*
+Predecoded instruction cache:
+Every address gets a Chip8Instr holding an operation index and the operand
+fields already pulled out of the opcode. Entries start out as OP_DECODE,
+which decodes the opcode on first execution and then runs it. Writes into
+memory through FX33/FX55 reset the touched entries back to OP_DECODE, so
+self-modifying ROMs still see their new code.
+*/
+
+//Maps an opcode to its operation. Mirrors the opcode groups of the original nested switch
+static uint8_t decodeOp(uint16_t opcode){
+    switch (opcode & 0xF000){
+        case 0x0000:
+            switch (opcode & 0x000F){
+                case 0x0000: return OP_CLS;
+                case 0x000E: return OP_RET;
+            }
+            break;
+        case 0x1000: return OP_JUMP;
+        case 0x2000: return OP_CALL;
+        case 0x3000: return OP_SKIP_EQ_IMM;
+        case 0x4000: return OP_SKIP_NE_IMM;
+        case 0x5000: return OP_SKIP_EQ_REG;
+        case 0x6000: return OP_LOAD_IMM;
+        case 0x7000: return OP_ADD_IMM;
+        case 0x8000:
+            switch (opcode & 0x000F){
+                case 0x0000: return OP_MOVE;
+                case 0x0001: return OP_OR;
+                case 0x0002: return OP_AND;
+                case 0x0003: return OP_XOR;
+                case 0x0004: return OP_ADD;
+                case 0x0005: return OP_SUB;
+                case 0x0006: return OP_SHR;
+                case 0x0007: return OP_SUBN;
+                case 0x000E: return OP_SHL;
+            }
+            break;
+        case 0x9000: return OP_SKIP_NE_REG;
+        case 0xA000: return OP_LOAD_I;
+        case 0xB000: return OP_JUMP_V0;
+        case 0xC000: return OP_RAND;
+        case 0xD000: return OP_DRAW;
+        case 0xE000:
+            switch (opcode & 0x000F){
+                case 0x000E: return OP_SKIP_KEY;
+                case 0x0001: return OP_SKIP_NOT_KEY;
             }
-        } break;
-
-        case 0xF000: { //Opcode starts with F
-            switch(opcode & 0x00F0){ //Could check last byte, but checking third creates a more orderly list
-                case 0x0000: { //FX00
-                    switch(opcode & 0x000F){ //Check last byte for unique entries
-                        case 0x0007: { //Opcode FX07, Vx = get_delay()
-                            int X = (opcode & 0x0F00) >> 8;
-                            V[X] = delayTimer;
-                            PC += 2;
-                        } break;
-                        case 0x000A: { //Opcode FX0A, Vx = get_key()
-
-                            int X = (opcode & 0x0F00) >> 8;
-
-                            bool keyPressed = false;
-                            //Iterate through key array to see if any were flagged as being pressed
-                            for(int i = 0; i< 16; i++){
-                                if(key[i] != 0){
-                                    keyPressed = true;
-                                    V[X] = i;
-                                }
-                            }
-                            if(!keyPressed)
-                                return;
-                            PC += 2;
-                        } break;
-
-                        default: {
-                            printf("\nUnknown op code: %.4X\n", opcode);
-                        } exit(3);
+            break;
+        case 0xF000:
+            switch (opcode & 0x00F0){ //Could check last byte, but checking third creates a more orderly list
+                case 0x0000:
+                    switch (opcode & 0x000F){
+                        case 0x0007: return OP_GET_DELAY;
+                        case 0x000A: return OP_WAIT_KEY;
                     }
-                } break;   
-
-                case 0x0010: { //F010
-                    switch(opcode & 0x000F){
-                        case 0x0005: { //Opcode Fx15, delay_timer(Vx)
-                            int X = (opcode & 0x0F00) >> 8;
-                            delayTimer = V[X];
-                            PC += 2;
-                        } break;
-                        case 0x0008: { //Opcode FX18, sound_timer(Vx)
-                            int X = (opcode & 0x0F00) >> 8;
-                            soundTimer = V[X];
-                            PC += 2;
-                        } break;
-                        case 0x000E: { //Opcode FX1E, I += Vx
-                            int X = (opcode & 0x0F00) >> 8;
-                            //Wikipedia states V[F] is unaffected by overflow, so it's left commented out
-                            //technically 0xFFFF would overflow but memory is only 0xFFF long
-                            //V[0xF] = (I + V[X] > 0xFFF)? 1 : 0; 
-                            I += V[X];
-                            PC += 2;
-                        } break;
-                        default: {
-                            printf("\nUnknown op code: %.4X\n", opcode);
-                        } exit(3);
+                    break;
+                case 0x0010:
+                    switch (opcode & 0x000F){
+                        case 0x0005: return OP_SET_DELAY;
+                        case 0x0008: return OP_SET_SOUND;
+                        case 0x000E: return OP_ADD_I;
                     }
-                } break;
-
-                case 0x0020: { //Opcode FX29, I = sprite_addr[VX]
-                    int X = (opcode & 0x0F00) >> 8;
-                    I = V[X] * 0x5;
-                    PC += 2;
-                } break;  
-
-                case 0x0030: { //Opcode FX33, set_BCD(Vx)
-                    int X = (opcode & 0x0F00) >> 8;
-                    memory[I] = V[X] / 100;
-                    memory[I+1] =  (V[X] / 10) % 10;
-                    memory[I+2] = V[X] % 10;
-                    PC += 2;
-                } break;
-                
-                case 0x0050: { //Opcode FX55, reg_dump(Vx, &I)
-                    int X = (opcode & 0x0F00) >> 8;
-                    for(int i = 0; i<=X; i++)
-                        memory[I + i] = V[i];
-                    //Wikipedia states I will be left unmodified after operation
-                    //I += 1;
-                    PC += 2;
-                } break;
-
-                case 0x0060: { //Opcode FX65, reg_load(Vx, &I)
-                    int X = (opcode & 0x0F00) >> 8;
-                    for(int i = 0; i<=X; i++)
-                        V[i] = memory[I + i];
-                    //Wikipedia states I will be left unmodified after operation
-                    //I += 1;
-                    PC += 2;
-                } break;
-                default: {
-                    printf("\nUnknown op code: %.4X\n", opcode);
-                } exit(3);
+                    break;
+                case 0x0020: return OP_FONT;
+                case 0x0030: return OP_BCD;
+                case 0x0050: return OP_STORE;
+                case 0x0060: return OP_LOAD;
             }
-        } break;
+            break;
+    }
+    return OP_UNKNOWN;
+}
+
+Chip8Instr Chip8::decode(uint16_t op){
+    Chip8Instr entry;
+    entry.opcode = op;
+    entry.x = (op & 0x0F00) >> 8;
+    entry.y = (op & 0x00F0) >> 4;
+    entry.n = op & 0x000F;
+    entry.nn = op & 0x00FF;
+    entry.nnn = op & 0x0FFF;
+    entry.op = decodeOp(op);
+    return entry;
+}
+
+void Chip8::decodeAt(uint16_t address){
+    //Fetching both parts of opcode and combining them with | (or) operation
+    decoded[address] = decode(memory[address] << 8 | memory[(address + 1) & 0xFFF]);
+    if(hasBreakpoint(address))
+        decoded[address].op = OP_BREAK;
+}
+
+//Drops cached decodes overlapping [address, address+length). An opcode starting
+//one byte before the write also covers the first written byte
+void Chip8::invalidateDecoded(uint16_t address, int length){
+    for(int i = -1; i < length; i++)
+        decoded[(address + i) & 0xFFF].op = OP_DECODE;
+
+    if(watchCount){
+        for(int i = 0; i < length; i++){
+            uint16_t a = (address + i) & 0xFFF;
+            if((watchpoints[a >> 6] >> (a & 63)) & 1){
+                stop = Chip8Stop::Watchpoint;
+                stopAddress = a;
+                break;
+            }
+        }
+    }
+
+    writeCount++;
+    lastWriteAddress = address;
+    lastWriteLength = length;
+}
 
-        default: {
-            printf("\nUnknown op code: %.4X\n", opcode);
-        } exit(3);
+//Breakpoints survive ROM loads: init() drops every decoded entry and decodeAt() puts them back
+void Chip8::setBreakpoint(uint16_t address, bool enabled){
+    address &= 0xFFF;
+    breakpointCount += (int)enabled - (int)hasBreakpoint(address);
+    if(enabled)
+        breakpoints[address >> 6] |= 1ULL << (address & 63);
+    else
+        breakpoints[address >> 6] &= ~(1ULL << (address & 63));
+    decoded[address].op = OP_DECODE;
+}
+
+void Chip8::setWatchpoint(uint16_t address, int length, bool enabled){
+    for(int i = 0; i < length; i++){
+        uint16_t a = (address + i) & 0xFFF;
+        if(enabled)
+            watchpoints[a >> 6] |= 1ULL << (a & 63);
+        else
+            watchpoints[a >> 6] &= ~(1ULL << (a & 63));
     }
+    watchCount = 0;
+    for(uint64_t word : watchpoints)
+        watchCount += __builtin_popcountll(word);
+}
 
+void Chip8::clearBreakpoints(){
+    for(int address = 0; address < 0x1000; address++){
+        if(hasBreakpoint(address))
+            setBreakpoint(address, false);
+    }
+    memset(watchpoints, 0, sizeof(watchpoints));
+    watchCount = 0;
+}
+
+//One 60 Hz timer tick. Called once per emulated frame by whoever drives the core
+void Chip8::tickTimers(){
     if(delayTimer > 0){
         delayTimer--;
     }
 
+    //The beeper sounds for as long as the sound timer is above zero
     if(soundTimer > 0){
-        if(soundTimer == 1)
-            //play sound
         soundTimer--;
+        soundChanged(true, instructionClock);
+    }
+}
+
+//Tells the beeper when the sound timer crosses zero in either direction
+void Chip8::soundChanged(bool wasOn, uint64_t time){
+    if(beeper && wasOn != (soundTimer > 0))
+        beeper->edge(time, soundTimer > 0);
+}
+
+//A frame is a fixed number of instructions followed by one timer tick
+uint64_t Chip8::runFrame(int instructionsPerFrame){
+    uint64_t executed = run(instructionsPerFrame);
+    if(fault == Chip8Fault::None)
+        tickTimers();
+#if CHIP8_PROFILE
+    if(profiler)
+        profiler->endFrame();
+#endif
+    return executed;
+}
+
+void Chip8::setProfiler(Profiler *profiler){
+#if CHIP8_PROFILE
+    this->profiler = profiler;
+#else
+    (void)profiler;
+#endif
+}
+
+bool Chip8::profilingAvailable(){
+    return CHIP8_PROFILE != 0;
+}
+
+//Stops the instance on an opcode it can't execute. The host decides what to do with it
+void Chip8::unknownOpcode(){
+    fault = Chip8Fault::UnknownOpcode;
+}
+
+const char *Chip8::faultName(Chip8Fault fault){
+    switch(fault){
+        case Chip8Fault::None: return "none";
+        case Chip8Fault::UnknownOpcode: return "unknown opcode";
+        case Chip8Fault::Exited: return "exited";
+        case Chip8Fault::MemoryOutOfBounds: return "memory out of bounds";
+        case Chip8Fault::StackOverflow: return "stack overflow";
+        case Chip8Fault::StackUnderflow: return "stack underflow";
+        case Chip8Fault::BadKey: return "bad key";
+    }
+    return "unknown fault";
+}
+
+void Chip8::executeCycle(){
+    run(1);
+}
+
+//Profiling gets its own copy of the loop, so the plain one carries no trace of it.
+//So does every quirk profile, picked here once per batch rather than per opcode
+uint64_t Chip8::run(uint64_t cycles){
+    stop = Chip8Stop::None;
+
+    //SUPER-CHIP and XO-CHIP have a loop of their own and no profiler hooks
+    if(ext){
+        if(platform == Chip8Platform::XOChip)
+            return runPlatform<Chip8Platform::XOChip>(cycles);
+        return runPlatform<Chip8Platform::SuperChip>(cycles);
+    }
+#if CHIP8_PROFILE
+    if(profiler)
+        return runClassic<true>(cycles);
+#endif
+    return runClassic<false>(cycles);
+}
+
+template<bool Profiled>
+uint64_t Chip8::runClassic(uint64_t cycles){
+#if CHIP8_SINGLE_PROFILE
+    return runLoop<Profiled, Chip8Quirks::Modern>(cycles);
+#else
+    switch(getQuirks()){
+        case Chip8Quirks::VIP: return runLoop<Profiled, Chip8Quirks::VIP>(cycles);
+        case Chip8Quirks::SuperChip: return runLoop<Profiled, Chip8Quirks::SuperChip>(cycles);
+        case Chip8Quirks::XOChip: return runLoop<Profiled, Chip8Quirks::XOChip>(cycles);
+        default: return runLoop<Profiled, Chip8Quirks::Modern>(cycles);
     }
+#endif
+}
+
+template<bool Profiled, Chip8Quirks Quirks>
+uint64_t Chip8::runLoop(uint64_t cycles){
+    constexpr Chip8QuirkSet profile = quirkSet(Quirks);
+
+    //A faulted instance stays halted until the next ROM load
+    if(fault != Chip8Fault::None || cycles == 0)
+        return 0;
+
+    //Hot state lives in locals for the length of the batch and is written back on exit
+    uint16_t pc = PC;
+    uint64_t executed = 0;
+    const Chip8Instr *in = &decoded[pc & 0xFFF];
+
+    //Idle loop detection. Keys and timers can't change inside a batch, so landing
+    //on the same backward jump target twice with the same V and I, and no side
+    //effect in between, proves the code is going round a fixed cycle. Whole turns
+    //of it are then skipped, leaving the machine exactly where running them would
+    //have. The profiled loop counts every instruction, so it never skips
+    const uint16_t NO_LOOP = 0xFFFF;
+    uint16_t loopTarget = NO_LOOP;
+    uint64_t loopStart = 0;
+    uint16_t loopI = 0;
+    uint8_t loopV[16];
+    idle = false;
+    #define SIDE_EFFECT() (loopTarget = NO_LOOP)
+
+#if CHIP8_COMPUTED_GOTO
+    #define CHIP8_LABEL(name) &&L_##name,
+    static const void *labels[] = { CHIP8_OPS(CHIP8_LABEL) };
+    #undef CHIP8_LABEL
+    #define CASE(name) L_##name
+    #define DISPATCH() goto *labels[in->op]
+#else
+    #define CASE(name) case name
+    #define DISPATCH() goto dispatch
+#endif
+
+#if CHIP8_PROFILE
+    #define PROFILE(hook) do{ if(Profiled) profiler->hook; } while(0)
+#else
+    #define PROFILE(hook) do{} while(0)
+#endif
+
+    //Ends an instruction: stop at the end of the batch or move on to the next opcode
+    #define NEXT() \
+        do{ \
+            PROFILE(instruction(in->op, (uint16_t)(in == &breakInstr ? breakAddress : in - decoded))); \
+            if(++executed == cycles) \
+                goto done; \
+            in = &decoded[pc & 0xFFF]; \
+            DISPATCH(); \
+        } while(0)
+
+    //Ends an instruction that hit a watchpoint
+    #define STOP() \
+        do{ \
+            PROFILE(instruction(in->op, (uint16_t)(in == &breakInstr ? breakAddress : in - decoded))); \
+            executed++; \
+            goto done; \
+        } while(0)
+
+    //Halts on an instruction that would reach outside the machine, leaving PC on it
+    #define FAULT(reason) \
+        do{ \
+            opcode = in->opcode; \
+            fault = reason; \
+            goto done; \
+        } while(0)
+
+#if CHIP8_COMPUTED_GOTO
+    DISPATCH();
+#else
+    dispatch:
+    switch(in->op){
+#endif
+
+    CASE(OP_DECODE): { //First execution of an address: decode it in place, then run it
+        decodeAt(pc & 0xFFF);
+        DISPATCH();
+    }
+
+    CASE(OP_UNKNOWN): {
+        opcode = in->opcode;
+        unknownOpcode();
+        goto done;
+    }
+
+    CASE(OP_BREAK): { //Breakpoint: stop in front of it, unless the run started here
+        if(executed != 0){
+            stop = Chip8Stop::Breakpoint;
+            stopAddress = pc & 0xFFF;
+            goto done;
+        }
+        //Run the real opcode from a copy, the cache keeps the breakpoint
+        breakInstr = *in;
+        breakInstr.op = decode(in->opcode).op;
+        breakAddress = pc & 0xFFF;
+        in = &breakInstr;
+        DISPATCH();
+    }
+
+    CASE(OP_CLS): { //Opcode 00E0, display clear
+        memset(display, 0, sizeof(display));
+        markDirty(0, 0, 64, 32);
+        SIDE_EFFECT();
+        pc += 2; //Move to next instruction
+    } NEXT();
+
+    CASE(OP_RET): { //Opcode 00EE, return
+        if(SP == 0)
+            FAULT(Chip8Fault::StackUnderflow);
+        SP--;
+        pc = stack[SP];
+        SIDE_EFFECT();
+        PROFILE(ret());
+    } NEXT();
+
+    CASE(OP_JUMP): { //Opcode 1NNN, goto NNN
+        if(!Profiled && in->nnn <= pc){
+            //A backward jump ends one turn of a possible wait loop
+            if(loopTarget == in->nnn && loopI == I && memcmp(loopV, V, 16) == 0){
+                uint64_t period = executed + 1 - loopStart;
+                uint64_t skip = (cycles - executed - 1) / period * period;
+                executed += skip;
+                idleInstructions += skip;
+                idle = delayTimer == 0 && soundTimer == 0;
+            }
+            loopTarget = in->nnn;
+            loopStart = executed + 1;
+            loopI = I;
+            memcpy(loopV, V, 16);
+        }
+        pc = in->nnn;
+    } NEXT();
+
+    CASE(OP_CALL): { //Opcode 2NNN, *(0xNNN)() (call subroutine at NNN)
+        if(SP >= 16)
+            FAULT(Chip8Fault::StackOverflow);
+        //Moving to next instruction to store it. pc only wraps on fetch, so a call past the end would
+        //otherwise push an address that depends on where the run was split
+        stack[SP] = (pc + 2) & 0xFFF;
+        SP++;
+        pc = in->nnn;
+        SIDE_EFFECT();
+        PROFILE(call(in->nnn));
+    } NEXT();
+
+    CASE(OP_SKIP_EQ_IMM): { //Opcode 3XNN, if (Vx == NN)
+        pc += (V[in->x] == in->nn) ? 4 : 2;
+    } NEXT();
+
+    CASE(OP_SKIP_NE_IMM): { //Opcode 4XNN, if (Vx != NN)
+        pc += (V[in->x] != in->nn) ? 4 : 2;
+    } NEXT();
+
+    CASE(OP_SKIP_EQ_REG): { //Opcode 5XY0, if (Vx == Vy)
+        pc += (V[in->x] == V[in->y]) ? 4 : 2;
+    } NEXT();
+
+    CASE(OP_LOAD_IMM): { //Opcode 6XNN, Vx = NN
+        V[in->x] = in->nn;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_ADD_IMM): { //Opcode 7XNN, Vx += NN
+        V[in->x] += in->nn;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_MOVE): { //Opcode 8XY0, Vx = Vy
+        V[in->x] = V[in->y];
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_OR): { //Opcode 8XY1, Vx |= Vy
+        V[in->x] |= V[in->y];
+        if constexpr(profile.vfReset)
+            V[0xF] = 0;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_AND): { //Opcode 8XY2, Vx &= Vy
+        V[in->x] &= V[in->y];
+        if constexpr(profile.vfReset)
+            V[0xF] = 0;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_XOR): { //Opcode 8XY3, Vx ^= Vy
+        V[in->x] ^= V[in->y];
+        if constexpr(profile.vfReset)
+            V[0xF] = 0;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_ADD): { //Opcode 8XY4, Vx += Vy
+        int sum = V[in->x] + V[in->y];
+        V[0xF] = (sum > 0xFF) ? 1 : 0;
+        V[in->x] = sum & 0xFF;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SUB): { //Opcode 8XY5, Vx -= Vy
+        V[0xF] = (V[in->x] > V[in->y])? 1 : 0;
+        V[in->x] -= V[in->y];
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SHR): { //Opcode 8XY6, Vx >>= 1, or Vx = Vy >> 1
+        if constexpr(profile.shiftVY){
+            uint8_t source = V[in->y];
+            V[in->x] = source >> 1;
+            V[0xF] = source & 0x1;
+        }
+        else{
+            V[0xF] = V[in->x] & 0x1;
+            V[in->x] = V[in->x] >> 1;
+        }
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SUBN): { //Opcode 8XY7, Vx = Vy - Vx
+        V[0xF] = (V[in->y] > V[in->x])? 1 : 0;
+        V[in->x] = V[in->y] - V[in->x];
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SHL): { //Opcode 8XYE, Vx <<= 1, or Vx = Vy << 1
+        if constexpr(profile.shiftVY){
+            uint8_t source = V[in->y];
+            V[in->x] = source << 1;
+            V[0xF] = source >> 7;
+        }
+        else{
+            V[0xF] = V[in->x] >> 7;
+            V[in->x] = V[in->x] << 1;
+        }
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SKIP_NE_REG): { //Opcode 9XY0, if(Vx != Vy)
+        pc += (V[in->x] != V[in->y]) ? 4 : 2;
+    } NEXT();
+
+    CASE(OP_LOAD_I): { //Opcode ANNN, I = NNN
+        I = in->nnn;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_JUMP_V0): { //Opcode BNNN, PC = V0 + NNN, or BXNN, PC = VX + XNN
+        pc = in->nnn + V[profile.jumpVX ? in->x : 0];
+    } NEXT();
+
+    CASE(OP_RAND): { //Opcode CXNN, Vx = rand() & NN
+        V[in->x] = nextRandom() & in->nn;
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_DRAW): { //Opcode DXYN, draw(Vx, Vy, N)
+        //Each sprite row is shifted into place and XORed into its display row in one go.
+        //Any bit set in both the row and the sprite is a collision
+        if(I + in->n > 0x1000)
+            FAULT(Chip8Fault::MemoryOutOfBounds);
+        V[0xF] = drawSprite<profile.clip>(V[in->x], V[in->y], in->n) ? 1 : 0;
+        drawFlag = true;
+        SIDE_EFFECT();
+        PROFILE(draw());
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SKIP_KEY): { //EX9E, if(key() == Vx)
+        if(V[in->x] > 0xF)
+            FAULT(Chip8Fault::BadKey);
+        pc += (key[V[in->x]] != 0) ? 4 : 2;
+    } NEXT();
+
+    CASE(OP_SKIP_NOT_KEY): { //EXA1, if(key() != Vx)
+        if(V[in->x] > 0xF)
+            FAULT(Chip8Fault::BadKey);
+        pc += (key[V[in->x]] == 0) ? 4 : 2;
+    } NEXT();
+
+    CASE(OP_GET_DELAY): { //Opcode FX07, Vx = get_delay()
+        V[in->x] = delayTimer;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_WAIT_KEY): { //Opcode FX0A, Vx = get_key()
+        bool keyPressed = false;
+        //Iterate through key array to see if any were flagged as being pressed
+        for(int i = 0; i< 16; i++){
+            if(key[i] != 0){
+                keyPressed = true;
+                V[in->x] = i;
+            }
+        }
+        //PC stays put until a key is down. No key can go down before the batch
+        //ends, so the rest of it would be spent re-running this opcode
+        if(keyPressed)
+            pc += 2;
+        else if(!Profiled){
+            idleInstructions += cycles - executed - 1;
+            executed = cycles - 1;
+            idle = delayTimer == 0 && soundTimer == 0;
+        }
+    } NEXT();
+
+    CASE(OP_SET_DELAY): { //Opcode Fx15, delay_timer(Vx)
+        delayTimer = V[in->x];
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SET_SOUND): { //Opcode FX18, sound_timer(Vx)
+        bool wasOn = soundTimer > 0;
+        soundTimer = V[in->x];
+        soundChanged(wasOn, instructionClock + executed);
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_ADD_I): { //Opcode FX1E, I += Vx
+        //Wikipedia states V[F] is unaffected by overflow, so it's left commented out
+        //technically 0xFFFF would overflow but memory is only 0xFFF long
+        //V[0xF] = (I + V[X] > 0xFFF)? 1 : 0;
+        I += V[in->x];
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_FONT): { //Opcode FX29, I = sprite_addr[VX]
+        I = V[in->x] * 0x5;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_BCD): { //Opcode FX33, set_BCD(Vx)
+        if(I + 3 > 0x1000)
+            FAULT(Chip8Fault::MemoryOutOfBounds);
+        memory[I] = V[in->x] / 100;
+        memory[I+1] = (V[in->x] / 10) % 10;
+        memory[I+2] = V[in->x] % 10;
+        invalidateDecoded(I, 3);
+        SIDE_EFFECT();
+        pc += 2;
+        if(stop != Chip8Stop::None)
+            STOP();
+    } NEXT();
+
+    CASE(OP_STORE): { //Opcode FX55, reg_dump(Vx, &I)
+        if(I + in->x + 1 > 0x1000)
+            FAULT(Chip8Fault::MemoryOutOfBounds);
+        for(int i = 0; i<=in->x; i++)
+            memory[I + i] = V[i];
+        invalidateDecoded(I, in->x + 1);
+        SIDE_EFFECT();
+        //Left alone since SUPER-CHIP, moved past the registers by the original interpreter
+        if constexpr(profile.memoryIncrement)
+            I += in->x + 1;
+        pc += 2;
+        if(stop != Chip8Stop::None)
+            STOP();
+    } NEXT();
+
+    CASE(OP_LOAD): { //Opcode FX65, reg_load(Vx, &I)
+        if(I + in->x + 1 > 0x1000)
+            FAULT(Chip8Fault::MemoryOutOfBounds);
+        for(int i = 0; i<=in->x; i++)
+            V[i] = memory[I + i];
+        if constexpr(profile.memoryIncrement)
+            I += in->x + 1;
+        pc += 2;
+    } NEXT();
+
+#if !CHIP8_COMPUTED_GOTO
+    }
+#endif
+
+    #undef NEXT
+    #undef STOP
+    #undef FAULT
+    #undef SIDE_EFFECT
+    #undef PROFILE
+    #undef DISPATCH
+    #undef CASE
+
+    done:
+    //Fetches wrap around the address space, and so does the PC left behind, so a
+    //ROM running off the end or jumping past it with BNNN still has a valid state
+    PC = pc & 0xFFF;
+    instructionClock += executed;
 
     //Print statement for current opcode, left in for testing
     // printf("PC: %04X Opcode: %04X\n", PC, opcode);
 
+    return executed;
 }
-
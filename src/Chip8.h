@@ -2,8 +2,144 @@
 #define CHIP_8_H
 
 #include <stdint.h>
+#include <stddef.h>
+
+//Profiling hooks are compiled in with -DCHIP8_PROFILE=1 (the CMake option of the same name)
+#ifndef CHIP8_PROFILE
+#define CHIP8_PROFILE 0
+#endif
+
+//-DCHIP8_SINGLE_PROFILE=1 (the CMake option of the same name) leaves out every quirk profile
+//but each platform's own, so there's one interpreter loop per platform to compare against
+#ifndef CHIP8_SINGLE_PROFILE
+#define CHIP8_SINGLE_PROFILE 0
+#endif
+
+//GCC and Clang support jumping through a table of label addresses, which gives every
+//handler its own dispatch branch. Other compilers, or -DCHIP8_COMPUTED_GOTO=0, go
+//through a switch. Both the classic and the extended core follow this
+#ifndef CHIP8_COMPUTED_GOTO
+#if defined(__GNUC__)
+#define CHIP8_COMPUTED_GOTO 1
+#else
+#define CHIP8_COMPUTED_GOTO 0
+#endif
+#endif
+
+//Reason an instance stopped executing. Faults are kept per instance so
+//one bad ROM doesn't take down every other instance in the process
+enum class Chip8Fault : uint8_t{
+    None,
+    UnknownOpcode,
+    Exited, //The ROM ran 00FD (SUPER-CHIP and XO-CHIP)
+    MemoryOutOfBounds, //DXYN, FX33, FX55 or FX65 reached past the end of the 4 KB address space
+    StackOverflow, //2NNN with all 16 stack entries in use
+    StackUnderflow, //00EE with nothing on the stack
+    BadKey //EX9E or EXA1 with Vx above 0xF
+};
+
+//Why the last run() returned early without a fault. Set by breakpoints and watchpoints
+enum class Chip8Stop : uint8_t{
+    None,
+    Breakpoint, //PC is at a breakpoint and the opcode there hasn't run yet
+    Watchpoint //The last opcode run wrote to a watched address
+};
+
+//Machine the core emulates. The classic platform keeps its original fixed-size
+//state and interpreter loop; the others add an extended state block on top
+enum class Chip8Platform : uint8_t{
+    Chip8, //4 KB memory, 64x32 screen
+    SuperChip, //4 KB memory, 128x64 hi-res mode, scrolling, 16x16 sprites, RPL flags
+    XOChip //64 KB memory, SUPER-CHIP plus up to 4 drawing planes, long I loads and register ranges
+};
+
+//How the opcodes interpreters have never agreed on behave. Each profile runs in an
+//interpreter loop instantiated for it, so none of them costs a branch per opcode
+enum class Chip8Quirks : uint8_t{
+    Default, //The platform's own: Modern on chip8, SuperChip on schip, XOChip on xochip
+    Modern, //What the classic core always did, and what most newer ROMs expect
+    VIP, //The original COSMAC VIP interpreter
+    SuperChip, //SUPER-CHIP 1.1 on the HP 48
+    XOChip //Octo
+};
+
+//What a quirk profile changes
+struct Chip8QuirkSet{
+    bool vfReset; //8XY1, 8XY2 and 8XY3 clear VF
+    bool shiftVY; //8XY6 and 8XYE shift VY into VX, rather than VX in place
+    bool memoryIncrement; //FX55 and FX65 leave I just past the last register
+    bool clip; //DXYN clips sprites at the screen edges instead of wrapping them round
+    bool jumpVX; //BXNN jumps to XNN + VX rather than NNN + V0
+};
+
+//Operations the predecoded cache can hold. OP_DECODE marks an entry that
+//hasn't been decoded yet or was invalidated by a write, OP_BREAK one with a
+//breakpoint on it (the other fields still hold the real opcode)
+#define CHIP8_OPS(X) \
+    X(OP_DECODE) X(OP_UNKNOWN) X(OP_BREAK) \
+    X(OP_CLS) X(OP_RET) X(OP_JUMP) X(OP_CALL) \
+    X(OP_SKIP_EQ_IMM) X(OP_SKIP_NE_IMM) X(OP_SKIP_EQ_REG) \
+    X(OP_LOAD_IMM) X(OP_ADD_IMM) \
+    X(OP_MOVE) X(OP_OR) X(OP_AND) X(OP_XOR) X(OP_ADD) X(OP_SUB) X(OP_SHR) X(OP_SUBN) X(OP_SHL) \
+    X(OP_SKIP_NE_REG) X(OP_LOAD_I) X(OP_JUMP_V0) X(OP_RAND) X(OP_DRAW) \
+    X(OP_SKIP_KEY) X(OP_SKIP_NOT_KEY) \
+    X(OP_GET_DELAY) X(OP_WAIT_KEY) X(OP_SET_DELAY) X(OP_SET_SOUND) X(OP_ADD_I) \
+    X(OP_FONT) X(OP_BCD) X(OP_STORE) X(OP_LOAD)
+
+//Operations only the SUPER-CHIP and XO-CHIP decoder produces. They come after
+//the classic ones, so the classic loop's dispatch table never has to cover them
+#define CHIP8_EXT_OPS(X) \
+    X(OP_SCROLL_DOWN) X(OP_SCROLL_UP) X(OP_SCROLL_RIGHT) X(OP_SCROLL_LEFT) \
+    X(OP_EXIT) X(OP_LORES) X(OP_HIRES) \
+    X(OP_SAVE_RANGE) X(OP_LOAD_RANGE) X(OP_LONG_I) X(OP_PLANE) X(OP_AUDIO) X(OP_PITCH) \
+    X(OP_BIG_FONT) X(OP_SAVE_FLAGS) X(OP_LOAD_FLAGS)
+
+#define CHIP8_ENUM(name) name,
+enum Chip8Op : uint8_t{
+    CHIP8_OPS(CHIP8_ENUM)
+    CHIP8_EXT_OPS(CHIP8_ENUM)
+    OP_COUNT
+};
+#undef CHIP8_ENUM
+
+//An opcode with its operation and operand fields already extracted
+struct Chip8Instr{
+    uint16_t opcode;
+    uint16_t nnn;
+    uint8_t op;
+    uint8_t x;
+    uint8_t y;
+    uint8_t n;
+    uint8_t nn;
+};
+
+//State only the SUPER-CHIP and XO-CHIP platforms have
+struct Chip8Extended{
+    static const int PLANES = 4;
+
+    uint8_t memory[0x10000];
+    Chip8Instr decoded[0x10000];
+    //Each plane is 64 rows of 128 pixels as two words, left half first, leftmost pixel in bit 63.
+    //Lo-res mode only uses the left words of the first 32 rows
+    uint64_t planes[PLANES][64][2];
+    uint8_t flags[16]; //FX75/FX85 user flags
+    uint8_t pattern[16]; //XO-CHIP audio pattern, kept for save states
+    uint8_t pitch;
+    uint8_t planeMask; //Planes that DXYN, 00E0 and the scrolls act on
+    bool hires;
+};
+
+class Beeper;
+class Profiler;
+//Code generated by chip8-aot, one specialization per ROM module (see Aot.h)
+template<typename Module> struct Chip8AotCode;
 
 class Chip8{
+    friend class Chip8Jit;
+    friend class Chip8Aot;
+    friend class GdbStub;
+    template<typename Module> friend struct Chip8AotCode;
+
     private:
         uint8_t memory[0x1000]; //4096 bytes of memory, or 0xFFF bytes
         uint8_t V[16]; //Registers
@@ -16,19 +152,223 @@ class Chip8{
 
         uint8_t delayTimer;
         uint8_t soundTimer;
-        
+
+        Chip8Fault fault;
+
+        //PCG32 generator behind CXNN. Each instance has its own, reseeded from rngSeed on every init()
+        uint64_t rngSeed;
+        uint64_t rngState;
+
+        //Screen as 32 rows of 64 pixels, one bit per pixel. Bit 63 is the leftmost column
+        uint64_t display[32];
+
+        //Screen area changed since the last clearDirty(): a mask of rows and a column span
+        uint32_t dirtyRows;
+        int dirtyLeft;
+        int dirtyRight;
+
+        Chip8Instr decoded[0x1000]; //Predecoded opcode at each address
+        //Everything from memory up to here is the classic machine, declared in one
+        //run so restore() can copy it as a single block
+
+        Chip8Platform platform; //Survives LoadROM, like the seed
+        Chip8Quirks quirks; //As set, possibly Default. Survives LoadROM too
+        Chip8Extended *ext; //Only allocated for SUPER-CHIP and XO-CHIP
+
+        Profiler *profiler; //Only used when built with CHIP8_PROFILE
+        Beeper *beeper;
+
+        //Instructions run over the instance's lifetime, never reset. Beeper edges are stamped with it
+        uint64_t instructionClock;
+
+        //Set when the last run ended spinning in a wait loop with both timers at zero
+        bool idle;
+        uint64_t idleInstructions; //Instructions skipped over by idle loop detection
+
+        //Debugger support, one bit per address. A breakpoint is patched into the decoded
+        //cache as OP_BREAK, so with none set the loop runs exactly as it does without them
+        uint64_t breakpoints[0x1000 / 64];
+        uint64_t watchpoints[0x1000 / 64];
+        int breakpointCount; //So backends running code of their own can tell there are none cheaply
+        int watchCount; //Watched addresses, so writes skip the bitmap while there are none
+        Chip8Stop stop;
+        uint16_t stopAddress;
+        Chip8Instr breakInstr; //The opcode under a breakpoint, while a run steps off it
+        uint16_t breakAddress;
+
+        //Last range of memory invalidated by a write, for backends caching translated code
+        uint32_t writeCount;
+        uint16_t lastWriteAddress;
+        uint16_t lastWriteLength;
+
         void init();
+        void unknownOpcode();
+        void decodeAt(uint16_t address);
+        void invalidateDecoded(uint16_t address, int length);
+        template<bool Clip> bool drawSprite(int x, int y, int height);
+        void markDirty(int x, int y, int w, int h);
+        void seedRandom();
+        void soundChanged(bool wasOn, uint64_t time);
+        template<bool Profiled> uint64_t runClassic(uint64_t cycles);
+        template<bool Profiled, Chip8Quirks Quirks> uint64_t runLoop(uint64_t cycles);
+
+        //SUPER-CHIP and XO-CHIP, in Chip8Extended.cpp
+        void initExtended();
+        void decodeExtendedAt(uint32_t address);
+        void invalidateExtended(uint32_t address, int length);
+        template<Chip8Platform Platform, bool Clip> bool drawExtended(int x, int y, int n);
+        void scrollExtended(int down, int right);
+        void clearPlanes(uint8_t mask);
+        template<Chip8Platform Platform> uint64_t runPlatform(uint64_t cycles);
+        template<Chip8Platform Platform, Chip8Quirks Quirks> uint64_t runExtended(uint64_t cycles);
+
+        uint8_t nextRandom(){ return randomByte(rngState); }
 
     public:
-        uint8_t pixels[64][32]; //64x32 Screen with
         uint8_t key[16];
         bool drawFlag;
 
         Chip8();
         ~Chip8();
+        //An instance owns its extended state, so copies go through restore() instead
+        Chip8(const Chip8&) = delete;
+        Chip8 &operator=(const Chip8&) = delete;
 
         bool LoadROM(const char *filePath);
+        bool LoadROM(const uint8_t *data, size_t size);
+        //Copies a ROM to 0x200 without resetting the machine first. Right after restore()
+        //from a freshly reset instance it does the same as LoadROM(), minus the reset
+        bool placeROM(const uint8_t *data, size_t size);
+
+        //Fast restart for hosts that rerun the core thousands of times a second, such as
+        //fuzzers: copies the whole machine from pristine, decoded cache included, with one
+        //block copy (two on SUPER-CHIP and XO-CHIP). Both must be on the same platform.
+        //The instruction clock, breakpoints and attached profiler and beeper stay as they are
+        bool restore(const Chip8 &pristine);
         void executeCycle();
+        uint64_t run(uint64_t cycles);
+        uint64_t runFrame(int instructionsPerFrame);
+        void tickTimers();
+
+        //Same seed, ROM and input give the same run. The seed survives LoadROM
+        void setSeed(uint64_t seed);
+        uint64_t getSeed() const { return rngSeed; }
+
+        //The generator itself, for other backends: the state a seed starts from and the next CXNN byte
+        static uint64_t randomState(uint64_t seed);
+        static uint8_t randomByte(uint64_t &state){
+            uint64_t old = state;
+            state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+            uint32_t shifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+            uint32_t rot = (uint32_t)(old >> 59);
+            uint32_t out = (shifted >> rot) | (shifted << ((32 - rot) & 31));
+            return (uint8_t)(out >> 24);
+        }
+
+        //Splits an opcode into its operation and operand fields
+        static Chip8Instr decode(uint16_t opcode);
+        //The same for SUPER-CHIP and XO-CHIP, which add opcodes and read some classic ones more strictly
+        static Chip8Instr decode(uint16_t opcode, Chip8Platform platform);
+
+        //Selects the machine to emulate and resets it. Takes effect for every later LoadROM
+        void setPlatform(Chip8Platform platform);
+        Chip8Platform getPlatform() const { return platform; }
+        static const char *platformName(Chip8Platform platform);
+        static bool parsePlatform(const char *name, Chip8Platform &platform);
+
+        //Picks the quirk profile, for this and every later ROM. Default follows the platform
+        void setQuirks(Chip8Quirks quirks){ this->quirks = quirks; }
+        //The profile in effect, never Default. Always the platform's own in single-profile builds
+        Chip8Quirks getQuirks() const{
+            if(CHIP8_SINGLE_PROFILE)
+                return defaultQuirks(platform);
+            return quirks != Chip8Quirks::Default ? quirks : defaultQuirks(platform);
+        }
+        static Chip8Quirks defaultQuirks(Chip8Platform platform){
+            return platform == Chip8Platform::Chip8 ? Chip8Quirks::Modern :
+                platform == Chip8Platform::SuperChip ? Chip8Quirks::SuperChip : Chip8Quirks::XOChip;
+        }
+        static constexpr Chip8QuirkSet quirkSet(Chip8Quirks quirks){
+            //vfReset, shiftVY, memoryIncrement, clip, jumpVX
+            return quirks == Chip8Quirks::VIP ? Chip8QuirkSet{ true, true, true, true, false } :
+                quirks == Chip8Quirks::SuperChip ? Chip8QuirkSet{ false, false, false, true, true } :
+                quirks == Chip8Quirks::XOChip ? Chip8QuirkSet{ false, true, true, false, false } :
+                Chip8QuirkSet{ false, false, false, false, false };
+        }
+        static const char *quirksName(Chip8Quirks quirks);
+        static bool parseQuirks(const char *name, Chip8Quirks &quirks);
+        static bool singleProfile(){ return CHIP8_SINGLE_PROFILE != 0; }
+
+        //True when only a key change can make the next frame do anything new, so a
+        //real-time host can sleep until input arrives instead of running frames
+        bool isIdle() const { return idle; }
+        uint64_t getIdleInstructions() const { return idleInstructions; }
+
+        //A run stops before the opcode at a breakpoint, unless it's the first opcode
+        //of the run, so continuing from a breakpoint or stepping just works. It stops
+        //after an opcode that writes to a watched address. Classic platform only
+        void setBreakpoint(uint16_t address, bool enabled);
+        bool hasBreakpoint(uint16_t address) const{
+            return (breakpoints[(address & 0xFFF) >> 6] >> (address & 63)) & 1;
+        }
+        void setWatchpoint(uint16_t address, int length, bool enabled);
+        void clearBreakpoints();
+        Chip8Stop getStop() const { return stop; }
+        uint16_t getStopAddress() const { return stopAddress; } //Breakpoint, or first watched address written
+
+        Chip8Fault getFault() const { return fault; }
+        static const char *faultName(Chip8Fault fault);
+        uint16_t getOpcode() const { return opcode; }
+        uint64_t framebufferHash() const;
+
+        //Attaches a profiler, or detaches it with nullptr. Does nothing unless built with CHIP8_PROFILE
+        void setProfiler(Profiler *profiler);
+        Profiler *getProfiler() const { return profiler; }
+        static bool profilingAvailable();
+
+        //Attaches a beeper that gets an edge whenever the sound timer starts or stops, or detaches it with nullptr
+        void setBeeper(Beeper *beeper){ this->beeper = beeper; }
+        Beeper *getBeeper() const { return beeper; }
+        uint64_t getInstructionClock() const { return instructionClock; }
+
+        //Current screen size: 64x32, or 128x64 in SUPER-CHIP and XO-CHIP hi-res mode
+        int getWidth() const { return ext && ext->hires ? 128 : 64; }
+        int getHeight() const { return ext && ext->hires ? 64 : 32; }
+        //Drawing planes: 1, or 4 on XO-CHIP. A pixel's colour index has bit p set when lit in plane p
+        int getPlanes() const { return platform == Chip8Platform::XOChip ? Chip8Extended::PLANES : 1; }
+        //Rows of one SUPER-CHIP/XO-CHIP plane, as in Chip8Extended::planes. nullptr on the classic platform
+        const uint64_t (*getPlane(int plane) const)[2] { return ext ? ext->planes[plane & 3] : nullptr; }
+
+        //Framebuffer accessors, expanding the packed rows on demand. getDisplay() is the
+        //classic 64x32 screen only; getPixel() and the copies cover every platform and
+        //give colour indices, getWidth() x getHeight() of them
+        const uint64_t *getDisplay() const { return display; }
+        uint8_t getPixel(int x, int y) const;
+        void copyPixels(uint8_t *out) const;
+        void copyARGB(uint32_t *out, uint32_t on, uint32_t off) const;
+        void copyARGB(uint32_t *out, const uint32_t *palette) const; //palette has 1 << getPlanes() entries
+
+        //Dirty region for presenters that only upload what changed. Left/right are
+        //inclusive columns, and there is nothing dirty when getDirtyRows() is 0
+        uint32_t getDirtyRows() const { return dirtyRows; }
+        int getDirtyLeft() const { return dirtyLeft; }
+        int getDirtyRight() const { return dirtyRight; }
+        void clearDirty();
+
+        //Snapshots of the whole machine: memory, registers, stack, timers, keys,
+        //screen and generator state, in a versioned little-endian format of exactly
+        //getStateSize() bytes. That's STATE_SIZE on the classic platform, more on the others
+        static const uint16_t STATE_VERSION = 2;
+        static const size_t STATE_SIZE = 0x115C;
+        static const size_t MAX_STATE_SIZE = 0x11180;
+        static size_t stateSize(Chip8Platform platform);
+        size_t getStateSize() const { return stateSize(platform); }
+        void saveState(uint8_t *out) const;
+        bool loadState(const uint8_t *data, size_t size);
+        //The checks loadState() makes before touching anything: size, header, platform and register ranges
+        bool isValidState(const uint8_t *data, size_t size) const;
+        bool saveState(const char *filePath) const;
+        bool loadState(const char *filePath);
 };
 
 
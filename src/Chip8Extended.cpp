@@ -0,0 +1,673 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Beeper.h"
+#include "Chip8.h"
+
+/*
+SUPER-CHIP and XO-CHIP:
+Both platforms run through their own copy of the interpreter loop, one
+instantiation per platform and quirk profile, over the extended state block. The classic loop
+and its state never see any of it, so the classic platform pays one branch
+per run() call for the extension and nothing per instruction.
+
+Behaviour follows Octo, the reference implementation for XO-CHIP, with the
+modern reading of SUPER-CHIP: lo-res mode is a 64x32 screen, 00FE/00FF clear
+the screen, DXY0 draws a 16x16 sprite in both modes and VF is set to 1 on any
+collision. The rest is up to the quirk profile, the platform's own by
+default: SUPER-CHIP clips sprites at the screen edges, BXNN jumps to
+XNN + VX, FX55/FX65 leave I alone and shifts ignore VY. XO-CHIP wraps sprites,
+jumps from V0, advances I past stored registers and shifts VY into VX.
+Flags are written after the result everywhere, so VF as a destination loses.
+
+Planes are 128-bit rows kept as two words, so scrolls, clears and sprite rows
+are a couple of shifts and XORs per row.
+*/
+
+extern uint8_t fontset[80];
+
+//SUPER-CHIP 8x10 digits, extended to A-F as in XO-CHIP. FX30 points I here
+static const uint16_t BIG_FONT = 0xA0;
+static const uint8_t bigFontset[160] = {
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+static inline uint32_t addressMask(Chip8Platform platform){
+    return platform == Chip8Platform::XOChip ? 0xFFFF : 0xFFF;
+}
+
+Chip8Instr Chip8::decode(uint16_t op, Chip8Platform platform){
+    Chip8Instr entry = decode(op);
+    if(platform == Chip8Platform::Chip8)
+        return entry;
+    bool xo = platform == Chip8Platform::XOChip;
+
+    switch(op & 0xF000){
+        case 0x0000: //The classic decoder only looks at the last nibble here, which would swallow 00CN and 00FX
+            if(op == 0x00E0)
+                entry.op = OP_CLS;
+            else if(op == 0x00EE)
+                entry.op = OP_RET;
+            else if((op & 0xFFF0) == 0x00C0)
+                entry.op = OP_SCROLL_DOWN;
+            else if(xo && (op & 0xFFF0) == 0x00D0)
+                entry.op = OP_SCROLL_UP;
+            else if(op == 0x00FB)
+                entry.op = OP_SCROLL_RIGHT;
+            else if(op == 0x00FC)
+                entry.op = OP_SCROLL_LEFT;
+            else if(op == 0x00FD)
+                entry.op = OP_EXIT;
+            else if(op == 0x00FE)
+                entry.op = OP_LORES;
+            else if(op == 0x00FF)
+                entry.op = OP_HIRES;
+            else
+                entry.op = OP_UNKNOWN;
+            break;
+        case 0x5000:
+            if(xo && entry.n == 2)
+                entry.op = OP_SAVE_RANGE;
+            else if(xo && entry.n == 3)
+                entry.op = OP_LOAD_RANGE;
+            break;
+        case 0xF000:
+            if(xo && op == 0xF000)
+                entry.op = OP_LONG_I;
+            else if(xo && op == 0xF002)
+                entry.op = OP_AUDIO;
+            else if(xo && entry.nn == 0x01)
+                entry.op = OP_PLANE;
+            else if(xo && entry.nn == 0x3A)
+                entry.op = OP_PITCH;
+            else if(entry.nn == 0x30)
+                entry.op = OP_BIG_FONT;
+            else if(entry.nn == 0x75)
+                entry.op = OP_SAVE_FLAGS;
+            else if(entry.nn == 0x85)
+                entry.op = OP_LOAD_FLAGS;
+            break;
+    }
+    return entry;
+}
+
+//Clean extended state with the fonts in place. Zeroed memory decodes as OP_DECODE,
+//which is entry 0 of the operation list
+void Chip8::initExtended(){
+    memset(ext, 0, sizeof(Chip8Extended));
+    memcpy(ext->memory, fontset, sizeof(fontset));
+    memcpy(ext->memory + BIG_FONT, bigFontset, sizeof(bigFontset));
+    ext->planeMask = 1;
+    ext->hires = false;
+}
+
+void Chip8::decodeExtendedAt(uint32_t address){
+    uint32_t mask = addressMask(platform);
+    uint16_t op = ext->memory[address & mask] << 8 | ext->memory[(address + 1) & mask];
+    ext->decoded[address & mask] = decode(op, platform);
+}
+
+//Same as invalidateDecoded(), over the extended memory
+void Chip8::invalidateExtended(uint32_t address, int length){
+    uint32_t mask = addressMask(platform);
+    for(int i = -1; i < length; i++)
+        ext->decoded[(address + i) & mask].op = OP_DECODE;
+}
+
+void Chip8::clearPlanes(uint8_t mask){
+    for(int p = 0; p < Chip8Extended::PLANES; p++){
+        if((mask >> p) & 1)
+            memset(ext->planes[p], 0, sizeof(ext->planes[p]));
+    }
+    markDirty(0, 0, 64, 32);
+}
+
+//Moves the selected planes down (negative for up) and right (negative for left), filling with unlit pixels
+void Chip8::scrollExtended(int down, int right){
+    int height = ext->hires ? 64 : 32;
+    bool hires = ext->hires;
+    for(int p = 0; p < Chip8Extended::PLANES; p++){
+        if(((ext->planeMask >> p) & 1) == 0)
+            continue;
+        uint64_t (*rows)[2] = ext->planes[p];
+
+        if(down > 0){
+            memmove(rows + down, rows, (height - down) * sizeof(rows[0]));
+            memset(rows, 0, down * sizeof(rows[0]));
+        }
+        else if(down < 0){
+            int up = -down;
+            memmove(rows, rows + up, (height - up) * sizeof(rows[0]));
+            memset(rows + height - up, 0, up * sizeof(rows[0]));
+        }
+
+        if(right > 0){
+            for(int y = 0; y < height; y++){
+                rows[y][1] = hires ? (rows[y][1] >> right) | (rows[y][0] << (64 - right)) : 0;
+                rows[y][0] >>= right;
+            }
+        }
+        else if(right < 0){
+            int left = -right;
+            for(int y = 0; y < height; y++){
+                rows[y][0] = (rows[y][0] << left) | (hires ? rows[y][1] >> (64 - left) : 0);
+                rows[y][1] = hires ? rows[y][1] << left : 0;
+            }
+        }
+    }
+    markDirty(0, 0, 64, 32);
+}
+
+//An 8 or 16 pixel sprite row placed at column x of a 64 or 128 pixel screen row,
+//as left and right words. Pixels past the right edge wrap around or are dropped
+static inline void placeRow(uint32_t bits, int size, int x, int width, bool wrap, uint64_t &left, uint64_t &right){
+    uint64_t sprite = (uint64_t)bits << (64 - size);
+    if(width == 64){
+        left = sprite >> x;
+        if(wrap && x)
+            left |= sprite << (64 - x);
+        right = 0;
+    }
+    else if(x < 64){
+        left = sprite >> x;
+        right = x ? sprite << (64 - x) : 0;
+    }
+    else{
+        left = wrap && x + size > 128 ? sprite << (128 - x) : 0;
+        right = sprite >> (x - 64);
+    }
+}
+
+//DXYN on the selected planes. Each plane takes its own sprite data, one after the other
+template<Chip8Platform Platform, bool Clip>
+bool Chip8::drawExtended(int x, int y, int n){
+    const bool wrap = !Clip;
+    const uint32_t mask = addressMask(Platform);
+    int width = ext->hires ? 128 : 64;
+    int height = ext->hires ? 64 : 32;
+    x &= width - 1;
+    y &= height - 1;
+    int size = n == 0 ? 16 : 8;
+    int rows = n == 0 ? 16 : n;
+
+    uint32_t address = I;
+    uint64_t collision = 0;
+    for(int p = 0; p < Chip8Extended::PLANES; p++){
+        if(((ext->planeMask >> p) & 1) == 0)
+            continue;
+        uint64_t (*plane)[2] = ext->planes[p];
+        for(int row = 0; row < rows; row++){
+            uint32_t bits = ext->memory[address & mask];
+            if(size == 16)
+                bits = bits << 8 | ext->memory[(address + 1) & mask];
+            address += size / 8;
+
+            int line = y + row;
+            if(line >= height){
+                if(!wrap)
+                    continue;
+                line -= height;
+            }
+            uint64_t left, right;
+            placeRow(bits, size, x, width, wrap, left, right);
+            uint64_t *dst = plane[line];
+            collision |= (dst[0] & left) | (dst[1] & right);
+            dst[0] ^= left;
+            dst[1] ^= right;
+        }
+    }
+    markDirty(0, 0, 64, 32);
+    return collision != 0;
+}
+
+//One loop per platform and quirk profile, picked once per batch
+template<Chip8Platform Platform>
+uint64_t Chip8::runPlatform(uint64_t cycles){
+#if CHIP8_SINGLE_PROFILE
+    return runExtended<Platform, Platform == Chip8Platform::XOChip ? Chip8Quirks::XOChip : Chip8Quirks::SuperChip>(cycles);
+#else
+    switch(getQuirks()){
+        case Chip8Quirks::Modern: return runExtended<Platform, Chip8Quirks::Modern>(cycles);
+        case Chip8Quirks::VIP: return runExtended<Platform, Chip8Quirks::VIP>(cycles);
+        case Chip8Quirks::SuperChip: return runExtended<Platform, Chip8Quirks::SuperChip>(cycles);
+        default: return runExtended<Platform, Chip8Quirks::XOChip>(cycles);
+    }
+#endif
+}
+
+template<Chip8Platform Platform, Chip8Quirks Quirks>
+uint64_t Chip8::runExtended(uint64_t cycles){
+    if(fault != Chip8Fault::None || cycles == 0)
+        return 0;
+
+    constexpr Chip8QuirkSet profile = quirkSet(Quirks);
+    const bool xo = Platform == Chip8Platform::XOChip;
+    const uint32_t mask = addressMask(Platform);
+    uint8_t *mem = ext->memory;
+    uint16_t pc = PC;
+    uint64_t executed = 0;
+    const Chip8Instr *in = &ext->decoded[pc & mask];
+
+    //Idle loop detection, exactly as in the classic loop
+    const uint16_t NO_LOOP = 0xFFFF;
+    uint16_t loopTarget = NO_LOOP;
+    uint64_t loopStart = 0;
+    uint16_t loopI = 0;
+    uint8_t loopV[16];
+    idle = false;
+    #define SIDE_EFFECT() (loopTarget = NO_LOOP)
+
+    //XO-CHIP skips step over the whole of a 4-byte F000 NNNN
+    #define SKIP(condition) \
+        pc += !(condition) ? 2 : (xo && mem[(pc + 2) & mask] == 0xF0 && mem[(pc + 3) & mask] == 0x00) ? 6 : 4
+
+#if CHIP8_COMPUTED_GOTO
+    #define CHIP8_LABEL(name) &&L_##name,
+    static const void *labels[] = { CHIP8_OPS(CHIP8_LABEL) CHIP8_EXT_OPS(CHIP8_LABEL) };
+    #undef CHIP8_LABEL
+    #define CASE(name) L_##name
+    #define DISPATCH() goto *labels[in->op]
+#else
+    #define CASE(name) case name
+    #define DISPATCH() goto dispatch
+#endif
+
+    #define NEXT() \
+        do{ \
+            if(++executed == cycles) \
+                goto done; \
+            in = &ext->decoded[pc & mask]; \
+            DISPATCH(); \
+        } while(0)
+
+    //Memory and key indices wrap here, so only the stack can be reached past its end
+    #define FAULT(reason) \
+        do{ \
+            opcode = in->opcode; \
+            fault = reason; \
+            goto done; \
+        } while(0)
+
+#if CHIP8_COMPUTED_GOTO
+    DISPATCH();
+#else
+    dispatch:
+    switch(in->op){
+#endif
+
+    CASE(OP_DECODE): {
+        decodeExtendedAt(pc & mask);
+        DISPATCH();
+    }
+
+    CASE(OP_UNKNOWN): CASE(OP_BREAK): { //Breakpoints never get patched in here
+        opcode = in->opcode;
+        unknownOpcode();
+        goto done;
+    }
+
+    CASE(OP_CLS): { //Opcode 00E0, clear the selected planes
+        clearPlanes(ext->planeMask);
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_RET): { //Opcode 00EE
+        if(SP == 0)
+            FAULT(Chip8Fault::StackUnderflow);
+        SP--;
+        pc = stack[SP];
+        SIDE_EFFECT();
+    } NEXT();
+
+    CASE(OP_JUMP): { //Opcode 1NNN
+        if(in->nnn <= pc){
+            if(loopTarget == in->nnn && loopI == I && memcmp(loopV, V, 16) == 0){
+                uint64_t period = executed + 1 - loopStart;
+                uint64_t skip = (cycles - executed - 1) / period * period;
+                executed += skip;
+                idleInstructions += skip;
+                idle = delayTimer == 0 && soundTimer == 0;
+            }
+            loopTarget = in->nnn;
+            loopStart = executed + 1;
+            loopI = I;
+            memcpy(loopV, V, 16);
+        }
+        pc = in->nnn;
+    } NEXT();
+
+    CASE(OP_CALL): { //Opcode 2NNN
+        if(SP >= 16)
+            FAULT(Chip8Fault::StackOverflow);
+        stack[SP] = (pc + 2) & mask;
+        SP++;
+        pc = in->nnn;
+        SIDE_EFFECT();
+    } NEXT();
+
+    CASE(OP_SKIP_EQ_IMM): { //Opcode 3XNN
+        SKIP(V[in->x] == in->nn);
+    } NEXT();
+
+    CASE(OP_SKIP_NE_IMM): { //Opcode 4XNN
+        SKIP(V[in->x] != in->nn);
+    } NEXT();
+
+    CASE(OP_SKIP_EQ_REG): { //Opcode 5XY0
+        SKIP(V[in->x] == V[in->y]);
+    } NEXT();
+
+    CASE(OP_LOAD_IMM): { //Opcode 6XNN
+        V[in->x] = in->nn;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_ADD_IMM): { //Opcode 7XNN
+        V[in->x] += in->nn;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_MOVE): { //Opcode 8XY0
+        V[in->x] = V[in->y];
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_OR): { //Opcode 8XY1
+        V[in->x] |= V[in->y];
+        if constexpr(profile.vfReset)
+            V[0xF] = 0;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_AND): { //Opcode 8XY2
+        V[in->x] &= V[in->y];
+        if constexpr(profile.vfReset)
+            V[0xF] = 0;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_XOR): { //Opcode 8XY3
+        V[in->x] ^= V[in->y];
+        if constexpr(profile.vfReset)
+            V[0xF] = 0;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_ADD): { //Opcode 8XY4
+        int sum = V[in->x] + V[in->y];
+        V[in->x] = sum & 0xFF;
+        V[0xF] = sum > 0xFF;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SUB): { //Opcode 8XY5
+        uint8_t flag = V[in->x] >= V[in->y];
+        V[in->x] -= V[in->y];
+        V[0xF] = flag;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SHR): { //Opcode 8XY6
+        uint8_t value = profile.shiftVY ? V[in->y] : V[in->x];
+        V[in->x] = value >> 1;
+        V[0xF] = value & 1;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SUBN): { //Opcode 8XY7
+        uint8_t flag = V[in->y] >= V[in->x];
+        V[in->x] = V[in->y] - V[in->x];
+        V[0xF] = flag;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SHL): { //Opcode 8XYE
+        uint8_t value = profile.shiftVY ? V[in->y] : V[in->x];
+        V[in->x] = value << 1;
+        V[0xF] = value >> 7;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SKIP_NE_REG): { //Opcode 9XY0
+        SKIP(V[in->x] != V[in->y]);
+    } NEXT();
+
+    CASE(OP_LOAD_I): { //Opcode ANNN
+        I = in->nnn;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_JUMP_V0): { //Opcode BNNN, or BXNN (XNN + VX) with the SUPER-CHIP quirk
+        pc = in->nnn + V[profile.jumpVX ? in->x : 0];
+    } NEXT();
+
+    CASE(OP_RAND): { //Opcode CXNN
+        V[in->x] = nextRandom() & in->nn;
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_DRAW): { //Opcode DXYN, DXY0 draws 16x16
+        V[0xF] = drawExtended<Platform, profile.clip>(V[in->x], V[in->y], in->n) ? 1 : 0;
+        drawFlag = true;
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SKIP_KEY): { //EX9E
+        SKIP(key[V[in->x] & 0xF] != 0);
+    } NEXT();
+
+    CASE(OP_SKIP_NOT_KEY): { //EXA1
+        SKIP(key[V[in->x] & 0xF] == 0);
+    } NEXT();
+
+    CASE(OP_GET_DELAY): { //Opcode FX07
+        V[in->x] = delayTimer;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_WAIT_KEY): { //Opcode FX0A
+        bool keyPressed = false;
+        for(int i = 0; i < 16; i++){
+            if(key[i] != 0){
+                keyPressed = true;
+                V[in->x] = i;
+            }
+        }
+        if(keyPressed)
+            pc += 2;
+        else{
+            idleInstructions += cycles - executed - 1;
+            executed = cycles - 1;
+            idle = delayTimer == 0 && soundTimer == 0;
+        }
+    } NEXT();
+
+    CASE(OP_SET_DELAY): { //Opcode FX15
+        delayTimer = V[in->x];
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SET_SOUND): { //Opcode FX18
+        bool wasOn = soundTimer > 0;
+        soundTimer = V[in->x];
+        soundChanged(wasOn, instructionClock + executed);
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_ADD_I): { //Opcode FX1E
+        I += V[in->x];
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_FONT): { //Opcode FX29
+        I = (V[in->x] & 0xF) * 5;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_BCD): { //Opcode FX33
+        mem[I & mask] = V[in->x] / 100;
+        mem[(I + 1) & mask] = (V[in->x] / 10) % 10;
+        mem[(I + 2) & mask] = V[in->x] % 10;
+        invalidateExtended(I, 3);
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_STORE): { //Opcode FX55
+        for(int i = 0; i <= in->x; i++)
+            mem[(I + i) & mask] = V[i];
+        invalidateExtended(I, in->x + 1);
+        if constexpr(profile.memoryIncrement)
+            I += in->x + 1;
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_LOAD): { //Opcode FX65
+        for(int i = 0; i <= in->x; i++)
+            V[i] = mem[(I + i) & mask];
+        if constexpr(profile.memoryIncrement)
+            I += in->x + 1;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SCROLL_DOWN): { //Opcode 00CN
+        scrollExtended(in->n, 0);
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SCROLL_UP): { //Opcode 00DN, XO-CHIP
+        scrollExtended(-in->n, 0);
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SCROLL_RIGHT): { //Opcode 00FB, 4 pixels
+        scrollExtended(0, 4);
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SCROLL_LEFT): { //Opcode 00FC, 4 pixels
+        scrollExtended(0, -4);
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_EXIT): { //Opcode 00FD, the ROM is done. PC stays on it
+        opcode = in->opcode;
+        fault = Chip8Fault::Exited;
+        goto done;
+    }
+
+    CASE(OP_LORES): //Opcode 00FE
+    CASE(OP_HIRES): { //Opcode 00FF
+        ext->hires = in->op == OP_HIRES;
+        clearPlanes(0xF);
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SAVE_RANGE): { //Opcode 5XY2, store VX to VY at I in either direction, I unchanged
+        int count = abs(in->x - in->y) + 1;
+        int step = in->x <= in->y ? 1 : -1;
+        for(int i = 0; i < count; i++)
+            mem[(I + i) & mask] = V[in->x + i * step];
+        invalidateExtended(I, count);
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_LOAD_RANGE): { //Opcode 5XY3
+        int count = abs(in->x - in->y) + 1;
+        int step = in->x <= in->y ? 1 : -1;
+        for(int i = 0; i < count; i++)
+            V[in->x + i * step] = mem[(I + i) & mask];
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_LONG_I): { //Opcode F000 NNNN, I = the following word
+        I = mem[(pc + 2) & mask] << 8 | mem[(pc + 3) & mask];
+        pc += 4;
+    } NEXT();
+
+    CASE(OP_PLANE): { //Opcode FN01, select the planes to draw on
+        ext->planeMask = in->x;
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_AUDIO): { //Opcode F002, load the 16-byte audio pattern from I
+        for(int i = 0; i < 16; i++)
+            ext->pattern[i] = mem[(I + i) & mask];
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_PITCH): { //Opcode FX3A
+        ext->pitch = V[in->x];
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_BIG_FONT): { //Opcode FX30, I = 8x10 sprite for the digit in VX
+        I = BIG_FONT + (V[in->x] & 0xF) * 10;
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_SAVE_FLAGS): { //Opcode FX75, V0 to VX into the user flags. SUPER-CHIP has 8 of them
+        int last = xo ? in->x : in->x & 7;
+        for(int i = 0; i <= last; i++)
+            ext->flags[i] = V[i];
+        SIDE_EFFECT();
+        pc += 2;
+    } NEXT();
+
+    CASE(OP_LOAD_FLAGS): { //Opcode FX85
+        int last = xo ? in->x : in->x & 7;
+        for(int i = 0; i <= last; i++)
+            V[i] = ext->flags[i];
+        pc += 2;
+    } NEXT();
+
+#if !CHIP8_COMPUTED_GOTO
+    }
+#endif
+
+    #undef NEXT
+    #undef FAULT
+    #undef DISPATCH
+    #undef CASE
+    #undef SKIP
+    #undef SIDE_EFFECT
+
+    done:
+    PC = pc & mask;
+    instructionClock += executed;
+    return executed;
+}
+
+template uint64_t Chip8::runPlatform<Chip8Platform::SuperChip>(uint64_t cycles);
+template uint64_t Chip8::runPlatform<Chip8Platform::XOChip>(uint64_t cycles);
@@ -0,0 +1,167 @@
+#include <string.h>
+
+#include "FrameStream.h"
+
+size_t FrameStream::captureImage(const Chip8 &chip, uint8_t *image, uint8_t &width, uint8_t &height, uint8_t &planes){
+    width = (uint8_t)chip.getWidth();
+    height = (uint8_t)chip.getHeight();
+    uint8_t *p = image;
+    if(chip.getPlatform() == Chip8Platform::Chip8){
+        planes = 1;
+        const uint64_t *rows = chip.getDisplay();
+        for(int y = 0; y < 32; y++){
+            for(int b = 0; b < 8; b++)
+                *p++ = rows[y] >> (56 - b * 8);
+        }
+        return p - image;
+    }
+
+    planes = (uint8_t)chip.getPlanes();
+    int words = width / 64;
+    for(int plane = 0; plane < planes; plane++){
+        const uint64_t (*rows)[2] = chip.getPlane(plane);
+        for(int y = 0; y < height; y++){
+            for(int w = 0; w < words; w++){
+                for(int b = 0; b < 8; b++)
+                    *p++ = rows[y][w] >> (56 - b * 8);
+            }
+        }
+    }
+    return p - image;
+}
+
+uint32_t FrameStream::checksum(const uint8_t *image, size_t size){
+    uint32_t hash = 0x811C9DC5;
+    for(size_t i = 0; i < size; i++){
+        hash ^= image[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+static inline uint8_t *putVarint(uint8_t *out, size_t value){
+    while(value >= 0x80){
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static inline bool getVarint(const uint8_t *&p, const uint8_t *end, size_t &value){
+    value = 0;
+    for(int shift = 0; shift < 28; shift += 7){
+        if(p == end)
+            return false;
+        uint8_t b = *p++;
+        value |= (size_t)(b & 0x7F) << shift;
+        if(!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+//A changed run only ends at this many unchanged bytes, which is where a new pair
+//costs less than carrying the unchanged bytes along
+static const size_t GAP = 3;
+
+size_t FrameStream::encodeDelta(const uint8_t *previous, const uint8_t *current, size_t size, uint8_t *out){
+    uint8_t *o = out;
+    size_t i = 0;
+    for(;;){
+        size_t equalStart = i;
+        while(i + 8 <= size && memcmp(previous + i, current + i, 8) == 0)
+            i += 8;
+        while(i < size && previous[i] == current[i])
+            i++;
+        if(i == size)
+            break;
+
+        size_t changedStart = i;
+        size_t same = 0;
+        while(i < size && same < GAP){
+            same = previous[i] == current[i] ? same + 1 : 0;
+            i++;
+        }
+        i -= same;
+
+        o = putVarint(o, changedStart - equalStart);
+        o = putVarint(o, i - changedStart);
+        for(size_t j = changedStart; j < i; j++)
+            *o++ = previous[j] ^ current[j];
+    }
+    return o - out;
+}
+
+bool FrameStream::applyDelta(const uint8_t *delta, size_t length, uint8_t *image, size_t size){
+    const uint8_t *end = delta + length;
+    size_t pos = 0;
+    while(delta < end){
+        size_t equal, changed;
+        if(!getVarint(delta, end, equal) || !getVarint(delta, end, changed))
+            return false;
+        if(equal > size - pos || changed > size - pos - equal || changed > (size_t)(end - delta))
+            return false;
+        pos += equal;
+        for(size_t j = 0; j < changed; j++)
+            image[pos + j] ^= delta[j];
+        pos += changed;
+        delta += changed;
+    }
+    return true;
+}
+
+void FrameStream::put(std::vector<uint8_t> &out, uint64_t value, int bytes){
+    for(int b = 0; b < bytes; b++)
+        out.push_back((uint8_t)(value >> (b * 8)));
+}
+
+uint64_t FrameStream::get(const uint8_t *&p, int bytes){
+    uint64_t v = 0;
+    for(int b = 0; b < bytes; b++)
+        v |= (uint64_t)p[b] << (b * 8);
+    p += bytes;
+    return v;
+}
+
+size_t FrameStream::beginMessage(std::vector<uint8_t> &out, StreamMessage type){
+    size_t start = out.size();
+    out.push_back((uint8_t)type);
+    put(out, 0, 2);
+    return start;
+}
+
+void FrameStream::finishMessage(std::vector<uint8_t> &out, size_t start){
+    size_t length = out.size() - start - HEADER_SIZE;
+    out[start + 1] = length & 0xFF;
+    out[start + 2] = (length >> 8) & 0xFF;
+}
+
+size_t FrameStream::nextMessage(const uint8_t *data, size_t size, StreamMessage &type, const uint8_t *&payload, size_t &length){
+    if(size < HEADER_SIZE)
+        return 0;
+    length = data[1] | data[2] << 8;
+    if(size < HEADER_SIZE + length)
+        return 0;
+    type = (StreamMessage)data[0];
+    payload = data + HEADER_SIZE;
+    return HEADER_SIZE + length;
+}
+
+bool FrameStream::parseFrame(const uint8_t *payload, size_t length, StreamFrame &frame){
+    if(length < 20)
+        return false;
+    const uint8_t *p = payload;
+    frame.sequence = (uint32_t)get(p, 4);
+    frame.frame = (uint32_t)get(p, 4);
+    frame.input = (uint32_t)get(p, 4);
+    frame.flags = p[0];
+    frame.width = p[1];
+    frame.height = p[2];
+    frame.planes = p[3];
+    p += 4;
+    frame.checksum = (uint32_t)get(p, 4);
+    frame.delta = p;
+    frame.deltaSize = length - 20;
+    return frame.width % 8 == 0 && imageSize(frame.width, frame.height, frame.planes) <= MAX_IMAGE;
+}
@@ -0,0 +1,96 @@
+#ifndef FRAME_STREAM_H
+#define FRAME_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "Chip8.h"
+
+/*
+Frame stream protocol, between chip8-server and its clients over a stream
+socket. Every message is a type byte, a 16-bit payload length and the
+payload, little-endian throughout.
+
+Client to server:
+  Hello     version (16), seed (64), ROM name length (8), ROM name. An empty
+            name picks the server's first ROM
+  Keys      input sequence (32), key mask (16), bit n set while key n is down.
+            Each Keys message holds for at least one frame, in the order sent
+  Keyframe  empty. Asks for the next frame to be sent whole
+
+Server to client:
+  Welcome   version (16), session id (32), platform, quirk profile, frames per second
+  Frame     sequence (32), frame (32), input sequence (32), flags, width,
+            height, planes, checksum (32), screen delta
+  Closed    reason, as text
+
+A screen is sent as an image: each plane in turn, each row of it top to
+bottom, width / 8 bytes per row with the leftmost pixel in the top bit.
+Frame sequence numbers go up by one per Frame message, so a gap means one
+was lost. The frame number counts emulated frames and skips the ones that
+weren't sent. The input sequence is the newest Keys message the frame ran
+with, which lets a client time its input end to end. The checksum is
+FNV-1a over the whole image once the delta is applied.
+
+The delta is the image XORed with the previous Frame's, or with an all-zero
+image when the Keyframe flag is set or the size changed, as pairs of
+varints (bytes unchanged, bytes changed) each followed by the changed bytes
+XORed. Bytes after the last pair are unchanged.
+*/
+enum class StreamMessage : uint8_t{
+    Hello = 0x01,
+    Keys = 0x02,
+    Keyframe = 0x03,
+    Welcome = 0x81,
+    Frame = 0x82,
+    Closed = 0x83
+};
+
+struct StreamFrame{
+    static const uint8_t KEYFRAME = 1; //Flag: the delta is against an all-zero image
+
+    uint32_t sequence;
+    uint32_t frame;
+    uint32_t input;
+    uint8_t flags;
+    uint8_t width;
+    uint8_t height;
+    uint8_t planes;
+    uint32_t checksum;
+    const uint8_t *delta; //Points into the received message
+    size_t deltaSize;
+};
+
+class FrameStream{
+    public:
+        static const uint16_t VERSION = 1;
+        static const size_t HEADER_SIZE = 3; //Type and payload length
+        static const size_t MAX_PAYLOAD = 0xFFFF;
+        static const size_t MAX_IMAGE = Chip8Extended::PLANES * 64 * 16;
+        //Frame header plus the worst case delta, which always fits a message
+        static const size_t MAX_FRAME = 20 + MAX_IMAGE + 8;
+
+        //The screen of chip as an image, returning its size in bytes
+        static size_t captureImage(const Chip8 &chip, uint8_t *image, uint8_t &width, uint8_t &height, uint8_t &planes);
+        static size_t imageSize(int width, int height, int planes){ return (size_t)planes * height * (width / 8); }
+        static uint32_t checksum(const uint8_t *image, size_t size);
+
+        //Encodes current XOR previous into out, which has room for MAX_IMAGE + 8 bytes
+        static size_t encodeDelta(const uint8_t *previous, const uint8_t *current, size_t size, uint8_t *out);
+        //XORs a received delta into image. False if it's malformed or runs past size
+        static bool applyDelta(const uint8_t *delta, size_t length, uint8_t *image, size_t size);
+
+        //Appends a message header to out and returns where it starts, for finishMessage()
+        static size_t beginMessage(std::vector<uint8_t> &out, StreamMessage type);
+        static void finishMessage(std::vector<uint8_t> &out, size_t start);
+        static void put(std::vector<uint8_t> &out, uint64_t value, int bytes);
+
+        //Finds a whole message at the start of data. Returns its total size, or 0 if more bytes are needed
+        static size_t nextMessage(const uint8_t *data, size_t size, StreamMessage &type, const uint8_t *&payload, size_t &length);
+        static bool parseFrame(const uint8_t *payload, size_t length, StreamFrame &frame);
+        static uint64_t get(const uint8_t *&p, int bytes);
+};
+
+
+#endif
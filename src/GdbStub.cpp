@@ -0,0 +1,477 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "GdbStub.h"
+#include "Net.h"
+
+//Register numbers in 'g', 'p' and the target description
+enum GdbRegister{
+    REG_V0 = 0,
+    REG_I = 16,
+    REG_PC,
+    REG_SP,
+    REG_DT,
+    REG_ST,
+    REG_COUNT
+};
+
+static int registerSize(int index){
+    return index == REG_I || index == REG_PC ? 2 : 1;
+}
+
+//CHIP-8 isn't an architecture GDB knows, so it gets its registers from here
+static std::string targetDescription(){
+    std::string xml = "<?xml version=\"1.0\"?>\n<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+        "<target version=\"1.0\">\n<feature name=\"org.chip8.core\">\n";
+    char line[64];
+    for(int i = 0; i < 16; i++){
+        snprintf(line, sizeof(line), "<reg name=\"v%x\" bitsize=\"8\" type=\"uint8\"/>\n", i);
+        xml += line;
+    }
+    xml += "<reg name=\"i\" bitsize=\"16\" type=\"data_ptr\"/>\n"
+        "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>\n"
+        "<reg name=\"sp\" bitsize=\"8\" type=\"uint8\"/>\n"
+        "<reg name=\"dt\" bitsize=\"8\" type=\"uint8\"/>\n"
+        "<reg name=\"st\" bitsize=\"8\" type=\"uint8\"/>\n"
+        "</feature>\n</target>\n";
+    return xml;
+}
+
+static void appendHex(std::string &out, uint32_t value, int bytes){
+    //Little-endian, as the registers are sent
+    char digits[3];
+    for(int b = 0; b < bytes; b++){
+        snprintf(digits, sizeof(digits), "%02x", (value >> (b * 8)) & 0xFF);
+        out += digits;
+    }
+}
+
+static int hexDigit(char c){
+    if(c >= '0' && c <= '9')
+        return c - '0';
+    if(c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+//Reads little-endian hex bytes from text at pos
+static bool parseHexBytes(const std::string &text, size_t pos, int bytes, uint32_t &value){
+    if(pos + bytes * 2 > text.size())
+        return false;
+    value = 0;
+    for(int b = 0; b < bytes; b++){
+        int high = hexDigit(text[pos + b * 2]);
+        int low = hexDigit(text[pos + b * 2 + 1]);
+        if(high < 0 || low < 0)
+            return false;
+        value |= (uint32_t)(high << 4 | low) << (b * 8);
+    }
+    return true;
+}
+
+GdbStub::GdbStub(Chip8 &chip, int instructionsPerFrame) : chip(chip){
+    this->instructionsPerFrame = instructionsPerFrame > 0 ? instructionsPerFrame : 9;
+    frameLeft = this->instructionsPerFrame;
+    listenFd = -1;
+    clientFd = -1;
+    noAck = false;
+    halted = true;
+    killed = false;
+    stopReply = "S05";
+}
+
+GdbStub::~GdbStub(){
+    closeClient();
+    if(listenFd >= 0)
+        close(listenFd);
+    if(!unixPath.empty())
+        unlink(unixPath.c_str());
+}
+
+bool GdbStub::listen(const char *address){
+    listenFd = listenSocket(address, 1, unixPath);
+    return listenFd >= 0;
+}
+
+//A debugger going away leaves nothing behind: its breakpoints go and the target runs on
+void GdbStub::closeClient(){
+    if(clientFd < 0)
+        return;
+    close(clientFd);
+    clientFd = -1;
+    input.clear();
+    chip.clearBreakpoints();
+    halted = false;
+}
+
+void GdbStub::poll(int timeoutMs){
+    if(clientFd >= 0){
+        receive(timeoutMs);
+        return;
+    }
+    if(listenFd < 0)
+        return;
+
+    pollfd p = { listenFd, POLLIN, 0 };
+    if(::poll(&p, 1, timeoutMs) <= 0)
+        return;
+    clientFd = accept(listenFd, nullptr, nullptr);
+    if(clientFd < 0)
+        return;
+    setNoDelay(clientFd);
+    noAck = false;
+    //Attaching stops a running target
+    if(!halted){
+        halted = true;
+        stopReply = "S05";
+    }
+}
+
+void GdbStub::receive(int timeoutMs){
+    pollfd p = { clientFd, POLLIN, 0 };
+    if(::poll(&p, 1, timeoutMs) <= 0)
+        return;
+    char buffer[4096];
+    ssize_t got = recv(clientFd, buffer, sizeof(buffer), 0);
+    if(got <= 0){
+        closeClient();
+        return;
+    }
+    input.append(buffer, got);
+
+    //Packets are $data#checksum. Acks and stray bytes in between are skipped
+    size_t pos = 0;
+    while(pos < input.size() && clientFd >= 0){
+        char c = input[pos];
+        if(c == 0x03){
+            pos++;
+            if(!halted)
+                halt("S02");
+            continue;
+        }
+        if(c != '$'){
+            pos++;
+            continue;
+        }
+        size_t end = input.find('#', pos);
+        if(end == std::string::npos || end + 2 >= input.size())
+            break;
+        std::string packet = input.substr(pos + 1, end - pos - 1);
+        uint8_t sum = 0;
+        for(char b : packet)
+            sum += (uint8_t)b;
+        int expected = hexDigit(input[end + 1]) << 4 | hexDigit(input[end + 2]);
+        pos = end + 3;
+        if(!noAck){
+            const char *ack = sum == expected ? "+" : "-";
+            ::send(clientFd, ack, 1, MSG_NOSIGNAL);
+        }
+        if(sum == expected)
+            handlePacket(packet);
+    }
+    if(clientFd >= 0)
+        input.erase(0, pos);
+}
+
+void GdbStub::send(const std::string &payload){
+    if(clientFd < 0)
+        return;
+    uint8_t sum = 0;
+    for(char c : payload)
+        sum += (uint8_t)c;
+    char tail[4];
+    snprintf(tail, sizeof(tail), "#%02x", sum);
+    std::string packet = "$" + payload + tail;
+
+    size_t sent = 0;
+    while(sent < packet.size()){
+        ssize_t n = ::send(clientFd, packet.data() + sent, packet.size() - sent, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0){
+            closeClient();
+            return;
+        }
+        sent += n;
+    }
+}
+
+void GdbStub::halt(const std::string &reply){
+    halted = true;
+    stopReply = reply;
+    send(reply);
+}
+
+//Tells the debugger why the target stopped, from the state the last run left behind
+void GdbStub::reportStop(){
+    char reply[32];
+    if(chip.getFault() == Chip8Fault::Exited)
+        snprintf(reply, sizeof(reply), "W00");
+    else if(chip.getFault() == Chip8Fault::UnknownOpcode)
+        snprintf(reply, sizeof(reply), "S04"); //SIGILL
+    else if(chip.getFault() != Chip8Fault::None)
+        snprintf(reply, sizeof(reply), "S0b"); //SIGSEGV, for memory, stack and key faults
+    else if(chip.getStop() == Chip8Stop::Watchpoint)
+        snprintf(reply, sizeof(reply), "T05watch:%x;", chip.getStopAddress());
+    else
+        snprintf(reply, sizeof(reply), "S05");
+    halt(reply);
+}
+
+//One instruction. A run always executes its first opcode, even under a breakpoint
+void GdbStub::step(){
+    if(chip.getFault() == Chip8Fault::None){
+        frameLeft -= (int)chip.run(1);
+        if(frameLeft == 0){
+            chip.tickTimers();
+            frameLeft = instructionsPerFrame;
+        }
+    }
+    reportStop();
+}
+
+bool GdbStub::runFrame(){
+    poll(0);
+    if(halted)
+        return false;
+    if(chip.getFault() != Chip8Fault::None){
+        reportStop();
+        return false;
+    }
+
+    frameLeft -= (int)chip.run(frameLeft);
+    bool finished = false;
+    if(frameLeft == 0){
+        chip.tickTimers();
+        frameLeft = instructionsPerFrame;
+        finished = true;
+    }
+    if(chip.getFault() != Chip8Fault::None || chip.getStop() != Chip8Stop::None)
+        reportStop();
+    return finished;
+}
+
+std::string GdbStub::readRegisters() const{
+    std::string out;
+    for(int i = 0; i < 16; i++)
+        appendHex(out, chip.V[i], 1);
+    appendHex(out, chip.I, 2);
+    appendHex(out, chip.PC, 2);
+    appendHex(out, chip.SP, 1);
+    appendHex(out, chip.delayTimer, 1);
+    appendHex(out, chip.soundTimer, 1);
+    return out;
+}
+
+bool GdbStub::writeRegister(int index, uint32_t value){
+    if(index >= REG_V0 && index < REG_V0 + 16)
+        chip.V[index - REG_V0] = (uint8_t)value;
+    else if(index == REG_I)
+        chip.I = (uint16_t)value;
+    else if(index == REG_PC)
+        chip.PC = value & 0xFFF;
+    else if(index == REG_SP && value <= 16)
+        chip.SP = (uint16_t)value;
+    else if(index == REG_DT)
+        chip.delayTimer = (uint8_t)value;
+    else if(index == REG_ST)
+        chip.soundTimer = (uint8_t)value;
+    else
+        return false;
+    return true;
+}
+
+//Reads stop at the end of memory. Reads starting past it fail
+std::string GdbStub::readMemory(uint32_t address, uint32_t length) const{
+    if(address >= 0x1000)
+        return "E01";
+    if(length > 0x1000 - address)
+        length = 0x1000 - address;
+    std::string out;
+    for(uint32_t i = 0; i < length; i++)
+        appendHex(out, chip.memory[address + i], 1);
+    return out;
+}
+
+bool GdbStub::writeMemory(uint32_t address, const std::string &hex){
+    uint32_t length = hex.size() / 2;
+    if(address >= 0x1000 || length > 0x1000 - address)
+        return false;
+    for(uint32_t i = 0; i < length; i++){
+        uint32_t value;
+        if(!parseHexBytes(hex, i * 2, 1, value))
+            return false;
+        chip.memory[address + i] = (uint8_t)value;
+    }
+    //Writes from the debugger aren't the program's own, but cached decodes still have to go
+    if(length)
+        chip.invalidateDecoded(address, length);
+    return true;
+}
+
+void GdbStub::handlePacket(const std::string &packet){
+    if(packet.empty()){
+        send("");
+        return;
+    }
+    const char *args = packet.c_str() + 1;
+    char *end;
+
+    switch(packet[0]){
+        case '?':
+            send(stopReply);
+            return;
+
+        case 'g':
+            send(readRegisters());
+            return;
+
+        case 'G':{
+            size_t pos = 1;
+            for(int i = 0; i < REG_COUNT; i++){
+                uint32_t value;
+                if(!parseHexBytes(packet, pos, registerSize(i), value) || !writeRegister(i, value)){
+                    send("E01");
+                    return;
+                }
+                pos += registerSize(i) * 2;
+            }
+            send("OK");
+            return;
+        }
+
+        case 'p':{
+            int index = (int)strtoul(args, nullptr, 16);
+            if(index < 0 || index >= REG_COUNT){
+                send("E01");
+                return;
+            }
+            std::string all = readRegisters();
+            size_t pos = 0;
+            for(int i = 0; i < index; i++)
+                pos += registerSize(i) * 2;
+            send(all.substr(pos, registerSize(index) * 2));
+            return;
+        }
+
+        case 'P':{
+            int index = (int)strtoul(args, &end, 16);
+            uint32_t value;
+            if(*end != '=' || index < 0 || index >= REG_COUNT ||
+                !parseHexBytes(packet, end + 1 - packet.c_str(), registerSize(index), value) || !writeRegister(index, value)){
+                send("E01");
+                return;
+            }
+            send("OK");
+            return;
+        }
+
+        case 'm':{
+            uint32_t address = strtoul(args, &end, 16);
+            uint32_t length = *end == ',' ? strtoul(end + 1, nullptr, 16) : 0;
+            send(readMemory(address, length));
+            return;
+        }
+
+        case 'M':{
+            uint32_t address = strtoul(args, &end, 16);
+            const char *data = *end == ',' ? strchr(end, ':') : nullptr;
+            uint32_t length = *end == ',' ? strtoul(end + 1, nullptr, 16) : 0;
+            std::string hex = data ? std::string(data + 1) : std::string();
+            send(data && hex.size() == length * 2 && writeMemory(address, hex) ? "OK" : "E01");
+            return;
+        }
+
+        case 'c':
+        case 's':
+            if(*args)
+                chip.PC = strtoul(args, nullptr, 16) & 0xFFF;
+            if(packet[0] == 's')
+                step();
+            else
+                halted = false; //The reply comes when the target stops again
+            return;
+
+        case 'Z':
+        case 'z':{
+            int type = (int)strtoul(args, &end, 16);
+            uint32_t address = *end == ',' ? strtoul(end + 1, &end, 16) : 0x10000;
+            uint32_t kind = *end == ',' ? strtoul(end + 1, nullptr, 16) : 1;
+            bool enable = packet[0] == 'Z';
+            if(type > 2){
+                send(""); //Read and access watchpoints aren't supported
+                return;
+            }
+            if(address >= 0x1000){
+                send("E01");
+                return;
+            }
+            if(type == 2)
+                chip.setWatchpoint((uint16_t)address, kind ? (int)kind : 1, enable);
+            else
+                chip.setBreakpoint((uint16_t)address, enable);
+            send("OK");
+            return;
+        }
+
+        case 'D':
+            send("OK");
+            closeClient();
+            return;
+
+        case 'k':
+            killed = true;
+            closeClient();
+            return;
+
+        case 'H':
+        case 'T':
+            send("OK");
+            return;
+
+        case 'q':
+            if(packet.compare(0, 10, "qSupported") == 0)
+                send("PacketSize=1000;qXfer:features:read+;QStartNoAckMode+");
+            else if(packet == "qAttached")
+                send("1");
+            else if(packet == "qC")
+                send("QC1");
+            else if(packet == "qfThreadInfo")
+                send("m1");
+            else if(packet == "qsThreadInfo")
+                send("l");
+            else if(packet.compare(0, 31, "qXfer:features:read:target.xml:") == 0){
+                static const std::string xml = targetDescription();
+                size_t offset = strtoul(packet.c_str() + 31, &end, 16);
+                size_t length = *end == ',' ? strtoul(end + 1, nullptr, 16) : 0;
+                if(offset >= xml.size())
+                    send("l");
+                else
+                    send((offset + length >= xml.size() ? "l" : "m") + xml.substr(offset, length));
+            }
+            else
+                send("");
+            return;
+
+        case 'Q':
+            if(packet == "QStartNoAckMode"){
+                send("OK");
+                noAck = true;
+            }
+            else
+                send("");
+            return;
+
+        default:
+            //Everything else, including X and the v packets, gets the empty "not supported"
+            send("");
+            return;
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef GDB_STUB_H
+#define GDB_STUB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#include "Chip8.h"
+
+/*
+GDB remote serial protocol server:
+Lets GDB (or anything else speaking the protocol) attach to a running Chip8
+over a local TCP port or a Unix socket. Registers are V0-VF, I, PC, SP and
+the two timers; memory is the 4 KB address space. Supports reading and
+writing both, software and hardware breakpoints (Z0/Z1), write watchpoints
+(Z2), single-step, continue and Ctrl-C.
+
+The stub owns the frame structure while it's in use: the host calls
+runFrame() wherever it would have called Chip8::runFrame(), and the stub
+runs the rest of the current frame unless the debugger has the target
+halted. A breakpoint halfway through a frame halts it there, and the frame
+finishes after the debugger lets it go. Breakpoints are patched into the
+core's decoded cache, so a target running with none set runs at full speed.
+
+Only the classic platform can be debugged.
+*/
+class GdbStub{
+    private:
+        Chip8 &chip;
+        int instructionsPerFrame;
+        int frameLeft; //Instructions left in the current frame
+
+        int listenFd;
+        int clientFd;
+        std::string unixPath; //Removed again on close
+        std::string input; //Received bytes not yet parsed into packets
+        bool noAck;
+
+        bool halted;
+        bool killed;
+        std::string stopReply; //Answer to '?', the reason of the last halt
+
+        void closeClient();
+        void receive(int timeoutMs);
+        void handlePacket(const std::string &packet);
+        void send(const std::string &payload);
+        void halt(const std::string &reply);
+        void step();
+        void reportStop();
+
+        std::string readRegisters() const;
+        bool writeRegister(int index, uint32_t value);
+        std::string readMemory(uint32_t address, uint32_t length) const;
+        bool writeMemory(uint32_t address, const std::string &hex);
+
+    public:
+        GdbStub(Chip8 &chip, int instructionsPerFrame);
+        ~GdbStub();
+
+        //Listens on "[host:]port" (host defaults to 127.0.0.1) or "unix:PATH"
+        bool listen(const char *address);
+
+        //Handles debugger traffic, waiting up to timeoutMs for some while the target is halted.
+        //Hosts call it in place of running frames while isHalted()
+        void poll(int timeoutMs);
+        //Runs the rest of the current frame unless the target is halted. True when a
+        //frame finished, i.e. its instructions ran and the timers ticked
+        bool runFrame();
+
+        //The target starts halted, waiting for a debugger to attach. Detaching lets it run
+        bool isHalted() const { return halted; }
+        bool isConnected() const { return clientFd >= 0; }
+        //The debugger sent a kill request
+        bool wasKilled() const { return killed; }
+};
+
+
+#endif
@@ -0,0 +1,854 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <initializer_list>
+
+#include "Jit.h"
+
+#if CHIP8_JIT_NATIVE
+#include <sys/mman.h>
+#endif
+
+/*
+Register usage in generated code:
+rbx - Chip8 instance, memory, timers and the stack are displacements off it
+rbp - entry table, the native code for every address
+r12 - cycles left in the run, each block takes its length off on entry
+r13 - I, for the whole run
+rsi, rdi, rdx, r8-r11, r14, r15 - V registers a block has used, loaded on first
+use and written back before the block is left
+eax - address being jumped to whenever control moves between blocks
+al, cl - scratch for the current opcode
+Control only ever moves between blocks through the entry table, with the
+address in eax. Addresses without code, and blocks the cycles left can't
+cover, lead to the exit stub, which stores PC and I and returns to the host
+with the cycles left. A call back into C++ writes the V registers back first,
+since most of the host registers they live in are caller-saved. Opcodes that
+aren't translated end their block with a call into the interpreter for just
+that opcode, after which the block moves on from the PC it left.
+*/
+
+namespace{
+
+enum HostReg{ RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+//Condition codes, added to 0x70 for rel8 jumps and to 0x80 or 0x90 after 0x0F for rel32 jumps and setcc
+enum Cond : uint8_t{ CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7 };
+
+struct Emitter{
+    uint8_t *buffer;
+    size_t size;
+    size_t used;
+    bool overflow;
+
+    void byte(uint8_t b){
+        if(used < size)
+            buffer[used++] = b;
+        else
+            overflow = true;
+    }
+
+    void bytes(std::initializer_list<uint8_t> list){
+        for(uint8_t b : list)
+            byte(b);
+    }
+
+    void imm16(uint16_t v){
+        byte(v & 0xFF);
+        byte(v >> 8);
+    }
+
+    void imm32(uint32_t v){
+        for(int i = 0; i < 4; i++)
+            byte((v >> (i * 8)) & 0xFF);
+    }
+
+    void imm64(uint64_t v){
+        for(int i = 0; i < 8; i++)
+            byte((v >> (i * 8)) & 0xFF);
+    }
+
+    //Byte operations always get a REX prefix, so sil and dil can be used
+    void rex(int reg, int index, int base){
+        byte(0x40 | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3));
+    }
+
+    void modrm(int mod, int reg, int rm){
+        byte((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    //ModRM for [rbx + disp32] with reg as the register operand
+    void mem(int reg, int32_t disp){
+        modrm(2, reg, RBX);
+        imm32((uint32_t)disp);
+    }
+
+    //ModRM and SIB for [rbx + index * (1 << scale) + disp32]
+    void memIndexed(int reg, int index, int scale, int32_t disp){
+        modrm(2, reg, 4);
+        byte((scale << 6) | ((index & 7) << 3) | RBX);
+        imm32((uint32_t)disp);
+    }
+
+    //op r/m8, r8. op is add 00, or 08, and 20, sub 28, xor 30, cmp 38 or mov 88
+    void op8(uint8_t op, int dst, int src){ rex(src, 0, dst); byte(op); modrm(3, src, dst); }
+    //op r/m8, imm8. ext is add 0, and 4 or cmp 7
+    void op8Imm(int ext, int dst, uint8_t v){ rex(0, 0, dst); byte(0x80); modrm(3, ext, dst); byte(v); }
+    void movImm8(int dst, uint8_t v){ rex(0, 0, dst); byte(0xB0 | (dst & 7)); byte(v); }
+    void shl1(int dst){ rex(0, 0, dst); byte(0xD0); modrm(3, 4, dst); }
+    void shr1(int dst){ rex(0, 0, dst); byte(0xD0); modrm(3, 5, dst); }
+    void shrImm(int dst, uint8_t v){ rex(0, 0, dst); byte(0xC0); modrm(3, 5, dst); byte(v); }
+    void setcc(Cond cc, int dst){ rex(0, 0, dst); bytes({0x0F, (uint8_t)(0x90 | cc)}); modrm(3, 0, dst); }
+    void movzx8(int dst, int src){ rex(dst, 0, src); bytes({0x0F, 0xB6}); modrm(3, dst, src); } //movzx dst32, src8
+    void load8(int dst, int32_t d){ rex(dst, 0, 0); bytes({0x0F, 0xB6}); mem(dst, d); } //movzx dst32, byte [rbx+d]
+    void store8(int32_t d, int src){ rex(src, 0, 0); byte(0x88); mem(src, d); } //mov [rbx+d], src8
+    void storeImm8AtAx(int32_t d, uint8_t v){ byte(0xC6); memIndexed(0, RAX, 0, d); byte(v); } //mov byte [rbx+rax+d], imm8
+
+    //I lives in r13 and never goes past 0xFFFF
+    void movIImm(uint16_t v){ bytes({0x41, 0xBD}); imm32(v); } //mov r13d, imm32
+    void addIAx(){ bytes({0x66, 0x41, 0x01, 0xC5}); } //add r13w, ax
+    void movIEax(){ bytes({0x41, 0x89, 0xC5}); } //mov r13d, eax
+    void cmpIImm(uint32_t v){ bytes({0x41, 0x81, 0xFD}); imm32(v); } //cmp r13d, imm32
+    void loadAtI(int dst, int32_t d){ rex(dst, R13, 0); bytes({0x0F, 0xB6}); memIndexed(dst, R13, 0, d); } //movzx dst32, byte [rbx+r13+d]
+    void storeAtI(int32_t d, int src){ rex(src, R13, 0); byte(0x88); memIndexed(src, R13, 0, d); } //mov [rbx+r13+d], src8
+    //or eax, dword [rbp+r13+d] and or al, byte [rbp+r13+d], for tables kept next to the entry table
+    void orTable32(int32_t d){ bytes({0x42, 0x0B, 0x84, 0x2D}); imm32((uint32_t)d); }
+    void orTable8(int32_t d){ bytes({0x42, 0x0A, 0x84, 0x2D}); imm32((uint32_t)d); }
+
+    //The cycles left, in r12
+    void cmpBudget(uint8_t v){ bytes({0x49, 0x83, 0xFC, v}); }
+    void subBudget(uint8_t v){ bytes({0x49, 0x83, 0xEC, v}); }
+    void addBudget(uint8_t v){ bytes({0x49, 0x83, 0xC4, v}); }
+
+    //Jumps to an offset in the buffer
+    void jccTo(Cond cc, size_t target){ bytes({0x0F, (uint8_t)(0x80 | cc)}); imm32((uint32_t)(target - (used + 4))); }
+    void jmpTo(size_t target){ byte(0xE9); imm32((uint32_t)(target - (used + 4))); }
+    //Forward jumps, returning where the displacement goes once the target is known
+    size_t jcc8(Cond cc){ bytes({(uint8_t)(0x70 | cc), 0}); return used - 1; }
+    size_t jcc32(Cond cc){ bytes({0x0F, (uint8_t)(0x80 | cc)}); imm32(0); return used - 4; }
+    void bind8(size_t at){
+        if(at < size)
+            buffer[at] = (uint8_t)(used - (at + 1));
+    }
+    void bind32(size_t at){
+        uint32_t rel = (uint32_t)(used - (at + 4));
+        for(size_t i = 0; i < 4 && at + i < size; i++)
+            buffer[at + i] = (rel >> (i * 8)) & 0xFF;
+    }
+
+    //Moves on to the block at a fixed address, or at the address in eax
+    void dispatch(uint16_t address){
+        byte(0xB8); //mov eax, imm32
+        imm32(address);
+        bytes({0xFF, 0xA5}); //jmp [rbp+disp32]
+        imm32(address * (uint32_t)sizeof(void*));
+    }
+    void dispatchEax(){ bytes({0xFF, 0x64, 0xC5, 0x00}); } //jmp [rbp+rax*8]
+
+    //Division by 10 as a multiply, exact below 1029. subEcx10 leaves eax - ecx * 10 in eax
+    void divEcx10(){ bytes({0x69, 0xC8}); imm32(205); bytes({0xC1, 0xE9, 0x0B}); } //imul ecx, eax, 205; shr ecx, 11
+    void divEax10(){ bytes({0x69, 0xC0}); imm32(205); bytes({0xC1, 0xE8, 0x0B}); } //imul eax, eax, 205; shr eax, 11
+    void subEcx10(){ bytes({0x8D, 0x0C, 0x89, 0x01, 0xC9, 0x29, 0xC8}); } //lea ecx, [rcx+rcx*4]; add ecx, ecx; sub eax, ecx
+
+    //fn(c, operands). The stack is 16-byte aligned in generated code
+    void call(const void *fn, uint32_t operands){
+        bytes({0x48, 0x89, 0xDF}); //mov rdi, rbx
+        byte(0xBE); //mov esi, imm32
+        imm32(operands);
+        callRax(fn);
+    }
+
+    //fn(object, cycles left)
+    void callWithBudget(const void *fn, const void *object){
+        bytes({0x48, 0xBF}); //mov rdi, imm64
+        imm64((uint64_t)(uintptr_t)object);
+        bytes({0x4C, 0x89, 0xE6}); //mov rsi, r12
+        callRax(fn);
+    }
+
+    void callRax(const void *fn){
+        bytes({0x48, 0xB8}); //mov rax, imm64
+        imm64((uint64_t)(uintptr_t)fn);
+        bytes({0xFF, 0xD0}); //call rax
+    }
+};
+
+//V registers a block has used, held in host registers until the block is left
+struct RegisterCache{
+    static const int COUNT = 9;
+
+    Emitter &e;
+    int32_t offV;
+    int8_t slot[16]; //Host register slot holding each V, -1 while it's only in memory
+    bool dirty[16];
+    int8_t owner[COUNT]; //V held in each slot, -1 when free
+    uint32_t lastUse[COUNT];
+    uint32_t clock;
+
+    static int host(int slot){
+        static const int HOSTS[COUNT] = { RSI, RDI, RDX, R8, R9, R10, R11, R14, R15 };
+        return HOSTS[slot];
+    }
+
+    RegisterCache(Emitter &e, int32_t offV) : e(e), offV(offV){
+        memset(slot, -1, sizeof(slot));
+        memset(dirty, 0, sizeof(dirty));
+        memset(owner, -1, sizeof(owner));
+        memset(lastUse, 0, sizeof(lastUse));
+        clock = 0;
+    }
+
+    void spill(int v){
+        int s = slot[v];
+        if(dirty[v])
+            e.store8(offV + v, host(s));
+        owner[s] = -1;
+        slot[v] = -1;
+        dirty[v] = false;
+    }
+
+    //Host register holding V[v], loaded from memory when load is set. The least recently used one is evicted
+    int get(int v, bool load = true){
+        if(slot[v] < 0){
+            int s = -1;
+            for(int i = 0; i < COUNT && s < 0; i++)
+                if(owner[i] < 0)
+                    s = i;
+            if(s < 0){
+                s = 0;
+                for(int i = 1; i < COUNT; i++)
+                    if(lastUse[i] < lastUse[s])
+                        s = i;
+                spill(owner[s]);
+            }
+            owner[s] = (int8_t)v;
+            slot[v] = (int8_t)s;
+            if(load)
+                e.load8(host(s), offV + v);
+        }
+        lastUse[slot[v]] = ++clock;
+        return host(slot[v]);
+    }
+
+    //Host register for a V about to be overwritten
+    int set(int v){
+        int reg = get(v, false);
+        dirty[v] = true;
+        return reg;
+    }
+
+    //Host register for a V about to be updated in place
+    int modify(int v){
+        int reg = get(v);
+        dirty[v] = true;
+        return reg;
+    }
+
+    //Writes back every changed V and forgets them all
+    void flush(){
+        for(int v = 0; v < 16; v++)
+            if(slot[v] >= 0)
+                spill(v);
+    }
+};
+
+//A way out of the middle of a block back to the host, at pc. refund is the
+//opcodes of the block from pc on, which never ran
+struct SideExit{
+    size_t jump;
+    uint16_t pc;
+    uint8_t refund;
+    int dirtyCount;
+    uint8_t dirtyV[16];
+    uint8_t dirtyHost[16];
+};
+
+//Opcodes translated in line, some of them as calls
+bool straightLine(uint8_t op){
+    switch(op){
+        case OP_LOAD_IMM: case OP_ADD_IMM: case OP_MOVE: case OP_OR: case OP_AND: case OP_XOR:
+        case OP_ADD: case OP_SUB: case OP_SHR: case OP_SUBN: case OP_SHL:
+        case OP_LOAD_I: case OP_ADD_I: case OP_FONT: case OP_RAND:
+        case OP_GET_DELAY: case OP_SET_DELAY: case OP_LOAD: case OP_DRAW: case OP_CLS:
+        case OP_BCD: case OP_STORE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+//Control flow translated into a jump straight to the next block
+bool nativeTerminator(uint8_t op){
+    switch(op){
+        case OP_JUMP: case OP_CALL: case OP_RET: case OP_JUMP_V0:
+        case OP_SKIP_EQ_IMM: case OP_SKIP_NE_IMM: case OP_SKIP_EQ_REG: case OP_SKIP_NE_REG:
+        case OP_SKIP_KEY: case OP_SKIP_NOT_KEY:
+            return true;
+        default:
+            return false;
+    }
+}
+
+}
+
+Chip8Jit::Chip8Jit(Chip8 &chip) : chip(chip){
+    code = nullptr;
+    codeSize = 0;
+    codeUsed = 0;
+    exitStub = 0;
+    enterStub = 0;
+    stubsSize = 0;
+    differential = false;
+    shadow = nullptr;
+    diverged = false;
+    divergedPC = 0;
+    clockedCycles = 0;
+
+#if CHIP8_JIT_NATIVE
+    size_t size = 1 << 20;
+    void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mapping != MAP_FAILED){
+        code = (uint8_t*)mapping;
+        codeSize = size;
+        emitStubs();
+    }
+#endif
+
+    flush();
+}
+
+Chip8Jit::~Chip8Jit(){
+#if CHIP8_JIT_NATIVE
+    if(code)
+        munmap(code, codeSize);
+#endif
+    delete shadow;
+}
+
+bool Chip8Jit::supported(){
+    return CHIP8_JIT_NATIVE != 0;
+}
+
+//The ways into and out of generated code, at the start of the buffer where flushes leave them
+void Chip8Jit::emitStubs(){
+    Emitter e = { code, codeSize, 0, false };
+    int32_t offI = (int32_t)((uint8_t*)&chip.I - (uint8_t*)&chip);
+    int32_t offPC = (int32_t)((uint8_t*)&chip.PC - (uint8_t*)&chip);
+
+    //Stores PC from eax and I, and returns the cycles left
+    exitStub = e.used;
+    e.bytes({0x66, 0x89, 0x83}); e.imm32(offPC); //mov [rbx+PC], ax
+    e.bytes({0x66, 0x44, 0x89, 0xAB}); e.imm32(offI); //mov [rbx+I], r13w
+    e.bytes({0x4C, 0x89, 0xE0}); //mov rax, r12
+    e.bytes({0x48, 0x83, 0xC4, 0x08}); //add rsp, 8
+    e.bytes({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3}); //pop r15-r12, rbp, rbx; ret
+
+    //uint64_t enter(Chip8 *c, const uint8_t **entries, uint64_t cycles, uint32_t pc)
+    enterStub = e.used;
+    e.bytes({0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57}); //push rbx, rbp, r12-r15
+    e.bytes({0x48, 0x83, 0xEC, 0x08}); //sub rsp, 8
+    e.bytes({0x48, 0x89, 0xFB}); //mov rbx, rdi
+    e.bytes({0x48, 0x89, 0xF5}); //mov rbp, rsi
+    e.bytes({0x49, 0x89, 0xD4}); //mov r12, rdx
+    e.bytes({0x44, 0x0F, 0xB7, 0xAB}); e.imm32(offI); //movzx r13d, word [rbx+I]
+    e.bytes({0x89, 0xC8}); //mov eax, ecx
+    e.dispatchEax();
+
+    stubsSize = e.used;
+}
+
+void Chip8Jit::flush(){
+    for(int i = 0; i < 0x1000; i++){
+        blocks[i].offset = NO_BLOCK;
+        blocks[i].length = 0;
+        entries[i] = code + exitStub;
+    }
+    memset(covered, 0, sizeof(covered));
+    memset(rewrites, 0, sizeof(rewrites));
+    codeUsed = stubsSize;
+    seenWrites = chip.writeCount;
+}
+
+void Chip8Jit::setDifferential(bool enabled){
+    differential = enabled;
+    diverged = false;
+    if(!enabled)
+        return;
+    //A machine of its own restored from the real one. It only checks the real instance, so it
+    //has no profiler, beeper or breakpoints of its own
+    if(!shadow)
+        shadow = new Chip8();
+    if(shadow->getPlatform() != chip.getPlatform())
+        shadow->setPlatform(chip.getPlatform());
+    shadow->setQuirks(chip.quirks);
+    shadow->restore(chip);
+}
+
+//CXNN is called out to rather than inlined, operands packs X in the high byte and NN in the low one
+void Chip8Jit::callRandom(Chip8 *c, uint32_t operands){
+    c->V[operands >> 8] = c->nextRandom() & (operands & 0xFF);
+}
+
+//DXYN, operands packs X, Y and N in its low three nibbles. I has been checked against the end of memory
+void Chip8Jit::callDraw(Chip8 *c, uint32_t operands){
+    c->V[0xF] = c->drawSprite<false>(c->V[operands >> 8], c->V[(operands >> 4) & 0xF], operands & 0xF) ? 1 : 0;
+    c->drawFlag = true;
+}
+
+void Chip8Jit::callClear(Chip8 *c, uint32_t){
+    memset(c->display, 0, sizeof(c->display));
+    c->markDirty(0, 0, 64, 32);
+}
+
+//Runs the opcode at PC for a block that couldn't translate it. Returns 0, leaving the
+//cycle unspent, if it didn't run, which is only ever because it faulted
+uint64_t Chip8Jit::callInterpreter(Chip8Jit *jit, uint64_t cycles){
+    //The block's cycles were all taken on entry, so the clock is brought up to this
+    //opcode for beeper edges, and cycles counts it as already spent
+    Chip8 &chip = jit->chip;
+    chip.instructionClock += jit->clockedCycles - (cycles + 1);
+    jit->clockedCycles = cycles + 1;
+    uint16_t pc = chip.PC;
+    uint64_t executed = chip.run(1);
+    jit->clockedCycles -= executed;
+    //FX0A with no key down would only come back here for every cycle left, so like
+    //the interpreter it spends them all at once and reports the wait as idle. The
+    //clock catches up with them when the run exits
+    if(executed == 1 && chip.PC == pc && chip.decoded[pc & 0xFFF].op == OP_WAIT_KEY){
+        chip.idleInstructions += cycles;
+        chip.idle = chip.delayTimer == 0 && chip.soundTimer == 0;
+        executed += cycles;
+    }
+    //Only loading a state or a ROM writes enough to flush the cache, so the code
+    //this returns to stays put, even if its block has been dropped
+    jit->checkWrites();
+    return executed;
+}
+
+//Drops the blocks whose translated bytes overlap memory written since the last check
+void Chip8Jit::checkWrites(){
+    if(chip.writeCount == seenWrites)
+        return;
+    seenWrites = chip.writeCount;
+
+    int first = chip.lastWriteAddress - 1;
+    int last = chip.lastWriteAddress + chip.lastWriteLength - 1;
+    if(last - first >= 0x1000){
+        flush();
+        return;
+    }
+
+    //Most writes are to data, which never made it into a block
+    bool hit = false;
+    for(int i = first; i <= last && !hit; i++)
+        hit = covered[i & 0xFFF];
+    if(!hit)
+        return;
+
+    //A block covering the range starts at most MAX_BLOCK opcodes and a terminator before it
+    for(int start = first - (MAX_BLOCK + 1) * 2; start <= last; start++){
+        Block &block = blocks[start & 0xFFF];
+        if(block.offset == NO_BLOCK)
+            continue;
+        if(start + block.length * 2 > first){
+            block.offset = NO_BLOCK;
+            entries[start & 0xFFF] = code + exitStub;
+            if(rewrites[start & 0xFFF] < 0xFF)
+                rewrites[start & 0xFFF]++;
+        }
+    }
+}
+
+Chip8Jit::Block &Chip8Jit::lookup(uint16_t address){
+    Block &block = blocks[address];
+    if(block.offset == NO_BLOCK && !compile(address, block)){
+        //Out of code space, start over with an empty cache
+        flush();
+        compile(address, block);
+    }
+    return block;
+}
+
+bool Chip8Jit::compile(uint16_t address, Block &block){
+    block.length = 0;
+    block.offset = NO_CODE;
+    //Code that keeps rewriting itself is cheaper to leave to the interpreter
+    if(!code || rewrites[address] >= MAX_REWRITES)
+        return true;
+
+    //The block's extent comes first, since its length is checked against the cycles left on entry.
+    //A translated terminator needs its return address and both sides of a skip inside the address
+    //space, anything else ending the block is interpreted
+    int length = 0;
+    uint16_t pc = address;
+    while(length < MAX_BLOCK && pc + 2 <= 0xFFF){
+        if(chip.decoded[pc].op == OP_DECODE)
+            chip.decodeAt(pc);
+        if(!straightLine(chip.decoded[pc].op))
+            break;
+        length++;
+        pc += 2;
+    }
+    bool terminated = length < MAX_BLOCK;
+    bool interpreted = false;
+    if(terminated){
+        if(chip.decoded[pc].op == OP_DECODE)
+            chip.decodeAt(pc);
+        interpreted = !nativeTerminator(chip.decoded[pc].op) || pc + 4 > 0xFFF;
+        length++;
+    }
+
+    Emitter e = { code, codeSize, codeUsed, false };
+    int32_t offV = (int32_t)((uint8_t*)chip.V - (uint8_t*)&chip);
+    int32_t offI = (int32_t)((uint8_t*)&chip.I - (uint8_t*)&chip);
+    int32_t offPC = (int32_t)((uint8_t*)&chip.PC - (uint8_t*)&chip);
+    int32_t offMemory = (int32_t)((uint8_t*)chip.memory - (uint8_t*)&chip);
+    int32_t offStack = (int32_t)((uint8_t*)chip.stack - (uint8_t*)&chip);
+    int32_t offSP = (int32_t)((uint8_t*)&chip.SP - (uint8_t*)&chip);
+    int32_t offDelay = (int32_t)((uint8_t*)&chip.delayTimer - (uint8_t*)&chip);
+    int32_t offKey = (int32_t)((uint8_t*)chip.key - (uint8_t*)&chip);
+    int32_t offDecoded = (int32_t)((uint8_t*)chip.decoded - (uint8_t*)&chip + offsetof(Chip8Instr, op));
+    int32_t offWriteCount = (int32_t)((uint8_t*)&chip.writeCount - (uint8_t*)&chip);
+    int32_t offWriteAddress = (int32_t)((uint8_t*)&chip.lastWriteAddress - (uint8_t*)&chip);
+    int32_t offWriteLength = (int32_t)((uint8_t*)&chip.lastWriteLength - (uint8_t*)&chip);
+    int32_t offCovered = (int32_t)(covered - (const uint8_t*)entries); //Off rbp
+    RegisterCache regs(e, offV);
+    SideExit exits[(MAX_BLOCK + 1) * 2]; //Two at most for each opcode
+    int exitCount = 0;
+
+    //Leaves for the interpreter at pc when cc holds, writing back the registers changed so far
+    auto sideExit = [&](Cond cc, uint16_t pc, int refund){
+        SideExit &exit = exits[exitCount++];
+        exit.jump = e.jcc32(cc);
+        exit.pc = pc;
+        exit.refund = (uint8_t)refund;
+        exit.dirtyCount = 0;
+        for(int v = 0; v < 16; v++){
+            if(regs.slot[v] >= 0 && regs.dirty[v]){
+                exit.dirtyV[exit.dirtyCount] = (uint8_t)v;
+                exit.dirtyHost[exit.dirtyCount++] = (uint8_t)RegisterCache::host(regs.slot[v]);
+            }
+        }
+    };
+
+    //Skips go on to pc + 2, or to pc + 4 when taken holds
+    auto skip = [&](Cond taken, uint16_t pc){
+        size_t over = e.jcc8(taken);
+        e.dispatch(pc + 2);
+        e.bind8(over);
+        e.dispatch(pc + 4);
+    };
+
+    //eax holds the address on entry, which is where the exit stub wants it when the cycles run short
+    e.cmpBudget((uint8_t)length);
+    e.jccTo(CC_B, exitStub);
+    e.subBudget((uint8_t)length);
+
+    pc = address;
+    for(int i = 0; i < length; i++, pc += 2){
+        const Chip8Instr &in = chip.decoded[pc];
+        if(interpreted && i == length - 1){
+            //Run by the interpreter from the instance, then on to wherever it left PC
+            regs.flush();
+            e.bytes({0x66, 0x44, 0x89, 0xAB}); e.imm32(offI); //mov [rbx+I], r13w
+            e.bytes({0x66, 0xC7, 0x83}); e.imm32(offPC); e.imm16(pc); //mov word [rbx+PC], imm16
+            e.callWithBudget((const void*)&Chip8Jit::callInterpreter, this);
+            e.bytes({0x44, 0x0F, 0xB7, 0xAB}); e.imm32(offI); //movzx r13d, word [rbx+I]
+            e.bytes({0x48, 0x85, 0xC0}); //test rax, rax
+            sideExit(CC_E, pc, 1);
+            //The block already took the one cycle off, anything past it was skipped over
+            e.addBudget(1);
+            e.bytes({0x49, 0x29, 0xC4}); //sub r12, rax
+            e.bytes({0x0F, 0xB7, 0x83}); e.imm32(offPC); //movzx eax, word [rbx+PC]
+            e.dispatchEax();
+            break;
+        }
+        switch(in.op){
+            case OP_LOAD_IMM: e.movImm8(regs.set(in.x), in.nn); break;
+            case OP_ADD_IMM: e.op8Imm(0, regs.modify(in.x), in.nn); break;
+            case OP_MOVE:{
+                int y = regs.get(in.y);
+                if(in.x != in.y)
+                    e.op8(0x88, regs.set(in.x), y);
+                break;
+            }
+            case OP_OR: case OP_AND: case OP_XOR:{
+                int y = regs.get(in.y);
+                e.op8(in.op == OP_OR ? 0x08 : in.op == OP_AND ? 0x20 : 0x30, regs.modify(in.x), y);
+                break;
+            }
+            case OP_ADD: //Sum and carry come from the old values, VF is written before Vx
+                e.op8(0x88, RAX, regs.get(in.x)); e.op8(0x00, RAX, regs.get(in.y)); e.setcc(CC_B, RCX);
+                e.op8(0x88, regs.set(0xF), RCX); e.op8(0x88, regs.set(in.x), RAX);
+                break;
+            //The remaining flag opcodes reread their operands after writing VF, as the interpreter does
+            case OP_SUB:
+                e.op8(0x88, RAX, regs.get(in.x)); e.op8(0x38, RAX, regs.get(in.y)); e.setcc(CC_A, RCX);
+                e.op8(0x88, regs.set(0xF), RCX);
+                e.op8(0x88, RAX, regs.get(in.x)); e.op8(0x28, RAX, regs.get(in.y)); e.op8(0x88, regs.set(in.x), RAX);
+                break;
+            case OP_SHR:
+                e.op8(0x88, RAX, regs.get(in.x)); e.op8Imm(4, RAX, 1); e.op8(0x88, regs.set(0xF), RAX);
+                e.shr1(regs.modify(in.x));
+                break;
+            case OP_SUBN:
+                e.op8(0x88, RAX, regs.get(in.y)); e.op8(0x38, RAX, regs.get(in.x)); e.setcc(CC_A, RCX);
+                e.op8(0x88, regs.set(0xF), RCX);
+                e.op8(0x88, RAX, regs.get(in.y)); e.op8(0x28, RAX, regs.get(in.x)); e.op8(0x88, regs.set(in.x), RAX);
+                break;
+            case OP_SHL:
+                e.op8(0x88, RAX, regs.get(in.x)); e.shrImm(RAX, 7); e.op8(0x88, regs.set(0xF), RAX);
+                e.shl1(regs.modify(in.x));
+                break;
+            case OP_LOAD_I: e.movIImm(in.nnn); break;
+            case OP_ADD_I: e.movzx8(RAX, regs.get(in.x)); e.addIAx(); break;
+            case OP_FONT: e.movzx8(RAX, regs.get(in.x)); e.bytes({0x8D, 0x04, 0x80}); e.movIEax(); break; //lea eax, [rax+rax*4]
+            case OP_GET_DELAY: e.load8(regs.set(in.x), offDelay); break;
+            case OP_SET_DELAY: e.store8(offDelay, regs.get(in.x)); break;
+            case OP_RAND:
+                regs.flush();
+                e.call((const void*)&Chip8Jit::callRandom, (uint32_t)in.x << 8 | in.nn);
+                break;
+            case OP_LOAD: //I stays put under the modern profile. A read past the end faults in the interpreter
+                e.cmpIImm(0xFFF - in.x);
+                sideExit(CC_A, pc, length - i);
+                for(int v = 0; v <= in.x; v++)
+                    e.loadAtI(regs.set(v), offMemory + v);
+                break;
+            case OP_DRAW: //So does a sprite reaching past the end
+                e.cmpIImm(0x1000 - in.n);
+                sideExit(CC_A, pc, length - i);
+                regs.flush();
+                e.bytes({0x66, 0x44, 0x89, 0xAB}); e.imm32(offI); //mov [rbx+I], r13w
+                e.call((const void*)&Chip8Jit::callDraw, (uint32_t)in.x << 8 | in.y << 4 | in.n);
+                break;
+            case OP_CLS:
+                regs.flush();
+                e.call((const void*)&Chip8Jit::callClear, 0);
+                break;
+            case OP_BCD: case OP_STORE:{
+                //Writing from I - 1 on keeps the decoded entry before I inside memory, and I = 0 to the interpreter
+                int written = in.op == OP_BCD ? 3 : in.x + 1;
+                e.bytes({0x41, 0x8D, 0x45, 0xFF}); //lea eax, [r13-1]
+                e.byte(0x3D); e.imm32(0xFFF - written); //cmp eax, imm32
+                sideExit(CC_A, pc, length - i);
+                if(in.op == OP_BCD){
+                    int x = regs.get(in.x);
+                    e.movzx8(RAX, x); e.divEcx10(); e.subEcx10(); e.storeAtI(offMemory + 2, RAX);
+                    e.movzx8(RAX, x); e.divEax10(); e.divEcx10(); e.storeAtI(offMemory, RCX);
+                    e.subEcx10(); e.storeAtI(offMemory + 1, RAX);
+                }
+                else{
+                    for(int v = 0; v <= in.x; v++)
+                        e.storeAtI(offMemory + v, regs.get(v));
+                }
+
+                //Chip8::invalidateDecoded, minus the watchpoints, which keep the JIT out
+                e.bytes({0x41, 0x69, 0xC5}); e.imm32(sizeof(Chip8Instr)); //imul eax, r13d, imm32
+                for(int b = -1; b < written; b++)
+                    e.storeImm8AtAx(offDecoded + b * (int32_t)sizeof(Chip8Instr), OP_DECODE);
+                e.bytes({0xFF, 0x83}); e.imm32(offWriteCount); //inc dword [rbx+writeCount]
+                e.bytes({0x66, 0x44, 0x89, 0xAB}); e.imm32(offWriteAddress); //mov [rbx+lastWriteAddress], r13w
+                e.bytes({0x66, 0xC7, 0x83}); e.imm32(offWriteLength); e.imm16(written); //mov word [rbx+lastWriteLength], imm16
+
+                //A write over translated code leaves for the host, which drops the blocks it reached,
+                //maybe this one. Everything up to and including the write has run
+                e.bytes({0x31, 0xC0}); //xor eax, eax
+                for(int b = -1; b < written; ){
+                    if(written - b >= 4){
+                        e.orTable32(offCovered + b);
+                        b += 4;
+                    }
+                    else{
+                        e.orTable8(offCovered + b);
+                        b++;
+                    }
+                }
+                e.bytes({0x85, 0xC0}); //test eax, eax
+                sideExit(CC_NE, pc + 2, length - i - 1);
+                break;
+            }
+
+            //Terminators. Whatever would fault is left to the interpreter
+            case OP_JUMP:
+                regs.flush();
+                e.dispatch(in.nnn);
+                break;
+            case OP_CALL:
+                regs.flush();
+                e.bytes({0x66, 0x83, 0xBB}); e.imm32(offSP); e.byte(16); //cmp word [rbx+SP], 16
+                sideExit(CC_AE, pc, 1);
+                e.bytes({0x0F, 0xB7, 0x83}); e.imm32(offSP); //movzx eax, word [rbx+SP]
+                e.bytes({0x66, 0xC7, 0x84, 0x43}); e.imm32(offStack); e.imm16(pc + 2); //mov word [rbx+rax*2+stack], imm16
+                e.bytes({0x66, 0xFF, 0x83}); e.imm32(offSP); //inc word [rbx+SP]
+                e.dispatch(in.nnn);
+                break;
+            case OP_RET: //Return addresses past the end are left to the interpreter too
+                regs.flush();
+                e.bytes({0x0F, 0xB7, 0x83}); e.imm32(offSP); //movzx eax, word [rbx+SP]
+                e.bytes({0xFF, 0xC8, 0x83, 0xF8, 0x0F}); //dec eax; cmp eax, 15
+                sideExit(CC_A, pc, 1);
+                e.bytes({0x0F, 0xB7, 0x8C, 0x43}); e.imm32(offStack); //movzx ecx, word [rbx+rax*2+stack]
+                e.bytes({0x81, 0xF9}); e.imm32(0xFFF); //cmp ecx, 0xFFF
+                sideExit(CC_A, pc, 1);
+                e.bytes({0x66, 0x89, 0x83}); e.imm32(offSP); //mov [rbx+SP], ax
+                e.bytes({0x89, 0xC8}); //mov eax, ecx
+                e.dispatchEax();
+                break;
+            case OP_JUMP_V0:
+                e.movzx8(RAX, regs.get(0));
+                regs.flush();
+                e.byte(0x05); e.imm32(in.nnn); //add eax, imm32
+                e.byte(0x3D); e.imm32(0xFFF); //cmp eax, 0xFFF
+                sideExit(CC_A, pc, 1);
+                e.dispatchEax();
+                break;
+            case OP_SKIP_EQ_IMM: case OP_SKIP_NE_IMM:{
+                int x = regs.get(in.x);
+                regs.flush();
+                e.op8Imm(7, x, in.nn);
+                skip(in.op == OP_SKIP_EQ_IMM ? CC_E : CC_NE, pc);
+                break;
+            }
+            case OP_SKIP_EQ_REG: case OP_SKIP_NE_REG:{
+                int x = regs.get(in.x);
+                int y = regs.get(in.y);
+                regs.flush();
+                e.op8(0x38, x, y);
+                skip(in.op == OP_SKIP_EQ_REG ? CC_E : CC_NE, pc);
+                break;
+            }
+            case OP_SKIP_KEY: case OP_SKIP_NOT_KEY:
+                e.movzx8(RAX, regs.get(in.x));
+                regs.flush();
+                e.bytes({0x83, 0xF8, 0x0F}); //cmp eax, 15
+                sideExit(CC_A, pc, 1);
+                e.bytes({0x80, 0xBC, 0x03}); e.imm32(offKey); e.byte(0); //cmp byte [rbx+rax+key], 0
+                skip(in.op == OP_SKIP_KEY ? CC_NE : CC_E, pc);
+                break;
+        }
+    }
+
+    //A block cut short by its length goes on to the next one
+    if(!terminated){
+        regs.flush();
+        e.dispatch(pc);
+    }
+
+    for(int i = 0; i < exitCount; i++){
+        const SideExit &exit = exits[i];
+        e.bind32(exit.jump);
+        for(int j = 0; j < exit.dirtyCount; j++)
+            e.store8(offV + exit.dirtyV[j], exit.dirtyHost[j]);
+        e.addBudget(exit.refund);
+        e.byte(0xB8); //mov eax, imm32
+        e.imm32(exit.pc);
+        e.jmpTo(exitStub);
+    }
+
+    if(e.overflow)
+        return false;
+
+    block.offset = (uint32_t)codeUsed;
+    block.length = (uint8_t)length;
+    entries[address] = code + codeUsed;
+    codeUsed = e.used;
+    for(int i = 0; i < length * 2; i++)
+        covered[(address + i) & 0xFFF] = 1;
+    return true;
+}
+
+//Runs native code from PC for up to budget cycles, following blocks into each other,
+//or interprets up to the next block when there's no code to run
+uint64_t Chip8Jit::step(uint64_t budget){
+    Block &block = lookup(chip.PC & 0xFFF);
+
+    uint64_t executed = 0;
+    bool native = block.offset != NO_CODE && block.length <= budget;
+#if CHIP8_JIT_NATIVE
+    if(native){
+        //Differential mode stops after one block, so the shadow can check it
+        typedef uint64_t (*EnterFn)(Chip8 *c, const uint8_t **entries, uint64_t cycles, uint32_t pc);
+        EnterFn enter = (EnterFn)(void*)(code + enterStub);
+        uint64_t cycles = differential ? block.length : budget;
+        clockedCycles = cycles;
+        uint64_t left = enter(&chip, entries, cycles, chip.PC & 0xFFF);
+        executed = cycles - left;
+        chip.instructionClock += clockedCycles - left;
+    }
+#endif
+    //A block that left before its first opcode found something only the interpreter does, like a fault
+    if(executed == 0)
+        executed = chip.run(native || block.offset == NO_CODE ? 1 : budget);
+
+    //Interpreted opcodes can write memory too, so this has to run after either path
+    checkWrites();
+    return executed;
+}
+
+uint64_t Chip8Jit::run(uint64_t cycles){
+    //Profiles come from the interpreter, which sees every opcode
+    if(!translatable())
+        return chip.run(cycles);
+
+    checkWrites();
+
+    //As in the interpreter, idle only describes the latest run
+    chip.idle = false;
+    uint64_t executed = 0;
+    while(executed < cycles && chip.getFault() == Chip8Fault::None && !diverged){
+        if(!differential){
+            executed += step(cycles - executed);
+            continue;
+        }
+
+        //Each side has its own generator, so the shadow only needs the keys
+        uint16_t startPC = chip.PC;
+        memcpy(shadow->key, chip.key, sizeof(chip.key));
+        uint64_t count = step(cycles - executed);
+        shadow->run(count);
+        //A faulting terminator doesn't count as executed, but the shadow still has to hit it
+        if(chip.getFault() != Chip8Fault::None)
+            shadow->run(1);
+        executed += count;
+
+        if(!compareShadow()){
+            diverged = true;
+            divergedPC = startPC;
+        }
+        if(count == 0)
+            break;
+    }
+    return executed;
+}
+
+//Same frame structure as Chip8::runFrame
+uint64_t Chip8Jit::runFrame(int instructionsPerFrame){
+    if(!translatable())
+        return chip.runFrame(instructionsPerFrame);
+    uint64_t executed = run(instructionsPerFrame);
+    if(chip.getFault() == Chip8Fault::None && !diverged){
+        chip.tickTimers();
+        if(differential)
+            shadow->tickTimers();
+    }
+    return executed;
+}
+
+bool Chip8Jit::translatable() const{
+    return code && !chip.profiler && !chip.ext && !chip.breakpointCount && !chip.watchCount &&
+        chip.getQuirks() == Chip8Quirks::Modern;
+}
+
+bool Chip8Jit::compareShadow(){
+    const Chip8 &a = chip;
+    const Chip8 &b = *shadow;
+    return memcmp(a.memory, b.memory, sizeof(a.memory)) == 0 &&
+        memcmp(a.V, b.V, sizeof(a.V)) == 0 &&
+        a.I == b.I && a.PC == b.PC && a.SP == b.SP &&
+        memcmp(a.stack, b.stack, sizeof(a.stack)) == 0 &&
+        a.delayTimer == b.delayTimer && a.soundTimer == b.soundTimer &&
+        memcmp(a.display, b.display, sizeof(a.display)) == 0 &&
+        a.rngState == b.rngState && a.fault == b.fault;
+}
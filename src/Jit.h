@@ -0,0 +1,100 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Chip8.h"
+
+//Native code generation is only implemented for x86-64 on systems with mmap
+#if defined(__x86_64__) && defined(__unix__)
+#define CHIP8_JIT_NATIVE 1
+#else
+#define CHIP8_JIT_NATIVE 0
+#endif
+
+/*
+Basic-block JIT backend:
+Straight-line runs of ALU/register opcodes are translated into x86-64 and
+cached by start address. A block ends at a jump, call, return, BNNN or
+skip, which is translated too and jumps straight into the next block
+through a table of entry points. Sprites and screen clears call out to
+C++. FX33 and FX55 write memory in line, and leave for the host when they
+land on translated code, which may be the rest of their own block. The few
+opcodes left, like FX0A and FX18, end their block with a call into the
+interpreter, which then carries on from the PC it left. An FX0A still
+waiting for a key spends the rest of the run there and reports it idle,
+the same as the interpreter's wait. I stays in a host
+register for the whole run, and the V registers a block uses are kept in
+host registers until it's left, so they're only in the instance at block
+boundaries. Keys and timers can't change inside a run, so nothing is lost
+by only seeing them between runs.
+The interpreter stays the reference, and differential mode replays every
+block on a shadow Chip8 through the interpreter and compares the two states.
+*/
+class Chip8Jit{
+    private:
+        static const uint32_t NO_BLOCK = 0xFFFFFFFF;
+        static const uint32_t NO_CODE = 0xFFFFFFFE;
+        static const int MAX_BLOCK = 64; //Straight-line opcodes compiled into one block, not counting the terminator
+        static const int MAX_REWRITES = 4; //Invalidations after which an address is no longer compiled
+
+        struct Block{
+            uint32_t offset; //Start of the native code in the code buffer, NO_BLOCK if not compiled yet
+            uint8_t length; //Opcodes covered by the native code, terminator included
+        };
+
+        Chip8 &chip;
+        Block blocks[0x1000];
+        const uint8_t *entries[0x1000]; //Native code for each address, the exit stub where there's none
+        uint8_t covered[0x1000]; //Memory bytes translated into a block since the last flush
+        uint8_t rewrites[0x1000]; //Times the block at each address was invalidated by a write
+        uint32_t seenWrites;
+
+        uint8_t *code;
+        size_t codeSize;
+        size_t codeUsed;
+        size_t exitStub;
+        size_t enterStub;
+        size_t stubsSize;
+
+        bool differential;
+        Chip8 *shadow;
+        bool diverged;
+        uint16_t divergedPC;
+        uint64_t clockedCycles; //Cycles left in the current native run when the instruction clock was last brought up to date
+
+        void emitStubs();
+        Block &lookup(uint16_t address);
+        bool compile(uint16_t address, Block &block);
+        void checkWrites();
+        uint64_t step(uint64_t budget);
+        bool compareShadow();
+
+        static void callRandom(Chip8 *c, uint32_t operands);
+        static void callDraw(Chip8 *c, uint32_t operands);
+        static void callClear(Chip8 *c, uint32_t operands);
+        static uint64_t callInterpreter(Chip8Jit *jit, uint64_t cycles);
+
+    public:
+        Chip8Jit(Chip8 &chip);
+        ~Chip8Jit();
+
+        static bool supported();
+        //Whether run() translates the instance as it's set up now. Profiling, breakpoints, watchpoints,
+        //SUPER-CHIP, XO-CHIP and quirk profiles other than the modern one leave it to the interpreter
+        bool translatable() const;
+
+        //Runs up to cycles opcodes and returns how many ran, like Chip8::run
+        uint64_t run(uint64_t cycles);
+        uint64_t runFrame(int instructionsPerFrame);
+        void flush();
+
+        //Differential mode checks every block against the interpreter
+        void setDifferential(bool enabled);
+        bool hasDiverged() const { return diverged; }
+        uint16_t getDivergedPC() const { return divergedPC; }
+};
+
+
+#endif
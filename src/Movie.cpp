@@ -0,0 +1,171 @@
+#include <string.h>
+#include <fstream>
+#include <iterator>
+
+#include "Movie.h"
+
+static const uint8_t movieMagic[4] = { 'C', '8', 'M', 'V' };
+
+static void put(std::vector<uint8_t> &out, uint64_t v, int bytes){
+    for(int b = 0; b < bytes; b++)
+        out.push_back((uint8_t)(v >> (b * 8)));
+}
+
+static uint64_t get(const uint8_t *&p, int bytes){
+    uint64_t v = 0;
+    for(int b = 0; b < bytes; b++)
+        v |= (uint64_t)p[b] << (b * 8);
+    p += bytes;
+    return v;
+}
+
+Movie::Movie(){
+    seed = 0;
+    platform = Chip8Platform::Chip8;
+    quirks = Chip8Quirks::Default;
+    romHash = 0;
+    instructionsPerFrame = 0;
+    frames = 0;
+    checkpointInterval = 60;
+    lastKeys = 0;
+}
+
+void Movie::begin(const Chip8 &chip, uint64_t romHash, int instructionsPerFrame, uint32_t checkpointInterval){
+    seed = chip.getSeed();
+    platform = chip.getPlatform();
+    quirks = chip.getQuirks();
+    this->romHash = romHash;
+    this->instructionsPerFrame = (uint32_t)instructionsPerFrame;
+    this->checkpointInterval = checkpointInterval ? checkpointInterval : 1;
+    frames = 0;
+    lastKeys = 0;
+    keyChanges.clear();
+    checkpoints.clear();
+}
+
+void Movie::recordFrame(const Chip8 &chip){
+    //Keys only change between frames, so the mask now is the one the frame ran with
+    uint16_t keys = keyMask(chip);
+    if(keys != lastKeys){
+        keyChanges.push_back({ frames, keys });
+        lastKeys = keys;
+    }
+
+    frames++;
+    if(frames % checkpointInterval == 0)
+        checkpoints.push_back({ frames, chip.framebufferHash() });
+}
+
+void Movie::finish(const Chip8 &chip){
+    if(checkpoints.empty() || checkpoints.back().frame != frames)
+        checkpoints.push_back({ frames, chip.framebufferHash() });
+}
+
+bool Movie::save(const char *filePath) const{
+    std::vector<uint8_t> out;
+    out.insert(out.end(), movieMagic, movieMagic + 4);
+    put(out, VERSION, 2);
+    put(out, (uint8_t)platform, 1);
+    put(out, (uint8_t)quirks, 1);
+    put(out, seed, 8);
+    put(out, romHash, 8);
+    put(out, instructionsPerFrame, 4);
+    put(out, frames, 4);
+    put(out, keyChanges.size(), 4);
+    put(out, checkpoints.size(), 4);
+    for(const KeyChange &k : keyChanges){
+        put(out, k.frame, 4);
+        put(out, k.keys, 2);
+    }
+    for(const Checkpoint &c : checkpoints){
+        put(out, c.frame, 4);
+        put(out, c.hash, 8);
+    }
+
+    std::ofstream file(filePath, std::ios::binary);
+    if(!file.is_open())
+        return false;
+    file.write((const char*)out.data(), out.size());
+    return file.good();
+}
+
+bool Movie::load(const char *filePath){
+    std::ifstream file(filePath, std::ios::binary);
+    if(!file.is_open())
+        return false;
+    std::vector<uint8_t> in((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    const size_t headerSize = 40;
+    if(in.size() < headerSize || memcmp(in.data(), movieMagic, 4) != 0)
+        return false;
+    const uint8_t *p = in.data() + 4;
+    uint16_t version = (uint16_t)get(p, 2);
+    if(version != VERSION && version != 1)
+        return false;
+    uint8_t newPlatform = (uint8_t)get(p, 1);
+    uint8_t newQuirks = (uint8_t)get(p, 1);
+
+    uint64_t newSeed = get(p, 8);
+    uint64_t newROMHash = get(p, 8);
+    uint32_t newInstructionsPerFrame = (uint32_t)get(p, 4);
+    uint32_t newFrames = (uint32_t)get(p, 4);
+    uint64_t keyCount = get(p, 4);
+    uint64_t checkpointCount = get(p, 4);
+    if(in.size() != headerSize + keyCount * 6 + checkpointCount * 12 || newInstructionsPerFrame == 0 ||
+        newPlatform > (uint8_t)Chip8Platform::XOChip || newQuirks > (uint8_t)Chip8Quirks::XOChip)
+        return false;
+
+    seed = newSeed;
+    platform = (Chip8Platform)newPlatform;
+    quirks = (Chip8Quirks)newQuirks;
+    romHash = newROMHash;
+    instructionsPerFrame = newInstructionsPerFrame;
+    frames = newFrames;
+    keyChanges.resize(keyCount);
+    for(KeyChange &k : keyChanges){
+        k.frame = (uint32_t)get(p, 4);
+        k.keys = (uint16_t)get(p, 2);
+    }
+    checkpoints.resize(checkpointCount);
+    for(Checkpoint &c : checkpoints){
+        c.frame = (uint32_t)get(p, 4);
+        c.hash = get(p, 8);
+    }
+    //Their hashes came from the old row-at-a-time hash, which nothing computes any more
+    if(version == 1)
+        checkpoints.clear();
+    lastKeys = keyChanges.empty() ? 0 : keyChanges.back().keys;
+    return true;
+}
+
+uint16_t Movie::keyMask(const Chip8 &chip){
+    uint16_t keys = 0;
+    for(int i = 0; i < 16; i++){
+        if(chip.key[i])
+            keys |= 1 << i;
+    }
+    return keys;
+}
+
+void Movie::applyKeys(Chip8 &chip, uint16_t keys){
+    for(int i = 0; i < 16; i++)
+        chip.key[i] = (keys >> i) & 1;
+}
+
+uint64_t Movie::hashROM(const uint8_t *data, size_t size){
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for(size_t i = 0; i < size; i++){
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+bool Movie::hashROMFile(const char *filePath, uint64_t &hash){
+    std::ifstream file(filePath, std::ios::binary);
+    if(!file.is_open())
+        return false;
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    hash = hashROM(data.data(), data.size());
+    return true;
+}
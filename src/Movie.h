@@ -0,0 +1,82 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "Chip8.h"
+
+/*
+Input movies:
+A movie holds everything needed to play a session back bit for bit: the
+generator seed, the frame budget, a hash of the ROM, and every change of the
+16-key mask with the frame it took effect on. Framebuffer hashes are taken
+at regular checkpoints so a replay can say where it first went wrong.
+
+File layout, little-endian:
+"C8MV", version (16 bit), platform, quirk profile (0, the platform's own, in older
+movies), seed (64 bit), ROM hash (64 bit),
+instructions per frame, frame count, key change count, checkpoint count (32 bit each),
+then the key changes as (frame 32 bit, key mask 16 bit)
+and the checkpoints as (frames run 32 bit, framebuffer hash 64 bit).
+Version 1 movies hashed whole rows at once, which missed some changes. They
+still load, without their checkpoints.
+*/
+class Movie{
+    public:
+        struct KeyChange{
+            uint32_t frame; //Frame the mask applies from, counting from 0
+            uint16_t keys; //Bit n set while key n is down
+        };
+
+        struct Checkpoint{
+            uint32_t frame; //Frames run when the hash was taken
+            uint64_t hash; //Chip8::framebufferHash()
+        };
+
+    private:
+        static const uint16_t VERSION = 2;
+
+        uint64_t seed;
+        Chip8Platform platform;
+        Chip8Quirks quirks;
+        uint64_t romHash;
+        uint32_t instructionsPerFrame;
+        uint32_t frames;
+        uint32_t checkpointInterval;
+        uint16_t lastKeys;
+
+        std::vector<KeyChange> keyChanges;
+        std::vector<Checkpoint> checkpoints;
+
+    public:
+        Movie();
+
+        //Recording: begin() right after loading the ROM, then recordFrame() after every frame
+        void begin(const Chip8 &chip, uint64_t romHash, int instructionsPerFrame, uint32_t checkpointInterval = 60);
+        void recordFrame(const Chip8 &chip);
+        //Adds a closing checkpoint unless the last frame already has one
+        void finish(const Chip8 &chip);
+
+        bool save(const char *filePath) const;
+        bool load(const char *filePath);
+
+        uint64_t getSeed() const { return seed; }
+        Chip8Platform getPlatform() const { return platform; }
+        Chip8Quirks getQuirks() const { return quirks; }
+        uint64_t getROMHash() const { return romHash; }
+        int getInstructionsPerFrame() const { return (int)instructionsPerFrame; }
+        uint32_t getFrames() const { return frames; }
+        const std::vector<KeyChange> &getKeyChanges() const { return keyChanges; }
+        const std::vector<Checkpoint> &getCheckpoints() const { return checkpoints; }
+
+        static uint16_t keyMask(const Chip8 &chip);
+        static void applyKeys(Chip8 &chip, uint16_t keys);
+        //64-bit FNV-1a of a ROM image, as stored in the header
+        static uint64_t hashROM(const uint8_t *data, size_t size);
+        static bool hashROMFile(const char *filePath, uint64_t &hash);
+};
+
+
+#endif
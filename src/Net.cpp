@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Net.h"
+
+static bool unixAddress(const char *address, sockaddr_un &addr){
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(address + 5) >= sizeof(addr.sun_path))
+        return false;
+    strcpy(addr.sun_path, address + 5);
+    return true;
+}
+
+//Splits "[host:]port" and resolves it. The caller frees the list
+static addrinfo *resolve(const char *address, bool passive){
+    std::string host = "127.0.0.1";
+    const char *port = address;
+    const char *colon = strrchr(address, ':');
+    if(colon){
+        host.assign(address, colon - address);
+        port = colon + 1;
+    }
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    addrinfo *found = nullptr;
+    if(getaddrinfo(host.c_str(), port, &hints, &found) != 0)
+        return nullptr;
+    return found;
+}
+
+int listenSocket(const char *address, int backlog, std::string &unixPath){
+    unixPath.clear();
+    if(strncmp(address, "unix:", 5) == 0){
+        sockaddr_un addr;
+        if(!unixAddress(address, addr))
+            return -1;
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd < 0)
+            return -1;
+        unlink(addr.sun_path);
+        if(bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, backlog) != 0){
+            close(fd);
+            return -1;
+        }
+        unixPath = addr.sun_path;
+        return fd;
+    }
+
+    addrinfo *found = resolve(address, true);
+    int fd = -1;
+    for(addrinfo *a = found; a && fd < 0; a = a->ai_next){
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if(fd < 0)
+            continue;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if(bind(fd, a->ai_addr, a->ai_addrlen) != 0 || listen(fd, backlog) != 0){
+            close(fd);
+            fd = -1;
+        }
+    }
+    if(found)
+        freeaddrinfo(found);
+    return fd;
+}
+
+int connectSocket(const char *address){
+    if(strncmp(address, "unix:", 5) == 0){
+        sockaddr_un addr;
+        if(!unixAddress(address, addr))
+            return -1;
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd < 0)
+            return -1;
+        if(connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0){
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    addrinfo *found = resolve(address, false);
+    int fd = -1;
+    for(addrinfo *a = found; a && fd < 0; a = a->ai_next){
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if(fd < 0)
+            continue;
+        if(connect(fd, a->ai_addr, a->ai_addrlen) != 0){
+            close(fd);
+            fd = -1;
+        }
+    }
+    if(found)
+        freeaddrinfo(found);
+    return fd;
+}
+
+void setNoDelay(int fd){
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+bool setNonBlocking(int fd){
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
@@ -0,0 +1,23 @@
+#ifndef NET_H
+#define NET_H
+
+#include <string>
+
+/*
+Socket helpers shared by the servers and the client. Addresses are
+"[host:]port" for TCP, where the host defaults to 127.0.0.1 so nothing is
+reachable from outside unless asked for, or "unix:PATH" for a Unix socket.
+*/
+
+//A socket listening on address, or -1. unixPath gets the socket file to remove once
+//it's closed, and stays empty for TCP
+int listenSocket(const char *address, int backlog, std::string &unixPath);
+//A socket connected to address, or -1
+int connectSocket(const char *address);
+
+//Small writes go out straight away instead of waiting to be batched. Harmless on Unix sockets
+void setNoDelay(int fd);
+bool setNonBlocking(int fd);
+
+
+#endif
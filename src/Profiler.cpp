@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "Profiler.h"
+
+static const int MAX_DEPTH = 16; //Deeper than the Chip8 stack, so any extra calls are counted but not timed
+
+Profiler::Profiler(size_t maxTraceEvents){
+    this->maxTraceEvents = maxTraceEvents;
+    reset();
+}
+
+void Profiler::reset(){
+    memset(opCounts, 0, sizeof(opCounts));
+    memset(pcCounts, 0, sizeof(pcCounts));
+    memset(routines, 0, sizeof(routines));
+    instructions = 0;
+    callStack.clear();
+    edges.clear();
+    trace.clear();
+    traceFull = false;
+    frames.clear();
+    frameStart = 0;
+    frameDraws = 0;
+    presents = 0;
+}
+
+void Profiler::addTrace(uint16_t address, bool begin){
+    if(trace.size() < maxTraceEvents)
+        trace.push_back({ instructions, address, begin });
+    else
+        traceFull = true;
+}
+
+void Profiler::call(uint16_t address){
+    address &= 0xFFF;
+    uint16_t caller = callStack.empty() ? 0 : callStack.back().address;
+    edges[(uint32_t)caller << 16 | address]++;
+    routines[address].calls++;
+
+    if(callStack.size() >= MAX_DEPTH)
+        return;
+    callStack.push_back({ address, instructions, 0 });
+    addTrace(address, true);
+}
+
+void Profiler::ret(){
+    if(callStack.empty())
+        return;
+    CallFrame frame = callStack.back();
+    callStack.pop_back();
+
+    uint64_t duration = instructions - frame.start;
+    routines[frame.address].inclusive += duration;
+    routines[frame.address].exclusive += duration - frame.childTime;
+    if(!callStack.empty())
+        callStack.back().childTime += duration;
+    addTrace(frame.address, false);
+}
+
+void Profiler::endFrame(){
+    frames.push_back({ instructions - frameStart, frameDraws, presents.exchange(0, std::memory_order_relaxed) });
+    frameStart = instructions;
+    frameDraws = 0;
+}
+
+const char *Profiler::opName(Chip8Op op){
+    #define CHIP8_NAME(name) #name,
+    static const char *names[] = { CHIP8_OPS(CHIP8_NAME) CHIP8_EXT_OPS(CHIP8_NAME) };
+    #undef CHIP8_NAME
+    return op < OP_COUNT ? names[op] : "?";
+}
+
+bool Profiler::writeJSON(const char *filePath) const{
+    FILE *out = fopen(filePath, "w");
+    if(!out)
+        return false;
+
+    fprintf(out, "{\n  \"instructions\": %llu,\n", (unsigned long long)instructions);
+
+    fprintf(out, "  \"opcodes\": {");
+    bool first = true;
+    for(int op = OP_CLS; op < OP_COUNT; op++){
+        fprintf(out, "%s\n    \"%s\": %llu", first ? "" : ",", opName((Chip8Op)op) + 3, (unsigned long long)opCounts[op]);
+        first = false;
+    }
+    fprintf(out, "\n  },\n");
+
+    //Program space only, the interpreter area never holds code
+    std::vector<uint16_t> hot;
+    for(int a = 0x200; a < 0x1000; a++){
+        if(pcCounts[a])
+            hot.push_back(a);
+    }
+    std::sort(hot.begin(), hot.end(), [this](uint16_t a, uint16_t b){ return pcCounts[a] > pcCounts[b]; });
+    fprintf(out, "  \"hotspots\": [");
+    for(size_t i = 0; i < hot.size() && i < 32; i++){
+        fprintf(out, "%s\n    {\"address\": \"0x%03X\", \"count\": %llu}", i ? "," : "", hot[i],
+            (unsigned long long)pcCounts[hot[i]]);
+    }
+    fprintf(out, "\n  ],\n  \"pc_histogram_base\": \"0x200\",\n  \"pc_histogram\": [");
+    for(int a = 0x200; a < 0x1000; a++)
+        fprintf(out, "%s%llu", a == 0x200 ? "" : ",", (unsigned long long)pcCounts[a]);
+    fprintf(out, "],\n");
+
+    fprintf(out, "  \"subroutines\": [");
+    first = true;
+    for(int a = 0; a < 0x1000; a++){
+        const Routine &r = routines[a];
+        if(!r.calls)
+            continue;
+        fprintf(out, "%s\n    {\"address\": \"0x%03X\", \"calls\": %llu, \"inclusive\": %llu, \"exclusive\": %llu}",
+            first ? "" : ",", a, (unsigned long long)r.calls, (unsigned long long)r.inclusive,
+            (unsigned long long)r.exclusive);
+        first = false;
+    }
+    fprintf(out, "\n  ],\n");
+
+    std::vector<std::pair<uint32_t, uint64_t>> sortedEdges(edges.begin(), edges.end());
+    std::sort(sortedEdges.begin(), sortedEdges.end());
+    fprintf(out, "  \"calls\": [");
+    for(size_t i = 0; i < sortedEdges.size(); i++){
+        uint32_t key = sortedEdges[i].first;
+        fprintf(out, "%s\n    {\"caller\": \"0x%03X\", \"callee\": \"0x%03X\", \"count\": %llu}", i ? "," : "",
+            key >> 16, key & 0xFFF, (unsigned long long)sortedEdges[i].second);
+    }
+    fprintf(out, "\n  ],\n");
+
+    fprintf(out, "  \"frames\": [");
+    for(size_t i = 0; i < frames.size(); i++){
+        const FrameStats &f = frames[i];
+        fprintf(out, "%s\n    {\"instructions\": %llu, \"draws\": %u, \"presents\": %u}", i ? "," : "",
+            (unsigned long long)f.instructions, f.draws, f.presents);
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    bool ok = !ferror(out);
+    fclose(out);
+    return ok;
+}
+
+bool Profiler::writeTrace(const char *filePath) const{
+    FILE *out = fopen(filePath, "w");
+    if(!out)
+        return false;
+
+    //Timestamps are in executed instructions, shown by the viewer as microseconds
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"otherData\": {\"time_unit\": \"instructions\", \"truncated\": %s},\n"
+        "\"traceEvents\": [\n", traceFull ? "true" : "false");
+    fprintf(out, "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"Chip8\"}}");
+
+    size_t depth = 0;
+    uint64_t lastTime = 0;
+    for(const TraceEvent &e : trace){
+        if(e.begin)
+            depth++;
+        else if(depth)
+            depth--;
+        else
+            continue;
+        fprintf(out, ",\n  {\"name\": \"sub_%03X\", \"cat\": \"call\", \"ph\": \"%c\", \"ts\": %llu, \"pid\": 1, \"tid\": 1}",
+            e.address, e.begin ? 'B' : 'E', (unsigned long long)e.time);
+        lastTime = e.time;
+    }
+
+    uint64_t time = 0;
+    for(const FrameStats &f : frames){
+        fprintf(out, ",\n  {\"name\": \"frame\", \"ph\": \"C\", \"ts\": %llu, \"pid\": 1, \"tid\": 1, "
+            "\"args\": {\"instructions\": %llu, \"draws\": %u, \"presents\": %u}}",
+            (unsigned long long)time, (unsigned long long)f.instructions, f.draws, f.presents);
+        time += f.instructions;
+    }
+    if(time > lastTime)
+        lastTime = time;
+
+    //Close whatever was still running when the trace ended
+    if(!traceFull)
+        lastTime = std::max<uint64_t>(lastTime, instructions);
+    for(; depth > 0; depth--)
+        fprintf(out, ",\n  {\"ph\": \"E\", \"ts\": %llu, \"pid\": 1, \"tid\": 1}", (unsigned long long)lastTime);
+
+    fprintf(out, "\n]}\n");
+    bool ok = !ferror(out);
+    fclose(out);
+    return ok;
+}
@@ -0,0 +1,104 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+
+#include "Chip8.h"
+
+/*
+Execution profiler:
+Attached to a Chip8 with setProfiler(), it counts every executed opcode by
+operation and by address, times subroutines between 2NNN and 00EE, and
+keeps per-frame counts of instructions, sprite draws and presents. Time is
+measured in executed instructions, so profiles are exact and repeatable.
+
+The hooks only exist when the core is built with CHIP8_PROFILE. Even then
+the interpreter runs a separate copy of its loop while a profiler is
+attached, so an instance without one runs exactly the unprofiled code.
+*/
+class Profiler{
+    public:
+        struct FrameStats{
+            uint64_t instructions;
+            uint32_t draws;
+            uint32_t presents;
+        };
+
+        struct Routine{
+            uint64_t calls;
+            uint64_t inclusive; //Instructions from the call to the return, callees included
+            uint64_t exclusive; //The same without the time spent in callees
+        };
+
+    private:
+        struct CallFrame{
+            uint16_t address;
+            uint64_t start;
+            uint64_t childTime;
+        };
+
+        struct TraceEvent{
+            uint64_t time;
+            uint16_t address;
+            bool begin;
+        };
+
+        uint64_t opCounts[OP_COUNT];
+        uint64_t pcCounts[0x1000];
+        uint64_t instructions;
+
+        Routine routines[0x1000];
+        std::vector<CallFrame> callStack;
+        std::unordered_map<uint32_t, uint64_t> edges; //Calls per caller << 16 | callee, caller 0 outside any subroutine
+
+        std::vector<TraceEvent> trace;
+        size_t maxTraceEvents;
+        bool traceFull;
+
+        std::vector<FrameStats> frames;
+        uint64_t frameStart;
+        uint32_t frameDraws;
+        std::atomic<uint32_t> presents;
+
+        void addTrace(uint16_t address, bool begin);
+
+    public:
+        //Call and return events kept for the Chrome trace. Counters keep going once it's full
+        Profiler(size_t maxTraceEvents = 1 << 20);
+
+        void reset();
+
+        //Hooks called by the interpreter
+        void instruction(uint8_t op, uint16_t address){
+            opCounts[op]++;
+            pcCounts[address]++;
+            instructions++;
+        }
+        void draw(){ frameDraws++; }
+        void call(uint16_t address);
+        void ret();
+        void endFrame();
+
+        //Called by the presenter, which may be on another thread
+        void present(){ presents.fetch_add(1, std::memory_order_relaxed); }
+
+        uint64_t getInstructions() const { return instructions; }
+        uint64_t getOpCount(Chip8Op op) const { return opCounts[op]; }
+        uint64_t getPCCount(uint16_t address) const { return pcCounts[address & 0xFFF]; }
+        const Routine &getRoutine(uint16_t address) const { return routines[address & 0xFFF]; }
+        const std::vector<FrameStats> &getFrames() const { return frames; }
+
+        static const char *opName(Chip8Op op);
+
+        //Counters, hot spots, subroutines and frames as one JSON document
+        bool writeJSON(const char *filePath) const;
+        //Subroutines as nested slices and frames as counters, for chrome://tracing or Perfetto
+        bool writeTrace(const char *filePath) const;
+};
+
+
+#endif
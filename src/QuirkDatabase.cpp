@@ -0,0 +1,73 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "QuirkDatabase.h"
+
+//Splits a line into its hash and profile, ignoring the comment. Empty lines give no fields
+static int parseLine(std::string &line, uint64_t &hash, Chip8Quirks &quirks){
+    size_t comment = line.find('#');
+    if(comment != std::string::npos)
+        line.erase(comment);
+
+    std::vector<std::string> fields;
+    size_t pos = 0;
+    while(pos < line.size()){
+        pos = line.find_first_not_of(" \t\r", pos);
+        if(pos == std::string::npos)
+            break;
+        size_t end = line.find_first_of(" \t\r", pos);
+        if(end == std::string::npos)
+            end = line.size();
+        fields.push_back(line.substr(pos, end - pos));
+        pos = end;
+    }
+    if(fields.empty())
+        return 0;
+    if(fields.size() != 2 || fields[0].size() != 16 || fields[0].find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+        return -1;
+    hash = strtoull(fields[0].c_str(), nullptr, 16);
+    return Chip8::parseQuirks(fields[1].c_str(), quirks) ? 1 : -1;
+}
+
+bool QuirkDatabase::load(const char *filePath, int *errorLine){
+    std::ifstream file(filePath);
+    if(!file.is_open()){
+        if(errorLine)
+            *errorLine = 0;
+        return false;
+    }
+
+    //Read it all first, so a bad file leaves the table as it was
+    std::vector<std::pair<uint64_t, Chip8Quirks>> parsed;
+    std::string line;
+    int number = 0;
+    while(std::getline(file, line)){
+        number++;
+        uint64_t hash;
+        Chip8Quirks quirks;
+        int result = parseLine(line, hash, quirks);
+        if(result < 0){
+            if(errorLine)
+                *errorLine = number;
+            return false;
+        }
+        if(result > 0)
+            parsed.push_back({ hash, quirks });
+    }
+
+    for(const auto &entry : parsed)
+        entries[entry.first] = entry.second;
+    return true;
+}
+
+bool QuirkDatabase::lookup(uint64_t romHash, Chip8Quirks &quirks) const{
+    auto it = entries.find(romHash);
+    if(it == entries.end())
+        return false;
+    quirks = it->second;
+    return true;
+}
@@ -0,0 +1,38 @@
+#ifndef QUIRKDATABASE_H
+#define QUIRKDATABASE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <unordered_map>
+
+#include "Chip8.h"
+
+/*
+Quirk profiles by ROM:
+A text file maps ROM images to the profile they were written for, so a
+frontend can pick it on load instead of being told. Each line is the ROM's
+hash as 16 hex digits, as Movie::hashROM() computes it and the frontend
+prints it, then a profile name as Chip8::parseQuirks() reads it:
+
+    # Comments run to the end of the line
+    8f1c2e9a0b3d4c5e vip
+
+Blank lines are skipped. A later line for the same hash replaces the earlier.
+*/
+class QuirkDatabase{
+    private:
+        std::unordered_map<uint64_t, Chip8Quirks> entries;
+
+    public:
+        //Adds the entries in filePath. On a malformed line nothing is added and
+        //errorLine, when given, gets its number (0 if the file couldn't be read)
+        bool load(const char *filePath, int *errorLine = nullptr);
+
+        void add(uint64_t romHash, Chip8Quirks quirks){ entries[romHash] = quirks; }
+        //Leaves quirks alone if the ROM isn't listed
+        bool lookup(uint64_t romHash, Chip8Quirks &quirks) const;
+        size_t size() const { return entries.size(); }
+};
+
+
+#endif
@@ -0,0 +1,325 @@
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "Aot.h"
+#include "Recompiler.h"
+
+Chip8Recompiler::Chip8Recompiler(const uint8_t *rom, size_t size, Chip8Quirks quirks){
+    memset(memory, 0, sizeof(memory));
+    romSize = size;
+    if(size <= 0x1000 - 0x200)
+        memcpy(memory + 0x200, rom, size);
+    this->quirks = quirks;
+    instructions = 0;
+    dynamicExits = 0;
+}
+
+bool Chip8Recompiler::analyze(){
+    blocks.clear();
+    instructions = 0;
+    dynamicExits = 0;
+    if(romSize > 0x1000 - 0x200)
+        return false;
+
+    bool visited[0x1000] = {};
+    bool executes[0x1000] = {};
+    std::vector<uint16_t> pending = { 0x200 };
+    while(!pending.empty()){
+        uint16_t address = pending.back();
+        pending.pop_back();
+        //Targets outside the ROM are left to the interpreter
+        if(!inROM(address) || visited[address])
+            continue;
+        visited[address] = true;
+
+        Block block = { address, 0, Chip8Aot::NO_LOOP, false, false };
+        uint16_t pc = address;
+        while(!block.terminated && block.length < MAX_BLOCK && inROM(pc)){
+            Chip8Instr in = fetch(pc);
+            executes[pc] = true;
+            block.length++;
+            block.terminated = true;
+            switch(in.op){
+                case OP_JUMP:
+                    block.loopTarget = in.nnn;
+                    pending.push_back(in.nnn);
+                    break;
+                case OP_CALL:
+                    block.sideEffects = true;
+                    pending.push_back(pc + 2);
+                    pending.push_back(in.nnn);
+                    break;
+                case OP_RET:
+                    block.sideEffects = true;
+                    dynamicExits++;
+                    break;
+                case OP_JUMP_V0:
+                    //The usual jump table is a run of 1NNN at the base address
+                    dynamicExits++;
+                    pending.push_back(in.nnn);
+                    for(int entry = 1; entry < MAX_TABLE && inROM(in.nnn + entry * 2 - 2); entry++){
+                        if(fetch(in.nnn + entry * 2 - 2).op != OP_JUMP)
+                            break;
+                        pending.push_back(in.nnn + entry * 2);
+                    }
+                    break;
+                case OP_SKIP_EQ_IMM: case OP_SKIP_NE_IMM: case OP_SKIP_EQ_REG: case OP_SKIP_NE_REG:
+                case OP_SKIP_KEY: case OP_SKIP_NOT_KEY:
+                    pending.push_back(pc + 4);
+                    pending.push_back(pc + 2);
+                    break;
+                case OP_WAIT_KEY:
+                    pending.push_back(pc + 2);
+                    break;
+                case OP_BCD: case OP_STORE:
+                    //May have rewritten what comes next, so it's looked up again at run time
+                    block.sideEffects = true;
+                    dynamicExits++;
+                    pending.push_back(pc + 2);
+                    break;
+                case OP_UNKNOWN:
+                    break;
+                case OP_CLS: case OP_RAND: case OP_DRAW: case OP_SET_DELAY: case OP_SET_SOUND:
+                    block.sideEffects = true;
+                    block.terminated = false;
+                    break;
+                default:
+                    block.terminated = false;
+                    break;
+            }
+            pc += 2;
+        }
+        //Ran into MAX_BLOCK or the end of the ROM: whatever comes next gets a block of its own
+        if(!block.terminated)
+            pending.push_back(pc);
+        blocks.push_back(block);
+    }
+
+    std::sort(blocks.begin(), blocks.end(), [](const Block &a, const Block &b){ return a.address < b.address; });
+    for(bool e : executes)
+        instructions += e;
+    return true;
+}
+
+static void appendf(std::string &out, const char *format, ...){
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    out += line;
+}
+
+static const char *faultName(Chip8Fault fault){
+    switch(fault){
+        case Chip8Fault::UnknownOpcode: return "UnknownOpcode";
+        case Chip8Fault::MemoryOutOfBounds: return "MemoryOutOfBounds";
+        case Chip8Fault::StackOverflow: return "StackOverflow";
+        case Chip8Fault::StackUnderflow: return "StackUnderflow";
+        default: return "BadKey";
+    }
+}
+
+//One block as a static member function, a switch with a case for every opcode to
+//enter at. Each opcode is written out as the interpreter runs it for the module's
+//quirks, with pc + 2 * index standing in for the interpreter's pc, so even a block
+//entered at an unmasked address leaves the same state
+void Chip8Recompiler::emitBlock(std::string &out, const Block &block) const{
+    const Chip8QuirkSet profile = Chip8::quirkSet(quirks);
+    std::string body;
+    for(int k = 0; k < block.length; k++){
+        uint16_t address = block.address + k * 2;
+        Chip8Instr in = fetch(address);
+        int x = in.x;
+        int y = in.y;
+        int next = k * 2 + 2;
+        bool last = k == block.length - 1;
+        auto fault = [&](const char *condition, Chip8Fault reason){
+            appendf(body, "        if(%s)\n            return Chip8Aot::fault(c, pc, %d, 0x%04X, Chip8Fault::%s) - entry;\n",
+                condition, k, in.opcode, faultName(reason));
+        };
+        auto skip = [&](const char *condition){
+            appendf(body, "        pc += %s ? %d : %d;\n", condition, next + 2, next);
+        };
+        char condition[64];
+
+        //Any opcode can be the way in, where the last batch ended. The dispatcher hands over
+        //what's left of this one, which can end inside the block just as well
+        if(k > 0){
+            appendf(body, "        [[fallthrough]];\n    case %d:\n", k);
+            appendf(body, "        if(budget == %d){\n            pc += %d;\n            return %d - entry;\n        }\n", k, k * 2, k);
+        }
+        appendf(body, "        //0x%03X %04X\n", address, in.opcode);
+        switch(in.op){
+            case OP_CLS: body += "        Chip8Aot::clearScreen(c);\n"; break;
+            case OP_RET:
+                fault("c.SP == 0", Chip8Fault::StackUnderflow);
+                body += "        pc = c.stack[--c.SP];\n";
+                break;
+            case OP_JUMP: appendf(body, "        pc = 0x%03X;\n", in.nnn); break;
+            case OP_CALL:
+                fault("c.SP >= 16", Chip8Fault::StackOverflow);
+                //Masked as the interpreter does, since pc can be past the end after BNNN
+                appendf(body, "        c.stack[c.SP++] = (pc + %d) & 0xFFF;\n        pc = 0x%03X;\n", next, in.nnn);
+                break;
+            case OP_SKIP_EQ_IMM: snprintf(condition, sizeof(condition), "V[0x%X] == 0x%02X", x, in.nn); skip(condition); break;
+            case OP_SKIP_NE_IMM: snprintf(condition, sizeof(condition), "V[0x%X] != 0x%02X", x, in.nn); skip(condition); break;
+            case OP_SKIP_EQ_REG: case OP_SKIP_NE_REG:
+                //Comparing a register with itself is settled here, compilers warn about it otherwise
+                if(x == y)
+                    appendf(body, "        pc += %d;\n", in.op == OP_SKIP_EQ_REG ? next + 2 : next);
+                else{
+                    snprintf(condition, sizeof(condition), "V[0x%X] %s V[0x%X]", x, in.op == OP_SKIP_EQ_REG ? "==" : "!=", y);
+                    skip(condition);
+                }
+                break;
+            case OP_LOAD_IMM: appendf(body, "        V[0x%X] = 0x%02X;\n", x, in.nn); break;
+            case OP_ADD_IMM: appendf(body, "        V[0x%X] += 0x%02X;\n", x, in.nn); break;
+            case OP_MOVE: appendf(body, "        V[0x%X] = V[0x%X];\n", x, y); break;
+            case OP_OR: case OP_AND: case OP_XOR:
+                appendf(body, "        V[0x%X] %s= V[0x%X];\n", x, in.op == OP_OR ? "|" : in.op == OP_AND ? "&" : "^", y);
+                if(profile.vfReset)
+                    body += "        V[0xF] = 0;\n";
+                break;
+            case OP_ADD:
+                appendf(body, "        {\n            int sum = V[0x%X] + V[0x%X];\n            V[0xF] = sum > 0xFF;\n"
+                    "            V[0x%X] = (uint8_t)sum;\n        }\n", x, y, x);
+                break;
+            case OP_SUB: case OP_SUBN:
+                if(x == y)
+                    appendf(body, "        V[0x%X] = 0;\n        V[0xF] = 0;\n", x);
+                else if(in.op == OP_SUB)
+                    appendf(body, "        V[0xF] = V[0x%X] > V[0x%X];\n        V[0x%X] -= V[0x%X];\n", x, y, x, y);
+                else
+                    appendf(body, "        V[0xF] = V[0x%X] > V[0x%X];\n        V[0x%X] = V[0x%X] - V[0x%X];\n", y, x, x, y, x);
+                break;
+            case OP_SHR: case OP_SHL:{
+                bool right = in.op == OP_SHR;
+                if(profile.shiftVY)
+                    appendf(body, "        {\n            uint8_t source = V[0x%X];\n            V[0x%X] = source %s 1;\n"
+                        "            V[0xF] = source %s;\n        }\n", y, x, right ? ">>" : "<<", right ? "& 1" : ">> 7");
+                else
+                    appendf(body, "        V[0xF] = V[0x%X] %s;\n        V[0x%X] %s= 1;\n", x, right ? "& 1" : ">> 7", x,
+                        right ? ">>" : "<<");
+                break;
+            }
+            case OP_LOAD_I: appendf(body, "        c.I = 0x%03X;\n", in.nnn); break;
+            case OP_JUMP_V0: appendf(body, "        pc = 0x%03X + V[0x%X];\n", in.nnn, profile.jumpVX ? x : 0); break;
+            case OP_RAND: appendf(body, "        V[0x%X] = c.nextRandom() & 0x%02X;\n", x, in.nn); break;
+            case OP_DRAW:
+                snprintf(condition, sizeof(condition), "c.I + %d > 0x1000", in.n);
+                fault(condition, Chip8Fault::MemoryOutOfBounds);
+                appendf(body, "        V[0xF] = c.drawSprite<%s>(V[0x%X], V[0x%X], %d);\n        c.drawFlag = true;\n",
+                    profile.clip ? "true" : "false", x, y, in.n);
+                break;
+            case OP_SKIP_KEY: case OP_SKIP_NOT_KEY:
+                snprintf(condition, sizeof(condition), "V[0x%X] > 0xF", x);
+                fault(condition, Chip8Fault::BadKey);
+                snprintf(condition, sizeof(condition), "c.key[V[0x%X]] %s 0", x, in.op == OP_SKIP_KEY ? "!=" : "==");
+                skip(condition);
+                break;
+            case OP_GET_DELAY: appendf(body, "        V[0x%X] = c.delayTimer;\n", x); break;
+            case OP_WAIT_KEY:
+                appendf(body, "        if(!Chip8Aot::waitKey(c, 0x%X)){\n            pc += %d;\n"
+                    "            return (%d - entry) | Chip8Aot::WAITING;\n        }\n", x, k * 2, k);
+                break;
+            case OP_SET_DELAY: appendf(body, "        c.delayTimer = V[0x%X];\n", x); break;
+            case OP_SET_SOUND: appendf(body, "        Chip8Aot::setSound(c, 0x%X, %d - entry);\n", x, k); break;
+            case OP_ADD_I: appendf(body, "        c.I += V[0x%X];\n", x); break;
+            case OP_FONT: appendf(body, "        c.I = V[0x%X] * 5;\n", x); break;
+            case OP_BCD:
+                fault("c.I + 3 > 0x1000", Chip8Fault::MemoryOutOfBounds);
+                appendf(body, "        c.memory[c.I] = V[0x%X] / 100;\n        c.memory[c.I + 1] = V[0x%X] / 10 %% 10;\n"
+                    "        c.memory[c.I + 2] = V[0x%X] %% 10;\n        c.invalidateDecoded(c.I, 3);\n", x, x, x);
+                break;
+            case OP_STORE: case OP_LOAD:
+                snprintf(condition, sizeof(condition), "c.I + %d > 0x1000", x + 1);
+                fault(condition, Chip8Fault::MemoryOutOfBounds);
+                if(in.op == OP_STORE)
+                    appendf(body, "        memcpy(c.memory + c.I, V, %d);\n        c.invalidateDecoded(c.I, %d);\n", x + 1, x + 1);
+                else
+                    appendf(body, "        memcpy(V, c.memory + c.I, %d);\n", x + 1);
+                if(profile.memoryIncrement)
+                    appendf(body, "        c.I += %d;\n", x + 1);
+                break;
+            default:
+                appendf(body, "        return Chip8Aot::fault(c, pc, %d, 0x%04X, Chip8Fault::UnknownOpcode) - entry;\n", k, in.opcode);
+                continue;
+        }
+
+        if(!last)
+            continue;
+        //Every way out of the block leaves pc where the interpreter would have
+        switch(in.op){
+            case OP_RET: case OP_JUMP: case OP_CALL: case OP_JUMP_V0:
+            case OP_SKIP_EQ_IMM: case OP_SKIP_NE_IMM: case OP_SKIP_EQ_REG: case OP_SKIP_NE_REG:
+            case OP_SKIP_KEY: case OP_SKIP_NOT_KEY:
+                break;
+            default:
+                appendf(body, "        pc += %d;\n", next);
+                break;
+        }
+        appendf(body, "        return %d - entry;\n", block.length);
+    }
+
+    //Unused names are left out, compilers warn about them otherwise
+    bool usesV = body.find("V[") != std::string::npos || body.find("memcpy(V") != std::string::npos ||
+        body.find(", V, ") != std::string::npos;
+    bool usesMachine = usesV || body.find("(c") != std::string::npos || body.find("c.") != std::string::npos;
+    appendf(out, "    static uint32_t b%03X(Chip8 &%s, uint16_t &pc, uint32_t entry, uint32_t budget){\n", block.address,
+        usesMachine ? "c" : "");
+    if(usesV)
+        out += "        uint8_t *V = c.V;\n";
+    //From here on pc + 2 * k is opcode k of the block, and budget counts from its start
+    out += "        pc -= entry * 2;\n        budget += entry;\n        switch(entry){\n    case 0:\n";
+    out += body;
+    out += "        }\n        return 0;\n    }\n";
+}
+
+std::string Chip8Recompiler::emit(const char *name, uint64_t romHash) const{
+    static const char *quirkEnum[] = { "Default", "Modern", "VIP", "SuperChip", "XOChip" };
+
+    //The name goes into a string literal as it is, less anything that would need escaping
+    std::string safeName;
+    for(const char *p = name; *p; p++)
+        safeName += (*p >= 0x20 && *p < 0x7F && *p != '"' && *p != '\\') ? *p : '_';
+
+    std::string out;
+    appendf(out, "//Compiled by chip8-aot from %s (%zu bytes, %s quirks). Don't edit, compile the ROM again\n",
+        safeName.c_str(), romSize, Chip8::quirksName(quirks));
+    appendf(out, "//%zu blocks, %zu opcodes, %zu exits resolved at run time\n\n", blocks.size(), instructions, dynamicExits);
+    out += "#include <stdint.h>\n#include <string.h>\n\n#include \"Aot.h\"\n\nnamespace{\nstruct Module;\n}\n\n";
+
+    out += "template<>\nstruct Chip8AotCode<Module>{\n";
+    for(size_t i = 0; i < blocks.size(); i++){
+        if(i)
+            out += "\n";
+        emitBlock(out, blocks[i]);
+    }
+    out += "};\n\nnamespace{\n\n";
+
+    out += "const Chip8AotBlock blocks[] = {\n";
+    for(const Block &block : blocks){
+        appendf(out, "    { 0x%03X, %d, 0x%04X, %s, &Chip8AotCode<Module>::b%03X },\n", block.address, block.length,
+            block.loopTarget, block.sideEffects ? "true" : "false", block.address);
+    }
+    //Arrays can't be empty, a block of no opcodes is skipped when the module is loaded
+    if(blocks.empty())
+        out += "    { 0, 0, Chip8Aot::NO_LOOP, false, nullptr },\n";
+    out += "};\n\n";
+
+    out += "const uint8_t rom[] = {";
+    for(size_t i = 0; i < romSize; i++)
+        appendf(out, "%s0x%02X,", i % 16 ? " " : "\n    ", memory[0x200 + i]);
+    if(romSize == 0)
+        out += "\n    0";
+    out += "\n};\n\n";
+
+    appendf(out, "const Chip8AotModule module = {\n    \"%s\", 0x%016llXULL, Chip8Quirks::%s,\n    rom, %zu, blocks, %zu\n};\n\n",
+        safeName.c_str(), (unsigned long long)romHash, quirkEnum[(int)quirks], romSize, blocks.size());
+    out += "Chip8AotRegistration registration(module);\n\n}\n";
+    return out;
+}
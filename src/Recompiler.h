@@ -0,0 +1,66 @@
+#ifndef RECOMPILER_H
+#define RECOMPILER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "Chip8.h"
+
+/*
+Static recompiler, the offline half of Aot.h:
+Explores a ROM by recursive descent from 0x200, following jumps, calls and
+both sides of every skip, and writes it out as C++ with one function per
+basic block. A block runs until the opcode that ends it: a jump, call,
+return, skip, FX0A, or FX33/FX55, which may rewrite code. Blocks are allowed
+to overlap, so code reached both by falling through and by a jump is
+compiled into both blocks rather than split.
+
+Returns and BNNN only have targets at run time, and so do the opcodes after
+a write to code. They're left to the dispatcher, which finds the block for
+wherever control ends up or falls back to the interpreter. For BNNN, the
+base address and any table of 1NNN jumps at it are compiled as entry points,
+since that's the usual shape of a jump table. The quirk profile is fixed at
+compile time, so generated code has no quirk checks at all.
+*/
+class Chip8Recompiler{
+    private:
+        static const int MAX_BLOCK = 64; //Opcodes in one block, terminator included
+        static const int MAX_TABLE = 16; //1NNN entries followed in a BNNN jump table
+
+        struct Block{
+            uint16_t address;
+            int length;
+            uint16_t loopTarget; //Chip8Aot::NO_LOOP unless the block ends with a 1NNN
+            bool sideEffects;
+            bool terminated; //Ends with a control transfer rather than running off the ROM or MAX_BLOCK
+        };
+
+        uint8_t memory[0x1000];
+        size_t romSize;
+        Chip8Quirks quirks;
+        std::vector<Block> blocks;
+        size_t instructions; //Distinct addresses some block runs an opcode from
+        size_t dynamicExits; //Blocks ending where only the run-time dispatcher knows where to go
+
+        bool inROM(uint32_t address) const { return address >= 0x200 && address + 2 <= 0x200 + romSize; }
+        Chip8Instr fetch(uint16_t address) const { return Chip8::decode(memory[address] << 8 | memory[address + 1]); }
+        void emitBlock(std::string &out, const Block &block) const;
+
+    public:
+        //quirks can't be Default, and picks the code generated for the opcodes they change
+        Chip8Recompiler(const uint8_t *rom, size_t size, Chip8Quirks quirks);
+
+        //Finds every block reachable from 0x200. False if the ROM doesn't fit in memory
+        bool analyze();
+        //The translation unit defining the module, registered under name
+        std::string emit(const char *name, uint64_t romHash) const;
+
+        size_t getBlockCount() const { return blocks.size(); }
+        size_t getInstructionCount() const { return instructions; }
+        size_t getDynamicExits() const { return dynamicExits; }
+};
+
+
+#endif
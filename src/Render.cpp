@@ -0,0 +1,81 @@
+#include <stdio.h>
+
+#include "Render.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+PixelExpander::PixelExpander(Palette palette){
+    setPalette(palette);
+}
+
+void PixelExpander::setPalette(Palette palette){
+    this->palette = palette;
+    for(int nibble = 0; nibble < 16; nibble++){
+        for(int i = 0; i < 4; i++)
+            table[nibble][i] = ((nibble >> (3 - i)) & 1) ? palette.on : palette.off;
+    }
+}
+
+void PixelExpander::expandRow(uint64_t row, uint32_t *out) const{
+    for(int i = 0; i < 16; i++){
+        const uint32_t *pixels = table[(row >> (60 - i * 4)) & 0xF];
+#if defined(__SSE2__)
+        _mm_storeu_si128((__m128i*)(out + i * 4), _mm_load_si128((const __m128i*)pixels));
+#else
+        out[i * 4] = pixels[0];
+        out[i * 4 + 1] = pixels[1];
+        out[i * 4 + 2] = pixels[2];
+        out[i * 4 + 3] = pixels[3];
+#endif
+    }
+}
+
+void PixelExpander::expandRows(const uint64_t *rows, uint32_t rowMask, uint32_t *out) const{
+    for(int y = 0; y < 32; y++){
+        if((rowMask >> y) & 1)
+            expandRow(rows[y], out + y * 64);
+    }
+}
+
+void planeColors(Palette palette, uint32_t *colors){
+    //Planes 1 and 2 together give Octo's four colour look, the other planes add primaries
+    static const uint32_t fixed[16] = {
+        0, 0, 0xFFFF6600, 0xFF662200,
+        0xFFFF0000, 0xFF00FF00, 0xFF0000FF, 0xFFFFFF00,
+        0xFF880000, 0xFF008800, 0xFF000088, 0xFF888800,
+        0xFFFF00FF, 0xFF00FFFF, 0xFF880088, 0xFF008888
+    };
+    for(int i = 0; i < 16; i++)
+        colors[i] = fixed[i];
+    colors[0] = palette.off;
+    colors[1] = palette.on;
+}
+
+void expandPlanes(const uint64_t (*const *planes)[2], int planeCount, int width, int height,
+    const uint32_t *colors, uint32_t *out){
+    for(int y = 0; y < height; y++){
+        for(int half = 0; half * 64 < width; half++){
+            uint64_t words[4] = {};
+            for(int p = 0; p < planeCount; p++)
+                words[p] = planes[p][y][half];
+            uint32_t *row = out + y * width + half * 64;
+            for(int x = 0; x < 64; x++){
+                int shift = 63 - x;
+                int color = ((words[0] >> shift) & 1) | ((words[1] >> shift) & 1) << 1 |
+                    ((words[2] >> shift) & 1) << 2 | ((words[3] >> shift) & 1) << 3;
+                row[x] = colors[color];
+            }
+        }
+    }
+}
+
+bool parsePalette(const char *text, Palette &out){
+    unsigned int off, on;
+    if(sscanf(text, "%6x,%6x", &off, &on) != 2)
+        return false;
+    out.off = 0xFF000000 | off;
+    out.on = 0xFF000000 | on;
+    return true;
+}
@@ -0,0 +1,47 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdint.h>
+
+//Colours for unlit and lit pixels, as ARGB8888
+struct Palette{
+    uint32_t off;
+    uint32_t on;
+};
+
+/*
+Expands packed 1-bit display rows into ARGB8888 pixels. Each nibble of a
+row indexes a 16-entry table of four ready-made pixels, which is copied
+out with one 128-bit store (SSE2) or four scalar stores elsewhere. The
+table is rebuilt whenever the palette changes.
+*/
+class PixelExpander{
+    private:
+        alignas(16) uint32_t table[16][4];
+        Palette palette;
+
+    public:
+        PixelExpander(Palette palette = { 0xFF000000, 0xFFFFFFFF });
+
+        void setPalette(Palette palette);
+        Palette getPalette() const { return palette; }
+
+        //One 64-pixel row, leftmost pixel from bit 63
+        void expandRow(uint64_t row, uint32_t *out) const;
+        //Every row set in rowMask, into a 64-pixel wide buffer at the same row
+        void expandRows(const uint64_t *rows, uint32_t rowMask, uint32_t *out) const;
+};
+
+//Colours of the 16 XO-CHIP plane combinations. Index 0 and 1 come from a palette,
+//the rest are fixed
+void planeColors(Palette palette, uint32_t *colors);
+//SUPER-CHIP/XO-CHIP planes (as in Chip8::getPlane()) into a width-wide ARGB8888 buffer.
+//A pixel's colour index has bit p set when it's lit in plane p
+void expandPlanes(const uint64_t (*const *planes)[2], int planeCount, int width, int height,
+    const uint32_t *colors, uint32_t *out);
+
+//Parses "RRGGBB,RRGGBB" (unlit, lit) into an opaque palette
+bool parsePalette(const char *text, Palette &out);
+
+
+#endif
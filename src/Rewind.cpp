@@ -0,0 +1,158 @@
+#include <string.h>
+
+#include "Rewind.h"
+
+Rewind::Rewind(size_t maxFrames, size_t arenaBytes){
+    this->maxFrames = maxFrames ? maxFrames : 1;
+    //The arena always has to fit at least one worst case delta
+    arenaSize = arenaBytes < SCRATCH_SIZE ? SCRATCH_SIZE : arenaBytes;
+    arena = new uint8_t[arenaSize];
+    entries = new Entry[this->maxFrames];
+    states[0] = new uint8_t[Chip8::MAX_STATE_SIZE];
+    states[1] = new uint8_t[Chip8::MAX_STATE_SIZE];
+    scratch = new uint8_t[SCRATCH_SIZE];
+    current = states[0];
+    next = states[1];
+    stateSize = Chip8::STATE_SIZE;
+    reset();
+}
+
+Rewind::~Rewind(){
+    delete[] arena;
+    delete[] entries;
+    delete[] states[0];
+    delete[] states[1];
+    delete[] scratch;
+}
+
+void Rewind::reset(){
+    arenaHead = 0;
+    first = 0;
+    count = 0;
+    hasCurrent = false;
+}
+
+size_t Rewind::getBytesUsed() const{
+    size_t used = 0;
+    for(size_t i = 0; i < count; i++)
+        used += entries[(first + i) % maxFrames].length;
+    return used;
+}
+
+void Rewind::dropOldest(){
+    first = (first + 1) % maxFrames;
+    count--;
+}
+
+static inline uint64_t load64(const uint8_t *p){
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+/*
+Encodes a XOR b as tokens of (16-bit run of equal bytes, 16-bit count of
+changed bytes, the changed bytes XORed). A changed run only ends at 8 equal
+bytes in a row, so short gaps don't cost a token each. Runs longer than a
+16-bit count are split over several tokens.
+*/
+size_t Rewind::encodeDelta(const uint8_t *a, const uint8_t *b, size_t size, uint8_t *out){
+    uint8_t *o = out;
+    size_t i = 0;
+    while(i < size){
+        size_t equalStart = i;
+        size_t equalEnd = size - i > 0xFFFF ? i + 0xFFFF : size;
+        while(i + 8 <= equalEnd && load64(a + i) == load64(b + i))
+            i += 8;
+        while(i < equalEnd && a[i] == b[i])
+            i++;
+
+        size_t changedStart = i;
+        size_t changedEnd = size - i > 0xFFFF ? i + 0xFFFF : size;
+        size_t same = 0;
+        while(i < changedEnd && same < 8){
+            same = a[i] == b[i] ? same + 1 : 0;
+            i++;
+        }
+        i -= same;
+
+        size_t equal = changedStart - equalStart;
+        size_t changed = i - changedStart;
+        o[0] = equal & 0xFF;
+        o[1] = equal >> 8;
+        o[2] = changed & 0xFF;
+        o[3] = changed >> 8;
+        o += 4;
+        for(size_t j = changedStart; j < i; j++)
+            *o++ = a[j] ^ b[j];
+    }
+    return o - out;
+}
+
+void Rewind::applyDelta(const uint8_t *delta, size_t length, uint8_t *state){
+    const uint8_t *end = delta + length;
+    uint8_t *p = state;
+    while(delta < end){
+        p += delta[0] | delta[1] << 8;
+        size_t changed = delta[2] | delta[3] << 8;
+        delta += 4;
+        for(size_t j = 0; j < changed; j++)
+            p[j] ^= delta[j];
+        p += changed;
+        delta += changed;
+    }
+}
+
+void Rewind::push(const Chip8 &chip){
+    if(chip.getStateSize() != stateSize){
+        reset();
+        stateSize = chip.getStateSize();
+    }
+    if(!hasCurrent){
+        chip.saveState(current);
+        hasCurrent = true;
+        return;
+    }
+
+    chip.saveState(next);
+    size_t length = encodeDelta(current, next, stateSize, scratch);
+    uint8_t *swap = current;
+    current = next;
+    next = swap;
+
+    if(count == maxFrames)
+        dropOldest();
+
+    //Wrap to the start of the arena when the delta doesn't fit at the end. Entries
+    //still sitting between the head and the end are the oldest, so they go first
+    size_t start = arenaHead;
+    if(start + length > arenaSize){
+        while(count && entries[first].offset >= start)
+            dropOldest();
+        start = 0;
+    }
+    //Then drop whatever the new delta would overwrite, oldest first
+    while(count && entries[first].offset < start + length && entries[first].offset + entries[first].length > start)
+        dropOldest();
+
+    memcpy(arena + start, scratch, length);
+    arenaHead = start + length;
+
+    Entry &entry = entries[(first + count) % maxFrames];
+    entry.offset = (uint32_t)start;
+    entry.length = (uint32_t)length;
+    count++;
+}
+
+bool Rewind::stepBack(Chip8 &chip){
+    if(!count)
+        return false;
+
+    //The newest delta turns the kept state into the one before it
+    Entry &entry = entries[(first + count - 1) % maxFrames];
+    applyDelta(arena + entry.offset, entry.length, current);
+    arenaHead = entry.offset;
+    count--;
+
+    return chip.loadState(current, stateSize);
+}
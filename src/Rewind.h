@@ -0,0 +1,64 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Chip8.h"
+
+/*
+Rewind history:
+Keeps the newest save state in full plus, for every frame before it, the
+XOR of that state against the one after it. Consecutive frames rarely
+differ in more than a few registers, timers and screen rows, so each XOR is
+almost all zeroes and is stored as runs of zeroes and changed bytes. Going
+back a frame XORs the newest delta into the kept state. Deltas live in one
+fixed arena used as a ring, and the oldest are dropped to make room.
+*/
+class Rewind{
+    private:
+        struct Entry{
+            uint32_t offset; //Start of the encoded delta in the arena
+            uint32_t length;
+        };
+
+        uint8_t *arena;
+        size_t arenaSize;
+        size_t arenaHead; //Where the next delta goes
+
+        Entry *entries;
+        size_t maxFrames;
+        size_t first; //Oldest entry
+        size_t count;
+
+        //Sized for the largest platform. Only stateSize bytes of each are used
+        uint8_t *states[2];
+        uint8_t *current; //Newest state pushed, or restored by stepBack()
+        uint8_t *next; //The other buffer, swapped with current on every push
+        uint8_t *scratch; //Larger than the worst case encoding
+        static const size_t SCRATCH_SIZE = Chip8::MAX_STATE_SIZE * 2;
+        size_t stateSize; //State size of the platform being recorded
+        bool hasCurrent;
+
+        void dropOldest();
+        static size_t encodeDelta(const uint8_t *a, const uint8_t *b, size_t size, uint8_t *out);
+        static void applyDelta(const uint8_t *delta, size_t length, uint8_t *state);
+
+    public:
+        //Defaults to five minutes at 60 frames per second in 4MB of deltas
+        Rewind(size_t maxFrames = 5 * 60 * 60, size_t arenaBytes = 4 << 20);
+        ~Rewind();
+
+        void reset();
+
+        //Records one frame. Call once per emulated frame. A change of platform starts the history over
+        void push(const Chip8 &chip);
+        //Restores the frame before the last one pushed or restored. Returns false once history runs out
+        bool stepBack(Chip8 &chip);
+
+        size_t getFrames() const { return count; }
+        size_t getBytesUsed() const;
+};
+
+
+#endif
@@ -0,0 +1,378 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <thread>
+
+#include "Movie.h"
+#include "QuirkDatabase.h"
+#include "RomStore.h"
+
+static const char MAGIC[8] = { 'C', 'H', '8', 'S', 'T', 'O', 'R', 'E' };
+static const uint32_t ORDER_MARK = 0x01020304;
+static const uint32_t VERSION = 1;
+static const size_t ROM_ALIGN = 64;
+
+struct RomStoreHeader{
+    char magic[8];
+    uint32_t byteOrder; //ORDER_MARK as the writer stored it
+    uint32_t version;
+    uint64_t entryCount;
+    uint64_t namesOffset;
+    uint64_t namesLength;
+    uint64_t fileLength;
+};
+
+struct RomStoreEntry{
+    uint64_t hash;
+    uint64_t dataOffset; //The ROM, its reachability bitmap, then its invalid opcodes on a 2-byte boundary
+    uint32_t size;
+    uint32_t nameOffset; //Into the names
+    uint32_t nameLength;
+    uint32_t reachableOpcodes;
+    uint32_t invalidCount;
+    uint8_t platform;
+    uint8_t quirks;
+    uint8_t quirksListed;
+    uint8_t reserved;
+};
+
+static size_t romSpace(Chip8Platform platform){
+    return (platform == Chip8Platform::XOChip ? 0x10000 : 0x1000) - 0x200;
+}
+
+static uint64_t alignUp(uint64_t offset, uint64_t alignment){
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+static uint64_t invalidOffset(const RomStoreEntry &entry){
+    return alignUp(entry.dataOffset + entry.size + (entry.size + 7) / 8, 2);
+}
+
+RomStore::RomStore(){
+    base = nullptr;
+    length = 0;
+    header = nullptr;
+    entries = nullptr;
+}
+
+RomStore::~RomStore(){
+    close();
+}
+
+void RomStore::close(){
+    if(base)
+        munmap((void*)base, length);
+    base = nullptr;
+    length = 0;
+    header = nullptr;
+    entries = nullptr;
+}
+
+bool RomStore::isArchive(const char *filePath){
+    char magic[sizeof(MAGIC)];
+    std::ifstream file(filePath, std::ios::binary);
+    return file.read(magic, sizeof(magic)) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+bool RomStore::open(const char *filePath){
+    close();
+    int fd = ::open(filePath, O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    void *mapped = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(RomStoreHeader))
+        mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    //The mapping holds its own reference to the file
+    ::close(fd);
+    if(mapped == MAP_FAILED)
+        return false;
+    base = (const uint8_t*)mapped;
+    length = st.st_size;
+    header = (const RomStoreHeader*)base;
+    entries = (const RomStoreEntry*)(base + sizeof(RomStoreHeader));
+
+    //Everything a lookup will touch is checked now, so the rest of the class can trust the file
+    bool valid = memcmp(header->magic, MAGIC, sizeof(MAGIC)) == 0 && header->byteOrder == ORDER_MARK &&
+        header->version == VERSION && header->fileLength == length &&
+        header->entryCount <= (length - sizeof(RomStoreHeader)) / sizeof(RomStoreEntry) &&
+        header->namesOffset >= sizeof(RomStoreHeader) + header->entryCount * sizeof(RomStoreEntry) &&
+        header->namesOffset <= length && header->namesLength <= length - header->namesOffset;
+    for(uint64_t i = 0; valid && i < header->entryCount; i++){
+        const RomStoreEntry &entry = entries[i];
+        Chip8Platform platform = (Chip8Platform)entry.platform;
+        valid = (i == 0 || entries[i - 1].hash < entry.hash) &&
+            entry.platform <= (uint8_t)Chip8Platform::XOChip && entry.size <= romSpace(platform) &&
+            entry.quirks > (uint8_t)Chip8Quirks::Default && entry.quirks <= (uint8_t)Chip8Quirks::XOChip &&
+            (uint64_t)entry.nameOffset + entry.nameLength <= header->namesLength &&
+            entry.dataOffset % ROM_ALIGN == 0 && entry.dataOffset <= length &&
+            entry.reachableOpcodes <= entry.size && entry.invalidCount <= entry.reachableOpcodes &&
+            invalidOffset(entry) + entry.invalidCount * 2ULL <= length;
+    }
+    if(!valid)
+        close();
+    return valid;
+}
+
+size_t RomStore::size() const{
+    return header ? (size_t)header->entryCount : 0;
+}
+
+RomInfo RomStore::info(const RomStoreEntry &entry) const{
+    RomInfo rom;
+    rom.hash = entry.hash;
+    rom.name.assign((const char*)base + header->namesOffset + entry.nameOffset, entry.nameLength);
+    rom.data = base + entry.dataOffset;
+    rom.size = entry.size;
+    rom.platform = (Chip8Platform)entry.platform;
+    rom.quirks = (Chip8Quirks)entry.quirks;
+    rom.quirksListed = entry.quirksListed != 0;
+    rom.reachable = rom.data + entry.size;
+    rom.reachableOpcodes = entry.reachableOpcodes;
+    rom.invalid = (const uint16_t*)(base + invalidOffset(entry));
+    rom.invalidCount = entry.invalidCount;
+    return rom;
+}
+
+RomInfo RomStore::get(size_t index) const{
+    return info(entries[index]);
+}
+
+bool RomStore::find(uint64_t hash, RomInfo &rom) const{
+    const RomStoreEntry *end = entries + size();
+    const RomStoreEntry *entry = std::lower_bound(entries, end, hash,
+        [](const RomStoreEntry &e, uint64_t h){ return e.hash < h; });
+    if(entry == end || entry->hash != hash)
+        return false;
+    rom = info(*entry);
+    return true;
+}
+
+bool RomStore::findName(const std::string &name, RomInfo &rom) const{
+    for(size_t i = 0; i < size(); i++){
+        const RomStoreEntry &entry = entries[i];
+        if(entry.nameLength == name.size() &&
+            memcmp(base + header->namesOffset + entry.nameOffset, name.data(), name.size()) == 0){
+            rom = info(entry);
+            return true;
+        }
+    }
+    return false;
+}
+
+//Recursive descent over one platform's decoder. Code outside the ROM, or only reached
+//through BNNN's register or a return, is left for run time
+static void scan(const uint8_t *data, size_t size, Chip8Platform platform, RomAnalysis &analysis){
+    size = std::min(size, romSpace(platform));
+    analysis.platform = platform;
+    analysis.reachable.assign((size + 7) / 8, 0);
+    analysis.reachableOpcodes = 0;
+    analysis.invalid.clear();
+
+    bool xo = platform == Chip8Platform::XOChip;
+    uint32_t end = 0x200 + (uint32_t)size;
+    auto byteAt = [&](uint32_t address) -> uint8_t { return address >= 0x200 && address < end ? data[address - 0x200] : 0; };
+    std::vector<uint32_t> pending = { 0x200 };
+    while(!pending.empty()){
+        uint32_t pc = pending.back();
+        pending.pop_back();
+        while(pc >= 0x200 && pc + 2 <= end){
+            uint32_t offset = pc - 0x200;
+            if(analysis.reachable[offset >> 3] & (1 << (offset & 7)))
+                break;
+            analysis.reachable[offset >> 3] |= 1 << (offset & 7);
+            analysis.reachableOpcodes++;
+
+            Chip8Instr in = Chip8::decode(byteAt(pc) << 8 | byteAt(pc + 1), platform);
+            uint32_t next = pc + 2;
+            switch(in.op){
+                case OP_UNKNOWN:
+                    analysis.invalid.push_back((uint16_t)pc);
+                    next = 0;
+                    break;
+                case OP_RET: case OP_EXIT:
+                    next = 0;
+                    break;
+                case OP_JUMP: case OP_JUMP_V0: //BNNN's offset is only known at run time, so just its base
+                    next = in.nnn;
+                    break;
+                case OP_CALL:
+                    pending.push_back(in.nnn);
+                    break;
+                case OP_SKIP_EQ_IMM: case OP_SKIP_NE_IMM: case OP_SKIP_EQ_REG: case OP_SKIP_NE_REG:
+                case OP_SKIP_KEY: case OP_SKIP_NOT_KEY:
+                    //XO-CHIP skips step over the whole of a 4-byte F000 NNNN
+                    pending.push_back(xo && byteAt(pc + 2) == 0xF0 && byteAt(pc + 3) == 0x00 ? pc + 6 : pc + 4);
+                    break;
+                case OP_LONG_I:
+                    next = pc + 4;
+                    break;
+            }
+            pc = next;
+        }
+    }
+    std::sort(analysis.invalid.begin(), analysis.invalid.end());
+}
+
+void RomStore::analyze(const uint8_t *data, size_t size, RomAnalysis &analysis){
+    static const Chip8Platform order[] = { Chip8Platform::Chip8, Chip8Platform::SuperChip, Chip8Platform::XOChip };
+    RomAnalysis attempt;
+    bool found = false;
+    for(Chip8Platform platform : order){
+        if(size > romSpace(platform) && platform != Chip8Platform::XOChip)
+            continue;
+        scan(data, size, platform, attempt);
+        //With no clean fit, the platform that leaves the fewest opcodes undecoded
+        if(!found || attempt.invalid.size() < analysis.invalid.size())
+            analysis = attempt;
+        found = true;
+        if(analysis.invalid.empty())
+            break;
+    }
+}
+
+namespace{
+
+struct IndexedROM{
+    std::string name;
+    std::vector<uint8_t> data;
+    uint64_t hash;
+    RomAnalysis analysis;
+    Chip8Quirks quirks;
+    bool quirksListed;
+    const char *error; //Why it was left out, or nullptr
+};
+
+}
+
+static void indexFile(const std::string &path, const QuirkDatabase *quirkDb, IndexedROM &rom){
+    rom.name = path.substr(path.find_last_of('/') + 1);
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if(!file.is_open()){
+        rom.error = "could not be read";
+        return;
+    }
+    rom.data.resize((size_t)file.tellg());
+    file.seekg(0);
+    if(!file.read((char*)rom.data.data(), rom.data.size())){
+        rom.error = "could not be read";
+        return;
+    }
+    if(rom.data.empty() || rom.data.size() > romSpace(Chip8Platform::XOChip)){
+        rom.error = rom.data.empty() ? "is empty" : "fits no platform";
+        return;
+    }
+    rom.hash = Movie::hashROM(rom.data.data(), rom.data.size());
+    RomStore::analyze(rom.data.data(), rom.data.size(), rom.analysis);
+    rom.quirks = Chip8Quirks::Default;
+    rom.quirksListed = quirkDb && quirkDb->lookup(rom.hash, rom.quirks);
+    if(!rom.quirksListed)
+        rom.quirks = Chip8::defaultQuirks(rom.analysis.platform);
+    rom.error = nullptr;
+}
+
+bool RomStore::build(const std::vector<std::string> &files, const char *filePath, unsigned threads,
+    const QuirkDatabase *quirkDb, std::vector<std::string> &skipped){
+    //Reading and analysing is independent per file, writing is done in one pass afterwards
+    std::vector<IndexedROM> indexed(files.size());
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    threads = std::max(1u, std::min<unsigned>(threads, (unsigned)std::max<size_t>(files.size(), 1)));
+    for(unsigned t = 0; t < threads; t++){
+        workers.emplace_back([&](){
+            for(size_t i = next++; i < files.size(); i = next++)
+                indexFile(files[i], quirkDb, indexed[i]);
+        });
+    }
+    for(auto &worker : workers)
+        worker.join();
+
+    //Sorted by hash, keeping file order among equal hashes, so a ROM stored under
+    //several names keeps the first
+    std::vector<IndexedROM*> roms;
+    for(size_t i = 0; i < files.size(); i++){
+        if(indexed[i].error)
+            skipped.push_back(files[i] + " " + indexed[i].error);
+        else
+            roms.push_back(&indexed[i]);
+    }
+    std::stable_sort(roms.begin(), roms.end(), [](const IndexedROM *a, const IndexedROM *b){ return a->hash < b->hash; });
+    std::vector<IndexedROM*> unique;
+    for(IndexedROM *rom : roms){
+        if(!unique.empty() && unique.back()->hash == rom->hash){
+            if(unique.back()->data != rom->data)
+                skipped.push_back(rom->name + " has the same hash as " + unique.back()->name);
+            continue;
+        }
+        unique.push_back(rom);
+    }
+
+    RomStoreHeader header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.byteOrder = ORDER_MARK;
+    header.version = VERSION;
+    header.entryCount = unique.size();
+    header.namesOffset = sizeof(RomStoreHeader) + unique.size() * sizeof(RomStoreEntry);
+
+    std::string names;
+    std::vector<RomStoreEntry> entries(unique.size());
+    for(size_t i = 0; i < unique.size(); i++){
+        RomStoreEntry &entry = entries[i];
+        memset(&entry, 0, sizeof(entry));
+        entry.hash = unique[i]->hash;
+        entry.nameOffset = (uint32_t)names.size();
+        entry.nameLength = (uint32_t)unique[i]->name.size();
+        names += unique[i]->name;
+    }
+    header.namesLength = names.size();
+
+    uint64_t offset = header.namesOffset + header.namesLength;
+    for(size_t i = 0; i < unique.size(); i++){
+        const IndexedROM &rom = *unique[i];
+        RomStoreEntry &entry = entries[i];
+        entry.dataOffset = alignUp(offset, ROM_ALIGN);
+        entry.size = (uint32_t)rom.data.size();
+        entry.reachableOpcodes = rom.analysis.reachableOpcodes;
+        entry.invalidCount = (uint32_t)rom.analysis.invalid.size();
+        entry.platform = (uint8_t)rom.analysis.platform;
+        entry.quirks = (uint8_t)rom.quirks;
+        entry.quirksListed = rom.quirksListed;
+        offset = invalidOffset(entry) + entry.invalidCount * 2ULL;
+    }
+    header.fileLength = offset;
+
+    //Written beside the target and renamed over it, so readers never see half a file
+    std::string temporary = std::string(filePath) + ".tmp";
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    if(!out.is_open())
+        return false;
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)entries.data(), entries.size() * sizeof(RomStoreEntry));
+    out.write(names.data(), names.size());
+    static const char zeros[ROM_ALIGN] = {};
+    uint64_t written = header.namesOffset + header.namesLength;
+    for(size_t i = 0; i < unique.size(); i++){
+        const IndexedROM &rom = *unique[i];
+        const RomStoreEntry &entry = entries[i];
+        out.write(zeros, entry.dataOffset - written);
+        out.write((const char*)rom.data.data(), rom.data.size());
+        out.write((const char*)rom.analysis.reachable.data(), rom.analysis.reachable.size());
+        uint64_t invalidAt = invalidOffset(entry);
+        out.write(zeros, invalidAt - (entry.dataOffset + entry.size + rom.analysis.reachable.size()));
+        out.write((const char*)rom.analysis.invalid.data(), rom.analysis.invalid.size() * 2);
+        written = invalidAt + entry.invalidCount * 2ULL;
+    }
+    out.close();
+    if(!out.good() || ::rename(temporary.c_str(), filePath) != 0){
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,95 @@
+#ifndef ROMSTORE_H
+#define ROMSTORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "Chip8.h"
+
+class QuirkDatabase;
+
+//What a ROM's bytes say about it, worked out once when it's indexed
+struct RomAnalysis{
+    Chip8Platform platform; //The smallest machine every opcode reached decodes on
+    std::vector<uint8_t> reachable; //One bit per ROM byte, set where a reachable opcode starts
+    uint32_t reachableOpcodes;
+    std::vector<uint16_t> invalid; //Addresses of reachable opcodes that don't decode on platform
+};
+
+//One ROM in an open store. Pointers are into the mapped file and last as long as the store
+struct RomInfo{
+    uint64_t hash; //Movie::hashROM()
+    std::string name; //File name it was indexed from, the first one for duplicates
+    const uint8_t *data;
+    size_t size;
+    Chip8Platform platform;
+    Chip8Quirks quirks; //Never Default
+    bool quirksListed; //Came from a quirk database rather than the platform's own
+    const uint8_t *reachable; //(size + 7) / 8 bytes, laid out as RomAnalysis::reachable
+    uint32_t reachableOpcodes;
+    const uint16_t *invalid;
+    uint32_t invalidCount;
+};
+
+/*
+Content-addressed ROM store:
+One archive file holding any number of ROMs, each stored once under its
+hash, along with what a host would otherwise work out on every start: the
+platform, the quirk profile, which addresses hold reachable code, and which
+reachable opcodes don't decode. Opening a store maps the file and checks
+its tables; nothing is read or copied until a ROM is used, so a farm
+starting thousands of sessions shares one copy in the page cache, and each
+Chip8::LoadROM() from RomInfo::data is a single copy into the machine.
+
+The file is a header, a table of fixed-size entries sorted by hash (so a
+lookup is a binary search), the names, and then each ROM with its
+reachability bitmap and invalid-opcode list, starting on a cache line.
+Numbers are stored in the host's byte order, which the header records, so
+an archive only opens on machines of the same order.
+
+build() indexes a list of files on a pool of threads, each reading and
+analysing ROMs, and writes the archive to a temporary file that's renamed
+into place, so a store being rebuilt can stay open in running hosts.
+*/
+class RomStore{
+    private:
+        const uint8_t *base;
+        size_t length;
+        const struct RomStoreHeader *header;
+        const struct RomStoreEntry *entries;
+
+        RomInfo info(const RomStoreEntry &entry) const;
+
+    public:
+        RomStore();
+        ~RomStore();
+        RomStore(const RomStore&) = delete;
+        RomStore &operator=(const RomStore&) = delete;
+
+        //Maps an archive. False if it can't be read or isn't a valid archive for this host
+        bool open(const char *filePath);
+        void close();
+        //Quick check on the first bytes of a file, to tell archives from ROMs
+        static bool isArchive(const char *filePath);
+
+        size_t size() const;
+        //In hash order
+        RomInfo get(size_t index) const;
+        bool find(uint64_t hash, RomInfo &rom) const;
+        bool findName(const std::string &name, RomInfo &rom) const;
+
+        //Follows every jump, call and both sides of every skip from 0x200, trying each
+        //platform from the classic machine up until every opcode reached decodes
+        static void analyze(const uint8_t *data, size_t size, RomAnalysis &analysis);
+
+        //Indexes files into an archive at filePath on threads workers. Quirks come from
+        //quirkDb when it lists a ROM, otherwise from its platform. Files that can't be read
+        //or fit no platform are left out and added to skipped. False if it couldn't be written
+        static bool build(const std::vector<std::string> &files, const char *filePath, unsigned threads,
+            const QuirkDatabase *quirkDb, std::vector<std::string> &skipped);
+};
+
+
+#endif
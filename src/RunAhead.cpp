@@ -0,0 +1,39 @@
+#include <chrono>
+
+#include "RunAhead.h"
+
+RunAhead::RunAhead(int frames){
+    shadow = new Chip8();
+    this->frames = frames > 0 ? frames : 0;
+    passes = 0;
+    totalNanoseconds = 0;
+    worstNanoseconds = 0;
+}
+
+RunAhead::~RunAhead(){
+    delete shadow;
+}
+
+const Chip8 &RunAhead::run(const Chip8 &chip, int instructionsPerFrame){
+    if(frames == 0)
+        return chip;
+
+    auto start = std::chrono::steady_clock::now();
+    //restore() only copies between instances of the same platform, and leaves the quirks alone
+    if(shadow->getPlatform() != chip.getPlatform())
+        shadow->setPlatform(chip.getPlatform());
+    shadow->setQuirks(chip.getQuirks());
+    shadow->restore(chip);
+
+    //A fault ends the speculation early, and the real machine will get there on its own
+    for(int f = 0; f < frames && shadow->getFault() == Chip8Fault::None; f++)
+        shadow->runFrame(instructionsPerFrame);
+
+    uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    passes++;
+    totalNanoseconds += elapsed;
+    if(elapsed > worstNanoseconds)
+        worstNanoseconds = elapsed;
+    return *shadow;
+}
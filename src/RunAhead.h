@@ -0,0 +1,48 @@
+#ifndef RUNAHEAD_H
+#define RUNAHEAD_H
+
+#include <stdint.h>
+
+#include "Chip8.h"
+
+/*
+Run-ahead:
+Most ROMs only react to a key a frame or more after it goes down, since
+they poll the keypad with EX9E/EXA1 or FX0A once per game loop and draw the
+result on a later one. Run-ahead hides that lag. After the real machine has
+run its frame with the newest keys, a shadow instance is restored from it
+and runs a few more frames headless with the same keys held, and the host
+shows the shadow's screen instead. The real machine never sees those
+frames, so movies, rewind, captures and sound all follow it alone. If the
+keys change again, the next pass simply predicts something else.
+
+restore() copies the machine in a block or two, so a pass costs that copy
+plus frames times the instructions per frame, all on the emulation thread.
+*/
+class RunAhead{
+    private:
+        Chip8 *shadow; //No beeper, profiler or breakpoints, so speculation has no side effects
+        int frames;
+        uint64_t passes;
+        uint64_t totalNanoseconds;
+        uint64_t worstNanoseconds;
+
+    public:
+        RunAhead(int frames);
+        ~RunAhead();
+        RunAhead(const RunAhead&) = delete;
+        RunAhead &operator=(const RunAhead&) = delete;
+
+        //Copies chip into the shadow and runs it frames ahead. Returns the instance to present:
+        //the shadow, or chip itself when there are no frames to run ahead
+        const Chip8 &run(const Chip8 &chip, int instructionsPerFrame);
+
+        int getFrames() const { return frames; }
+        uint64_t getPasses() const { return passes; }
+        //Time spent per pass, copy included
+        double getAverageMilliseconds() const { return passes ? totalNanoseconds / 1e6 / passes : 0; }
+        double getWorstMilliseconds() const { return worstNanoseconds / 1e6; }
+};
+
+
+#endif
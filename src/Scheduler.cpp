@@ -0,0 +1,69 @@
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include "Scheduler.h"
+
+Scheduler::Scheduler(int instructionsPerSecond, double frameRate, int maxCatchUp){
+    this->frameRate = frameRate;
+    this->maxCatchUp = std::max(1, maxCatchUp);
+    //Round to the nearest whole budget, but always run at least one instruction a frame
+    instructionsPerFrame = std::max(1, (int)std::lround(instructionsPerSecond / frameRate));
+    uncapped = false;
+    reset();
+}
+
+void Scheduler::setUncapped(bool enabled){
+    uncapped = enabled;
+    reset();
+}
+
+void Scheduler::reset(){
+    start = Clock::now();
+    frame = 0;
+    dropped = 0;
+}
+
+//Deadlines are computed from the start time each frame, so rounding never accumulates into drift
+Scheduler::Clock::time_point Scheduler::frameTime(uint64_t index) const{
+    return start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(index / frameRate));
+}
+
+int Scheduler::framesDue(){
+    if(uncapped){
+        frame += maxCatchUp;
+        return maxCatchUp;
+    }
+
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    uint64_t target = (uint64_t)(elapsed * frameRate);
+    if(target <= frame)
+        return 0;
+
+    uint64_t due = target - frame;
+    if(due > (uint64_t)maxCatchUp){
+        //Too far behind to catch up without a visible burst, skip ahead instead
+        dropped += due - maxCatchUp;
+        frame += due - maxCatchUp;
+        due = maxCatchUp;
+    }
+    frame += due;
+    return (int)due;
+}
+
+//Sleeps until the next frame is due. Returns straight away when uncapped or already late
+void Scheduler::waitForNextFrame() const{
+    if(uncapped)
+        return;
+    std::this_thread::sleep_until(frameTime(frame + 1));
+}
+
+int Scheduler::millisecondsToNextFrame() const{
+    if(uncapped)
+        return 0;
+    auto left = frameTime(frame + 1) - Clock::now();
+    if(left <= Clock::duration::zero())
+        return 0;
+    //Rounded up, so a wait never wakes just short of the frame
+    return (int)std::chrono::ceil<std::chrono::milliseconds>(left).count();
+}
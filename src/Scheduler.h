@@ -0,0 +1,49 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <chrono>
+
+/*
+Frame pacing for real-time runs:
+Emulation advances in frames of a fixed instruction budget plus one timer
+tick, so game speed only depends on the configured rate and never on host
+jitter. The scheduler compares a monotonic clock against the number of
+frames already run and says how many frames are due. If the host falls
+too far behind, the excess frames are dropped (and counted) rather than
+run in a burst.
+*/
+class Scheduler{
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        double frameRate;
+        int instructionsPerFrame;
+        int maxCatchUp;
+        bool uncapped;
+
+        Clock::time_point start;
+        uint64_t frame;
+        uint64_t dropped;
+
+        Clock::time_point frameTime(uint64_t index) const;
+
+    public:
+        Scheduler(int instructionsPerSecond, double frameRate = 60.0, int maxCatchUp = 4);
+
+        //Uncapped runs maxCatchUp frames per call and never waits
+        void setUncapped(bool enabled);
+        void reset();
+
+        int framesDue();
+        void waitForNextFrame() const;
+        //For hosts that wait on something else too. 0 when uncapped or already late
+        int millisecondsToNextFrame() const;
+
+        int getInstructionsPerFrame() const { return instructionsPerFrame; }
+        uint64_t getFrame() const { return frame; }
+        uint64_t getDroppedFrames() const { return dropped; }
+};
+
+
+#endif
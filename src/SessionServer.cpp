@@ -0,0 +1,428 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "Net.h"
+#include "SessionServer.h"
+
+SessionServer::SessionServer(const SessionConfig &config){
+    this->config = config;
+    if(this->config.keyframeInterval == 0)
+        this->config.keyframeInterval = 1;
+    //Same rounding as every other host, through the same class
+    instructionsPerFrame = Scheduler(config.instructionsPerSecond).getInstructionsPerFrame();
+    listenFd = -1;
+    stopping = false;
+    nextId = 1;
+    opened = 0;
+}
+
+SessionServer::~SessionServer(){
+    stop();
+    if(listenFd >= 0)
+        close(listenFd);
+    if(!unixPath.empty())
+        unlink(unixPath.c_str());
+}
+
+void SessionServer::addROM(const std::string &name, const std::vector<uint8_t> &data){
+    roms.push_back({ name, data, nullptr, data.size(), config.platform, config.quirks });
+}
+
+void SessionServer::addROM(const std::string &name, const uint8_t *data, size_t size, Chip8Platform platform,
+    Chip8Quirks quirks){
+    roms.push_back({ name, {}, data, size, platform, quirks });
+}
+
+bool SessionServer::listen(const char *address){
+    listenFd = listenSocket(address, 64, unixPath);
+    return listenFd >= 0;
+}
+
+void SessionServer::start(int workerCount){
+    stopping = false;
+    for(int i = 0; i < std::max(1, workerCount); i++){
+        Worker *worker = new Worker();
+        if(pipe(worker->wake) != 0){
+            delete worker;
+            break;
+        }
+        setNonBlocking(worker->wake[0]);
+        setNonBlocking(worker->wake[1]);
+        worker->load = 0;
+        worker->frames = worker->sent = worker->keyframes = worker->skipped = worker->bytes = 0;
+        workers.push_back(worker);
+        worker->thread = std::thread(&SessionServer::workerLoop, this, std::ref(*worker));
+    }
+}
+
+void SessionServer::stop(){
+    if(workers.empty())
+        return;
+    stopping = true;
+    for(Worker *worker : workers){
+        char c = 0;
+        (void)!write(worker->wake[1], &c, 1);
+        worker->thread.join();
+        //Connections handed over but never picked up
+        Session *s;
+        while(worker->incoming.pop(s)){
+            close(s->fd);
+            delete s;
+        }
+        close(worker->wake[0]);
+        close(worker->wake[1]);
+        delete worker;
+    }
+    workers.clear();
+}
+
+void SessionServer::poll(int timeoutMs){
+    if(listenFd < 0 || workers.empty())
+        return;
+    pollfd p = { listenFd, POLLIN, 0 };
+    if(::poll(&p, 1, timeoutMs) <= 0)
+        return;
+    int fd = accept(listenFd, nullptr, nullptr);
+    if(fd < 0)
+        return;
+    setNoDelay(fd);
+
+    Worker *target = workers[0];
+    int sessions = 0;
+    for(Worker *worker : workers){
+        sessions += worker->load.load(std::memory_order_relaxed);
+        if(worker->load.load(std::memory_order_relaxed) < target->load.load(std::memory_order_relaxed))
+            target = worker;
+    }
+
+    Session *s = new Session();
+    s->fd = fd;
+    s->id = nextId++;
+    s->chip = nullptr;
+    s->closing = false;
+    s->outOffset = 0;
+    s->input = 0;
+    s->inputAcked = true;
+    s->wantKeyframe = true;
+    s->width = s->height = s->planes = 0;
+    s->imageSize = 0;
+    s->sequence = 0;
+    s->frame = 0;
+    s->lastKeyframe = 0;
+
+    //Turned away here, where a blocking write of a few bytes doesn't hold anyone up
+    if(sessions >= config.maxSessions || !target->incoming.push(s)){
+        sendClosed(*s, "Server full");
+        (void)!send(fd, s->out.data(), s->out.size(), MSG_NOSIGNAL);
+        close(fd);
+        delete s;
+        return;
+    }
+    setNonBlocking(fd);
+    target->load.fetch_add(1, std::memory_order_relaxed);
+    opened++;
+    char c = 0;
+    (void)!write(target->wake[1], &c, 1);
+}
+
+SessionStats SessionServer::getStats() const{
+    SessionStats stats = {};
+    stats.opened = opened;
+    for(const Worker *worker : workers){
+        stats.sessions += worker->load.load(std::memory_order_relaxed);
+        stats.frames += worker->frames.load(std::memory_order_relaxed);
+        stats.sent += worker->sent.load(std::memory_order_relaxed);
+        stats.keyframes += worker->keyframes.load(std::memory_order_relaxed);
+        stats.skipped += worker->skipped.load(std::memory_order_relaxed);
+        stats.bytes += worker->bytes.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void SessionServer::workerLoop(Worker &worker){
+    Scheduler scheduler(config.instructionsPerSecond);
+    std::vector<pollfd> fds;
+
+    while(!stopping.load(std::memory_order_acquire)){
+        Session *adopted;
+        while(worker.incoming.pop(adopted))
+            worker.sessions.push_back(adopted);
+
+        //Every session on the worker runs on the worker's frame clock
+        int due = scheduler.framesDue();
+        if(due > 0){
+            for(Session *s : worker.sessions){
+                if(s->chip && !s->closing){
+                    runFrames(worker, *s, due);
+                    //Catching up sends only the newest screen
+                    if(!s->closing)
+                        sendFrame(worker, *s);
+                }
+                flush(worker, *s);
+            }
+        }
+
+        fds.resize(worker.sessions.size() + 1);
+        fds[0] = { worker.wake[0], POLLIN, 0 };
+        for(size_t i = 0; i < worker.sessions.size(); i++){
+            Session *s = worker.sessions[i];
+            short events = s->closing ? 0 : POLLIN;
+            if(s->outOffset < s->out.size())
+                events |= POLLOUT;
+            fds[i + 1] = { s->fd, events, 0 };
+        }
+        int ready = ::poll(fds.data(), fds.size(), scheduler.millisecondsToNextFrame());
+
+        if(ready > 0 && (fds[0].revents & POLLIN)){
+            char drain[64];
+            while(read(worker.wake[0], drain, sizeof(drain)) > 0){}
+        }
+        //Sessions only go away here, after their poll entry has been looked at
+        size_t kept = 0;
+        for(size_t i = 0; i < worker.sessions.size(); i++){
+            Session *s = worker.sessions[i];
+            short revents = ready > 0 ? fds[i + 1].revents : 0;
+            bool alive = true;
+            if(revents & (POLLERR | POLLNVAL))
+                alive = false;
+            else if(revents & (POLLIN | POLLHUP))
+                alive = receive(*s);
+            if(alive)
+                alive = flush(worker, *s);
+            if(alive && s->closing && s->outOffset == s->out.size())
+                alive = false;
+            if(alive)
+                worker.sessions[kept++] = s;
+            else
+                closeSession(worker, s);
+        }
+        worker.sessions.resize(kept);
+    }
+
+    for(Session *s : worker.sessions)
+        closeSession(worker, s);
+    worker.sessions.clear();
+}
+
+void SessionServer::closeSession(Worker &worker, Session *s){
+    close(s->fd);
+    delete s->chip;
+    delete s;
+    worker.load.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void SessionServer::runFrames(Worker &worker, Session &s, int frames){
+    for(int f = 0; f < frames; f++){
+        //One Keys message per frame, so a press and release inside one frame still lands
+        if(!s.keys.empty()){
+            uint16_t mask = s.keys.front().second;
+            s.input = s.keys.front().first;
+            s.keys.pop_front();
+            for(int k = 0; k < 16; k++)
+                s.chip->key[k] = (mask >> k) & 1;
+            s.inputAcked = false;
+        }
+        s.chip->runFrame(instructionsPerFrame);
+        s.frame++;
+        worker.frames.fetch_add(1, std::memory_order_relaxed);
+
+        if(s.chip->getFault() != Chip8Fault::None){
+            char reason[64];
+            if(s.chip->getFault() == Chip8Fault::Exited)
+                snprintf(reason, sizeof(reason), "ROM exited");
+            else
+                snprintf(reason, sizeof(reason), "ROM stopped with %s at opcode %.4X",
+                    Chip8::faultName(s.chip->getFault()), s.chip->getOpcode());
+            //The last screen still goes out before the reason
+            sendFrame(worker, s);
+            sendClosed(s, reason);
+            s.closing = true;
+            return;
+        }
+    }
+}
+
+void SessionServer::sendFrame(Worker &worker, Session &s){
+    uint8_t image[FrameStream::MAX_IMAGE];
+    uint8_t width, height, planes;
+    size_t size = FrameStream::captureImage(*s.chip, image, width, height, planes);
+
+    bool resized = width != s.width || height != s.height || planes != s.planes;
+    bool changed = resized || memcmp(image, s.image, size) != 0;
+    if(!changed && s.inputAcked && !s.wantKeyframe)
+        return;
+    //A client that's behind gets nothing new until it catches up, then one delta for everything it missed
+    if(s.out.size() - s.outOffset > SEND_BACKLOG){
+        worker.skipped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    bool keyframe = resized || s.wantKeyframe || (changed && s.frame - s.lastKeyframe >= config.keyframeInterval);
+    if(keyframe){
+        memset(s.image, 0, sizeof(s.image));
+        s.lastKeyframe = s.frame;
+        s.wantKeyframe = false;
+        worker.keyframes.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t start = FrameStream::beginMessage(s.out, StreamMessage::Frame);
+    FrameStream::put(s.out, s.sequence++, 4);
+    FrameStream::put(s.out, s.frame, 4);
+    FrameStream::put(s.out, s.input, 4);
+    s.out.push_back(keyframe ? StreamFrame::KEYFRAME : 0);
+    s.out.push_back(width);
+    s.out.push_back(height);
+    s.out.push_back(planes);
+    FrameStream::put(s.out, FrameStream::checksum(image, size), 4);
+    size_t deltaAt = s.out.size();
+    s.out.resize(deltaAt + FrameStream::MAX_IMAGE + 8);
+    size_t deltaSize = FrameStream::encodeDelta(s.image, image, size, s.out.data() + deltaAt);
+    s.out.resize(deltaAt + deltaSize);
+    FrameStream::finishMessage(s.out, start);
+
+    memcpy(s.image, image, size);
+    s.width = width;
+    s.height = height;
+    s.planes = planes;
+    s.imageSize = size;
+    s.inputAcked = true;
+    worker.sent.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SessionServer::sendClosed(Session &s, const char *reason){
+    size_t start = FrameStream::beginMessage(s.out, StreamMessage::Closed);
+    s.out.insert(s.out.end(), reason, reason + strlen(reason));
+    FrameStream::finishMessage(s.out, start);
+}
+
+//False once the session is over: the client went away or broke the protocol
+bool SessionServer::receive(Session &s){
+    uint8_t buffer[4096];
+    for(;;){
+        ssize_t got = recv(s.fd, buffer, sizeof(buffer), 0);
+        if(got == 0)
+            return false;
+        if(got < 0){
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return false;
+        }
+        //Nothing a client sends is anywhere near this long
+        if(s.in.size() + got > 1 << 16)
+            return false;
+        s.in.insert(s.in.end(), buffer, buffer + got);
+    }
+
+    size_t pos = 0;
+    StreamMessage type;
+    const uint8_t *payload;
+    size_t length;
+    while(!s.closing){
+        size_t used = FrameStream::nextMessage(s.in.data() + pos, s.in.size() - pos, type, payload, length);
+        if(used == 0)
+            break;
+        if(!handleMessage(s, type, payload, length))
+            return false;
+        pos += used;
+    }
+    s.in.erase(s.in.begin(), s.in.begin() + pos);
+    return true;
+}
+
+bool SessionServer::handleMessage(Session &s, StreamMessage type, const uint8_t *payload, size_t length){
+    const uint8_t *p = payload;
+    switch(type){
+        case StreamMessage::Hello:{
+            if(s.chip || length < 11 || FrameStream::get(p, 2) != FrameStream::VERSION)
+                return false;
+            uint64_t seed = FrameStream::get(p, 8);
+            size_t nameLength = *p++;
+            if(length != 11 + nameLength)
+                return false;
+            return openSession(s, seed, std::string((const char*)p, nameLength));
+        }
+        case StreamMessage::Keys:{
+            if(!s.chip || length != 6)
+                return false;
+            uint32_t sequence = (uint32_t)FrameStream::get(p, 4);
+            uint16_t mask = (uint16_t)FrameStream::get(p, 2);
+            //A client flooding keys loses the oldest, not the newest
+            if(s.keys.size() == MAX_PENDING_KEYS)
+                s.keys.pop_front();
+            s.keys.push_back({ sequence, mask });
+            return true;
+        }
+        case StreamMessage::Keyframe:
+            s.wantKeyframe = true;
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool SessionServer::openSession(Session &s, uint64_t seed, const std::string &name){
+    const ServedROM *rom = nullptr;
+    for(const ServedROM &entry : roms){
+        if(name.empty() || entry.name == name){
+            rom = &entry;
+            break;
+        }
+    }
+    if(!rom){
+        sendClosed(s, "Unknown ROM");
+        s.closing = true;
+        return true;
+    }
+
+    s.chip = new Chip8();
+    s.chip->setSeed(seed);
+    s.chip->setPlatform(rom->platform);
+    s.chip->setQuirks(rom->quirks);
+    if(!s.chip->LoadROM(rom->bytes(), rom->size)){
+        sendClosed(s, "ROM does not fit");
+        s.closing = true;
+        return true;
+    }
+
+    size_t start = FrameStream::beginMessage(s.out, StreamMessage::Welcome);
+    FrameStream::put(s.out, FrameStream::VERSION, 2);
+    FrameStream::put(s.out, s.id, 4);
+    s.out.push_back((uint8_t)rom->platform);
+    s.out.push_back((uint8_t)s.chip->getQuirks());
+    s.out.push_back(60);
+    FrameStream::finishMessage(s.out, start);
+    return true;
+}
+
+//Writes as much as the socket takes. False if the connection is gone
+bool SessionServer::flush(Worker &worker, Session &s){
+    while(s.outOffset < s.out.size()){
+        ssize_t put = send(s.fd, s.out.data() + s.outOffset, s.out.size() - s.outOffset, MSG_NOSIGNAL);
+        if(put < 0){
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return false;
+        }
+        s.outOffset += put;
+        worker.bytes.fetch_add(put, std::memory_order_relaxed);
+    }
+    if(s.outOffset == s.out.size()){
+        s.out.clear();
+        s.outOffset = 0;
+    }
+    //Keep the buffer from growing behind a slow client
+    else if(s.outOffset > SEND_BACKLOG){
+        s.out.erase(s.out.begin(), s.out.begin() + s.outOffset);
+        s.outOffset = 0;
+    }
+    return true;
+}
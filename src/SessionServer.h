@@ -0,0 +1,152 @@
+#ifndef SESSION_SERVER_H
+#define SESSION_SERVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Chip8.h"
+#include "FrameStream.h"
+#include "Scheduler.h"
+#include "SpscQueue.h"
+
+struct SessionConfig{
+    Chip8Platform platform = Chip8Platform::Chip8;
+    Chip8Quirks quirks = Chip8Quirks::Default;
+    int instructionsPerSecond = 540;
+    uint32_t keyframeInterval = 300; //Frames between whole screens, while the screen is changing
+    int maxSessions = 1024;
+};
+
+struct SessionStats{
+    uint64_t sessions; //Open right now
+    uint64_t opened;
+    uint64_t frames; //Emulated, over every session
+    uint64_t sent; //Frame messages
+    uint64_t keyframes;
+    uint64_t skipped; //Frames not sent because the client was behind
+    uint64_t bytes; //Everything written to clients
+};
+
+/*
+Multi-session server:
+Hosts any number of Chip8 sessions for thin clients on a local TCP port or
+Unix socket, speaking the protocol in FrameStream.h. Each connection is one
+session running one ROM, picked by name from the ones added.
+
+Sessions are spread over a pool of worker threads, each running an event
+loop over its own sessions: a poll() on their sockets that sleeps until a
+socket has something to read or the next 60 Hz frame is due. A session
+stays on one worker for its whole life, so nothing about it is shared
+between threads. The host thread accepts connections and hands each one to
+the worker with the fewest sessions through a lock-free queue, waking the
+worker through a pipe.
+
+A frame is only sent when the screen changed or it's the first to run
+with new keys, so an idle session sends nothing at all. Frames are XORed
+against the last image sent, not the last one run, so a client whose
+socket is backed up simply misses frames and then gets one delta covering
+all of them. A changing screen goes out whole every keyframeInterval
+frames, and whenever the client asks.
+*/
+class SessionServer{
+    private:
+        //Bytes waiting to go to a client past which no more frames are queued for it
+        static const size_t SEND_BACKLOG = 64 * 1024;
+        static const size_t MAX_PENDING_KEYS = 64;
+
+        struct Session{
+            int fd;
+            uint32_t id;
+            Chip8 *chip; //Created by the client's Hello
+            bool closing; //Close once everything queued is sent
+            std::vector<uint8_t> in;
+            std::vector<uint8_t> out;
+            size_t outOffset;
+
+            std::deque<std::pair<uint32_t, uint16_t>> keys; //Keys messages not applied yet
+            uint32_t input; //Newest Keys sequence applied
+            bool inputAcked; //Sent in a frame since it was applied
+            bool wantKeyframe;
+
+            uint8_t image[FrameStream::MAX_IMAGE]; //As last sent
+            uint8_t width, height, planes;
+            size_t imageSize;
+            uint32_t sequence;
+            uint32_t frame;
+            uint32_t lastKeyframe;
+        };
+
+        //A ROM sessions can ask for. Copied in, unless it lives in memory the host keeps, such as a RomStore
+        struct ServedROM{
+            std::string name;
+            std::vector<uint8_t> copy;
+            const uint8_t *data; //Set when not copied
+            size_t size;
+            Chip8Platform platform;
+            Chip8Quirks quirks;
+
+            const uint8_t *bytes() const { return data ? data : copy.data(); }
+        };
+
+        struct Worker{
+            std::thread thread;
+            SpscQueue<Session*, 256> incoming;
+            int wake[2]; //Pipe written to after a push to incoming
+            std::vector<Session*> sessions;
+            std::atomic<int> load; //Sessions, counted by the host when handing one over
+
+            std::atomic<uint64_t> frames;
+            std::atomic<uint64_t> sent;
+            std::atomic<uint64_t> keyframes;
+            std::atomic<uint64_t> skipped;
+            std::atomic<uint64_t> bytes;
+        };
+
+        SessionConfig config;
+        int instructionsPerFrame;
+        std::vector<ServedROM> roms;
+        int listenFd;
+        std::string unixPath;
+        std::vector<Worker*> workers;
+        std::atomic<bool> stopping;
+        uint32_t nextId;
+        uint64_t opened;
+
+        void workerLoop(Worker &worker);
+        void runFrames(Worker &worker, Session &s, int frames);
+        void sendFrame(Worker &worker, Session &s);
+        bool receive(Session &s);
+        bool handleMessage(Session &s, StreamMessage type, const uint8_t *payload, size_t length);
+        bool openSession(Session &s, uint64_t seed, const std::string &name);
+        void sendClosed(Session &s, const char *reason);
+        bool flush(Worker &worker, Session &s);
+        void closeSession(Worker &worker, Session *s);
+
+    public:
+        SessionServer(const SessionConfig &config);
+        ~SessionServer();
+
+        //ROMs sessions can ask for by name. The first one added is the default. This one is
+        //copied and runs on the configured platform and quirks
+        void addROM(const std::string &name, const std::vector<uint8_t> &data);
+        //Runs on a platform and quirks of its own. data isn't copied, so it has to outlive the server
+        void addROM(const std::string &name, const uint8_t *data, size_t size, Chip8Platform platform, Chip8Quirks quirks);
+        //Listens on "[host:]port" (host defaults to 127.0.0.1) or "unix:PATH"
+        bool listen(const char *address);
+        void start(int workerCount);
+        //Accepts connections, waiting up to timeoutMs for one. The host calls it in a loop
+        void poll(int timeoutMs);
+        //Closes every session and joins the workers
+        void stop();
+
+        SessionStats getStats() const;
+};
+
+
+#endif
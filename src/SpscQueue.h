@@ -0,0 +1,49 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+
+/*
+Bounded lock-free queue for exactly one producer thread and one consumer
+thread. Capacity must be a power of two. push() fails instead of blocking
+when the queue is full, pop() fails when it's empty.
+*/
+template<typename T, size_t Capacity>
+class SpscQueue{
+    static_assert(Capacity && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    private:
+        T items[Capacity];
+        //Kept on separate cache lines so the two threads don't fight over one
+        alignas(64) std::atomic<size_t> head; //Next item to pop, written by the consumer
+        alignas(64) std::atomic<size_t> tail; //Next slot to push, written by the producer
+
+    public:
+        SpscQueue() : items(), head(0), tail(0) {}
+
+        bool push(const T &item){
+            size_t t = tail.load(std::memory_order_relaxed);
+            if(t - head.load(std::memory_order_acquire) == Capacity)
+                return false;
+            items[t & (Capacity - 1)] = item;
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop(T &item){
+            size_t h = head.load(std::memory_order_relaxed);
+            if(h == tail.load(std::memory_order_acquire))
+                return false;
+            item = items[h & (Capacity - 1)];
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool empty() const{
+            return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+        }
+};
+
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stdint.h>
+#include <atomic>
+
+/*
+Lock-free triple buffer for handing whole frames from one producer thread
+to one consumer thread. The producer always has a buffer to write into and
+the consumer always has a complete frame to read, so neither side ever
+waits on the other. Frames the consumer doesn't pick up in time are simply
+replaced by newer ones.
+*/
+template<typename T>
+class TripleBuffer{
+    private:
+        static const uint8_t INDEX = 0x3;
+        static const uint8_t FRESH = 0x4; //Set when the middle buffer holds a frame the consumer hasn't taken
+
+        T buffers[3];
+        std::atomic<uint8_t> middle;
+        uint8_t back; //Producer side only
+        uint8_t front; //Consumer side only
+
+    public:
+        TripleBuffer() : buffers(), middle(1), back(0), front(2) {}
+
+        //Producer: fill writeBuffer(), then publish() it
+        T &writeBuffer(){ return buffers[back]; }
+
+        void publish(){
+            uint8_t old = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+            back = old & INDEX;
+        }
+
+        //Consumer: returns true and swaps in the newest frame if one was published since the last call
+        bool update(){
+            if((middle.load(std::memory_order_relaxed) & FRESH) == 0)
+                return false;
+            uint8_t old = middle.exchange(front, std::memory_order_acq_rel);
+            front = old & INDEX;
+            return true;
+        }
+
+        const T &readBuffer() const { return buffers[front]; }
+};
+
+
+#endif
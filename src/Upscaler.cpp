@@ -0,0 +1,358 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#include "Upscaler.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//Brightness of the dimmed part of each row with Scanlines, out of 256
+static const int SCANLINE_LEVEL = 96;
+static const uint32_t BORDER = 0xFF000000;
+
+//Each pixel of in as factor copies side by side
+static void replicateRow(const uint32_t *in, int count, int factor, uint32_t *out){
+    int i = 0;
+#if defined(__SSE2__)
+    if(factor >= 4){
+        //The last store of a square overlaps the one before when factor isn't a multiple of 4
+        for(; i < count; i++){
+            __m128i pixel = _mm_set1_epi32((int)in[i]);
+            uint32_t *square = out + i * factor;
+            for(int k = 0; k + 4 <= factor; k += 4)
+                _mm_storeu_si128((__m128i*)(square + k), pixel);
+            _mm_storeu_si128((__m128i*)(square + factor - 4), pixel);
+        }
+        return;
+    }
+    if(factor == 2){
+        for(; i + 4 <= count; i += 4){
+            __m128i pixels = _mm_loadu_si128((const __m128i*)(in + i));
+            _mm_storeu_si128((__m128i*)(out + i * 2), _mm_unpacklo_epi32(pixels, pixels));
+            _mm_storeu_si128((__m128i*)(out + i * 2 + 4), _mm_unpackhi_epi32(pixels, pixels));
+        }
+    }
+#endif
+    for(; i < count; i++){
+        for(int k = 0; k < factor; k++)
+            out[i * factor + k] = in[i];
+    }
+}
+
+//Scales the colour channels by SCANLINE_LEVEL / 256, keeping alpha
+static void dimRow(const uint32_t *in, int count, uint32_t *out){
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i level = _mm_set1_epi16(SCANLINE_LEVEL);
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    for(; i + 4 <= count; i += 4){
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), level), 8);
+        __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), level), 8);
+        __m128i dimmed = _mm_packus_epi16(lo, hi);
+        dimmed = _mm_or_si128(_mm_andnot_si128(alpha, dimmed), _mm_and_si128(alpha, pixels));
+        _mm_storeu_si128((__m128i*)(out + i), dimmed);
+    }
+#endif
+    for(; i < count; i++){
+        uint32_t pixel = in[i];
+        uint32_t dimmed = pixel & 0xFF000000;
+        for(int shift = 0; shift < 24; shift += 8)
+            dimmed |= ((((pixel >> shift) & 0xFF) * SCANLINE_LEVEL) >> 8) << shift;
+        out[i] = dimmed;
+    }
+}
+
+/*
+EPX (Scale2x) on one row, into two rows twice as wide. With A above the
+pixel P, B right of it, C left and D below, the top left output is A when
+C and A match and neither matches its other neighbour, and so on round the
+square; otherwise every output is P. padded is the row with its end pixels
+repeated one further out, so the comparisons never leave it.
+*/
+static void epxRow(const uint32_t *above, const uint32_t *padded, const uint32_t *below, int count,
+    uint32_t *top, uint32_t *bottom){
+    int x = 0;
+#if defined(__SSE2__)
+    for(; x + 4 <= count; x += 4){
+        __m128i p = _mm_loadu_si128((const __m128i*)(padded + x + 1));
+        __m128i a = _mm_loadu_si128((const __m128i*)(above + x));
+        __m128i b = _mm_loadu_si128((const __m128i*)(padded + x + 2));
+        __m128i c = _mm_loadu_si128((const __m128i*)(padded + x));
+        __m128i d = _mm_loadu_si128((const __m128i*)(below + x));
+        __m128i ca = _mm_cmpeq_epi32(c, a);
+        __m128i ab = _mm_cmpeq_epi32(a, b);
+        __m128i cd = _mm_cmpeq_epi32(c, d);
+        __m128i bd = _mm_cmpeq_epi32(b, d);
+        __m128i m0 = _mm_andnot_si128(_mm_or_si128(cd, ab), ca);
+        __m128i m1 = _mm_andnot_si128(_mm_or_si128(ca, bd), ab);
+        __m128i m2 = _mm_andnot_si128(_mm_or_si128(bd, ca), cd);
+        __m128i m3 = _mm_andnot_si128(_mm_or_si128(ab, cd), bd);
+        __m128i e0 = _mm_or_si128(_mm_and_si128(m0, a), _mm_andnot_si128(m0, p));
+        __m128i e1 = _mm_or_si128(_mm_and_si128(m1, b), _mm_andnot_si128(m1, p));
+        __m128i e2 = _mm_or_si128(_mm_and_si128(m2, c), _mm_andnot_si128(m2, p));
+        __m128i e3 = _mm_or_si128(_mm_and_si128(m3, d), _mm_andnot_si128(m3, p));
+        _mm_storeu_si128((__m128i*)(top + x * 2), _mm_unpacklo_epi32(e0, e1));
+        _mm_storeu_si128((__m128i*)(top + x * 2 + 4), _mm_unpackhi_epi32(e0, e1));
+        _mm_storeu_si128((__m128i*)(bottom + x * 2), _mm_unpacklo_epi32(e2, e3));
+        _mm_storeu_si128((__m128i*)(bottom + x * 2 + 4), _mm_unpackhi_epi32(e2, e3));
+    }
+#endif
+    for(; x < count; x++){
+        uint32_t p = padded[x + 1], a = above[x], b = padded[x + 2], c = padded[x], d = below[x];
+        top[x * 2] = c == a && c != d && a != b ? a : p;
+        top[x * 2 + 1] = a == b && a != c && b != d ? b : p;
+        bottom[x * 2] = d == c && d != b && c != a ? c : p;
+        bottom[x * 2 + 1] = b == d && b != a && d != c ? d : p;
+    }
+}
+
+Upscaler::Upscaler(int outWidth, int outHeight, int threads){
+    //Large enough for a hi-res screen at least once over
+    this->outWidth = std::max(outWidth, 128);
+    this->outHeight = std::max(outHeight, 64);
+    filter = UpscaleFilter::Nearest;
+    decay = 0;
+    width = 0;
+    height = 0;
+    settled = true;
+    source = nullptr;
+    target = nullptr;
+    scale = 1;
+    left = 0;
+    top = 0;
+    bandRows = 1;
+    bandCount = 0;
+    nextBand = 0;
+    generation = 0;
+    busy = 0;
+    stopping = false;
+
+    if(threads <= 0)
+        threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    scratch.resize(threads);
+    for(int i = 1; i < threads; i++)
+        workers.emplace_back(&Upscaler::workerLoop, this, i);
+}
+
+Upscaler::~Upscaler(){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(std::thread &worker : workers)
+        worker.join();
+}
+
+void Upscaler::setPhosphor(float decay){
+    this->decay = std::min(std::max(decay, 0.0f), 0.99f);
+    reset();
+}
+
+void Upscaler::reset(){
+    width = 0;
+    height = 0;
+    settled = true;
+}
+
+const char *Upscaler::filterName(UpscaleFilter filter){
+    switch(filter){
+        case UpscaleFilter::Scale2x: return "scale2x";
+        case UpscaleFilter::Scanlines: return "scanlines";
+        default: return "nearest";
+    }
+}
+
+bool Upscaler::parseFilter(const char *name, UpscaleFilter &filter){
+    if(strcmp(name, "nearest") == 0)
+        filter = UpscaleFilter::Nearest;
+    else if(strcmp(name, "scale2x") == 0 || strcmp(name, "epx") == 0)
+        filter = UpscaleFilter::Scale2x;
+    else if(strcmp(name, "scanlines") == 0)
+        filter = UpscaleFilter::Scanlines;
+    else
+        return false;
+    return true;
+}
+
+void Upscaler::blend(const uint32_t *pixels){
+    size_t count = (size_t)width * height;
+    if(decay <= 0){
+        memcpy(blended.data(), pixels, count * sizeof(uint32_t));
+        settled = true;
+        return;
+    }
+
+    //Four channels per pixel, lowest byte first: B, G, R, A
+    float *acc = phosphor.data();
+    int changing = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 keep = _mm_set1_ps(decay);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    for(; i + 4 <= count; i += 4){
+        __m128i in = _mm_loadu_si128((const __m128i*)(pixels + i));
+        __m128i lo = _mm_unpacklo_epi8(in, zero);
+        __m128i hi = _mm_unpackhi_epi8(in, zero);
+        __m128i channels[4] = { _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+            _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero) };
+        for(int k = 0; k < 4; k++){
+            float *pixel = acc + (i + k) * 4;
+            __m128 fresh = _mm_cvtepi32_ps(channels[k]);
+            __m128 rest = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(pixel), fresh), keep);
+            __m128 close = _mm_cmplt_ps(_mm_andnot_ps(sign, rest), half);
+            changing |= _mm_movemask_ps(close) ^ 0xF;
+            __m128 shown = _mm_add_ps(fresh, _mm_andnot_ps(close, rest));
+            _mm_storeu_ps(pixel, shown);
+            channels[k] = _mm_cvtps_epi32(shown);
+        }
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(channels[0], channels[1]),
+            _mm_packs_epi32(channels[2], channels[3]));
+        _mm_storeu_si128((__m128i*)(blended.data() + i), packed);
+    }
+#endif
+    for(; i < count; i++){
+        uint32_t out = 0;
+        for(int c = 0; c < 4; c++){
+            float fresh = (float)((pixels[i] >> (c * 8)) & 0xFF);
+            float rest = (acc[i * 4 + c] - fresh) * decay;
+            if(fabsf(rest) < 0.5f)
+                rest = 0;
+            else
+                changing = 1;
+            acc[i * 4 + c] = fresh + rest;
+            out |= (uint32_t)lrintf(fresh + rest) << (c * 8);
+        }
+        blended[i] = out;
+    }
+    settled = !changing;
+}
+
+void Upscaler::process(const uint32_t *pixels, int width, int height, uint32_t *out){
+    //A new size, or the first screen since a reset, is shown as it is and starts the phosphor
+    if(width != this->width || height != this->height){
+        this->width = width;
+        this->height = height;
+        blended.resize((size_t)width * height);
+        phosphor.resize((size_t)width * height * 4);
+        for(size_t i = 0; i < (size_t)width * height && decay > 0; i++){
+            for(int c = 0; c < 4; c++)
+                phosphor[i * 4 + c] = (float)((pixels[i] >> (c * 8)) & 0xFF);
+        }
+        for(std::vector<uint32_t> &rows : scratch)
+            rows.resize((size_t)width * 5 + 2);
+    }
+    blend(pixels);
+
+    scale = std::max(1, std::min(outWidth / width, outHeight / height));
+    left = (outWidth - width * scale) / 2;
+    top = (outHeight - height * scale) / 2;
+    //A few bands per thread, so one that's slow to wake doesn't hold the frame up
+    bandRows = std::max(1, height / (int)(scratch.size() * 2));
+    bandCount = (height + bandRows - 1) / bandRows;
+    source = blended.data();
+    target = out;
+    nextBand = 0;
+
+    if(workers.empty()){
+        runBands(0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        generation++;
+        busy = (int)workers.size();
+    }
+    wake.notify_all();
+    runBands(0);
+    std::unique_lock<std::mutex> guard(lock);
+    finished.wait(guard, [this]{ return busy == 0; });
+}
+
+void Upscaler::workerLoop(int index){
+    uint64_t seen = 0;
+    while(true){
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [&]{ return stopping || generation != seen; });
+            if(stopping)
+                return;
+            seen = generation;
+        }
+        runBands(index);
+        std::lock_guard<std::mutex> guard(lock);
+        if(--busy == 0)
+            finished.notify_one();
+    }
+}
+
+void Upscaler::runBands(int thread){
+    for(int band = nextBand++; band < bandCount; band = nextBand++)
+        scaleBand(band, thread);
+}
+
+void Upscaler::scaleBand(int band, int thread){
+    int first = band * bandRows;
+    int last = std::min(height, first + bandRows);
+    int span = width * scale;
+    int right = outWidth - left - span;
+
+    //The first and last bands also own the border above and below the screen
+    if(band == 0)
+        std::fill(target, target + (size_t)top * outWidth, BORDER);
+    if(band == bandCount - 1){
+        uint32_t *below = target + (size_t)(top + height * scale) * outWidth;
+        std::fill(below, target + (size_t)outHeight * outWidth, BORDER);
+    }
+
+    //EPX doubles, then squares fill out the rest. An odd scale can't be split like that
+    bool epx = filter == UpscaleFilter::Scale2x && scale % 2 == 0;
+    int dimmed = filter == UpscaleFilter::Scanlines && scale > 1 ? std::max(1, scale / 4) : 0;
+    uint32_t *padded = scratch[thread].data();
+    uint32_t *doubled = padded + width + 2;
+
+    for(int y = first; y < last; y++){
+        const uint32_t *row = source + (size_t)y * width;
+        uint32_t *out = target + (size_t)(top + y * scale) * outWidth;
+
+        if(epx){
+            const uint32_t *above = y > 0 ? row - width : row;
+            const uint32_t *below = y + 1 < height ? row + width : row;
+            padded[0] = row[0];
+            memcpy(padded + 1, row, width * sizeof(uint32_t));
+            padded[width + 1] = row[width - 1];
+            epxRow(above, padded, below, width, doubled, doubled + width * 2);
+
+            int half = scale / 2;
+            for(int r = 0; r < scale; r++){
+                uint32_t *line = out + (size_t)r * outWidth;
+                if(r % half == 0)
+                    replicateRow(doubled + (r / half) * width * 2, width * 2, half, line + left);
+                else
+                    memcpy(line + left, line + left - outWidth, span * sizeof(uint32_t));
+            }
+        }
+        else{
+            replicateRow(row, width, scale, out + left);
+            for(int r = 1; r < scale; r++){
+                uint32_t *line = out + (size_t)r * outWidth;
+                if(r >= scale - dimmed)
+                    dimRow(out + left, span, line + left);
+                else
+                    memcpy(line + left, out + left, span * sizeof(uint32_t));
+            }
+        }
+
+        for(int r = 0; r < scale; r++){
+            uint32_t *line = out + (size_t)r * outWidth;
+            std::fill(line, line + left, BORDER);
+            std::fill(line + left + span, line + left + span + right, BORDER);
+        }
+    }
+}
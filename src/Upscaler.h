@@ -0,0 +1,108 @@
+#ifndef UPSCALER_H
+#define UPSCALER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//How the screen is enlarged to the output size
+enum class UpscaleFilter : uint8_t{
+    Nearest, //Every pixel a solid square
+    Scale2x, //EPX: rounds off diagonal steps by doubling, then squares. Needs an even scale
+    Scanlines //Squares with the bottom quarter of each row dimmed, like the gaps on a CRT
+};
+
+/*
+Post-processing for the screen, on the CPU:
+A phosphor filter blends each new screen into the ones before it, so
+sprites that XOR drawing erases and redraws every other frame show as a
+steady, dimmer image instead of flickering. Every channel moves towards
+the new screen by (1 - decay) of the way each frame, and snaps to it once
+it's within half a step. The filter works at the emulated resolution, on
+four pixels at a time (SSE2).
+
+The blended screen is then scaled by the largest whole factor that fits
+the output and centred in it, with the border left black. Output rows are
+split into bands of whole emulated rows, which a pool of worker threads
+and the calling thread share. Each band is independent, so a frame needs
+no locking beyond handing out bands. Squares are written with 128-bit
+stores, EPX compares four pixels with their neighbours per instruction,
+and dimmed rows are scaled in 16-bit lanes.
+
+Everything goes to a caller-owned buffer. Nothing here knows about SDL,
+so the same frames can be produced and checked headless.
+*/
+class Upscaler{
+    private:
+        int outWidth;
+        int outHeight;
+        UpscaleFilter filter;
+        float decay;
+
+        //Phosphor state, four float channels per emulated pixel, and the blended screen it gives
+        std::vector<float> phosphor;
+        std::vector<uint32_t> blended;
+        int width;
+        int height;
+        bool settled; //The last blended screen was the input screen exactly
+
+        //The frame being scaled, for the workers
+        const uint32_t *source;
+        uint32_t *target;
+        int scale;
+        int left;
+        int top;
+        int bandRows; //Emulated rows per band
+        int bandCount;
+        std::atomic<int> nextBand;
+        std::vector<std::vector<uint32_t>> scratch; //One per thread, the calling thread's first
+
+        std::vector<std::thread> workers;
+        std::mutex lock;
+        std::condition_variable wake;
+        std::condition_variable finished;
+        uint64_t generation; //Bumped for every frame handed to the workers
+        int busy; //Workers still on the current frame
+        bool stopping;
+
+        void blend(const uint32_t *pixels);
+        void workerLoop(int index);
+        void runBands(int thread);
+        void scaleBand(int band, int thread);
+
+    public:
+        //threads counts the calling thread, 0 for one per core
+        Upscaler(int outWidth, int outHeight, int threads = 0);
+        ~Upscaler();
+        Upscaler(const Upscaler&) = delete;
+        Upscaler &operator=(const Upscaler&) = delete;
+
+        void setFilter(UpscaleFilter filter){ this->filter = filter; }
+        UpscaleFilter getFilter() const { return filter; }
+        //0 turns the phosphor off. Clamped below 1, where nothing would ever change
+        void setPhosphor(float decay);
+        float getPhosphor() const { return decay; }
+        //Forgets every screen before the next one
+        void reset();
+
+        //Blends a width x height ARGB8888 screen into the phosphor and scales it into
+        //out, which is getOutputWidth() x getOutputHeight(). The screen can change size
+        //between calls, which starts the phosphor over
+        void process(const uint32_t *pixels, int width, int height, uint32_t *out);
+        //False while the phosphor is still fading towards the last screen, so processing
+        //it again would give a different picture
+        bool isSettled() const { return settled; }
+
+        int getOutputWidth() const { return outWidth; }
+        int getOutputHeight() const { return outHeight; }
+        int getThreads() const { return (int)workers.size() + 1; }
+
+        static const char *filterName(UpscaleFilter filter);
+        static bool parseFilter(const char *name, UpscaleFilter &filter);
+};
+
+
+#endif
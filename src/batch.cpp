@@ -0,0 +1,316 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Aot.h"
+#include "Chip8.h"
+#include "Jit.h"
+#include "Movie.h"
+#include "QuirkDatabase.h"
+#include "RomStore.h"
+
+/*
+Headless corpus runner. Runs every ROM in a directory or ROM store for a
+fixed number of cycles or frames, spread over a pool of worker threads with
+one Chip8 per worker, and prints a line per ROM.
+*/
+
+struct BatchResult{
+    std::string name;
+    bool loaded = false;
+    Chip8Quirks quirks = Chip8Quirks::Default;
+    Chip8Fault fault = Chip8Fault::None;
+    uint16_t faultOpcode = 0;
+    uint64_t instructions = 0;
+    double seconds = 0;
+    uint64_t hash = 0;
+    bool compiled = false; //Ran through a module compiled ahead of time
+    bool diverged = false; //The JIT or compiled module disagreed with the interpreter
+    bool unchecked = false; //A differential run on a platform or quirk profile the shadow can't check
+    uint16_t divergedPC = 0;
+};
+
+//A ROM file, or one in a ROM store when stored.data is set
+struct BatchROM{
+    std::filesystem::path path;
+    RomInfo stored = {};
+};
+
+struct BatchOptions{
+    const char *romDir = nullptr;
+    uint64_t cycles = 0;
+    uint64_t frames = 0;
+    int cyclesPerFrame = 9; //~540 instructions per second at 60 frames per second
+    unsigned threads = 0;
+    uint64_t seed = 0; //Every ROM gets the same seed, so results are reproducible
+    Chip8Platform platform = Chip8Platform::Chip8;
+    bool platformGiven = false; //Otherwise stored ROMs run on the platform they were indexed as
+    Chip8Quirks quirks = Chip8Quirks::Default; //Used for every ROM when given, ahead of the database
+    bool quirksGiven = false;
+    QuirkDatabase quirkDb;
+    bool jit = false;
+    bool aot = false;
+    bool differential = false;
+};
+
+static void usage(){
+    printf("Usage: chip8-batch <ROM directory or store> [--cycles N | --frames N] [--ipf N] [--threads N] [--seed N] [--platform chip8|schip|xochip]\n"
+        "                   [--quirks modern|vip|schip|xochip] [--quirk-db FILE] [--jit | --jit-diff | --aot | --aot-diff]\n");
+}
+
+static bool parseArgs(int argc, char **argv, BatchOptions &opts){
+    for(int i = 1; i < argc; i++){
+        const char *arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(strcmp(arg, "--cycles") == 0 && hasValue)
+            opts.cycles = strtoull(argv[++i], nullptr, 10);
+        else if(strcmp(arg, "--frames") == 0 && hasValue)
+            opts.frames = strtoull(argv[++i], nullptr, 10);
+        else if(strcmp(arg, "--ipf") == 0 && hasValue)
+            opts.cyclesPerFrame = atoi(argv[++i]);
+        else if(strcmp(arg, "--threads") == 0 && hasValue)
+            opts.threads = (unsigned)atoi(argv[++i]);
+        else if(strcmp(arg, "--seed") == 0 && hasValue)
+            opts.seed = strtoull(argv[++i], nullptr, 0);
+        else if(strcmp(arg, "--platform") == 0 && hasValue){
+            opts.platformGiven = true;
+            if(!Chip8::parsePlatform(argv[++i], opts.platform))
+                return false;
+        }
+        else if(strcmp(arg, "--quirks") == 0 && hasValue){
+            opts.quirksGiven = true;
+            if(!Chip8::parseQuirks(argv[++i], opts.quirks))
+                return false;
+        }
+        else if(strcmp(arg, "--quirk-db") == 0 && hasValue){
+            int errorLine = 0;
+            if(!opts.quirkDb.load(argv[++i], &errorLine)){
+                if(errorLine)
+                    printf("%s:%d: expected a 16 digit ROM hash and a quirk profile\n", argv[i], errorLine);
+                else
+                    printf("Could not read %s\n", argv[i]);
+                return false;
+            }
+        }
+        else if(strcmp(arg, "--jit") == 0)
+            opts.jit = true;
+        else if(strcmp(arg, "--jit-diff") == 0)
+            opts.jit = opts.differential = true;
+        else if(strcmp(arg, "--aot") == 0)
+            opts.aot = true;
+        else if(strcmp(arg, "--aot-diff") == 0)
+            opts.aot = opts.differential = true;
+        else if(arg[0] != '-' && !opts.romDir)
+            opts.romDir = arg;
+        else
+            return false;
+    }
+    if(!opts.romDir || opts.cyclesPerFrame <= 0 || (opts.jit && opts.aot))
+        return false;
+    if(opts.cycles == 0 && opts.frames == 0)
+        opts.frames = 600;
+    if(opts.threads == 0)
+        opts.threads = std::max(1u, std::thread::hardware_concurrency());
+    return true;
+}
+
+static bool readFile(const std::filesystem::path &path, std::vector<uint8_t> &out){
+    std::ifstream file(path, std::ios::binary);
+    if(!file.is_open())
+        return false;
+    out.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static void runROM(Chip8 &chip8, const BatchOptions &opts, const BatchROM &rom, BatchResult &result){
+    std::vector<uint8_t> file;
+    const uint8_t *data = rom.stored.data;
+    size_t size = rom.stored.size;
+    Chip8Platform platform = opts.platform;
+    if(data){
+        result.name = rom.stored.name;
+        if(!opts.platformGiven)
+            platform = rom.stored.platform;
+    }
+    else{
+        result.name = rom.path.filename().string();
+        if(!readFile(rom.path, file))
+            return;
+        data = file.data();
+        size = file.size();
+    }
+    //Only the classic machine runs through the JIT and compiled modules, so there's nothing to check
+    //anywhere else. Passing such a ROM would look like a clean comparison that never happened
+    if(opts.differential && platform != Chip8Platform::Chip8){
+        result.unchecked = true;
+        return;
+    }
+    if(chip8.getPlatform() != platform)
+        chip8.setPlatform(platform);
+    chip8.setSeed(opts.seed);
+    if(!chip8.LoadROM(data, size))
+        return;
+    result.loaded = true;
+
+    //--quirks, then the database, then the profile the store has for the ROM
+    uint64_t hash = rom.stored.data ? rom.stored.hash : Movie::hashROM(data, size);
+    Chip8Quirks quirks = opts.quirks;
+    if(!opts.quirksGiven && !opts.quirkDb.lookup(hash, quirks) && rom.stored.data && rom.stored.quirksListed)
+        quirks = rom.stored.quirks;
+    chip8.setQuirks(quirks);
+    result.quirks = chip8.getQuirks();
+
+    Chip8Jit *jit = nullptr;
+    if(opts.jit){
+        jit = new Chip8Jit(chip8);
+        //Other quirk profiles run in the interpreter under the JIT too, so the same goes for them
+        if(opts.differential && !jit->translatable()){
+            delete jit;
+            result.unchecked = true;
+            return;
+        }
+        jit->setDifferential(opts.differential);
+    }
+    //ROMs without a module compiled in for them run through the interpreter
+    Chip8Aot *native = nullptr;
+    const Chip8AotModule *module = opts.aot && platform == Chip8Platform::Chip8 ?
+        Chip8Aot::findModule(hash, result.quirks) : nullptr;
+    if(module){
+        native = new Chip8Aot(chip8, *module);
+        native->setDifferential(opts.differential);
+        result.compiled = true;
+    }
+
+    //Cycle budgets still run in frames so the timers tick at the usual rate
+    uint64_t budget = opts.cycles ? opts.cycles : opts.frames * opts.cyclesPerFrame;
+    uint64_t executed = 0;
+    auto start = std::chrono::steady_clock::now();
+    while(executed < budget && chip8.getFault() == Chip8Fault::None && !(jit && jit->hasDiverged()) &&
+        !(native && native->hasDiverged())){
+        int frame = (int)std::min<uint64_t>(opts.cyclesPerFrame, budget - executed);
+        executed += jit ? jit->runFrame(frame) : native ? native->runFrame(frame) : chip8.runFrame(frame);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    if(jit){
+        result.diverged = jit->hasDiverged();
+        result.divergedPC = jit->getDivergedPC();
+        delete jit;
+    }
+    if(native){
+        result.diverged = native->hasDiverged();
+        result.divergedPC = native->getDivergedPC();
+        delete native;
+    }
+
+    result.instructions = executed;
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    result.fault = chip8.getFault();
+    result.faultOpcode = chip8.getOpcode();
+    result.hash = chip8.framebufferHash();
+}
+
+int main(int argc, char **argv){
+    BatchOptions opts;
+    if(!parseArgs(argc, argv, opts)){
+        usage();
+        return 2;
+    }
+    if(opts.differential && opts.platform != Chip8Platform::Chip8){
+        printf("--jit-diff and --aot-diff only check the chip8 platform\n");
+        return 2;
+    }
+    if(opts.jit && !Chip8Jit::supported())
+        printf("JIT not supported on this platform, using the interpreter\n");
+
+    //A store is mapped rather than read, and its ROMs are copied straight out of the mapping
+    std::vector<BatchROM> roms;
+    RomStore store;
+    if(RomStore::isArchive(opts.romDir)){
+        if(!store.open(opts.romDir)){
+            printf("Could not open ROM store %s\n", opts.romDir);
+            return 2;
+        }
+        roms.resize(store.size());
+        for(size_t i = 0; i < store.size(); i++)
+            roms[i].stored = store.get(i);
+        std::sort(roms.begin(), roms.end(), [](const BatchROM &a, const BatchROM &b){ return a.stored.name < b.stored.name; });
+    }
+    else{
+        std::error_code err;
+        for(const auto &entry : std::filesystem::directory_iterator(opts.romDir, err)){
+            if(entry.is_regular_file())
+                roms.push_back({ entry.path() });
+        }
+        if(err){
+            printf("Could not read ROM directory %s: %s\n", opts.romDir, err.message().c_str());
+            return 2;
+        }
+        std::sort(roms.begin(), roms.end(), [](const BatchROM &a, const BatchROM &b){ return a.path < b.path; });
+    }
+
+    std::vector<BatchResult> results(roms.size());
+    std::atomic<size_t> next(0);
+
+    //Workers pull the next ROM index until the list runs out
+    std::vector<std::thread> workers;
+    unsigned threadCount = std::min<size_t>(opts.threads, std::max<size_t>(roms.size(), 1));
+    auto wallStart = std::chrono::steady_clock::now();
+    for(unsigned t = 0; t < threadCount; t++){
+        workers.emplace_back([&](){
+            Chip8 *chip8 = new Chip8();
+            chip8->setPlatform(opts.platform);
+            for(size_t i = next++; i < roms.size(); i = next++)
+                runROM(*chip8, opts, roms[i], results[i]);
+            delete chip8;
+        });
+    }
+    for(auto &worker : workers)
+        worker.join();
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+    int failures = 0;
+    uint64_t totalInstructions = 0;
+    printf("%-32s %-26s %-7s %12s %14s %18s\n", "ROM", "STATUS", "QUIRKS", "INSTRUCTIONS", "IPS", "FRAMEBUFFER");
+    for(const BatchResult &r : results){
+        char status[32];
+        if(r.unchecked && r.loaded)
+            snprintf(status, sizeof(status), "%s quirks, can't diff", Chip8::quirksName(r.quirks));
+        else if(r.unchecked)
+            snprintf(status, sizeof(status), "not chip8, can't diff");
+        else if(!r.loaded)
+            snprintf(status, sizeof(status), "load error");
+        else if(r.diverged)
+            snprintf(status, sizeof(status), "%s mismatch at %.3X", opts.jit ? "jit" : "aot", r.divergedPC);
+        else if(r.fault == Chip8Fault::Exited)
+            snprintf(status, sizeof(status), "exited");
+        else if(r.fault != Chip8Fault::None)
+            snprintf(status, sizeof(status), "%s %.4X", Chip8::faultName(r.fault), r.faultOpcode);
+        else
+            snprintf(status, sizeof(status), r.compiled ? "ok (aot)" : "ok");
+
+        //A ROM that exits on its own hasn't failed
+        bool faulted = r.fault != Chip8Fault::None && r.fault != Chip8Fault::Exited;
+        if(r.unchecked || !r.loaded || faulted || r.diverged)
+            failures++;
+        totalInstructions += r.instructions;
+
+        double ips = r.seconds > 0 ? r.instructions / r.seconds : 0;
+        printf("%-32s %-26s %-7s %12llu %14.0f %016llX\n", r.name.c_str(), status,
+            r.loaded ? Chip8::quirksName(r.quirks) : "-", (unsigned long long)r.instructions, ips, (unsigned long long)r.hash);
+    }
+    printf("\n%zu ROMs, %d failed, %u threads, %.3fs wall, %.0f aggregate IPS\n", results.size(), failures,
+        threadCount, wallSeconds, wallSeconds > 0 ? totalInstructions / wallSeconds : 0);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,404 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "Chip8.h"
+#include "Jit.h"
+#include "Profiler.h"
+
+/*
+Benchmark suite for the execution backends. Every benchmark is a ROM run
+for a fixed number of cycles on a fresh instance:
+- micro/...: one opcode class repeated in a tight loop
+- synthetic/...: generated instruction mixes from a fixed seed
+- rom/...: whole ROMs from --roms
+Each one runs through the interpreter's batched run(), the per-cycle
+executeCycle() path, the JIT and, in builds with CHIP8_PROFILE, the
+interpreter with a profiler attached, and reports ns per instruction and
+instructions per second, as a table or as JSON for tracking across builds.
+--quirks runs them under other quirk profiles too. Each profile has its own
+interpreter loop, so the modern one should match a build configured with
+-DCHIP8_SINGLE_PROFILE=ON, which has no other loops to pick from. The JSON
+records which of the two a run came from.
+*/
+
+struct BenchCase{
+    std::string name;
+    std::vector<uint8_t> rom;
+};
+
+struct BenchResult{
+    std::string name;
+    const char *backend;
+    const char *quirks;
+    bool ok;
+    uint64_t instructions;
+    double seconds;
+};
+
+struct BenchOptions{
+    uint64_t cycles = 10000000;
+    int repeat = 3; //Best of this many runs
+    bool interpreter = true;
+    bool stepper = true;
+    bool jit = true;
+    bool profiled = true;
+    std::vector<Chip8Quirks> quirks = { Chip8Quirks::Modern };
+    const char *filter = nullptr;
+    const char *romDir = nullptr;
+    const char *jsonPath = nullptr; //"-" for stdout
+};
+
+static void usage(){
+    printf("Usage: chip8_bench [--cycles N] [--repeat N] [--backend interp|step|jit|prof|all]"
+        " [--quirks modern|vip|schip|xochip|all] [--filter TEXT] [--roms DIR] [--json FILE|-]\n");
+}
+
+static bool parseArgs(int argc, char **argv, BenchOptions &opts){
+    for(int i = 1; i < argc; i++){
+        const char *arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(strcmp(arg, "--cycles") == 0 && hasValue)
+            opts.cycles = strtoull(argv[++i], nullptr, 10);
+        else if(strcmp(arg, "--repeat") == 0 && hasValue)
+            opts.repeat = atoi(argv[++i]);
+        else if(strcmp(arg, "--backend") == 0 && hasValue){
+            const char *name = argv[++i];
+            bool all = strcmp(name, "all") == 0;
+            opts.interpreter = all || strcmp(name, "interp") == 0;
+            opts.stepper = all || strcmp(name, "step") == 0;
+            opts.jit = all || strcmp(name, "jit") == 0;
+            opts.profiled = all || strcmp(name, "prof") == 0;
+            if(!opts.interpreter && !opts.stepper && !opts.jit && !opts.profiled)
+                return false;
+        }
+        else if(strcmp(arg, "--quirks") == 0 && hasValue){
+            const char *name = argv[++i];
+            Chip8Quirks quirks;
+            if(strcmp(name, "all") == 0)
+                opts.quirks = { Chip8Quirks::Modern, Chip8Quirks::VIP, Chip8Quirks::SuperChip, Chip8Quirks::XOChip };
+            else if(Chip8::parseQuirks(name, quirks) && quirks != Chip8Quirks::Default)
+                opts.quirks = { quirks };
+            else
+                return false;
+            //A single-profile build would quietly run every profile as modern
+            if(Chip8::singleProfile() && (opts.quirks.size() != 1 || opts.quirks[0] != Chip8Quirks::Modern)){
+                fprintf(stderr, "This build only has the modern profile (CHIP8_SINGLE_PROFILE)\n");
+                return false;
+            }
+        }
+        else if(strcmp(arg, "--filter") == 0 && hasValue)
+            opts.filter = argv[++i];
+        else if(strcmp(arg, "--roms") == 0 && hasValue)
+            opts.romDir = argv[++i];
+        else if(strcmp(arg, "--json") == 0 && hasValue)
+            opts.jsonPath = argv[++i];
+        else
+            return false;
+    }
+    return opts.cycles > 0 && opts.repeat > 0;
+}
+
+//Builds a ROM that runs setup once and then loops over body forever
+class LoopBuilder{
+    private:
+        std::vector<uint8_t> rom;
+        size_t loopStart = 0;
+
+    public:
+        void op(uint16_t opcode){
+            rom.push_back(opcode >> 8);
+            rom.push_back(opcode & 0xFF);
+        }
+
+        void startLoop(){ loopStart = rom.size(); }
+
+        //Setting the delay timer is a side effect to the interpreter's idle loop
+        //detection, so it never skips passes and every instruction really runs
+        std::vector<uint8_t> finish(){
+            op(0xF015);
+            op(0x1000 | (uint16_t)(0x200 + loopStart));
+            return rom;
+        }
+};
+
+static const int BODY = 64; //Opcodes per loop iteration, so the closing jump stays a small share
+
+static BenchCase loopCase(const char *name, std::vector<uint16_t> setup, std::vector<uint16_t> body){
+    LoopBuilder b;
+    for(uint16_t op : setup)
+        b.op(op);
+    b.startLoop();
+    for(int i = 0; i < BODY; i += (int)body.size()){
+        for(uint16_t op : body)
+            b.op(op);
+    }
+    return { name, b.finish() };
+}
+
+//Setup for anything touching memory through I: a sprite to draw at 0x300 and I pointing at it
+static std::vector<uint16_t> spriteSetup(){
+    return { 0xA300, 0x60FF, 0xF055, 0x6000 };
+}
+
+static void addMicroCases(std::vector<BenchCase> &cases){
+    cases.push_back(loopCase("micro/alu-imm", {}, { 0x6012, 0x7105, 0x6234, 0x7301 }));
+    cases.push_back(loopCase("micro/alu-8xyn", { 0x6013, 0x6127 },
+        { 0x8010, 0x8011, 0x8012, 0x8013, 0x8014, 0x8015, 0x8016, 0x8017, 0x801E, 0x8124 }));
+    cases.push_back(loopCase("micro/index", {}, { 0xA400, 0xF01E, 0xF129, 0xA123 }));
+    //V0 is 0: 3000 and 4001 skip the following filler, 3001 and 4000 don't
+    cases.push_back(loopCase("micro/skip-taken", { 0x6000 }, { 0x3000, 0x6101, 0x4001, 0x6101 }));
+    cases.push_back(loopCase("micro/skip-not-taken", { 0x6000 }, { 0x3001, 0x6101, 0x4000, 0x6101 }));
+    cases.push_back(loopCase("micro/skip-reg", { 0x6000, 0x6100 }, { 0x5010, 0x6201, 0x9010, 0x6201 }));
+
+    //Sprites of height 1, 5 and 15 at a byte-aligned column, an unaligned one and
+    //both wrapping edges. V0 holds x and V1 holds y
+    struct DrawPos{ const char *name; uint8_t x; uint8_t y; };
+    const DrawPos positions[] = { { "aligned", 8, 4 }, { "unaligned", 13, 4 }, { "wrap-x", 60, 4 }, { "wrap-y", 13, 28 } };
+    const int heights[] = { 1, 5, 15 };
+    for(const DrawPos &pos : positions){
+        for(int h : heights){
+            std::vector<uint16_t> setup = spriteSetup();
+            setup.push_back(0x6000 | pos.x);
+            setup.push_back(0x6100 | pos.y);
+            std::string name = std::string("micro/draw-h") + std::to_string(h) + "-" + pos.name;
+            cases.push_back(loopCase(name.c_str(), setup, { (uint16_t)(0xD010 | h) }));
+        }
+    }
+
+    cases.push_back(loopCase("micro/bcd", { 0xA800, 0x60FE }, { 0xF033 }));
+    //I is set every time, since some quirk profiles move it on
+    cases.push_back(loopCase("micro/store-16", {}, { 0xA800, 0xFF55 }));
+    cases.push_back(loopCase("micro/load-16", {}, { 0xA800, 0xFF65 }));
+    cases.push_back(loopCase("micro/cls", {}, { 0x00E0 }));
+    //200: call 204, 202: jump 200, 204: return
+    cases.push_back({ "micro/call-ret", { 0x22, 0x04, 0x12, 0x00, 0x00, 0xEE } });
+}
+
+//Straight-line mixes of random opcodes from a fixed seed. The mixed flavour also
+//draws and goes through memory, always with I freshly pointed at a safe buffer
+static BenchCase syntheticCase(const char *name, uint32_t seed, bool mixed){
+    uint32_t state = seed;
+    auto next = [&state](){
+        state = state * 1664525u + 1013904223u;
+        return (uint16_t)(state >> 16);
+    };
+
+    LoopBuilder b;
+    b.startLoop();
+    for(int i = 0; i < 256; i++){
+        uint16_t r = next();
+        uint16_t x = (r >> 8) & 0xF;
+        uint16_t y = (r >> 4) & 0xF;
+        int kind = next() % (mixed ? 9 : 6);
+        switch(kind){
+            case 0: b.op(0x6000 | x << 8 | (r & 0xFF)); break;
+            case 1: b.op(0x7000 | x << 8 | (r & 0xFF)); break;
+            case 2: b.op(0x8000 | x << 8 | y << 4 | "\x00\x01\x02\x03\x04\x05\x06\x07\x0E"[r % 9]); break;
+            case 3: b.op(0xC000 | x << 8 | (r & 0xFF)); break;
+            case 4: b.op(0xA000 | (0x300 + (r & 0x3FF))); break;
+            case 5: b.op(0x3000 | x << 8 | (r & 0x3)); b.op(0x6000 | x << 8); break;
+            case 6: b.op(0xA800); b.op(0xD000 | x << 8 | y << 4 | (1 + (r & 7))); break;
+            case 7: b.op(0xA800); b.op(0xF033 | x << 8); break;
+            case 8: b.op(0xA900); b.op((r & 1 ? 0xF055 : 0xF065) | x << 8); break;
+        }
+    }
+    //Keep a trailing skip from jumping over the loop's closing jump
+    b.op(0x6000);
+    return { name, b.finish() };
+}
+
+static bool addROMCases(const char *dir, std::vector<BenchCase> &cases){
+    std::vector<std::filesystem::path> roms;
+    std::error_code err;
+    for(const auto &entry : std::filesystem::directory_iterator(dir, err)){
+        if(entry.is_regular_file())
+            roms.push_back(entry.path());
+    }
+    if(err){
+        printf("Could not read ROM directory %s: %s\n", dir, err.message().c_str());
+        return false;
+    }
+    std::sort(roms.begin(), roms.end());
+
+    for(const auto &path : roms){
+        std::ifstream file(path, std::ios::binary);
+        std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        cases.push_back({ "rom/" + path.filename().string(), rom });
+    }
+    return true;
+}
+
+enum class Backend{ Interpreter, Stepper, Jit, Profiled };
+
+static const char *backendName(Backend backend){
+    switch(backend){
+        case Backend::Interpreter: return "interp";
+        case Backend::Stepper: return "step";
+        case Backend::Profiled: return "prof";
+        default: return "jit";
+    }
+}
+
+//Runs one case once on a fresh instance and returns false if it faulted before the budget
+static bool runOnce(const BenchCase &c, Backend backend, Chip8Quirks quirks, uint64_t cycles, Chip8 &chip8,
+    uint64_t &executed, double &seconds){
+    chip8.setQuirks(quirks);
+    executed = 0;
+    seconds = 0;
+    if(!chip8.LoadROM(c.rom.data(), c.rom.size()))
+        return false;
+    Chip8Jit *jit = backend == Backend::Jit ? new Chip8Jit(chip8) : nullptr;
+    Profiler *profiler = backend == Backend::Profiled ? new Profiler() : nullptr;
+    chip8.setProfiler(profiler);
+
+    //Timers tick between chunks so whole ROMs waiting on them still make progress
+    const uint64_t chunk = 1 << 16;
+    auto start = std::chrono::steady_clock::now();
+    while(executed < cycles && chip8.getFault() == Chip8Fault::None){
+        uint64_t n = std::min(chunk, cycles - executed);
+        if(backend == Backend::Stepper){
+            for(uint64_t i = 0; i < n && chip8.getFault() == Chip8Fault::None; i++){
+                chip8.executeCycle();
+                executed += chip8.getFault() == Chip8Fault::None;
+            }
+        }
+        else{
+            executed += jit ? jit->run(n) : chip8.run(n);
+        }
+        chip8.tickTimers();
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    chip8.setProfiler(nullptr);
+    delete profiler;
+    delete jit;
+    return chip8.getFault() == Chip8Fault::None;
+}
+
+//Names come from ROM filenames, which can hold anything a JSON string can't
+static void writeJSONString(FILE *out, const char *text){
+    fputc('"', out);
+    for(const unsigned char *c = (const unsigned char*)text; *c; c++){
+        if(*c == '"' || *c == '\\')
+            fprintf(out, "\\%c", *c);
+        else if(*c < 0x20)
+            fprintf(out, "\\u%04X", *c);
+        else
+            fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+static void writeJSON(FILE *out, const std::vector<BenchResult> &results, const BenchOptions &opts){
+    fprintf(out, "{\n  \"cycles\": %llu,\n  \"repeat\": %d,\n", (unsigned long long)opts.cycles, opts.repeat);
+#if defined(__VERSION__)
+    fprintf(out, "  \"compiler\": ");
+    writeJSONString(out, __VERSION__);
+    fprintf(out, ",\n");
+#endif
+#if defined(__AVX2__)
+    fprintf(out, "  \"avx2\": true,\n");
+#else
+    fprintf(out, "  \"avx2\": false,\n");
+#endif
+    fprintf(out, "  \"profiler_compiled\": %s,\n", Chip8::profilingAvailable() ? "true" : "false");
+    fprintf(out, "  \"single_profile\": %s,\n", Chip8::singleProfile() ? "true" : "false");
+    fprintf(out, "  \"jit_native\": %s,\n  \"benchmarks\": [\n", Chip8Jit::supported() ? "true" : "false");
+    for(size_t i = 0; i < results.size(); i++){
+        const BenchResult &r = results[i];
+        double ns = r.instructions ? r.seconds * 1e9 / r.instructions : 0;
+        double ips = r.seconds > 0 ? r.instructions / r.seconds : 0;
+        fprintf(out, "    {\"name\": ");
+        writeJSONString(out, r.name.c_str());
+        fprintf(out, ", \"backend\": \"%s\", \"quirks\": \"%s\", \"ok\": %s, \"instructions\": %llu, "
+            "\"seconds\": %.6f, \"ns_per_instruction\": %.4f, \"instructions_per_second\": %.0f}%s\n",
+            r.backend, r.quirks, r.ok ? "true" : "false", (unsigned long long)r.instructions,
+            r.seconds, ns, ips, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char **argv){
+    BenchOptions opts;
+    if(!parseArgs(argc, argv, opts)){
+        usage();
+        return 2;
+    }
+
+    std::vector<BenchCase> cases;
+    addMicroCases(cases);
+    cases.push_back(syntheticCase("synthetic/alu", 1, false));
+    cases.push_back(syntheticCase("synthetic/mixed", 2, true));
+    if(opts.romDir && !addROMCases(opts.romDir, cases))
+        return 2;
+
+    std::vector<Backend> backends;
+    if(opts.interpreter)
+        backends.push_back(Backend::Interpreter);
+    if(opts.stepper)
+        backends.push_back(Backend::Stepper);
+    if(opts.jit)
+        backends.push_back(Backend::Jit);
+    if(opts.profiled && Chip8::profilingAvailable())
+        backends.push_back(Backend::Profiled);
+
+    //Table goes to stdout unless the JSON does
+    bool table = !opts.jsonPath || strcmp(opts.jsonPath, "-") != 0;
+    if(table)
+        printf("%-32s %-8s %-7s %12s %10s %14s\n", "BENCHMARK", "BACKEND", "QUIRKS", "INSTRUCTIONS", "NS/INSTR", "IPS");
+
+    Chip8 *chip8 = new Chip8();
+    std::vector<BenchResult> results;
+    int failures = 0;
+    for(const BenchCase &c : cases){
+        if(opts.filter && c.name.find(opts.filter) == std::string::npos)
+            continue;
+        for(Chip8Quirks quirks : opts.quirks){
+            for(Backend backend : backends){
+                BenchResult r = { c.name, backendName(backend), Chip8::quirksName(quirks), true, 0, 0 };
+                for(int i = 0; i < opts.repeat; i++){
+                    uint64_t executed;
+                    double seconds;
+                    bool ok = runOnce(c, backend, quirks, opts.cycles, *chip8, executed, seconds);
+                    r.ok = r.ok && ok;
+                    if(i == 0 || seconds < r.seconds){
+                        r.instructions = executed;
+                        r.seconds = seconds;
+                    }
+                }
+                if(!r.ok)
+                    failures++;
+                results.push_back(r);
+
+                if(table){
+                    double ns = r.instructions ? r.seconds * 1e9 / r.instructions : 0;
+                    printf("%-32s %-8s %-7s %12llu %10.3f %14.0f%s\n", r.name.c_str(), r.backend, r.quirks,
+                        (unsigned long long)r.instructions, ns, r.seconds > 0 ? r.instructions / r.seconds : 0,
+                        r.ok ? "" : "  (faulted)");
+                }
+            }
+        }
+    }
+    delete chip8;
+
+    if(opts.jsonPath){
+        FILE *out = strcmp(opts.jsonPath, "-") == 0 ? stdout : fopen(opts.jsonPath, "w");
+        if(!out){
+            printf("Could not write %s\n", opts.jsonPath);
+            return 2;
+        }
+        writeJSON(out, results, opts);
+        if(out != stdout)
+            fclose(out);
+    }
+    return failures ? 1 : 0;
+}
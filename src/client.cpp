@@ -0,0 +1,354 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Chip8.h"
+#include "FrameStream.h"
+#include "Net.h"
+
+/*
+Load and latency test client for chip8-server. Opens any number of sessions
+from one thread, presses random keys on each and checks every frame that
+comes back: sequence numbers must be contiguous and the rebuilt screen must
+match the server's checksum, otherwise the session asks for a keyframe and
+the miss counts as an error. Latency is the time from sending a Keys message
+to receiving the first frame that ran with it.
+*/
+
+typedef std::chrono::steady_clock Clock;
+
+struct ClientSession{
+    int fd = -1;
+    bool open = false;
+    std::string reason; //From the server's Closed message
+    std::vector<uint8_t> in;
+    std::vector<uint8_t> out;
+
+    uint32_t id = 0;
+    uint8_t image[FrameStream::MAX_IMAGE];
+    uint8_t width = 0, height = 0, planes = 0;
+    bool valid = false; //image matches the server's, until a frame is lost
+    uint32_t nextSequence = 0;
+
+    uint16_t keys = 0;
+    uint32_t input = 0;
+    std::deque<std::pair<uint32_t, Clock::time_point>> inFlight; //Keys messages not seen in a frame yet
+    Clock::time_point nextKeys;
+
+    uint64_t frames = 0; //Frame messages received
+    uint64_t keyframes = 0;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+    uint32_t firstFrame = 0, lastFrame = 0;
+    Clock::time_point firstTime, lastTime;
+    std::vector<double> latencies; //Milliseconds
+};
+
+static void usage(){
+    printf("Usage: chip8-client [--connect [HOST:]PORT | unix:PATH] [--sessions N] [--seconds S] [--rom NAME] [--seed N]\n"
+        "                    [--key-interval MS] [--quiet]\n");
+}
+
+static double percentile(std::vector<double> &values, double p){
+    if(values.empty())
+        return 0;
+    size_t n = std::min(values.size() - 1, (size_t)(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + n, values.end());
+    return values[n];
+}
+
+static void sendHello(ClientSession &s, uint64_t seed, const char *rom){
+    size_t length = strlen(rom);
+    size_t start = FrameStream::beginMessage(s.out, StreamMessage::Hello);
+    FrameStream::put(s.out, FrameStream::VERSION, 2);
+    FrameStream::put(s.out, seed, 8);
+    s.out.push_back((uint8_t)length);
+    s.out.insert(s.out.end(), rom, rom + length);
+    FrameStream::finishMessage(s.out, start);
+}
+
+static void requestKeyframe(ClientSession &s){
+    s.valid = false;
+    size_t start = FrameStream::beginMessage(s.out, StreamMessage::Keyframe);
+    FrameStream::finishMessage(s.out, start);
+}
+
+static void handleFrame(ClientSession &s, const StreamFrame &frame, Clock::time_point now){
+    if(s.frames == 0){
+        s.firstFrame = frame.frame;
+        s.firstTime = now;
+    }
+    s.frames++;
+    s.lastFrame = frame.frame;
+    s.lastTime = now;
+
+    //Every Keys message up to the one the frame ran with has now been seen
+    while(!s.inFlight.empty() && (int32_t)(frame.input - s.inFlight.front().first) >= 0){
+        if(s.inFlight.front().first == frame.input)
+            s.latencies.push_back(std::chrono::duration<double, std::milli>(now - s.inFlight.front().second).count());
+        s.inFlight.pop_front();
+    }
+
+    bool lost = frame.sequence != s.nextSequence;
+    s.nextSequence = frame.sequence + 1;
+    if(frame.flags & StreamFrame::KEYFRAME){
+        memset(s.image, 0, sizeof(s.image));
+        s.width = frame.width;
+        s.height = frame.height;
+        s.planes = frame.planes;
+        s.valid = true;
+        s.keyframes++;
+    }
+    else if(lost || frame.width != s.width || frame.height != s.height || frame.planes != s.planes){
+        s.errors++;
+        requestKeyframe(s);
+        return;
+    }
+    //Deltas after a miss are useless until the keyframe arrives
+    if(!s.valid)
+        return;
+
+    size_t size = FrameStream::imageSize(frame.width, frame.height, frame.planes);
+    if(!FrameStream::applyDelta(frame.delta, frame.deltaSize, s.image, size) ||
+        FrameStream::checksum(s.image, size) != frame.checksum){
+        s.errors++;
+        requestKeyframe(s);
+    }
+}
+
+//False once the connection is over
+static bool receive(ClientSession &s, Clock::time_point now){
+    uint8_t buffer[16384];
+    //Whatever arrived before the server hung up still gets read, its Closed message most of all
+    bool connected = true;
+    while(connected){
+        ssize_t got = recv(s.fd, buffer, sizeof(buffer), 0);
+        if(got == 0)
+            connected = false;
+        if(got <= 0){
+            if(got < 0 && errno == EINTR)
+                continue;
+            if(got < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                connected = false;
+            break;
+        }
+        s.bytes += got;
+        s.in.insert(s.in.end(), buffer, buffer + got);
+    }
+
+    size_t pos = 0;
+    StreamMessage type;
+    const uint8_t *payload;
+    size_t length;
+    for(;;){
+        size_t used = FrameStream::nextMessage(s.in.data() + pos, s.in.size() - pos, type, payload, length);
+        if(used == 0)
+            break;
+        pos += used;
+        if(type == StreamMessage::Welcome && length >= 6){
+            const uint8_t *p = payload + 2;
+            s.id = (uint32_t)FrameStream::get(p, 4);
+        }
+        else if(type == StreamMessage::Frame){
+            StreamFrame frame;
+            if(FrameStream::parseFrame(payload, length, frame))
+                handleFrame(s, frame, now);
+            else
+                s.errors++;
+        }
+        else if(type == StreamMessage::Closed){
+            s.reason.assign((const char*)payload, length);
+            return false;
+        }
+    }
+    s.in.erase(s.in.begin(), s.in.begin() + pos);
+    return connected;
+}
+
+static bool flush(ClientSession &s){
+    while(!s.out.empty()){
+        ssize_t put = send(s.fd, s.out.data(), s.out.size(), MSG_NOSIGNAL);
+        if(put < 0){
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            return false;
+        }
+        s.out.erase(s.out.begin(), s.out.begin() + put);
+    }
+    return true;
+}
+
+static void closeSession(ClientSession &s){
+    close(s.fd);
+    s.fd = -1;
+    s.open = false;
+}
+
+int main(int argc, char **argv){
+    const char *address = "7800";
+    const char *rom = "";
+    int sessionCount = 1;
+    double seconds = 10;
+    uint64_t seed = 0;
+    int keyInterval = 100;
+    bool quiet = false;
+    for(int i = 1; i < argc; i++){
+        bool hasValue = i + 1 < argc;
+        if(strcmp(argv[i], "--connect") == 0 && hasValue)
+            address = argv[++i];
+        else if(strcmp(argv[i], "--sessions") == 0 && hasValue)
+            sessionCount = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--seconds") == 0 && hasValue)
+            seconds = atof(argv[++i]);
+        else if(strcmp(argv[i], "--rom") == 0 && hasValue)
+            rom = argv[++i];
+        else if(strcmp(argv[i], "--seed") == 0 && hasValue)
+            seed = strtoull(argv[++i], nullptr, 0);
+        else if(strcmp(argv[i], "--key-interval") == 0 && hasValue)
+            keyInterval = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--quiet") == 0)
+            quiet = true;
+        else{
+            usage();
+            return 2;
+        }
+    }
+    if(sessionCount <= 0 || seconds <= 0 || keyInterval < 0 || strlen(rom) > 255){
+        usage();
+        return 2;
+    }
+
+    std::vector<ClientSession> sessions(sessionCount);
+    uint64_t random = Chip8::randomState(seed);
+    auto start = Clock::now();
+    for(int i = 0; i < sessionCount; i++){
+        ClientSession &s = sessions[i];
+        s.fd = connectSocket(address);
+        if(s.fd < 0){
+            printf("Could not connect to %s\n", address);
+            return 2;
+        }
+        setNoDelay(s.fd);
+        setNonBlocking(s.fd);
+        s.open = true;
+        //Spread the sessions' key presses over the interval
+        s.nextKeys = start + std::chrono::milliseconds(keyInterval ? Chip8::randomByte(random) % keyInterval : 0);
+        sendHello(s, seed + i, rom);
+        flush(s);
+    }
+
+    auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+    std::vector<pollfd> fds(sessionCount);
+    int open = sessionCount;
+    while(open > 0){
+        auto now = Clock::now();
+        if(now >= end)
+            break;
+        //Each session flips one random key per interval
+        auto wake = end;
+        for(ClientSession &s : sessions){
+            if(!s.open || keyInterval == 0)
+                continue;
+            if(now >= s.nextKeys){
+                s.keys ^= 1 << (Chip8::randomByte(random) & 15);
+                s.input++;
+                size_t at = FrameStream::beginMessage(s.out, StreamMessage::Keys);
+                FrameStream::put(s.out, s.input, 4);
+                FrameStream::put(s.out, s.keys, 2);
+                FrameStream::finishMessage(s.out, at);
+                s.inFlight.push_back({ s.input, now });
+                s.nextKeys += std::chrono::milliseconds(keyInterval);
+            }
+            wake = std::min(wake, s.nextKeys);
+        }
+
+        for(int i = 0; i < sessionCount; i++){
+            ClientSession &s = sessions[i];
+            short events = 0;
+            if(s.open){
+                events = POLLIN;
+                if(!flush(s)){
+                    closeSession(s);
+                    open--;
+                    events = 0;
+                }
+                else if(!s.out.empty())
+                    events |= POLLOUT;
+            }
+            fds[i] = { s.open ? s.fd : -1, events, 0 };
+        }
+        int timeout = (int)std::chrono::ceil<std::chrono::milliseconds>(wake - now).count();
+        if(::poll(fds.data(), fds.size(), std::max(timeout, 0)) <= 0)
+            continue;
+
+        now = Clock::now();
+        for(int i = 0; i < sessionCount; i++){
+            ClientSession &s = sessions[i];
+            if(s.open && (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && !receive(s, now)){
+                closeSession(s);
+                open--;
+            }
+        }
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    uint64_t frames = 0, keyframes = 0, bytes = 0, errors = 0;
+    double emulated = 0;
+    std::vector<double> latencies;
+    if(!quiet)
+        printf("%-8s %8s %9s %8s %9s %8s %8s %8s %6s\n", "SESSION", "FPS", "UPDATES/S", "KB/S", "KEYFRAMES",
+            "LAT AVG", "LAT P99", "LAT MAX", "ERRORS");
+    for(ClientSession &s : sessions){
+        if(s.fd >= 0)
+            close(s.fd);
+        //Frame numbers count emulated frames, including the ones that weren't sent
+        double span = std::chrono::duration<double>(s.lastTime - s.firstTime).count();
+        double fps = s.frames > 1 && span > 0 ? (s.lastFrame - s.firstFrame) / span : 0;
+        double sum = 0, worst = 0;
+        for(double l : s.latencies){
+            sum += l;
+            worst = std::max(worst, l);
+        }
+        double average = s.latencies.empty() ? 0 : sum / s.latencies.size();
+        latencies.insert(latencies.end(), s.latencies.begin(), s.latencies.end());
+        if(!quiet){
+            printf("%-8u %8.1f %9.1f %8.2f %9llu %6.2fms %6.2fms %6.2fms %6llu", s.id, fps, s.frames / elapsed,
+                s.bytes / 1024.0 / elapsed, (unsigned long long)s.keyframes, average, percentile(s.latencies, 0.99), worst,
+                (unsigned long long)s.errors);
+            if(!s.reason.empty())
+                printf("  %s", s.reason.c_str());
+            printf("\n");
+        }
+        frames += s.frames;
+        keyframes += s.keyframes;
+        bytes += s.bytes;
+        errors += s.errors;
+        emulated += fps;
+    }
+
+    printf("%d sessions, %.2fs, %.1f emulated frames/s per session, %.1f updates/s, %.2f KB/s, %llu keyframes, %llu errors\n",
+        sessionCount, elapsed, emulated / sessionCount, frames / elapsed, bytes / 1024.0 / elapsed,
+        (unsigned long long)keyframes, (unsigned long long)errors);
+    if(!latencies.empty()){
+        double sum = 0;
+        for(double l : latencies)
+            sum += l;
+        printf("Input latency over %zu inputs: avg %.2fms, p50 %.2fms, p99 %.2fms, max %.2fms\n", latencies.size(),
+            sum / latencies.size(), percentile(latencies, 0.5), percentile(latencies, 0.99),
+            *std::max_element(latencies.begin(), latencies.end()));
+    }
+    return errors ? 1 : 0;
+}
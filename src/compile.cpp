@@ -0,0 +1,105 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "Chip8.h"
+#include "Movie.h"
+#include "QuirkDatabase.h"
+#include "Recompiler.h"
+
+/*
+Ahead-of-time ROM compiler. Writes a ROM out as a C++ translation unit that
+registers itself as a native module when linked into a program (see Aot.h).
+CMake runs it for every ROM in CHIP8_AOT_ROMS; run by hand, add the output
+to a target that links chip8_core.
+*/
+
+static void usage(){
+    printf("Usage: chip8-aot <ROM file> [--output FILE] [--name NAME] [--quirks modern|vip|schip|xochip] [--quirk-db FILE]\n");
+}
+
+int main(int argc, char **argv){
+    const char *romPath = nullptr;
+    std::string outputPath;
+    std::string name;
+    Chip8Quirks quirks = Chip8Quirks::Default;
+    bool quirksGiven = false;
+    QuirkDatabase quirkDb;
+    for(int i = 1; i < argc; i++){
+        bool hasValue = i + 1 < argc;
+        if(strcmp(argv[i], "--output") == 0 && hasValue)
+            outputPath = argv[++i];
+        else if(strcmp(argv[i], "--name") == 0 && hasValue)
+            name = argv[++i];
+        else if(strcmp(argv[i], "--quirks") == 0 && hasValue){
+            quirksGiven = true;
+            if(!Chip8::parseQuirks(argv[++i], quirks)){
+                usage();
+                return 2;
+            }
+        }
+        else if(strcmp(argv[i], "--quirk-db") == 0 && hasValue){
+            int errorLine = 0;
+            if(!quirkDb.load(argv[++i], &errorLine)){
+                if(errorLine)
+                    printf("%s:%d: expected a 16 digit ROM hash and a quirk profile\n", argv[i], errorLine);
+                else
+                    printf("Could not read %s\n", argv[i]);
+                return 2;
+            }
+        }
+        else if(argv[i][0] != '-' && !romPath)
+            romPath = argv[i];
+        else{
+            usage();
+            return 2;
+        }
+    }
+    if(!romPath){
+        usage();
+        return 2;
+    }
+
+    std::ifstream file(romPath, std::ios::binary);
+    if(!file.is_open()){
+        printf("Could not read %s\n", romPath);
+        return 2;
+    }
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::filesystem::path path(romPath);
+    if(name.empty())
+        name = path.filename().string();
+    if(outputPath.empty())
+        outputPath = path.filename().string() + ".cpp";
+
+    //Same order as the frontend: --quirks, then the database, then the classic platform's own
+    uint64_t romHash = Movie::hashROM(rom.data(), rom.size());
+    if(!quirksGiven)
+        quirkDb.lookup(romHash, quirks);
+    if(quirks == Chip8Quirks::Default)
+        quirks = Chip8::defaultQuirks(Chip8Platform::Chip8);
+
+    Chip8Recompiler compiler(rom.data(), rom.size(), quirks);
+    if(!compiler.analyze()){
+        printf("%s does not fit in memory\n", romPath);
+        return 2;
+    }
+    std::string source = compiler.emit(name.c_str(), romHash);
+
+    std::ofstream out(outputPath, std::ios::binary);
+    out.write(source.data(), source.size());
+    if(!out.good()){
+        printf("Could not write %s\n", outputPath.c_str());
+        return 2;
+    }
+    printf("%s: %zu bytes, %zu opcodes reached in %zu blocks, %zu exits resolved at run time, %s quirks\n",
+        name.c_str(), rom.size(), compiler.getInstructionCount(), compiler.getBlockCount(),
+        compiler.getDynamicExits(), Chip8::quirksName(quirks));
+    return 0;
+}
@@ -0,0 +1,232 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "Chip8.h"
+
+/*
+Fuzz target for the core. Built against libFuzzer with -DCHIP8_FUZZ=ON
+(Clang), as an AFL++ persistent-mode target when compiled with
+afl-clang-fast, and otherwise as a standalone driver that runs inputs from
+files or generates random ones.
+
+An input is a platform byte (modulo 3, with the quirk profile in what's left
+of it above that), two bytes of keypad state held down for the whole run,
+then the ROM. Every input starts from a pristine
+instance of its platform through Chip8::restore(), a block copy, and the ROM
+is copied in from the input buffer, so nothing is allocated, read from disk
+or decoded again between runs. The ROM runs for up to FRAMES frames or
+until it faults; faults are expected, crashes and sanitizer reports aren't.
+After the run the machine's save state has to pass the checks loadState()
+makes, so PC, SP and the fault are all in range.
+
+With CHIP8_FUZZ_CROSS_CHECK set in the environment, every input also runs
+on an instance reset the slow way with LoadROM(), and the two have to end
+up in the same state.
+*/
+
+static const int FRAMES = 60;
+static const int INSTRUCTIONS_PER_FRAME = 30;
+static const int PLATFORMS = 3;
+static const int QUIRK_PROFILES = (int)Chip8Quirks::XOChip + 1;
+
+struct FuzzInstances{
+    Chip8 *pristine[PLATFORMS];
+    Chip8 *chip[PLATFORMS];
+    Chip8 *check[PLATFORMS]; //Runs the cross check
+    uint8_t state[Chip8::MAX_STATE_SIZE];
+    uint8_t expected[Chip8::MAX_STATE_SIZE];
+    bool crossCheck;
+    uint64_t faults[(int)Chip8Fault::BadKey + 1];
+};
+
+static FuzzInstances *instances = nullptr;
+
+static void setUp(){
+    if(instances)
+        return;
+    instances = new FuzzInstances();
+    const Chip8Platform platforms[PLATFORMS] = { Chip8Platform::Chip8, Chip8Platform::SuperChip, Chip8Platform::XOChip };
+    for(int p = 0; p < PLATFORMS; p++){
+        instances->pristine[p] = new Chip8();
+        instances->chip[p] = new Chip8();
+        instances->check[p] = new Chip8();
+        instances->pristine[p]->setPlatform(platforms[p]);
+        instances->chip[p]->setPlatform(platforms[p]);
+        instances->check[p]->setPlatform(platforms[p]);
+    }
+    instances->crossCheck = getenv("CHIP8_FUZZ_CROSS_CHECK") != nullptr;
+}
+
+static void setKeys(Chip8 &chip, uint16_t keys){
+    for(int k = 0; k < 16; k++)
+        chip.key[k] = (keys >> k) & 1;
+}
+
+static void runFrames(Chip8 &chip){
+    for(int f = 0; f < FRAMES && chip.getFault() == Chip8Fault::None; f++)
+        chip.runFrame(INSTRUCTIONS_PER_FRAME);
+}
+
+static void fail(const char *what, const Chip8 &chip){
+    fprintf(stderr, "%s on %s with %s quirks (fault: %s, opcode %.4X)\n", what, Chip8::platformName(chip.getPlatform()),
+        Chip8::quirksName(chip.getQuirks()), Chip8::faultName(chip.getFault()), chip.getOpcode());
+    abort();
+}
+
+static int runInput(const uint8_t *data, size_t size){
+    setUp();
+    if(size < 3)
+        return 0;
+    int platform = data[0] % PLATFORMS;
+    Chip8Quirks quirks = (Chip8Quirks)(data[0] / PLATFORMS % QUIRK_PROFILES);
+    uint16_t keys = data[1] | data[2] << 8;
+    const uint8_t *rom = data + 3;
+    size_t romSize = size - 3;
+
+    Chip8 &chip = *instances->chip[platform];
+    chip.restore(*instances->pristine[platform]);
+    chip.setQuirks(quirks);
+    if(!chip.placeROM(rom, romSize))
+        return 0;
+    setKeys(chip, keys);
+    runFrames(chip);
+    instances->faults[(int)chip.getFault()]++;
+
+    size_t stateSize = chip.getStateSize();
+    chip.saveState(instances->state);
+    if(!chip.isValidState(instances->state, stateSize))
+        fail("State out of range", chip);
+
+    if(instances->crossCheck){
+        Chip8 &check = *instances->check[platform];
+        check.setQuirks(quirks);
+        check.LoadROM(rom, romSize);
+        setKeys(check, keys);
+        runFrames(check);
+        check.saveState(instances->expected);
+        if(memcmp(instances->state, instances->expected, stateSize) != 0)
+            fail("Restored run differs from a loaded one", chip);
+    }
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size){
+    return runInput(data, size);
+}
+
+#if !defined(CHIP8_LIBFUZZER)
+
+#if defined(__AFL_FUZZ_TESTCASE_LEN)
+__AFL_FUZZ_INIT();
+#endif
+
+static void usage(){
+    printf("Usage: chip8-fuzz <input file or directory>... [--cross-check]\n"
+        "       chip8-fuzz --random N [--seed N] [--max-size BYTES] [--cross-check]\n");
+}
+
+static bool readFile(const std::filesystem::path &path, std::vector<uint8_t> &out){
+    std::ifstream file(path, std::ios::binary);
+    if(!file.is_open())
+        return false;
+    out.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static void printSummary(uint64_t runs, double seconds){
+    printf("%llu inputs, %.3fs, %.0f inputs per second\n", (unsigned long long)runs, seconds,
+        seconds > 0 ? runs / seconds : 0);
+    for(int f = 0; f <= (int)Chip8Fault::BadKey; f++){
+        if(instances && instances->faults[f])
+            printf("  %-22s %llu\n", Chip8::faultName((Chip8Fault)f), (unsigned long long)instances->faults[f]);
+    }
+}
+
+int main(int argc, char **argv){
+#if defined(__AFL_FUZZ_TESTCASE_LEN)
+    //AFL++ persistent mode: inputs arrive through shared memory, many per process
+    setUp();
+    __AFL_INIT();
+    const uint8_t *buffer = __AFL_FUZZ_TESTCASE_BUF;
+    while(__AFL_LOOP(100000))
+        runInput(buffer, __AFL_FUZZ_TESTCASE_LEN);
+    return 0;
+#endif
+
+    std::vector<const char *> paths;
+    uint64_t randomInputs = 0;
+    uint64_t seed = 0;
+    size_t maxSize = 256;
+    bool crossCheck = false;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--random") == 0 && i + 1 < argc)
+            randomInputs = strtoull(argv[++i], nullptr, 10);
+        else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = strtoull(argv[++i], nullptr, 0);
+        else if(strcmp(argv[i], "--max-size") == 0 && i + 1 < argc)
+            maxSize = strtoull(argv[++i], nullptr, 10);
+        else if(strcmp(argv[i], "--cross-check") == 0)
+            crossCheck = true;
+        else if(argv[i][0] != '-')
+            paths.push_back(argv[i]);
+        else{
+            usage();
+            return 2;
+        }
+    }
+    if((paths.empty() && randomInputs == 0) || maxSize < 3){
+        usage();
+        return 2;
+    }
+
+    setUp();
+    instances->crossCheck |= crossCheck;
+    uint64_t runs = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    //Corpus or crash reproduction: every file once, directories one level deep
+    std::vector<uint8_t> input;
+    for(const char *path : paths){
+        std::vector<std::filesystem::path> files;
+        std::error_code err;
+        if(std::filesystem::is_directory(path, err)){
+            for(const auto &entry : std::filesystem::directory_iterator(path, err)){
+                if(entry.is_regular_file())
+                    files.push_back(entry.path());
+            }
+        }
+        else
+            files.push_back(path);
+        for(const auto &file : files){
+            if(!readFile(file, input)){
+                printf("Could not read %s\n", file.string().c_str());
+                return 2;
+            }
+            runInput(input.data(), input.size());
+            runs++;
+        }
+    }
+
+    //Random inputs from the core's own generator, as a quick smoke test without a fuzzer
+    uint64_t state = Chip8::randomState(seed);
+    input.resize(maxSize);
+    for(uint64_t n = 0; n < randomInputs; n++){
+        size_t size = 3 + (Chip8::randomByte(state) << 8 | Chip8::randomByte(state)) % (maxSize - 2);
+        for(size_t i = 0; i < size; i++)
+            input[i] = Chip8::randomByte(state);
+        runInput(input.data(), size);
+        runs++;
+    }
+
+    printSummary(runs, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    return 0;
+}
+
+#endif
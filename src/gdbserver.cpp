@@ -0,0 +1,77 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Chip8.h"
+#include "GdbStub.h"
+#include "Scheduler.h"
+
+/*
+Headless debug server. Loads a ROM halted and waits for GDB to attach, then
+runs it in real time under the debugger. Keys can't be pressed, so it suits
+ROMs that run on their own; the frontend's --gdb debugs interactive ones.
+*/
+
+static void usage(){
+    printf("Usage: chip8-gdb <ROM file> [--listen [HOST:]PORT | unix:PATH] [--ips N] [--seed N]\n");
+}
+
+int main(int argc, char **argv){
+    const char *romPath = nullptr;
+    const char *address = "1234";
+    int instructionsPerSecond = 540;
+    uint64_t seed = 0;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--listen") == 0 && i + 1 < argc)
+            address = argv[++i];
+        else if(strcmp(argv[i], "--ips") == 0 && i + 1 < argc)
+            instructionsPerSecond = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = strtoull(argv[++i], nullptr, 0);
+        else if(argv[i][0] != '-' && !romPath)
+            romPath = argv[i];
+        else{
+            usage();
+            return 2;
+        }
+    }
+    if(!romPath || instructionsPerSecond <= 0){
+        usage();
+        return 2;
+    }
+
+    Chip8 *chip8 = new Chip8();
+    chip8->setSeed(seed);
+    if(!chip8->LoadROM(romPath)){
+        printf("Could not load %s\n", romPath);
+        return 2;
+    }
+
+    Scheduler scheduler(instructionsPerSecond);
+    GdbStub *stub = new GdbStub(*chip8, scheduler.getInstructionsPerFrame());
+    if(!stub->listen(address)){
+        printf("Could not listen on %s\n", address);
+        return 2;
+    }
+    printf("Waiting for a debugger on %s\n", address);
+    fflush(stdout);
+
+    while(!stub->wasKilled()){
+        if(stub->isHalted()){
+            stub->poll(10);
+            //Time spent halted doesn't count towards the frames due
+            scheduler.reset();
+            continue;
+        }
+        int frames = scheduler.framesDue();
+        for(int f = 0; f < frames && !stub->isHalted(); f++)
+            stub->runFrame();
+        if(!stub->isHalted())
+            scheduler.waitForNextFrame();
+    }
+
+    delete stub;
+    delete chip8;
+    return 0;
+}
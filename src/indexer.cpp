@@ -0,0 +1,127 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Chip8.h"
+#include "QuirkDatabase.h"
+#include "RomStore.h"
+
+/*
+ROM store indexer. Builds an archive from every file in a directory (see
+RomStore.h), or lists what an archive holds. chip8-batch and chip8-server
+take an archive wherever they take a ROM directory.
+*/
+
+static void usage(){
+    printf("Usage: chip8-index <ROM directory> <archive> [--threads N] [--quirk-db FILE]\n"
+        "       chip8-index --list <archive> [--invalid]\n");
+}
+
+static int list(const char *archivePath, bool showInvalid){
+    RomStore store;
+    if(!store.open(archivePath)){
+        printf("%s is not a ROM store\n", archivePath);
+        return 2;
+    }
+    printf("%-16s %6s %-8s %-7s %8s %8s  %s\n", "HASH", "SIZE", "PLATFORM", "QUIRKS", "REACHED", "INVALID", "NAME");
+    for(size_t i = 0; i < store.size(); i++){
+        RomInfo rom = store.get(i);
+        printf("%016llX %6zu %-8s %-7s %8u %8u  %s\n", (unsigned long long)rom.hash, rom.size,
+            Chip8::platformName(rom.platform), Chip8::quirksName(rom.quirks), rom.reachableOpcodes, rom.invalidCount,
+            rom.name.c_str());
+        if(showInvalid){
+            for(uint32_t j = 0; j < rom.invalidCount; j++){
+                uint16_t address = rom.invalid[j];
+                printf("    %.3X: %.2X%.2X\n", address, rom.data[address - 0x200],
+                    address - 0x200 + 1u < rom.size ? rom.data[address - 0x200 + 1] : 0);
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv){
+    const char *romDir = nullptr;
+    const char *archivePath = nullptr;
+    bool listing = false;
+    bool showInvalid = false;
+    unsigned threads = 0;
+    QuirkDatabase quirkDb;
+    for(int i = 1; i < argc; i++){
+        bool hasValue = i + 1 < argc;
+        if(strcmp(argv[i], "--list") == 0)
+            listing = true;
+        else if(strcmp(argv[i], "--invalid") == 0)
+            showInvalid = true;
+        else if(strcmp(argv[i], "--threads") == 0 && hasValue)
+            threads = (unsigned)atoi(argv[++i]);
+        else if(strcmp(argv[i], "--quirk-db") == 0 && hasValue){
+            int errorLine = 0;
+            if(!quirkDb.load(argv[++i], &errorLine)){
+                if(errorLine)
+                    printf("%s:%d: expected a 16 digit ROM hash and a quirk profile\n", argv[i], errorLine);
+                else
+                    printf("Could not read %s\n", argv[i]);
+                return 2;
+            }
+        }
+        else if(argv[i][0] != '-' && !listing && !romDir)
+            romDir = argv[i];
+        else if(argv[i][0] != '-' && !archivePath)
+            archivePath = argv[i];
+        else{
+            usage();
+            return 2;
+        }
+    }
+    if(listing && archivePath && !romDir)
+        return list(archivePath, showInvalid);
+    if(listing || !romDir || !archivePath){
+        usage();
+        return 2;
+    }
+    if(threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::string> files;
+    std::error_code err;
+    for(const auto &entry : std::filesystem::directory_iterator(romDir, err)){
+        if(entry.is_regular_file())
+            files.push_back(entry.path().string());
+    }
+    if(err){
+        printf("Could not read ROM directory %s: %s\n", romDir, err.message().c_str());
+        return 2;
+    }
+    //Sorted, so which of several copies of a ROM names it doesn't depend on the directory order
+    std::sort(files.begin(), files.end());
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> skipped;
+    if(!RomStore::build(files, archivePath, threads, quirkDb.size() ? &quirkDb : nullptr, skipped)){
+        printf("Could not write %s\n", archivePath);
+        return 2;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for(const std::string &reason : skipped)
+        printf("Skipped %s\n", reason.c_str());
+
+    RomStore store;
+    if(!store.open(archivePath)){
+        printf("Could not read back %s\n", archivePath);
+        return 2;
+    }
+    size_t invalid = 0;
+    for(size_t i = 0; i < store.size(); i++)
+        invalid += store.get(i).invalidCount > 0;
+    printf("Indexed %zu ROMs into %s (%zu files, %zu duplicates, %zu with invalid opcodes) on %u threads in %.3fs\n",
+        store.size(), archivePath, files.size(), files.size() - skipped.size() - store.size(), invalid, threads, seconds);
+    return 0;
+}
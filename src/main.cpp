@@ -1,6 +1,24 @@
 #include <iostream>
 #include <SDL2/SDL.h>
+#include "Beeper.h"
+#include "Capture.h"
 #include "Chip8.h"
+#include "GdbStub.h"
+#include "Movie.h"
+#include "Profiler.h"
+#include "QuirkDatabase.h"
+#include "Render.h"
+#include "Rewind.h"
+#include "RunAhead.h"
+#include "Scheduler.h"
+#include "SpscQueue.h"
+#include "TripleBuffer.h"
+#include "Upscaler.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
 #include <thread>
 
 uint8_t keymap[16] = {
@@ -22,13 +40,391 @@ uint8_t keymap[16] = {
     SDLK_v
 };
 
+//Keypad changes and commands, sent from the SDL thread to the emulation thread
+struct InputEvent{
+    enum Type : uint8_t { KeyDown, KeyUp, Reset, SaveState, LoadState, RewindStart, RewindStop };
+    Type type;
+    uint8_t key;
+    uint64_t timestamp; //Steady clock nanoseconds when the SDL thread received the event
+};
+
+//A finished screen, published by the emulation thread
+struct Frame{
+    uint64_t rows[32];
+    //SUPER-CHIP and XO-CHIP screens. planeCount is 0 for the classic screen in rows
+    uint64_t planes[Chip8Extended::PLANES][64][2];
+    int planeCount;
+    int width;
+    int height;
+    uint64_t inputTimestamp; //Oldest input applied since the previous frame, 0 if there was none
+};
+
+//State shared by the two threads. The queue and the frame buffer are lock-free, the
+//condition variable only wakes an emulation thread sleeping on an idle ROM
+struct SharedState{
+    SpscQueue<InputEvent, 256> input;
+    TripleBuffer<Frame> frames;
+    std::atomic<bool> running;
+    std::atomic<bool> faulted;
+    std::mutex wakeLock;
+    std::condition_variable wake;
+};
+
+//Notifying under the lock means a wakeup can't slip in between the emulation
+//thread finding the queue empty and going to sleep
+static void wakeEmulation(SharedState &shared){
+    std::lock_guard<std::mutex> lock(shared.wakeLock);
+    shared.wake.notify_one();
+}
+
+static void sendInput(SharedState &shared, const InputEvent &input){
+    shared.input.push(input);
+    wakeEmulation(shared);
+}
+
+//SDL audio thread: pulls beeper samples. The beeper never blocks, so neither does this
+static void audioCallback(void *userdata, Uint8 *stream, int len){
+    ((Beeper*)userdata)->render((int16_t*)stream, len / 2);
+}
+
+//Runs a width x height screen through the upscaler and presents the result, which fills texture
+static void presentScaled(SDL_Renderer *renderer, SDL_Texture *texture, Upscaler &upscaler, const uint32_t *pixels,
+    int width, int height, uint32_t *scaled){
+    upscaler.process(pixels, width, height, scaled);
+    SDL_UpdateTexture(texture, NULL, scaled, upscaler.getOutputWidth() * sizeof(Uint32));
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, NULL, NULL);
+    SDL_RenderPresent(renderer);
+}
+
+static uint64_t nowNanoseconds(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//Emulation thread: applies input between frames, runs the frames that are due
+//and publishes the screen whenever it changed. It never touches SDL
+//With a movie, every frame run is recorded into it until a state load or rewind breaks the timeline.
+//With a debug stub, the debugger decides which frames run. With a capture, every completed frame goes to it.
+//With run-ahead, the screen published is the one a few frames on from the real machine
+static void emulationLoop(SharedState &shared, Chip8 &chip8, Scheduler &scheduler, const char *romPath,
+    Movie *movie, uint64_t romHash, GdbStub *gdb, FrameCapture *capture, RunAhead *runAhead){
+    uint64_t pendingInput = 0;
+    uint64_t publishedHash = 0; //Screen last published from run-ahead
+    bool rewinding = false;
+    Rewind *rewind = new Rewind();
+    std::string statePath = std::string(romPath) + ".state";
+    bool recording = movie != NULL;
+    scheduler.reset();
+    if(recording)
+        movie->begin(chip8, romHash, scheduler.getInstructionsPerFrame());
+
+    while(shared.running.load(std::memory_order_relaxed)){
+        InputEvent evt;
+        while(shared.input.pop(evt)){
+            switch(evt.type){
+                case InputEvent::Reset:
+                    if(!chip8.LoadROM(romPath)){
+                        shared.running = false;
+                        delete rewind;
+                        return;
+                    }
+                    rewind->reset();
+                    scheduler.reset();
+                    //A reset starts the recording over from the fresh ROM
+                    if(movie){
+                        movie->begin(chip8, romHash, scheduler.getInstructionsPerFrame());
+                        recording = true;
+                    }
+                    break;
+                case InputEvent::SaveState:
+                    if(chip8.saveState(statePath.c_str()))
+                        std::cout << "Saved state to " << statePath << std::endl;
+                    else
+                        std::cout << "Could not save state to " << statePath << std::endl;
+                    break;
+                case InputEvent::LoadState:
+                    if(recording){
+                        movie->finish(chip8);
+                        recording = false;
+                        std::cout << "Recording stopped by loading a state" << std::endl;
+                    }
+                    if(chip8.loadState(statePath.c_str()))
+                        rewind->reset();
+                    else
+                        std::cout << "No valid state in " << statePath << std::endl;
+                    break;
+                case InputEvent::RewindStart:
+                case InputEvent::RewindStop:
+                    rewinding = evt.type == InputEvent::RewindStart;
+                    if(rewinding && recording){
+                        movie->finish(chip8);
+                        recording = false;
+                        std::cout << "Recording stopped by rewinding" << std::endl;
+                    }
+                    break;
+                default:
+                    chip8.key[evt.key] = evt.type == InputEvent::KeyDown ? 1 : 0;
+                    break;
+            }
+            if(pendingInput == 0)
+                pendingInput = evt.timestamp;
+        }
+
+        //A kill from the debugger ends the session. While the debugger has the
+        //target halted, only its requests are served
+        if(gdb && gdb->wasKilled()){
+            shared.running = false;
+            continue;
+        }
+        if(gdb && gdb->isHalted()){
+            gdb->poll(10);
+            scheduler.reset();
+            continue;
+        }
+
+        //Run every frame that came due since the last pass, each one a fixed
+        //instruction budget followed by a 60 Hz timer tick. While rewinding,
+        //each due frame steps back through the history instead
+        int frames = scheduler.framesDue();
+        for(int f = 0; f < frames; f++){
+            if(rewinding){
+                rewind->stepBack(chip8);
+                continue;
+            }
+
+            //A frame cut short by a breakpoint finishes once the debugger resumes it
+            if(gdb){
+                if(!gdb->runFrame())
+                    break;
+            }
+            else
+                chip8.runFrame(scheduler.getInstructionsPerFrame());
+            rewind->push(chip8);
+            if(recording)
+                movie->recordFrame(chip8);
+            if(capture)
+                capture->submit(chip8);
+
+            //Under a debugger a fault just halts the target, so it can be looked at
+            if(chip8.getFault() != Chip8Fault::None && !gdb){
+                shared.faulted = true;
+                shared.running = false;
+                if(recording)
+                    movie->finish(chip8);
+                delete rewind;
+                return;
+            }
+        }
+
+        //Run-ahead speculates once per pass, from the newest real frame. A speculative screen can
+        //change back without anything being drawn, so it's compared with the last one published
+        const Chip8 *view = &chip8;
+        bool changed = chip8.getDirtyRows() != 0;
+        if(runAhead && !rewinding && !gdb){
+            changed = false;
+            if(frames > 0){
+                view = &runAhead->run(chip8, scheduler.getInstructionsPerFrame());
+                uint64_t hash = view->framebufferHash();
+                changed = hash != publishedHash;
+                publishedHash = hash;
+            }
+            chip8.clearDirty();
+        }
+        else if(changed)
+            publishedHash = 0;
+
+        if(changed){
+            Frame &frame = shared.frames.writeBuffer();
+            frame.width = view->getWidth();
+            frame.height = view->getHeight();
+            if(view->getPlatform() == Chip8Platform::Chip8){
+                memcpy(frame.rows, view->getDisplay(), sizeof(frame.rows));
+                frame.planeCount = 0;
+            }
+            else{
+                frame.planeCount = view->getPlanes();
+                for(int p = 0; p < frame.planeCount; p++)
+                    memcpy(frame.planes[p], view->getPlane(p), sizeof(frame.planes[p]));
+            }
+            frame.inputTimestamp = pendingInput;
+            shared.frames.publish();
+            chip8.clearDirty();
+            pendingInput = 0;
+        }
+
+        //A ROM spinning in a wait loop with its timers at zero would run the same
+        //frame over and over until a key changes, so sleep until input arrives.
+        //The frames not run while asleep never happened as far as movies and rewind know
+        if(frames > 0 && !rewinding && !gdb && chip8.isIdle()){
+            std::unique_lock<std::mutex> lock(shared.wakeLock);
+            shared.wake.wait(lock, [&shared]{
+                return !shared.input.empty() || !shared.running.load(std::memory_order_relaxed);
+            });
+            scheduler.reset();
+            continue;
+        }
+
+        scheduler.waitForNextFrame();
+    }
+    if(recording)
+        movie->finish(chip8);
+    delete rewind;
+}
+
 int main(int argc, char **argv){
 
-    if (argc != 2){
+    const char *romPath = NULL;
+    int instructionsPerSecond = 540; //Roughly the speed of the old fixed 1.8ms sleep per instruction
+    bool uncapped = false;
+    bool vsync = false;
+    uint64_t seed = (uint64_t)time(nullptr);
+    const char *moviePath = NULL;
+    const char *profilePrefix = NULL;
+    Palette palette = { 0xFF000000, 0xFFFFFFFF };
+    bool mute = false;
+    int audioBuffer = 512; //Samples per audio callback
+    int audioLatency = 40; //Milliseconds sound trails emulation by
+    Chip8Platform platform = Chip8Platform::Chip8;
+    Chip8Quirks quirks = Chip8Quirks::Default;
+    bool quirksGiven = false;
+    const char *quirkDbPath = NULL;
+    bool badArgument = false;
+    const char *gdbAddress = NULL;
+    const char *capturePath = NULL;
+    int captureScale = 4;
+    int runAheadFrames = 0;
+    UpscaleFilter filter = UpscaleFilter::Nearest;
+    bool filterGiven = false;
+    float phosphor = 0;
+    int filterThreads = 0;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--ips") == 0 && i + 1 < argc)
+            instructionsPerSecond = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--uncapped") == 0)
+            uncapped = true;
+        else if(strcmp(argv[i], "--vsync") == 0)
+            vsync = true;
+        else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            moviePath = argv[++i];
+        else if(strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+            profilePrefix = argv[++i];
+        else if(strcmp(argv[i], "--mute") == 0)
+            mute = true;
+        else if(strcmp(argv[i], "--audio-buffer") == 0 && i + 1 < argc)
+            audioBuffer = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--audio-latency") == 0 && i + 1 < argc)
+            audioLatency = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--gdb") == 0 && i + 1 < argc)
+            gdbAddress = argv[++i];
+        else if(strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+            capturePath = argv[++i];
+        else if(strcmp(argv[i], "--capture-scale") == 0 && i + 1 < argc)
+            captureScale = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--platform") == 0 && i + 1 < argc){
+            if(!Chip8::parsePlatform(argv[++i], platform))
+                badArgument = true;
+        }
+        else if(strcmp(argv[i], "--quirks") == 0 && i + 1 < argc){
+            quirksGiven = true;
+            if(!Chip8::parseQuirks(argv[++i], quirks))
+                badArgument = true;
+        }
+        else if(strcmp(argv[i], "--quirk-db") == 0 && i + 1 < argc)
+            quirkDbPath = argv[++i];
+        else if(strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc)
+            runAheadFrames = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--filter") == 0 && i + 1 < argc){
+            filterGiven = true;
+            if(!Upscaler::parseFilter(argv[++i], filter))
+                badArgument = true;
+        }
+        else if(strcmp(argv[i], "--phosphor") == 0 && i + 1 < argc)
+            phosphor = (float)atof(argv[++i]);
+        else if(strcmp(argv[i], "--filter-threads") == 0 && i + 1 < argc)
+            filterThreads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--palette") == 0 && i + 1 < argc){
+            if(!parsePalette(argv[++i], palette))
+                std::cout << "Palette should look like 000000,FFFFFF. Using the default." << std::endl;
+        }
+        else
+            romPath = argv[i];
+    }
+
+    CaptureFormat captureFormat = CaptureFormat::Y4M;
+    if(capturePath && !FrameCapture::formatFromPath(capturePath, captureFormat)){
+        std::cout << "Capture files should end in .y4m, .png or .gif" << std::endl;
+        badArgument = true;
+    }
+
+    if (romPath == NULL || badArgument || instructionsPerSecond <= 0 || audioBuffer <= 0 || audioLatency < 0
+        || captureScale <= 0 || runAheadFrames < 0 || phosphor < 0 || phosphor >= 1 || filterThreads < 0){
         std::cout << "Please enter a ROM path." << std::endl;
+        std::cout << "Usage: chip8 <ROM file> [--ips N] [--uncapped] [--vsync] [--palette RRGGBB,RRGGBB]"
+            " [--seed N] [--record movie] [--profile prefix] [--mute] [--audio-buffer samples]"
+            " [--audio-latency ms] [--platform chip8|schip|xochip] [--quirks modern|vip|schip|xochip]"
+            " [--quirk-db file] [--gdb [host:]port|unix:path] [--capture file.y4m|.png|.gif]"
+            " [--capture-scale N] [--run-ahead frames] [--filter nearest|scale2x|scanlines] [--phosphor decay]"
+            " [--filter-threads N]" << std::endl;
+        return 1;
+    }
+
+    Chip8 *chip8 = new Chip8();
+    chip8->setSeed(seed);
+    chip8->setPlatform(platform);
+    Scheduler scheduler(instructionsPerSecond);
+    scheduler.setUncapped(uncapped);
+
+    if(!chip8->LoadROM(romPath))
+        return 1;
+
+    //An explicit --quirks wins over the database, which wins over the platform's own
+    uint64_t romHash = 0;
+    Movie::hashROMFile(romPath, romHash);
+    if(quirkDbPath && !quirksGiven){
+        QuirkDatabase quirkDb;
+        int errorLine = 0;
+        if(!quirkDb.load(quirkDbPath, &errorLine)){
+            if(errorLine)
+                std::cout << quirkDbPath << ":" << errorLine << ": expected a 16 digit ROM hash and a quirk profile" << std::endl;
+            else
+                std::cout << "Could not read " << quirkDbPath << std::endl;
+        }
+        quirkDb.lookup(romHash, quirks);
+    }
+    chip8->setQuirks(quirks);
+    char hashText[17];
+    snprintf(hashText, sizeof(hashText), "%.16llx", (unsigned long long)romHash);
+    std::cout << "ROM " << hashText << ", " << Chip8::quirksName(chip8->getQuirks()) << " quirks" << std::endl;
+
+    //The profiler belongs to the emulation thread, except for present(), which is safe from here
+    Profiler *profiler = NULL;
+    if(profilePrefix){
+        if(!Chip8::profilingAvailable())
+            std::cout << "Built without CHIP8_PROFILE, --profile is ignored" << std::endl;
+        profiler = new Profiler();
+        chip8->setProfiler(profiler);
+    }
+
+    //The ROM starts halted until a debugger attaches
+    GdbStub *gdb = NULL;
+    if(gdbAddress && platform != Chip8Platform::Chip8)
+        std::cout << "Only the chip8 platform can be debugged, --gdb is ignored" << std::endl;
+    else if(gdbAddress){
+        gdb = new GdbStub(*chip8, scheduler.getInstructionsPerFrame());
+        if(!gdb->listen(gdbAddress)){
+            std::cout << "Could not listen on " << gdbAddress << std::endl;
+            return 1;
+        }
+        std::cout << "Waiting for a debugger on " << gdbAddress << std::endl;
     }
 
-    Chip8 chip8 = Chip8();
+    Movie *movie = NULL;
+    if(moviePath)
+        movie = new Movie();
 
     int height = 512;
     int width = 1024;
@@ -48,77 +444,324 @@ int main(int argc, char **argv){
          width, height, SDL_WINDOW_SHOWN);
 
     //Creating object to provide drawing context to window
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, 0);
+    //With vsync, presenting blocks until the display refreshes. That only holds up
+    //this thread now, the emulation thread keeps its own pace
+    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
     //Providing window size to renderer for accurate scaling
     SDL_RenderSetLogicalSize(renderer, width, height);
 
     //Pixel format ARGB8888 most common for chip8 emulator, often a native window format as well
     //Texture access streaming used for values that change often
+    //SUPER-CHIP and XO-CHIP recreate it whenever the screen switches between lo-res and hi-res
+    int textureWidth = 64;
+    int textureHeight = 32;
     SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, 
-        SDL_TEXTUREACCESS_STREAMING, 64, 32);
-
-    //Pixel buffer to support conversion between ARGB8888 (32bit) values and the Chip8 8bit values
-    uint32_t pixels[64*32];
-
-    //Jump label for reset key press
-    startROM:
-    //Not necessary for first run, but helps to prevent
-    //Visual artifacts on reloads
-    memset(chip8.pixels, 0, sizeof(chip8.pixels));
-    memset(pixels, 0, sizeof(pixels));
-    if(!chip8.LoadROM(argv[1]))
-        return 1;
+        SDL_TEXTUREACCESS_STREAMING, textureWidth, textureHeight);
+
+    //Pixel buffer to support conversion between ARGB8888 (32bit) values and the Chip8 1bit values
+    uint32_t pixels[128*64];
+    PixelExpander expander(palette);
+    uint32_t colors[16];
+    planeColors(palette, colors);
+
+    //With a filter or the phosphor, screens are scaled to the window on the CPU and uploaded whole.
+    //Otherwise the renderer stretches the small texture itself
+    Upscaler *upscaler = NULL;
+    SDL_Texture *scaledTexture = NULL;
+    uint32_t *scaled = NULL;
+    int scaledWidth = 64; //Size of the screen in pixels, the last one scaled
+    int scaledHeight = 32;
+    uint64_t lastScaled = 0;
+    if(filterGiven || phosphor > 0){
+        upscaler = new Upscaler(width, height, filterThreads);
+        upscaler->setFilter(filter);
+        upscaler->setPhosphor(phosphor);
+        scaledTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+            upscaler->getOutputWidth(), upscaler->getOutputHeight());
+        scaled = new uint32_t[upscaler->getOutputWidth() * upscaler->getOutputHeight()];
+    }
+
+    //Frames are written on a thread of the capture's own. If it falls behind, frames are dropped rather than waited for
+    FrameCapture *capture = NULL;
+    if(capturePath){
+        capture = new FrameCapture(captureFormat, capturePath, captureScale);
+        if(!capture->start(platform, colors)){
+            std::cout << "Could not write to " << capturePath << std::endl;
+            delete capture;
+            capture = NULL;
+        }
+    }
+
+    //Rows currently in the texture, to work out what changed in each new frame
+    uint64_t shown[32];
+    bool firstFrame = true;
+
+    //Input-to-photon latency: time from SDL delivering a key event to the
+    //present of the first frame emulated after it was applied
+    uint64_t latencySamples = 0;
+    uint64_t latencyTotal = 0;
+    uint64_t latencyWorst = 0;
 
-    while(true){
-        chip8.executeCycle();
+    //Beeper audio. Without a sound device (or with SDL_AUDIODRIVER=dummy) this still
+    //runs, and if no device opens at all the emulator just stays silent
+    Beeper *beeper = NULL;
+    SDL_AudioDeviceID audioDevice = 0;
+    if(!mute){
+        const int sampleRate = 48000;
+        int latencySamples = audioLatency * sampleRate / 1000;
+        if(latencySamples < audioBuffer)
+            latencySamples = audioBuffer;
+        beeper = new Beeper(sampleRate, scheduler.getInstructionsPerFrame() * 60, latencySamples);
 
+        SDL_AudioSpec want;
+        SDL_zero(want);
+        want.freq = sampleRate;
+        want.format = AUDIO_S16SYS;
+        want.channels = 1;
+        want.samples = (Uint16)audioBuffer;
+        want.callback = audioCallback;
+        want.userdata = beeper;
+        audioDevice = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
+        if(audioDevice == 0){
+            std::cout << "Could not open an audio device: " << SDL_GetError() << std::endl;
+            delete beeper;
+            beeper = NULL;
+        }
+        else{
+            chip8->setBeeper(beeper);
+            SDL_PauseAudioDevice(audioDevice, 0);
+        }
+    }
+
+    //Speculative frames run on the emulation thread, on an instance of their own
+    RunAhead *runAhead = NULL;
+    if(runAheadFrames > 0 && gdb)
+        std::cout << "Run-ahead is off while debugging" << std::endl;
+    else if(runAheadFrames > 0)
+        runAhead = new RunAhead(runAheadFrames);
+
+    SharedState *shared = new SharedState();
+    shared->running = true;
+    shared->faulted = false;
+    std::thread emulator(emulationLoop, std::ref(*shared), std::ref(*chip8), std::ref(scheduler), romPath,
+        movie, romHash, gdb, capture, runAhead);
+
+    //SDL thread: only polls events and presents frames
+    while(shared->running.load(std::memory_order_relaxed)){
         SDL_Event evt;
 
         while(SDL_PollEvent(&evt)){  //Go through SDL event queue
             if(evt.type == SDL_QUIT)
-                exit(0);
+                shared->running = false;
 
-            if(evt.type == SDL_KEYDOWN){
-                if(evt.key.keysym.sym == SDLK_ESCAPE)
-                    exit(0);
-                
-                if(evt.key.keysym.sym == SDLK_F1)
-                    goto startROM;
+            if(evt.type == SDL_KEYDOWN || evt.type == SDL_KEYUP){
+                //Held keys repeat, but the keypad only cares about the first press
+                if(evt.key.repeat)
+                    continue;
 
-                for(int i=0; i<16; i++){
-                    if(evt.key.keysym.sym == keymap[i])
-                        chip8.key[i] = 1;
+                InputEvent input;
+                input.timestamp = nowNanoseconds();
+
+                if(evt.type == SDL_KEYDOWN && evt.key.keysym.sym == SDLK_ESCAPE)
+                    shared->running = false;
+
+                //F1 resets, F5 saves a state next to the ROM, F7 loads it back
+                //and holding backspace rewinds
+                input.key = 0;
+                if(evt.type == SDL_KEYDOWN && evt.key.keysym.sym == SDLK_F1){
+                    input.type = InputEvent::Reset;
+                    sendInput(*shared, input);
+                }
+                if(evt.type == SDL_KEYDOWN && evt.key.keysym.sym == SDLK_F5){
+                    input.type = InputEvent::SaveState;
+                    sendInput(*shared, input);
+                }
+                if(evt.type == SDL_KEYDOWN && evt.key.keysym.sym == SDLK_F7){
+                    input.type = InputEvent::LoadState;
+                    sendInput(*shared, input);
+                }
+                if(evt.key.keysym.sym == SDLK_BACKSPACE){
+                    input.type = evt.type == SDL_KEYDOWN ? InputEvent::RewindStart : InputEvent::RewindStop;
+                    sendInput(*shared, input);
                 }
-            }
 
-            if(evt.type == SDL_KEYUP){
-                //No keyup events necessary for exit or reset ROM
-                //Only to reset/decrement the keypad values
                 for(int i=0; i<16; i++){
-                    if(evt.key.keysym.sym == keymap[i])
-                        chip8.key[i] = 0;
+                    if(evt.key.keysym.sym == keymap[i]){
+                        input.type = evt.type == SDL_KEYDOWN ? InputEvent::KeyDown : InputEvent::KeyUp;
+                        input.key = i;
+                        sendInput(*shared, input);
+                    }
                 }
             }
         }
 
-        if (chip8.drawFlag){
-            for(int i = 0; i< 64; i++){
-                for(int j = 0; j< 32; j++){
-                    pixels[j*64 + i] = chip8.pixels[i][j]? 0xFFFFFFFF : 0xFF000000; 
-                }
+        if(!shared->frames.update()){
+            //A phosphor still fading towards the last screen goes on presenting it at 60 Hz until it settles
+            if(upscaler && !upscaler->isSettled() && nowNanoseconds() - lastScaled >= 1000000000 / 60){
+                presentScaled(renderer, scaledTexture, *upscaler, pixels, scaledWidth, scaledHeight, scaled);
+                lastScaled = nowNanoseconds();
+                continue;
             }
+            //Nothing new to show. Sleep until an event arrives or a millisecond passes
+            SDL_WaitEventTimeout(NULL, 1);
+            continue;
+        }
+
+        const Frame &frame = shared->frames.readBuffer();
+
+        if(upscaler){
+            if(frame.planeCount){
+                const uint64_t (*planes[Chip8Extended::PLANES])[2];
+                for(int p = 0; p < frame.planeCount; p++)
+                    planes[p] = frame.planes[p];
+                expandPlanes(planes, frame.planeCount, frame.width, frame.height, colors, pixels);
+            }
+            else
+                expander.expandRows(frame.rows, 0xFFFFFFFF, pixels);
+            scaledWidth = frame.width;
+            scaledHeight = frame.height;
+            presentScaled(renderer, scaledTexture, *upscaler, pixels, scaledWidth, scaledHeight, scaled);
+            lastScaled = nowNanoseconds();
+            if(profiler)
+                profiler->present();
+        }
+        //Extended screens are small enough to upload whole every time
+        else if(frame.planeCount){
+            if(frame.width != textureWidth){
+                SDL_DestroyTexture(texture);
+                textureWidth = frame.width;
+                textureHeight = frame.height;
+                texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                    SDL_TEXTUREACCESS_STREAMING, textureWidth, textureHeight);
+            }
+            const uint64_t (*planes[Chip8Extended::PLANES])[2];
+            for(int p = 0; p < frame.planeCount; p++)
+                planes[p] = frame.planes[p];
+            expandPlanes(planes, frame.planeCount, frame.width, frame.height, colors, pixels);
+            SDL_UpdateTexture(texture, NULL, pixels, frame.width * sizeof(Uint32));
+            SDL_RenderClear(renderer);
+            SDL_RenderCopy(renderer, texture, NULL, NULL);
+            SDL_RenderPresent(renderer);
+            if(profiler)
+                profiler->present();
+        }
+
+        //Work out which rows and columns differ from what's already in the texture
+        uint32_t dirtyRows = 0;
+        uint64_t dirtyColumns = 0;
+        for(int y = 0; y < 32 && !frame.planeCount && !upscaler; y++){
+            uint64_t changed = firstFrame ? ~0ULL : frame.rows[y] ^ shown[y];
+            if(changed){
+                dirtyRows |= 1u << y;
+                dirtyColumns |= changed;
+            }
+            shown[y] = frame.rows[y];
+        }
+        if(!frame.planeCount)
+            firstFrame = false;
+
+        if (dirtyRows){
+            int left = 0;
+            int right = 63;
+            while(((dirtyColumns >> (63 - left)) & 1) == 0)
+                left++;
+            while(((dirtyColumns >> (63 - right)) & 1) == 0)
+                right--;
+            expander.expandRows(frame.rows, dirtyRows, pixels);
 
-            SDL_UpdateTexture(texture, NULL, pixels, 64 * sizeof(Uint32));
+            //Upload each run of consecutive dirty rows as one sub-rectangle of the texture
+            for(int y = 0; y < 32;){
+                if(((dirtyRows >> y) & 1) == 0){
+                    y++;
+                    continue;
+                }
+                int end = y;
+                while(end < 32 && ((dirtyRows >> end) & 1))
+                    end++;
+
+                SDL_Rect rect = { left, y, right - left + 1, end - y };
+                SDL_UpdateTexture(texture, &rect, pixels + y*64 + left, 64 * sizeof(Uint32));
+                y = end;
+            }
 
             //Clean out and reset the renderer
             SDL_RenderClear(renderer);
             SDL_RenderCopy(renderer, texture, NULL, NULL);
             SDL_RenderPresent(renderer);
+            if(profiler)
+                profiler->present();
+        }
 
-            chip8.drawFlag = false;
+        if(frame.inputTimestamp){
+            uint64_t latency = nowNanoseconds() - frame.inputTimestamp;
+            latencySamples++;
+            latencyTotal += latency;
+            if(latency > latencyWorst)
+                latencyWorst = latency;
         }
+    }
+
+    wakeEmulation(*shared);
+    emulator.join();
+    if(audioDevice)
+        SDL_CloseAudioDevice(audioDevice);
+    chip8->setBeeper(NULL);
+
+    if(latencySamples){
+        printf("Input latency: %llu samples, average %.2f ms, worst %.2f ms\n", (unsigned long long)latencySamples,
+            latencyTotal / 1e6 / latencySamples, latencyWorst / 1e6);
+    }
+    if(runAhead && runAhead->getPasses()){
+        printf("Run-ahead: %d frames, %llu passes, average %.3f ms, worst %.3f ms\n", runAhead->getFrames(),
+            (unsigned long long)runAhead->getPasses(), runAhead->getAverageMilliseconds(), runAhead->getWorstMilliseconds());
+    }
+    if(movie){
+        if(movie->save(moviePath))
+            printf("Recorded %u frames to %s\n", movie->getFrames(), moviePath);
+        else
+            printf("Could not write %s\n", moviePath);
+    }
+    if(profiler && Chip8::profilingAvailable()){
+        std::string json = std::string(profilePrefix) + ".json";
+        std::string trace = std::string(profilePrefix) + ".trace.json";
+        if(profiler->writeJSON(json.c_str()) && profiler->writeTrace(trace.c_str()))
+            printf("Wrote %s and %s\n", json.c_str(), trace.c_str());
+        else
+            printf("Could not write the profile to %s\n", profilePrefix);
+    }
+    if(scheduler.getDroppedFrames())
+        printf("Dropped %llu frames\n", (unsigned long long)scheduler.getDroppedFrames());
+    if(capture){
+        if(!capture->finish())
+            printf("Could not finish writing %s\n", capturePath);
+        printf("Captured %u frames to %s: %llu distinct, %llu duplicates, %llu dropped\n", capture->getFrames(),
+            capturePath, (unsigned long long)capture->getWritten(), (unsigned long long)capture->getDuplicates(),
+            (unsigned long long)capture->getDropped());
+    }
+
+    if(scaledTexture)
+        SDL_DestroyTexture(scaledTexture);
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
 
-        // Sleep to slow down emulation speed   
-        std::this_thread::sleep_for(std::chrono::microseconds(1800));
+    if(shared->faulted && chip8->getFault() == Chip8Fault::Exited)
+        printf("\nROM exited\n");
+    else if(shared->faulted){
+        printf("\nROM stopped with %s at opcode %.4X\n", Chip8::faultName(chip8->getFault()), chip8->getOpcode());
+        exit(3);
     }
+
+    delete upscaler;
+    delete[] scaled;
+    delete capture;
+    delete runAhead;
+    delete gdb;
+    delete beeper;
+    delete movie;
+    delete profiler;
+    delete shared;
+    delete chip8;
+    return 0;
 }
@@ -0,0 +1,315 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "Aot.h"
+#include "Beeper.h"
+#include "Capture.h"
+#include "Chip8.h"
+#include "Jit.h"
+#include "Movie.h"
+#include "Profiler.h"
+#include "Render.h"
+#include "RunAhead.h"
+#include "Upscaler.h"
+
+/*
+Headless movie player. Loads a ROM, plays a recorded movie back at full
+speed and checks the framebuffer hash at every checkpoint. Exits with 1 on
+the first mismatch, so recorded sessions double as regression tests. With
+--wav, the beeper is rendered offline in step with emulation and saved.
+With --capture, every frame is recorded to a video, GIF or PNG sequence.
+With --aot, the ROM runs through the module compiled into this program for
+it, and --aot-diff checks every compiled block against the interpreter.
+With --run-ahead, every frame is also run ahead as the frontend would, to
+time the passes and count how often the speculative screen came true.
+With --upscale, every frame also goes through the frontend's upscaler and
+phosphor into memory, to time it and hash the last picture.
+*/
+
+static void usage(){
+    printf("Usage: chip8-replay <ROM file> <movie file> [--jit | --aot | --aot-diff] [--profile PREFIX] [--wav FILE]\n"
+        "                    [--capture FILE.y4m|FILE.gif|FILE.png] [--capture-scale N] [--run-ahead FRAMES]\n"
+        "                    [--upscale nearest|scale2x|scanlines] [--phosphor DECAY] [--upscale-size WxH] [--upscale-threads N]\n");
+}
+
+int main(int argc, char **argv){
+    const char *romPath = nullptr;
+    const char *moviePath = nullptr;
+    bool jit = false;
+    bool aot = false;
+    bool aotDifferential = false;
+    const char *profilePrefix = nullptr;
+    const char *wavPath = nullptr;
+    const char *capturePath = nullptr;
+    int captureScale = 4;
+    int runAheadFrames = 0;
+    bool upscale = false;
+    UpscaleFilter filter = UpscaleFilter::Nearest;
+    float phosphor = 0;
+    int upscaleWidth = 1024; //The frontend's window
+    int upscaleHeight = 512;
+    int upscaleThreads = 0;
+    bool badUpscale = false;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--jit") == 0)
+            jit = true;
+        else if(strcmp(argv[i], "--aot") == 0)
+            aot = true;
+        else if(strcmp(argv[i], "--aot-diff") == 0)
+            aot = aotDifferential = true;
+        else if(strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+            profilePrefix = argv[++i];
+        else if(strcmp(argv[i], "--wav") == 0 && i + 1 < argc)
+            wavPath = argv[++i];
+        else if(strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+            capturePath = argv[++i];
+        else if(strcmp(argv[i], "--capture-scale") == 0 && i + 1 < argc)
+            captureScale = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc)
+            runAheadFrames = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--upscale") == 0 && i + 1 < argc){
+            upscale = true;
+            badUpscale |= !Upscaler::parseFilter(argv[++i], filter);
+        }
+        else if(strcmp(argv[i], "--phosphor") == 0 && i + 1 < argc)
+            phosphor = (float)atof(argv[++i]);
+        else if(strcmp(argv[i], "--upscale-size") == 0 && i + 1 < argc)
+            badUpscale |= sscanf(argv[++i], "%dx%d", &upscaleWidth, &upscaleHeight) != 2;
+        else if(strcmp(argv[i], "--upscale-threads") == 0 && i + 1 < argc)
+            upscaleThreads = atoi(argv[++i]);
+        else if(argv[i][0] != '-' && !romPath)
+            romPath = argv[i];
+        else if(argv[i][0] != '-' && !moviePath)
+            moviePath = argv[i];
+        else{
+            usage();
+            return 2;
+        }
+    }
+    CaptureFormat captureFormat = CaptureFormat::Y4M;
+    if(!romPath || !moviePath || captureScale <= 0 || runAheadFrames < 0 || badUpscale || phosphor < 0 || phosphor >= 1 ||
+        upscaleThreads < 0 || (jit && aot) || (capturePath && !FrameCapture::formatFromPath(capturePath, captureFormat))){
+        usage();
+        return 2;
+    }
+
+    Movie movie;
+    if(!movie.load(moviePath)){
+        printf("Could not read movie %s\n", moviePath);
+        return 2;
+    }
+
+    std::ifstream file(romPath, std::ios::binary);
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if(!file.is_open() || Movie::hashROM(rom.data(), rom.size()) != movie.getROMHash()){
+        printf("%s is not the ROM this movie was recorded with\n", romPath);
+        return 2;
+    }
+
+    Chip8 *chip8 = new Chip8();
+    chip8->setSeed(movie.getSeed());
+    chip8->setPlatform(movie.getPlatform());
+    chip8->setQuirks(movie.getQuirks());
+    if(!chip8->LoadROM(rom.data(), rom.size())){
+        printf("Could not load %s\n", romPath);
+        return 2;
+    }
+    Chip8Jit *compiler = jit ? new Chip8Jit(*chip8) : nullptr;
+
+    Chip8Aot *native = nullptr;
+    if(aot){
+        const Chip8AotModule *module = Chip8Aot::findModule(movie.getROMHash(), chip8->getQuirks());
+        if(!module || movie.getPlatform() != Chip8Platform::Chip8)
+            printf("No module compiled in for this ROM with %s quirks, using the interpreter\n",
+                Chip8::quirksName(chip8->getQuirks()));
+        else{
+            native = new Chip8Aot(*chip8, *module);
+            native->setDifferential(aotDifferential);
+        }
+    }
+
+    //Profiling runs everything through the interpreter, even with --jit
+    Profiler *profiler = nullptr;
+    if(profilePrefix){
+        if(!Chip8::profilingAvailable())
+            printf("Built without CHIP8_PROFILE, --profile is ignored\n");
+        profiler = new Profiler();
+        chip8->setProfiler(profiler);
+    }
+
+    Beeper *beeper = nullptr;
+    std::vector<int16_t> samples;
+    if(wavPath){
+        beeper = new Beeper(48000, movie.getInstructionsPerFrame() * 60, 0);
+        chip8->setBeeper(beeper);
+    }
+
+    //Replays run flat out, so the capture waits for the writer rather than dropping frames
+    FrameCapture *capture = nullptr;
+    if(capturePath){
+        uint32_t colors[16];
+        planeColors({ 0xFF000000, 0xFFFFFFFF }, colors);
+        capture = new FrameCapture(captureFormat, capturePath, captureScale);
+        capture->setBlocking(true);
+        if(!capture->start(movie.getPlatform(), colors)){
+            printf("Could not write %s\n", capturePath);
+            return 2;
+        }
+    }
+
+    //The screen each pass predicts for frame + runAheadFrames, checked once the real machine gets there
+    RunAhead *runAhead = runAheadFrames ? new RunAhead(runAheadFrames) : nullptr;
+    std::vector<uint64_t> predicted(runAheadFrames + 1);
+    uint64_t predictions = 0;
+    uint64_t predictionHits = 0;
+
+    //Upscaled frames go to memory only. The time and the hash of the last one are reported
+    Upscaler *upscaler = nullptr;
+    std::vector<uint32_t> screen, upscaled;
+    uint32_t upscaleColors[16];
+    double upscaleSeconds = 0;
+    double upscaleWorst = 0;
+    uint32_t upscaledFrames = 0;
+    if(upscale){
+        upscaler = new Upscaler(upscaleWidth, upscaleHeight, upscaleThreads);
+        upscaler->setFilter(filter);
+        upscaler->setPhosphor(phosphor);
+        upscaled.resize((size_t)upscaler->getOutputWidth() * upscaler->getOutputHeight());
+        screen.resize(128 * 64);
+        planeColors({ 0xFF000000, 0xFFFFFFFF }, upscaleColors);
+    }
+
+    const std::vector<Movie::KeyChange> &keys = movie.getKeyChanges();
+    const std::vector<Movie::Checkpoint> &checkpoints = movie.getCheckpoints();
+    size_t nextKey = 0;
+    size_t nextCheckpoint = 0;
+    int ipf = movie.getInstructionsPerFrame();
+    uint64_t executed = 0;
+    uint32_t framesRun = 0;
+    bool exited = false;
+    int result = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t frame = 0; frame < movie.getFrames(); frame++){
+        while(nextKey < keys.size() && keys[nextKey].frame == frame)
+            Movie::applyKeys(*chip8, keys[nextKey++].keys);
+
+        executed += native ? native->runFrame(ipf) : compiler ? compiler->runFrame(ipf) : chip8->runFrame(ipf);
+        if(beeper)
+            beeper->renderUntil(chip8->getInstructionClock(), samples);
+        if(capture)
+            capture->submit(*chip8);
+        if(native && native->hasDiverged()){
+            printf("Compiled block at %.3X differs from the interpreter in frame %u\n", native->getDivergedPC(), frame);
+            result = 1;
+            break;
+        }
+        framesRun = frame + 1;
+        //00FD ends the session like closing the window does, so the recording ends on this frame too
+        exited = chip8->getFault() == Chip8Fault::Exited;
+        if(chip8->getFault() != Chip8Fault::None && !exited){
+            printf("Fault in frame %u: %s at opcode %.4X\n", frame, Chip8::faultName(chip8->getFault()),
+                chip8->getOpcode());
+            result = 1;
+            break;
+        }
+
+        while(nextCheckpoint < checkpoints.size() && checkpoints[nextCheckpoint].frame == frame + 1){
+            const Movie::Checkpoint &c = checkpoints[nextCheckpoint++];
+            uint64_t hash = chip8->framebufferHash();
+            if(hash != c.hash){
+                printf("Mismatch after frame %u: expected %016llX, got %016llX\n", c.frame,
+                    (unsigned long long)c.hash, (unsigned long long)hash);
+                result = 1;
+                break;
+            }
+        }
+        if(result || exited)
+            break;
+
+        if(upscaler){
+            auto upscaleStart = std::chrono::steady_clock::now();
+            chip8->copyARGB(screen.data(), upscaleColors);
+            upscaler->process(screen.data(), chip8->getWidth(), chip8->getHeight(), upscaled.data());
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - upscaleStart).count();
+            upscaleSeconds += elapsed;
+            upscaleWorst = std::max(upscaleWorst, elapsed);
+            upscaledFrames++;
+        }
+
+        if(runAhead){
+            if(frame >= (uint32_t)runAheadFrames){
+                predictions++;
+                predictionHits += predicted[frame % predicted.size()] == chip8->framebufferHash();
+            }
+            predicted[(frame + runAheadFrames) % predicted.size()] = runAhead->run(*chip8, ipf).framebufferHash();
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if(!result){
+        printf("%u frames, %zu checkpoints matched, %.3fs, %.0f IPS%s\n", framesRun, nextCheckpoint,
+            seconds, seconds > 0 ? executed / seconds : 0, exited ? ", ROM exited" : "");
+    }
+    if(runAhead && predictions){
+        printf("Run-ahead: %d frames, %.1f%% of speculative screens came true, average %.3f ms, worst %.3f ms per pass\n",
+            runAheadFrames, predictionHits * 100.0 / predictions, runAhead->getAverageMilliseconds(),
+            runAhead->getWorstMilliseconds());
+    }
+    if(upscaler && upscaledFrames){
+        //FNV-1a, the same hash as for ROMs
+        uint64_t hash = Movie::hashROM((const uint8_t*)upscaled.data(), upscaled.size() * sizeof(uint32_t));
+        printf("Upscaled %u frames to %dx%d (%s, phosphor %.2f) on %d threads: average %.3f ms, worst %.3f ms, last %016llX\n",
+            upscaledFrames, upscaler->getOutputWidth(), upscaler->getOutputHeight(), Upscaler::filterName(filter),
+            upscaler->getPhosphor(), upscaler->getThreads(), upscaleSeconds * 1000 / upscaledFrames, upscaleWorst * 1000,
+            (unsigned long long)hash);
+    }
+    if(native){
+        uint64_t compiled = native->getCompiledInstructions();
+        uint64_t total = compiled + native->getInterpretedInstructions();
+        printf("%.1f%% of opcodes ran compiled%s\n", total ? compiled * 100.0 / total : 0.0,
+            aotDifferential && !native->hasDiverged() ? ", every block matched the interpreter" : "");
+    }
+
+    if(profiler && Chip8::profilingAvailable()){
+        std::string json = std::string(profilePrefix) + ".json";
+        std::string trace = std::string(profilePrefix) + ".trace.json";
+        if(profiler->writeJSON(json.c_str()) && profiler->writeTrace(trace.c_str()))
+            printf("Wrote %s and %s\n", json.c_str(), trace.c_str());
+        else
+            printf("Could not write the profile to %s\n", profilePrefix);
+    }
+
+    if(beeper){
+        if(Beeper::writeWAV(wavPath, samples, beeper->getSampleRate()))
+            printf("Wrote %.1fs of audio to %s\n", samples.size() / (double)beeper->getSampleRate(), wavPath);
+        else
+            printf("Could not write %s\n", wavPath);
+    }
+
+    if(capture){
+        if(capture->finish())
+            printf("Captured %u frames to %s (%llu distinct, %llu duplicates elided)\n", capture->getFrames(), capturePath,
+                (unsigned long long)capture->getWritten(), (unsigned long long)capture->getDuplicates());
+        else
+            printf("Could not write %s\n", capturePath);
+    }
+
+    delete capture;
+    delete upscaler;
+    delete runAhead;
+    delete native;
+    delete compiler;
+    delete beeper;
+    delete profiler;
+    delete chip8;
+    return result;
+}
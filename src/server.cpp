@@ -0,0 +1,188 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+#include "RomStore.h"
+#include "SessionServer.h"
+
+/*
+Multi-session server. Serves one ROM, or every ROM in a directory or ROM
+store by file name, to any number of clients at once over the protocol in
+FrameStream.h, until interrupted. chip8-client connects to it.
+*/
+
+static std::atomic<bool> interrupted(false);
+
+static void onSignal(int){
+    interrupted = true;
+}
+
+static void usage(){
+    printf("Usage: chip8-server <ROM file, directory or store> [--listen [HOST:]PORT | unix:PATH] [--workers N] [--ips N]\n"
+        "                    [--platform chip8|schip|xochip] [--quirks modern|vip|schip|xochip] [--keyframe-interval FRAMES]\n"
+        "                    [--max-sessions N] [--stats SECONDS]\n");
+}
+
+static bool readFile(const std::filesystem::path &path, std::vector<uint8_t> &out){
+    std::ifstream file(path, std::ios::binary);
+    if(!file.is_open())
+        return false;
+    out.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static void printStats(const SessionStats &stats, double seconds){
+    printf("%llu sessions (%llu opened), %llu frames, %llu sent, %llu keyframes, %llu skipped, %.1f KB/s\n",
+        (unsigned long long)stats.sessions, (unsigned long long)stats.opened, (unsigned long long)stats.frames,
+        (unsigned long long)stats.sent, (unsigned long long)stats.keyframes, (unsigned long long)stats.skipped,
+        seconds > 0 ? stats.bytes / 1024.0 / seconds : 0);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv){
+    const char *romPath = nullptr;
+    const char *address = "7800";
+    int workers = 0;
+    int statsSeconds = 0;
+    SessionConfig config;
+    bool platformGiven = false;
+    bool quirksGiven = false;
+    for(int i = 1; i < argc; i++){
+        bool hasValue = i + 1 < argc;
+        if(strcmp(argv[i], "--listen") == 0 && hasValue)
+            address = argv[++i];
+        else if(strcmp(argv[i], "--workers") == 0 && hasValue)
+            workers = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--ips") == 0 && hasValue)
+            config.instructionsPerSecond = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--platform") == 0 && hasValue){
+            platformGiven = true;
+            if(!Chip8::parsePlatform(argv[++i], config.platform)){
+                usage();
+                return 2;
+            }
+        }
+        else if(strcmp(argv[i], "--quirks") == 0 && hasValue){
+            quirksGiven = true;
+            if(!Chip8::parseQuirks(argv[++i], config.quirks)){
+                usage();
+                return 2;
+            }
+        }
+        else if(strcmp(argv[i], "--keyframe-interval") == 0 && hasValue)
+            config.keyframeInterval = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if(strcmp(argv[i], "--max-sessions") == 0 && hasValue)
+            config.maxSessions = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--stats") == 0 && hasValue)
+            statsSeconds = atoi(argv[++i]);
+        else if(argv[i][0] != '-' && !romPath)
+            romPath = argv[i];
+        else{
+            usage();
+            return 2;
+        }
+    }
+    if(!romPath || config.instructionsPerSecond <= 0 || config.maxSessions <= 0){
+        usage();
+        return 2;
+    }
+    if(workers <= 0)
+        workers = std::max(1u, std::thread::hardware_concurrency());
+
+    SessionServer *server = new SessionServer(config);
+    //A store stays mapped for as long as the server runs, and sessions load straight from it
+    RomStore store;
+    size_t romCount = 0;
+    if(RomStore::isArchive(romPath)){
+        if(!store.open(romPath)){
+            printf("Could not open ROM store %s\n", romPath);
+            return 2;
+        }
+        for(size_t i = 0; i < store.size(); i++){
+            RomInfo rom = store.get(i);
+            //--quirks, then the profile the store has for the ROM
+            Chip8Quirks quirks = config.quirks;
+            if(!quirksGiven && rom.quirksListed)
+                quirks = rom.quirks;
+            server->addROM(rom.name, rom.data, rom.size, platformGiven ? config.platform : rom.platform, quirks);
+        }
+        romCount = store.size();
+    }
+    else{
+        std::vector<std::filesystem::path> files;
+        std::error_code err;
+        if(std::filesystem::is_directory(romPath, err)){
+            for(const auto &entry : std::filesystem::directory_iterator(romPath, err)){
+                if(entry.is_regular_file())
+                    files.push_back(entry.path());
+            }
+            std::sort(files.begin(), files.end());
+        }
+        else
+            files.push_back(romPath);
+
+        std::vector<uint8_t> rom;
+        for(const auto &file : files){
+            if(!readFile(file, rom)){
+                printf("Could not read %s\n", file.string().c_str());
+                return 2;
+            }
+            server->addROM(file.filename().string(), rom);
+        }
+        romCount = files.size();
+    }
+    if(romCount == 0){
+        printf("No ROMs in %s\n", romPath);
+        return 2;
+    }
+    if(!server->listen(address)){
+        printf("Could not listen on %s\n", address);
+        return 2;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    server->start(workers);
+    printf("Serving %zu ROM%s on %s with %d worker%s\n", romCount, romCount == 1 ? "" : "s", address,
+        workers, workers == 1 ? "" : "s");
+    fflush(stdout);
+
+    auto start = std::chrono::steady_clock::now();
+    auto lastStats = start;
+    SessionStats last = {};
+    while(!interrupted){
+        server->poll(100);
+        auto now = std::chrono::steady_clock::now();
+        if(statsSeconds > 0 && now - lastStats >= std::chrono::seconds(statsSeconds)){
+            //Counts over the interval, except for the sessions open right now
+            SessionStats stats = server->getStats();
+            SessionStats interval = stats;
+            interval.opened -= last.opened;
+            interval.frames -= last.frames;
+            interval.sent -= last.sent;
+            interval.keyframes -= last.keyframes;
+            interval.skipped -= last.skipped;
+            interval.bytes -= last.bytes;
+            printStats(interval, std::chrono::duration<double>(now - lastStats).count());
+            last = stats;
+            lastStats = now;
+        }
+    }
+
+    SessionStats stats = server->getStats();
+    server->stop();
+    printf("Total: ");
+    printStats(stats, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    delete server;
+    return 0;
+}